@@ -0,0 +1,130 @@
+/*-----------------------------------------------------------------------------------
+File:			affectors.cpp
+Author:			Steve Costa
+Description:	The runtime affector list
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "affectors.h"						// Header file for these classes
+
+/*-----------------------------------------------------------------------------------
+Append an affector of each type
+-----------------------------------------------------------------------------------*/
+
+int CAffectorList::Add(const TAffectorDesc& desc)
+{
+	if (m_iCount >= AFFECTOR_LIST_SIZE)
+		return RETURN_FAILURE;
+
+	m_affectors[m_iCount] = desc;
+
+	return m_iCount++;
+}
+
+int CAffectorList::Add(const TGravityAffector& affector)
+{
+	TAffectorDesc desc;
+
+	desc.type = AFFECTOR_GRAVITY;
+	desc.gravity = affector;
+	return Add(desc);
+}
+
+int CAffectorList::Add(const TDragAffector& affector)
+{
+	TAffectorDesc desc;
+
+	desc.type = AFFECTOR_DRAG;
+	desc.drag = affector;
+	return Add(desc);
+}
+
+int CAffectorList::Add(const TAttractorAffector& affector)
+{
+	TAffectorDesc desc;
+
+	desc.type = AFFECTOR_ATTRACTOR;
+	desc.attractor = affector;
+	return Add(desc);
+}
+
+int CAffectorList::Add(const TVortexAffector& affector)
+{
+	TAffectorDesc desc;
+
+	desc.type = AFFECTOR_VORTEX;
+	desc.vortex = affector;
+	return Add(desc);
+}
+
+int CAffectorList::Add(const TWindAffector& affector)
+{
+	TAffectorDesc desc;
+
+	desc.type = AFFECTOR_WIND;
+	desc.wind = affector;
+	return Add(desc);
+}
+
+int CAffectorList::Add(const TDampingAffector& affector)
+{
+	TAffectorDesc desc;
+
+	desc.type = AFFECTOR_DAMPING;
+	desc.damping = affector;
+	return Add(desc);
+}
+
+/*-----------------------------------------------------------------------------------
+Run the affectors one after another over the block.  The type is switched on
+once per affector, and the block is small enough to stay in the cache between
+them.
+-----------------------------------------------------------------------------------*/
+
+void CAffectorList::Apply(CParticlePool& pool, int first, int count, unsigned int emitter,
+	bool accumulate, float dt) const
+{
+	int i;
+
+	for (i = 0; i < m_iCount; i++)
+	{
+		TAffectorDesc desc = m_affectors[i];
+		bool add = accumulate || (i > 0);
+
+		switch (desc.type)
+		{
+		case AFFECTOR_GRAVITY:
+			desc.gravity.Prepare(dt);
+			ApplyAffector(desc.gravity, pool, first, count, emitter, add);
+			break;
+
+		case AFFECTOR_DRAG:
+			desc.drag.Prepare(dt);
+			ApplyAffector(desc.drag, pool, first, count, emitter, add);
+			break;
+
+		case AFFECTOR_ATTRACTOR:
+			desc.attractor.Prepare(dt);
+			ApplyAffector(desc.attractor, pool, first, count, emitter, add);
+			break;
+
+		case AFFECTOR_VORTEX:
+			desc.vortex.Prepare(dt);
+			ApplyAffector(desc.vortex, pool, first, count, emitter, add);
+			break;
+
+		case AFFECTOR_WIND:
+			desc.wind.Prepare(dt);
+			ApplyAffector(desc.wind, pool, first, count, emitter, add);
+			break;
+
+		case AFFECTOR_DAMPING:
+			desc.damping.Prepare(dt);
+			ApplyAffector(desc.damping, pool, first, count, emitter, add);
+			break;
+		}
+	}
+}
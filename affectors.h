@@ -0,0 +1,366 @@
+/*-----------------------------------------------------------------------------------
+File:			affectors.h
+Author:			Steve Costa
+Description:	Affectors add accelerations to the particles of an emitter each
+step: extra gravity, drag, point attractors and repulsors,
+vortices, wind and damping.  They are stacked in two ways:
+
+	CFusedAffectors<A, B, ...>	the stack is a template, every
+								affector is inlined into one loop
+								which reads and writes each
+								particle once
+	CAffectorList				the stack is built at runtime,
+								from data say, and each affector
+								runs its own loop over a block of
+								particles still in the cache
+
+Both are called through CAffectorKernel once per block of
+particles, never per particle, and give the same results for the
+same affectors in the same order.  The accelerations go in the
+acceleration columns which the normal update integrates.
+-----------------------------------------------------------------------------------*/
+
+#ifndef AFFECTORS_H_
+#define AFFECTORS_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <math.h>
+
+#include "simUtil.h"						// Common Macros
+#include "particlePool.h"					// Particle attribute columns
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define AFFECTOR_LIST_SIZE		16				// Most affectors in a runtime list
+
+/*-----------------------------------------------------------------------------------
+The state of one particle an affector sees, and the acceleration it adds to
+-----------------------------------------------------------------------------------*/
+
+struct TAffectorParticle
+{
+	float		px, py, pz;				// Position at the start of the step
+	float		vx, vy, vz;
+	float		ax, ay, az;
+};
+
+/*-----------------------------------------------------------------------------------
+Affectors.  Each one is plain data with Prepare, called once a step with the
+step length, and Apply, called for every particle.
+-----------------------------------------------------------------------------------*/
+
+// Constant acceleration, on top of the global gravity
+struct TGravityAffector
+{
+	float		x, y, z;
+
+	void Prepare(float dt) { }
+	void Apply(TAffectorParticle& p) const {
+		p.ax += x;
+		p.ay += y;
+		p.az += z;
+	}
+};
+
+// Drag against the velocity, linear plus quadratic in the speed
+struct TDragAffector
+{
+	float		linear, quadratic;
+
+	void Prepare(float dt) { }
+	void Apply(TAffectorParticle& p) const {
+		float k = linear + quadratic * sqrtf(p.vx * p.vx + p.vy * p.vy + p.vz * p.vz);
+
+		p.ax -= k * p.vx;
+		p.ay -= k * p.vy;
+		p.az -= k * p.vz;
+	}
+};
+
+// Inverse square pull towards a point, softened by radius so it stays
+// finite at the point.  A negative strength pushes away.
+struct TAttractorAffector
+{
+	float		x, y, z;
+	float		strength;
+	float		radius;
+
+	void Prepare(float dt) { }
+	void Apply(TAffectorParticle& p) const {
+		float dx = x - p.px, dy = y - p.py, dz = z - p.pz;
+		float distSq = dx * dx + dy * dy + dz * dz + radius * radius;
+		float s = strength / (distSq * sqrtf(distSq));
+
+		p.ax += s * dx;
+		p.ay += s * dy;
+		p.az += s * dz;
+	}
+};
+
+// Swirl round an axis through a point, strongest about radius from the
+// axis.  Prepare makes the axis unit length.
+struct TVortexAffector
+{
+	float		x, y, z;
+	float		axisX, axisY, axisZ;
+	float		strength;
+	float		radius;
+
+	void Prepare(float dt) {
+		float length = sqrtf(axisX * axisX + axisY * axisY + axisZ * axisZ);
+
+		if (length > 0.0f)
+		{
+			axisX /= length;
+			axisY /= length;
+			axisZ /= length;
+		}
+	}
+	void Apply(TAffectorParticle& p) const {
+		float dx = p.px - x, dy = p.py - y, dz = p.pz - z;
+		float along = dx * axisX + dy * axisY + dz * axisZ;
+
+		// Offset from the axis
+		dx -= along * axisX;
+		dy -= along * axisY;
+		dz -= along * axisZ;
+
+		float s = strength / (dx * dx + dy * dy + dz * dz + radius * radius);
+
+		p.ax += s * (axisY * dz - axisZ * dy);
+		p.ay += s * (axisZ * dx - axisX * dz);
+		p.az += s * (axisX * dy - axisY * dx);
+	}
+};
+
+// Pulls the velocity towards the wind velocity
+struct TWindAffector
+{
+	float		x, y, z;
+	float		coupling;				// Per second
+
+	void Prepare(float dt) { }
+	void Apply(TAffectorParticle& p) const {
+		p.ax += coupling * (x - p.vx);
+		p.ay += coupling * (y - p.vy);
+		p.az += coupling * (z - p.vz);
+	}
+};
+
+// Velocity dies away by a factor of e every 1 / rate seconds, whatever
+// the step length
+struct TDampingAffector
+{
+	float		rate;
+	float		factor;					// Set by Prepare
+
+	void Prepare(float dt) {
+		factor = (dt > 0.0f) ? (1.0f - expf(-rate * dt)) / dt : rate;
+	}
+	void Apply(TAffectorParticle& p) const {
+		p.ax -= factor * p.vx;
+		p.ay -= factor * p.vy;
+		p.az -= factor * p.vz;
+	}
+};
+
+/*-----------------------------------------------------------------------------------
+Run an affector, or a stack of them, over the particles of one emitter in
+[first, first + count).  accumulate adds to the acceleration already there,
+otherwise it starts from zero.
+-----------------------------------------------------------------------------------*/
+
+template <class A>
+void ApplyAffector(const A& affector, CParticlePool& pool, int first, int count,
+	unsigned int emitter, bool accumulate)
+{
+	const float *posX = pool.Column(PARTICLE_PREV_X);
+	const float *posY = pool.Column(PARTICLE_PREV_Y);
+	const float *posZ = pool.Column(PARTICLE_PREV_Z);
+	const float *velX = pool.Column(PARTICLE_VEL_X);
+	const float *velY = pool.Column(PARTICLE_VEL_Y);
+	const float *velZ = pool.Column(PARTICLE_VEL_Z);
+	float *accelX = pool.Column(PARTICLE_ACCEL_X);
+	float *accelY = pool.Column(PARTICLE_ACCEL_Y);
+	float *accelZ = pool.Column(PARTICLE_ACCEL_Z);
+	const unsigned int *emitters = pool.UIntColumn(PARTICLE_EMITTER);
+	int i;
+
+	for (i = first; i < first + count; i++)
+	{
+		TAffectorParticle p;
+
+		if (emitters[i] != emitter)
+			continue;
+
+		p.px = posX[i];		p.py = posY[i];		p.pz = posZ[i];
+		p.vx = velX[i];		p.vy = velY[i];		p.vz = velZ[i];
+		p.ax = accumulate ? accelX[i] : 0.0f;
+		p.ay = accumulate ? accelY[i] : 0.0f;
+		p.az = accumulate ? accelZ[i] : 0.0f;
+
+		affector.Apply(p);
+
+		accelX[i] = p.ax;
+		accelY[i] = p.ay;
+		accelZ[i] = p.az;
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+A stack of affectors fixed at compile time, applied first to last
+-----------------------------------------------------------------------------------*/
+
+template <class... A>
+struct TAffectorStack;
+
+template <>
+struct TAffectorStack<>
+{
+	void Prepare(float dt) { }
+	void Apply(TAffectorParticle& p) const { }
+};
+
+template <class A, class... Rest>
+struct TAffectorStack<A, Rest...>
+{
+	A						head;
+	TAffectorStack<Rest...>	tail;
+
+	void Prepare(float dt) {
+		head.Prepare(dt);
+		tail.Prepare(dt);
+	}
+	void Apply(TAffectorParticle& p) const {
+		head.Apply(p);
+		tail.Apply(p);
+	}
+};
+
+/*-----------------------------------------------------------------------------------
+What an emitter holds on to, called once for each block of particles
+-----------------------------------------------------------------------------------*/
+
+class CAffectorKernel
+{
+public:
+
+	virtual ~CAffectorKernel() { }
+
+	// Add the accelerations of the particles of emitter in
+	// [first, first + count), see ApplyAffector
+	virtual void Apply(CParticlePool& pool, int first, int count, unsigned int emitter,
+		bool accumulate, float dt) const = 0;
+};
+
+/*-----------------------------------------------------------------------------------
+Affectors fused into one loop at compile time
+-----------------------------------------------------------------------------------*/
+
+template <class... A>
+class CFusedAffectors : public CAffectorKernel
+{
+	// Attributes
+private:
+
+	TAffectorStack<A...>	m_stack;
+
+	// Methods
+private:
+
+	template <class B, class... Rest>
+	static void Set(TAffectorStack<B, Rest...>& stack, const B& head, const Rest&... tail) {
+		stack.head = head;
+		Set(stack.tail, tail...);
+	}
+	static void Set(TAffectorStack<>& stack) { }
+
+public:
+
+	CFusedAffectors(const A&... affectors) { Set(m_stack, affectors...); }
+
+	void Apply(CParticlePool& pool, int first, int count, unsigned int emitter,
+		bool accumulate, float dt) const
+	{
+		TAffectorStack<A...> stack = m_stack;
+
+		stack.Prepare(dt);
+		ApplyAffector(stack, pool, first, count, emitter, accumulate);
+	}
+};
+
+// Saves spelling out the types, new MakeAffectors(drag, wind) say
+template <class... A>
+CFusedAffectors<A...> *MakeAffectors(const A&... affectors)
+{
+	return new CFusedAffectors<A...>(affectors...);
+}
+
+/*-----------------------------------------------------------------------------------
+Affectors chosen at runtime
+-----------------------------------------------------------------------------------*/
+
+enum EAffectorType
+{
+	AFFECTOR_GRAVITY,
+	AFFECTOR_DRAG,
+	AFFECTOR_ATTRACTOR,
+	AFFECTOR_VORTEX,
+	AFFECTOR_WIND,
+	AFFECTOR_DAMPING
+};
+
+struct TAffectorDesc
+{
+	int						type;			// EAffectorType
+	union
+	{
+		TGravityAffector	gravity;
+		TDragAffector		drag;
+		TAttractorAffector	attractor;
+		TVortexAffector		vortex;
+		TWindAffector		wind;
+		TDampingAffector	damping;
+	};
+};
+
+class CAffectorList : public CAffectorKernel
+{
+	// Attributes
+private:
+
+	TAffectorDesc	m_affectors[AFFECTOR_LIST_SIZE];
+	int				m_iCount;
+
+	// Methods
+private:
+
+	int Add(const TAffectorDesc& desc);
+
+public:
+
+	CAffectorList() { m_iCount = 0; }
+
+	// Append an affector, returns its index or RETURN_FAILURE when
+	// the list is full
+	int Add(const TGravityAffector& affector);
+	int Add(const TDragAffector& affector);
+	int Add(const TAttractorAffector& affector);
+	int Add(const TVortexAffector& affector);
+	int Add(const TWindAffector& affector);
+	int Add(const TDampingAffector& affector);
+
+	void Clear() { m_iCount = 0; }
+	int GetCount() const { return m_iCount; }
+	TAffectorDesc& GetAffector(int i) { return m_affectors[i]; }
+
+	void Apply(CParticlePool& pool, int first, int count, unsigned int emitter,
+		bool accumulate, float dt) const;
+};
+
+#endif
@@ -0,0 +1,838 @@
+/*-----------------------------------------------------------------------------------
+File:			barnesHut.cpp
+Author:			Steve Costa
+Description:	Building the octree and summing the forces for Barnes-Hut
+gravity, with scalar, SSE2 and AVX2 force sums.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include "barnesHut.h"						// Class header file
+#include "profiler.h"						// Frame zones
+#include "cpuFeatures.h"					// Instruction set detection
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define NBODY_LIST_PAD			8				// The list is padded to whole AVX registers
+#define NBODY_MIN_SOFTENING_SQ	1.0e-12f		// A particle pulling on itself gives no force
+
+/*-----------------------------------------------------------------------------------
+Spread the low 21 bits of v out to every third bit
+-----------------------------------------------------------------------------------*/
+
+static TOctreeKey SpreadBits(unsigned int v)
+{
+	TOctreeKey x = v & 0x1FFFFFu;
+
+	x = (x | (x << 32)) & 0x001F00000000FFFFull;
+	x = (x | (x << 16)) & 0x001F0000FF0000FFull;
+	x = (x | (x << 8)) & 0x100F00F00F00F00Full;
+	x = (x | (x << 4)) & 0x10C30C30C30C30C3ull;
+	x = (x | (x << 2)) & 0x1249249249249249ull;
+
+	return x;
+}
+
+/*-----------------------------------------------------------------------------------
+Scalar force sum
+-----------------------------------------------------------------------------------*/
+
+static void SumScalar(const float *x, const float *y, const float *z, const float *mass,
+	int count, float px, float py, float pz, float softeningSq, float *accel)
+{
+	float ax = 0.0f, ay = 0.0f, az = 0.0f;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		float dx = x[i] - px;
+		float dy = y[i] - py;
+		float dz = z[i] - pz;
+		float inv = 1.0f / sqrtf(dx * dx + dy * dy + dz * dz + softeningSq);
+		float s = mass[i] * inv * inv * inv;
+
+		ax += s * dx;
+		ay += s * dy;
+		az += s * dz;
+	}
+
+	accel[0] += ax;
+	accel[1] += ay;
+	accel[2] += az;
+}
+
+#ifdef CPU_X86
+
+/*-----------------------------------------------------------------------------------
+SSE2 force sum, four interactions at a time.  The reciprocal square root
+estimate has 12 bits, one Newton-Raphson step brings it close to full float
+precision for much less than a square root and a divide.  count must be a
+multiple of four.
+-----------------------------------------------------------------------------------*/
+
+TARGET_SSE2 static float HorizontalSum(__m128 v)
+{
+	__m128 shuffled = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(v, shuffled);
+
+	shuffled = _mm_movehl_ps(shuffled, sums);
+	return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+}
+
+TARGET_SSE2 static void SumSSE2(const float *x, const float *y, const float *z, const float *mass,
+	int count, float px, float py, float pz, float softeningSq, float *accel)
+{
+	__m128 vpx = _mm_set1_ps(px), vpy = _mm_set1_ps(py), vpz = _mm_set1_ps(pz);
+	__m128 vsoftening = _mm_set1_ps(softeningSq);
+	__m128 vhalf = _mm_set1_ps(0.5f);
+	__m128 vthreeHalves = _mm_set1_ps(1.5f);
+	__m128 ax = _mm_setzero_ps(), ay = _mm_setzero_ps(), az = _mm_setzero_ps();
+	int i;
+
+	for (i = 0; i < count; i += 4)
+	{
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), vpx);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), vpy);
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(z + i), vpz);
+		__m128 distSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+			_mm_add_ps(_mm_mul_ps(dz, dz), vsoftening));
+		__m128 inv = _mm_rsqrt_ps(distSq);
+
+		inv = _mm_mul_ps(inv, _mm_sub_ps(vthreeHalves, _mm_mul_ps(_mm_mul_ps(vhalf, distSq), _mm_mul_ps(inv, inv))));
+		__m128 s = _mm_mul_ps(_mm_loadu_ps(mass + i), _mm_mul_ps(inv, _mm_mul_ps(inv, inv)));
+
+		ax = _mm_add_ps(ax, _mm_mul_ps(s, dx));
+		ay = _mm_add_ps(ay, _mm_mul_ps(s, dy));
+		az = _mm_add_ps(az, _mm_mul_ps(s, dz));
+	}
+
+	accel[0] += HorizontalSum(ax);
+	accel[1] += HorizontalSum(ay);
+	accel[2] += HorizontalSum(az);
+}
+
+/*-----------------------------------------------------------------------------------
+AVX2 force sum, eight interactions at a time.  count must be a multiple of
+eight.
+-----------------------------------------------------------------------------------*/
+
+TARGET_AVX2 static float HorizontalSum256(__m256 v)
+{
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	__m128 shuffled = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1));
+
+	sum = _mm_add_ps(sum, shuffled);
+	shuffled = _mm_movehl_ps(shuffled, sum);
+	return _mm_cvtss_f32(_mm_add_ss(sum, shuffled));
+}
+
+TARGET_AVX2 static void SumAVX2(const float *x, const float *y, const float *z, const float *mass,
+	int count, float px, float py, float pz, float softeningSq, float *accel)
+{
+	__m256 vpx = _mm256_set1_ps(px), vpy = _mm256_set1_ps(py), vpz = _mm256_set1_ps(pz);
+	__m256 vsoftening = _mm256_set1_ps(softeningSq);
+	__m256 vhalf = _mm256_set1_ps(0.5f);
+	__m256 vthreeHalves = _mm256_set1_ps(1.5f);
+	__m256 ax = _mm256_setzero_ps(), ay = _mm256_setzero_ps(), az = _mm256_setzero_ps();
+	int i;
+
+	for (i = 0; i < count; i += 8)
+	{
+		__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + i), vpx);
+		__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + i), vpy);
+		__m256 dz = _mm256_sub_ps(_mm256_loadu_ps(z + i), vpz);
+		__m256 distSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+			_mm256_add_ps(_mm256_mul_ps(dz, dz), vsoftening));
+		__m256 inv = _mm256_rsqrt_ps(distSq);
+
+		inv = _mm256_mul_ps(inv, _mm256_sub_ps(vthreeHalves, _mm256_mul_ps(_mm256_mul_ps(vhalf, distSq), _mm256_mul_ps(inv, inv))));
+		__m256 s = _mm256_mul_ps(_mm256_loadu_ps(mass + i), _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv)));
+
+		ax = _mm256_add_ps(ax, _mm256_mul_ps(s, dx));
+		ay = _mm256_add_ps(ay, _mm256_mul_ps(s, dy));
+		az = _mm256_add_ps(az, _mm256_mul_ps(s, dz));
+	}
+
+	accel[0] += HorizontalSum256(ax);
+	accel[1] += HorizontalSum256(ay);
+	accel[2] += HorizontalSum256(az);
+}
+
+#endif
+
+/*-----------------------------------------------------------------------------------
+Interactions gathered for one group, padded with massless entries
+-----------------------------------------------------------------------------------*/
+
+struct TGravityList
+{
+	float	x[NBODY_LIST_SIZE + NBODY_LIST_PAD];
+	float	y[NBODY_LIST_SIZE + NBODY_LIST_PAD];
+	float	z[NBODY_LIST_SIZE + NBODY_LIST_PAD];
+	float	mass[NBODY_LIST_SIZE + NBODY_LIST_PAD];
+	int		count;
+};
+
+/*-----------------------------------------------------------------------------------
+Set any initial values for class state variables.
+-----------------------------------------------------------------------------------*/
+
+CBarnesHut::CBarnesHut()
+{
+	m_iNumBodies = 0;
+	m_iCount = 0;
+	m_iCapacity = 0;
+	m_fMin[0] = m_fMin[1] = m_fMin[2] = 0.0f;
+	m_fRootSize = 1.0f;
+	m_piParticles = NULL;
+	m_puiKeys[0] = m_puiKeys[1] = NULL;
+	m_piOrder[0] = m_piOrder[1] = NULL;
+	m_iSorted = 0;
+	m_piHistogram = NULL;
+	m_piSorted = NULL;
+	m_pfX = m_pfY = m_pfZ = NULL;
+	m_pfAccel[0] = m_pfAccel[1] = m_pfAccel[2] = NULL;
+	m_pNodes = NULL;
+	m_iNumNodes = 0;
+	m_piGroups = NULL;
+	m_iNumGroups = 0;
+	m_pTasks = NULL;
+	m_iNumTasks = 0;
+	m_piTop = NULL;
+	m_iNumTop = 0;
+
+	SetSimd(true);
+}
+
+CBarnesHut::~CBarnesHut()
+{
+	Shutdown();
+}
+
+/*-----------------------------------------------------------------------------------
+Free the arrays
+-----------------------------------------------------------------------------------*/
+
+void CBarnesHut::Shutdown()
+{
+	delete[] m_piParticles;
+	delete[] m_puiKeys[0];
+	delete[] m_puiKeys[1];
+	delete[] m_piOrder[0];
+	delete[] m_piOrder[1];
+	delete[] m_piHistogram;
+	delete[] m_piSorted;
+	delete[] m_pfX;
+	delete[] m_pfY;
+	delete[] m_pfZ;
+	delete[] m_pfAccel[0];
+	delete[] m_pNodes;
+	delete[] m_piGroups;
+	delete[] m_pTasks;
+	delete[] m_piTop;
+
+	m_piParticles = NULL;
+	m_puiKeys[0] = m_puiKeys[1] = NULL;
+	m_piOrder[0] = m_piOrder[1] = NULL;
+	m_piHistogram = NULL;
+	m_piSorted = NULL;
+	m_pfX = m_pfY = m_pfZ = NULL;
+	m_pfAccel[0] = m_pfAccel[1] = m_pfAccel[2] = NULL;
+	m_pNodes = NULL;
+	m_piGroups = NULL;
+	m_pTasks = NULL;
+	m_piTop = NULL;
+
+	m_iCount = 0;
+	m_iCapacity = 0;
+	m_iNumNodes = 0;
+	m_iNumGroups = 0;
+	m_iNumTasks = 0;
+	m_iNumTop = 0;
+}
+
+/*-----------------------------------------------------------------------------------
+Make room for count particles.  Every inner node has two children or more so
+there are fewer inner nodes than leaves and at most count leaves.  The nodes
+split serially hold more than NBODY_TASK_SIZE particles each, so there are at
+most count / NBODY_TASK_SIZE of them on any level, and each leaves at most
+eight tasks.
+-----------------------------------------------------------------------------------*/
+
+void CBarnesHut::Grow(int count)
+{
+	int numChunks = (count + NBODY_SORT_CHUNK - 1) / NBODY_SORT_CHUNK;
+	int numTop = NBODY_MAX_LEVEL * (count / NBODY_TASK_SIZE) + 1;
+
+	if (count <= m_iCapacity)
+		return;
+
+	Shutdown();
+
+	m_iCapacity = count;
+	m_piParticles = new int[count];
+	m_puiKeys[0] = new TOctreeKey[count];
+	m_puiKeys[1] = new TOctreeKey[count];
+	m_piOrder[0] = new int[count];
+	m_piOrder[1] = new int[count];
+	m_piHistogram = new int[numChunks * NBODY_RADIX_BUCKETS];
+	m_piSorted = new int[count];
+	m_pfX = new float[count];
+	m_pfY = new float[count];
+	m_pfZ = new float[count];
+	m_pfAccel[0] = new float[3 * count];
+	m_pfAccel[1] = m_pfAccel[0] + count;
+	m_pfAccel[2] = m_pfAccel[1] + count;
+	m_pNodes = new TOctreeNode[2 * count];
+	m_piGroups = new int[count];
+	m_pTasks = new TOctreeTask[8 * numTop];
+	m_piTop = new int[numTop];
+}
+
+/*-----------------------------------------------------------------------------------
+Choose the widest force sum
+-----------------------------------------------------------------------------------*/
+
+bool CBarnesHut::SetSimd(bool simd)
+{
+	m_pfnSum = SumScalar;
+	m_bSimd = false;
+
+#ifdef CPU_X86
+	int features = DetectCpuFeatures();
+
+	if (simd && (features & CPU_FEATURE_AVX2))
+		m_pfnSum = SumAVX2;
+	else if (simd && (features & CPU_FEATURE_SSE2))
+		m_pfnSum = SumSSE2;
+
+	m_bSimd = (m_pfnSum != SumScalar);
+#endif
+
+	return m_bSimd;
+}
+
+/*-----------------------------------------------------------------------------------
+Heavy bodies
+-----------------------------------------------------------------------------------*/
+
+int CBarnesHut::AddBody(const TVector& position, float mass)
+{
+	if (m_iNumBodies >= NBODY_MAX_BODIES)
+		return RETURN_FAILURE;
+
+	SetBody(m_iNumBodies, position, mass);
+
+	return m_iNumBodies++;
+}
+
+void CBarnesHut::SetBody(int id, const TVector& position, float mass)
+{
+	m_bodies[id].position = position;
+	m_bodies[id].mass = mass;
+}
+
+/*-----------------------------------------------------------------------------------
+Stable LSD radix sort of the keys, NBODY_RADIX_BITS at a time.  The keys are
+cut into fixed chunks of NBODY_SORT_CHUNK, each job counts the digits of its
+chunks and later scatters them, so the result does not depend on the number
+of threads.  A pass is skipped when every key has the same digit, which is
+common for the top digits when the particles fill only part of the cube.
+-----------------------------------------------------------------------------------*/
+
+void CBarnesHut::SortKeys(CJobSystem *jobs)
+{
+	int numChunks = (m_iCount + NBODY_SORT_CHUNK - 1) / NBODY_SORT_CHUNK;
+	int pass, digit, chunk, total;
+	int src = 0;
+
+	for (pass = 0; pass < NBODY_RADIX_PASSES; pass++)
+	{
+		int shift = pass * NBODY_RADIX_BITS;
+		const TOctreeKey *keys = m_puiKeys[src];
+		const int *order = m_piOrder[src];
+		TOctreeKey *dstKeys = m_puiKeys[src ^ 1];
+		int *dstOrder = m_piOrder[src ^ 1];
+
+		RunJobs(jobs, numChunks, 1, [this, keys, shift](int first, int count, int worker) {
+			for (int c = first; c < first + count; c++)
+			{
+				int *histogram = m_piHistogram + c * NBODY_RADIX_BUCKETS;
+				int last = MIN((c + 1) * NBODY_SORT_CHUNK, m_iCount);
+
+				memset(histogram, 0, sizeof(int) * NBODY_RADIX_BUCKETS);
+				for (int i = c * NBODY_SORT_CHUNK; i < last; i++)
+					histogram[(keys[i] >> shift) & (NBODY_RADIX_BUCKETS - 1)]++;
+			}
+		});
+
+		// Nothing would move
+		digit = int((keys[0] >> shift) & (NBODY_RADIX_BUCKETS - 1));
+		for (chunk = 0, total = 0; chunk < numChunks; chunk++)
+			total += m_piHistogram[chunk * NBODY_RADIX_BUCKETS + digit];
+		if (total == m_iCount)
+			continue;
+
+		// First slot of each digit in each chunk
+		for (digit = 0, total = 0; digit < NBODY_RADIX_BUCKETS; digit++)
+		{
+			for (chunk = 0; chunk < numChunks; chunk++)
+			{
+				int *counter = m_piHistogram + chunk * NBODY_RADIX_BUCKETS + digit;
+				int n = *counter;
+				*counter = total;
+				total += n;
+			}
+		}
+
+		RunJobs(jobs, numChunks, 1, [this, keys, order, dstKeys, dstOrder, shift](int first, int count, int worker) {
+			for (int c = first; c < first + count; c++)
+			{
+				int *offset = m_piHistogram + c * NBODY_RADIX_BUCKETS;
+				int last = MIN((c + 1) * NBODY_SORT_CHUNK, m_iCount);
+
+				for (int i = c * NBODY_SORT_CHUNK; i < last; i++)
+				{
+					int slot = offset[(keys[i] >> shift) & (NBODY_RADIX_BUCKETS - 1)]++;
+					dstKeys[slot] = keys[i];
+					dstOrder[slot] = order[i];
+				}
+			}
+		});
+
+		src ^= 1;
+	}
+
+	m_iSorted = src;
+}
+
+/*-----------------------------------------------------------------------------------
+Go down past the levels where every particle of a run is in the same octant.
+The keys share all the bits above level, so the first and last key tell.
+-----------------------------------------------------------------------------------*/
+
+int CBarnesHut::SkipLevels(int first, int count, int level) const
+{
+	const TOctreeKey *keys = m_puiKeys[m_iSorted];
+
+	while (level < NBODY_MAX_LEVEL && Octant(keys[first], level) == Octant(keys[first + count - 1], level))
+		level++;
+
+	return level;
+}
+
+/*-----------------------------------------------------------------------------------
+Give a node one child for each octant its particles fall in.  The octants of
+a sorted run go up in order, so each boundary is found by binary search.
+-----------------------------------------------------------------------------------*/
+
+void CBarnesHut::MakeChildren(int node, int level)
+{
+	const TOctreeKey *keys = m_puiKeys[m_iSorted];
+	TOctreeNode& n = m_pNodes[node];
+	int start[9], octant, numChildren = 0, child;
+
+	start[0] = n.first;
+	start[8] = n.first + n.count;
+
+	for (octant = 1; octant < 8; octant++)
+	{
+		int lo = start[octant - 1], hi = start[8];
+
+		while (lo < hi)
+		{
+			int mid = (lo + hi) / 2;
+			if (Octant(keys[mid], level) < octant)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		start[octant] = lo;
+	}
+
+	for (octant = 0; octant < 8; octant++)
+		numChildren += (start[octant + 1] > start[octant]);
+
+	n.firstChild = m_iNumNodes.fetch_add(numChildren, std::memory_order_relaxed);
+	n.numChildren = numChildren;
+
+	for (octant = 0, child = n.firstChild; octant < 8; octant++)
+	{
+		if (start[octant + 1] == start[octant])
+			continue;
+
+		m_pNodes[child].first = start[octant];
+		m_pNodes[child].count = start[octant + 1] - start[octant];
+		child++;
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Split the nodes too big for one job on the calling thread and leave the rest
+as tasks
+-----------------------------------------------------------------------------------*/
+
+void CBarnesHut::BuildTop(int node, int level)
+{
+	TOctreeNode& n = m_pNodes[node];
+	int child;
+
+	if (n.count <= NBODY_TASK_SIZE)
+	{
+		m_pTasks[m_iNumTasks].node = node;
+		m_pTasks[m_iNumTasks].level = level;
+		m_iNumTasks++;
+		return;
+	}
+
+	level = SkipLevels(n.first, n.count, level);
+	n.size = m_fRootSize / float(1 << level);
+
+	if (level >= NBODY_MAX_LEVEL)
+	{
+		// All in the same place, a task turns it into a leaf
+		m_pTasks[m_iNumTasks].node = node;
+		m_pTasks[m_iNumTasks].level = level;
+		m_iNumTasks++;
+		return;
+	}
+
+	MakeChildren(node, level);
+	m_piTop[m_iNumTop++] = node;
+
+	for (child = n.firstChild; child < n.firstChild + n.numChildren; child++)
+		BuildTop(child, level + 1);
+}
+
+/*-----------------------------------------------------------------------------------
+Build a whole subtree and sum its centres of mass on the way back up.  The
+first node on the way down small enough to be a group, or a leaf, becomes a
+group for the force pass.
+-----------------------------------------------------------------------------------*/
+
+void CBarnesHut::BuildSubtree(int node, int level, bool grouped)
+{
+	TOctreeNode& n = m_pNodes[node];
+	int child, i;
+
+	if (n.count > NBODY_LEAF_SIZE)
+		level = SkipLevels(n.first, n.count, level);
+	n.size = m_fRootSize / float(1 << level);
+
+	bool leaf = (n.count <= NBODY_LEAF_SIZE || level >= NBODY_MAX_LEVEL);
+
+	if (!grouped && (leaf || n.count <= NBODY_GROUP_SIZE))
+	{
+		m_piGroups[m_iNumGroups.fetch_add(1, std::memory_order_relaxed)] = node;
+		grouped = true;
+	}
+
+	if (leaf)
+	{
+		float x = 0.0f, y = 0.0f, z = 0.0f;
+
+		for (i = n.first; i < n.first + n.count; i++)
+		{
+			x += m_pfX[i];
+			y += m_pfY[i];
+			z += m_pfZ[i];
+		}
+
+		n.x = x / float(n.count);
+		n.y = y / float(n.count);
+		n.z = z / float(n.count);
+		n.mass = float(n.count) * m_params.particleMass;
+		n.firstChild = -1;
+		n.numChildren = 0;
+		return;
+	}
+
+	MakeChildren(node, level);
+
+	for (child = n.firstChild; child < n.firstChild + n.numChildren; child++)
+		BuildSubtree(child, level + 1, grouped);
+
+	SumChildren(node);
+}
+
+void CBarnesHut::SumChildren(int node)
+{
+	TOctreeNode& n = m_pNodes[node];
+	float x = 0.0f, y = 0.0f, z = 0.0f, mass = 0.0f;
+	int child;
+
+	for (child = n.firstChild; child < n.firstChild + n.numChildren; child++)
+	{
+		const TOctreeNode& c = m_pNodes[child];
+
+		x += c.x * c.mass;
+		y += c.y * c.mass;
+		z += c.z * c.mass;
+		mass += c.mass;
+	}
+
+	n.mass = mass;
+	if (mass > 0.0f)
+	{
+		n.x = x / mass;
+		n.y = y / mass;
+		n.z = z / mass;
+	}
+	else
+	{
+		// Massless particles, keep the node somewhere sensible
+		const TOctreeNode& c = m_pNodes[n.firstChild];
+		n.x = c.x;
+		n.y = c.y;
+		n.z = c.z;
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Forces on the particles of one group.  The tree is walked once for the whole
+group: a node is used whole when it is small next to its distance from the
+box round the group, otherwise it is opened, down to the particles of the
+leaves.  The same list then serves every particle of the group.  The group
+itself always gets opened and its particles pull on each other directly, a
+particle pulls on itself with no force as it is no distance away.
+-----------------------------------------------------------------------------------*/
+
+void CBarnesHut::Forces(CParticlePool& pool, int node)
+{
+	TGravityList list;
+	int stack[NBODY_STACK_SIZE];
+	const TOctreeNode& group = m_pNodes[node];
+	float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	float openingSq = m_params.openingAngle * m_params.openingAngle;
+	float softeningSq = MAX(m_params.softening * m_params.softening, NBODY_MIN_SOFTENING_SQ);
+	int first = group.first, last = group.first + group.count;
+	int top = 0, i, k;
+
+	for (i = first; i < last; i++)
+	{
+		lo[0] = MIN(lo[0], m_pfX[i]);	hi[0] = MAX(hi[0], m_pfX[i]);
+		lo[1] = MIN(lo[1], m_pfY[i]);	hi[1] = MAX(hi[1], m_pfY[i]);
+		lo[2] = MIN(lo[2], m_pfZ[i]);	hi[2] = MAX(hi[2], m_pfZ[i]);
+
+		m_pfAccel[0][i] = m_pfAccel[1][i] = m_pfAccel[2][i] = 0.0f;
+	}
+
+	float cx = 0.5f * (lo[0] + hi[0]), ex = 0.5f * (hi[0] - lo[0]);
+	float cy = 0.5f * (lo[1] + hi[1]), ey = 0.5f * (hi[1] - lo[1]);
+	float cz = 0.5f * (lo[2] + hi[2]), ez = 0.5f * (hi[2] - lo[2]);
+
+	// Sum the list for every particle of the group and empty it
+	auto flush = [&]() {
+		int padded = (list.count + NBODY_LIST_PAD - 1) & ~(NBODY_LIST_PAD - 1);
+		int j;
+
+		for (j = list.count; j < padded; j++)
+		{
+			list.x[j] = list.y[j] = list.z[j] = 0.0f;
+			list.mass[j] = 0.0f;
+		}
+
+		for (j = first; j < last; j++)
+		{
+			float accel[3] = { 0.0f, 0.0f, 0.0f };
+
+			m_pfnSum(list.x, list.y, list.z, list.mass, padded, m_pfX[j], m_pfY[j], m_pfZ[j], softeningSq, accel);
+			m_pfAccel[0][j] += accel[0];
+			m_pfAccel[1][j] += accel[1];
+			m_pfAccel[2][j] += accel[2];
+		}
+
+		list.count = 0;
+	};
+
+	auto add = [&](float x, float y, float z, float mass) {
+		if (list.count == NBODY_LIST_SIZE)
+			flush();
+
+		list.x[list.count] = x;
+		list.y[list.count] = y;
+		list.z[list.count] = z;
+		list.mass[list.count] = mass;
+		list.count++;
+	};
+
+	list.count = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const TOctreeNode& n = m_pNodes[stack[--top]];
+		float dx = MAX(fabsf(n.x - cx) - ex, 0.0f);
+		float dy = MAX(fabsf(n.y - cy) - ey, 0.0f);
+		float dz = MAX(fabsf(n.z - cz) - ez, 0.0f);
+
+		if (n.size * n.size < openingSq * (dx * dx + dy * dy + dz * dz))
+			add(n.x, n.y, n.z, n.mass);
+		else if (n.firstChild < 0)
+		{
+			for (k = n.first; k < n.first + n.count; k++)
+				add(m_pfX[k], m_pfY[k], m_pfZ[k], m_params.particleMass);
+		}
+		else
+		{
+			// Pushed backwards so the children come off in order
+			for (k = n.numChildren - 1; k >= 0; k--)
+				stack[top++] = n.firstChild + k;
+		}
+	}
+
+	flush();
+
+	// The bodies pull on every particle directly and the constant
+	// gravity of the update is cancelled
+	float *accelX = pool.Column(PARTICLE_ACCEL_X);
+	float *accelY = pool.Column(PARTICLE_ACCEL_Y);
+	float *accelZ = pool.Column(PARTICLE_ACCEL_Z);
+	float g = m_params.gravConst;
+
+	for (i = first; i < last; i++)
+	{
+		float ax = m_pfAccel[0][i], ay = m_pfAccel[1][i], az = m_pfAccel[2][i];
+
+		for (k = 0; k < m_iNumBodies; k++)
+		{
+			const TGravityBody& body = m_bodies[k];
+			float dx = body.position.x - m_pfX[i];
+			float dy = body.position.y - m_pfY[i];
+			float dz = body.position.z - m_pfZ[i];
+			float inv = 1.0f / sqrtf(dx * dx + dy * dy + dz * dz + softeningSq);
+			float s = body.mass * inv * inv * inv;
+
+			ax += s * dx;
+			ay += s * dy;
+			az += s * dz;
+		}
+
+		int particle = m_piSorted[i];
+		accelX[particle] = g * ax;
+		accelY[particle] = g * ay + CParticle::m_sfGravity;
+		accelZ[particle] = g * az;
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+One step of n-body gravity:
+
+	1. collect the live particles of n-body emitters and the cube round them
+	2. work out their keys and sort them
+	3. put their positions in sorted order
+	4. build the tree
+	5. sum the forces a group at a time
+
+Everything but the collection and the top of the tree runs on the job system.
+-----------------------------------------------------------------------------------*/
+
+void CBarnesHut::Step(CParticlePool& pool, const bool *nbodyEmitters, int numEmitters, CJobSystem *jobs)
+{
+	PROFILE_ZONE("nbody");
+
+	const float *prevX = pool.Column(PARTICLE_PREV_X);
+	const float *prevY = pool.Column(PARTICLE_PREV_Y);
+	const float *prevZ = pool.Column(PARTICLE_PREV_Z);
+	const unsigned int *emitter = pool.UIntColumn(PARTICLE_EMITTER);
+	int live = pool.GetLiveCount();
+	float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	float scale;
+	int i;
+
+	Grow(live);
+	m_iCount = 0;
+
+	for (i = 0; i < live; i++)
+	{
+		if (emitter[i] < (unsigned int)numEmitters && nbodyEmitters[emitter[i]])
+		{
+			m_piParticles[m_iCount++] = i;
+
+			lo[0] = MIN(lo[0], prevX[i]);	hi[0] = MAX(hi[0], prevX[i]);
+			lo[1] = MIN(lo[1], prevY[i]);	hi[1] = MAX(hi[1], prevY[i]);
+			lo[2] = MIN(lo[2], prevZ[i]);	hi[2] = MAX(hi[2], prevZ[i]);
+		}
+	}
+
+	m_iNumNodes = 0;
+	m_iNumGroups = 0;
+	m_iNumTasks = 0;
+	m_iNumTop = 0;
+
+	if (!m_iCount)
+		return;
+
+	// A cube a little bigger than the particles so none of them
+	// lands on the far edge
+	m_fRootSize = MAX(MAX(hi[0] - lo[0], hi[1] - lo[1]), hi[2] - lo[2]) * 1.001f + 1.0e-6f;
+	for (i = 0; i < 3; i++)
+		m_fMin[i] = lo[i];
+	scale = float(1 << NBODY_MAX_LEVEL) / m_fRootSize;
+
+	RunJobs(jobs, m_iCount, NBODY_SORT_CHUNK, [this, prevX, prevY, prevZ, scale](int first, int count, int worker) {
+		int top = (1 << NBODY_MAX_LEVEL) - 1;
+
+		for (int k = first; k < first + count; k++)
+		{
+			int p = m_piParticles[k];
+			int ix = MIN(int((prevX[p] - m_fMin[0]) * scale), top);
+			int iy = MIN(int((prevY[p] - m_fMin[1]) * scale), top);
+			int iz = MIN(int((prevZ[p] - m_fMin[2]) * scale), top);
+
+			m_puiKeys[0][k] = (SpreadBits(ix) << 2) | (SpreadBits(iy) << 1) | SpreadBits(iz);
+			m_piOrder[0][k] = k;
+		}
+	});
+
+	SortKeys(jobs);
+
+	RunJobs(jobs, m_iCount, NBODY_SORT_CHUNK, [this, prevX, prevY, prevZ](int first, int count, int worker) {
+		const int *order = m_piOrder[m_iSorted];
+
+		for (int s = first; s < first + count; s++)
+		{
+			int p = m_piParticles[order[s]];
+
+			m_piSorted[s] = p;
+			m_pfX[s] = prevX[p];
+			m_pfY[s] = prevY[p];
+			m_pfZ[s] = prevZ[p];
+		}
+	});
+
+	// The top of the tree on this thread, then the subtrees as jobs
+	// and the centres of mass of the top, children before parents
+	m_pNodes[0].first = 0;
+	m_pNodes[0].count = m_iCount;
+	m_iNumNodes = 1;
+
+	BuildTop(0, 0);
+
+	RunJobs(jobs, m_iNumTasks, 1, [this](int first, int count, int worker) {
+		for (int t = first; t < first + count; t++)
+			BuildSubtree(m_pTasks[t].node, m_pTasks[t].level, false);
+	});
+
+	for (i = m_iNumTop - 1; i >= 0; i--)
+		SumChildren(m_piTop[i]);
+
+	RunJobs(jobs, m_iNumGroups, NBODY_FORCE_GRAIN, [this, &pool](int first, int count, int worker) {
+		for (int group = first; group < first + count; group++)
+			Forces(pool, m_piGroups[group]);
+	});
+}
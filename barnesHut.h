@@ -0,0 +1,220 @@
+/*-----------------------------------------------------------------------------------
+File:			barnesHut.h
+Author:			Steve Costa
+Description:	N-body gravity for the particles of n-body emitters, using the
+Barnes-Hut approximation: far away groups of particles pull as
+one body at their centre of mass, so a step costs O(n log n)
+rather than O(n^2).  The octree is rebuilt every step:
+
+	1. the particles get 63 bit Morton keys, 21 bits per axis of
+	   their place in a cube round them all
+	2. the keys are radix sorted, so every octree node is a run of
+	   sorted particles
+	3. the top of the tree is split serially until the runs are
+	   small enough, then each subtree is built by its own job
+	4. centres of mass are summed up the tree
+
+Levels where all the particles of a node fall in the same octant
+are skipped, so every inner node has at least two children and
+the node array never needs more than two nodes per particle.
+Nothing is allocated once the arrays have grown to the particle
+count.
+
+Forces are worked out a group of up to NBODY_GROUP_SIZE nearby
+particles at a time: the tree is walked once for the whole group,
+the nodes far enough from it and the particles of the leaves which
+are not go into an interaction list, and the list is summed for
+every particle of the group with SSE2 or AVX2.
+-----------------------------------------------------------------------------------*/
+
+#ifndef BARNES_HUT_H_
+#define BARNES_HUT_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <atomic>
+
+#include "simUtil.h"						// Common Macros
+#include "vector.h"
+using namespace vec;
+#include "particlePool.h"					// Particle attribute columns
+#include "jobSystem.h"						// Worker threads
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define NBODY_LEAF_SIZE			8				// Most particles in a leaf above the last level
+#define NBODY_MAX_LEVEL			21				// Key bits per axis
+#define NBODY_GROUP_SIZE		64				// Most particles sharing one walk of the tree
+#define NBODY_TASK_SIZE			4096			// Subtrees this small are built by one job
+#define NBODY_SORT_CHUNK		16384			// Keys per radix sort job
+#define NBODY_RADIX_BITS		11
+#define NBODY_RADIX_BUCKETS		(1 << NBODY_RADIX_BITS)
+#define NBODY_RADIX_PASSES		6				// Enough passes for 63 bit keys
+#define NBODY_FORCE_GRAIN		16				// Groups per force job
+#define NBODY_STACK_SIZE		256				// Deeper than 7 siblings on each of 22 levels
+#define NBODY_LIST_SIZE			1024			// Interactions gathered before they are summed
+#define NBODY_MAX_BODIES		16
+
+/*-----------------------------------------------------------------------------------
+Types
+-----------------------------------------------------------------------------------*/
+
+typedef unsigned long long TOctreeKey;
+
+// Adds the pull of count point masses on the particle at (px, py, pz) to
+// accel, without the gravitational constant
+typedef void (*PFNGRAVITYSUM)(const float *x, const float *y, const float *z, const float *mass,
+	int count, float px, float py, float pz, float softeningSq, float *accel);
+
+/*-----------------------------------------------------------------------------------
+Settings
+-----------------------------------------------------------------------------------*/
+
+struct TBarnesHutParams
+{
+	float		gravConst;				// Gravitational constant
+	float		particleMass;
+	float		softening;				// Added to every distance, stops close pairs blowing up
+	float		openingAngle;			// Node size over distance below which a node is not opened
+
+	TBarnesHutParams() {
+		gravConst = 1.0f;
+		particleMass = 0.01f;
+		softening = 0.1f;
+		openingAngle = 0.5f;
+	}
+};
+
+/*-----------------------------------------------------------------------------------
+A heavy body which pulls on the particles but is not moved by them
+-----------------------------------------------------------------------------------*/
+
+struct TGravityBody
+{
+	TVector		position;
+	float		mass;
+};
+
+/*-----------------------------------------------------------------------------------
+Octree node, a run of particles in sorted order
+-----------------------------------------------------------------------------------*/
+
+struct TOctreeNode
+{
+	float		x, y, z;				// Centre of mass
+	float		mass;
+	float		size;					// Edge of the cube the particles lie in
+	int			firstChild;				// Children are next to each other, -1 for a leaf
+	int			numChildren;
+	int			first, count;			// Sorted particles
+};
+
+/*-----------------------------------------------------------------------------------
+Subtree left for a job to build
+-----------------------------------------------------------------------------------*/
+
+struct TOctreeTask
+{
+	int			node;
+	int			level;					// Level the node was split at
+};
+
+/*-----------------------------------------------------------------------------------
+Barnes-Hut class definition
+-----------------------------------------------------------------------------------*/
+
+class CBarnesHut
+{
+	// Attributes
+private:
+
+	TBarnesHutParams	m_params;
+	bool				m_bSimd;
+	PFNGRAVITYSUM		m_pfnSum;				// Widest sum the processor has
+
+	TGravityBody		m_bodies[NBODY_MAX_BODIES];
+	int					m_iNumBodies;
+
+	int					m_iCount;				// Particles this step
+	int					m_iCapacity;
+	float				m_fMin[3];				// Corner of the root cube
+	float				m_fRootSize;
+
+	int					*m_piParticles;			// Pool index of each particle in pool order
+	TOctreeKey			*m_puiKeys[2];			// Sort buffers
+	int					*m_piOrder[2];			// Index into m_piParticles of each key
+	int					m_iSorted;				// Buffer the sort finished in
+	int					*m_piHistogram;			// Digit counts of each sort chunk
+
+	int					*m_piSorted;			// Pool index of each sorted particle
+	float				*m_pfX, *m_pfY, *m_pfZ;	// Positions in sorted order
+	float				*m_pfAccel[3];			// Sums in sorted order
+
+	TOctreeNode			*m_pNodes;
+	std::atomic<int>	m_iNumNodes;
+	int					*m_piGroups;			// Nodes the forces are worked out for
+	std::atomic<int>	m_iNumGroups;
+	TOctreeTask			*m_pTasks;
+	int					m_iNumTasks;
+	int					*m_piTop;				// Inner nodes built before the jobs, parents first
+	int					m_iNumTop;
+
+	// Methods
+private:
+
+	void Grow(int count);
+	void SortKeys(CJobSystem *jobs);
+
+	int Octant(TOctreeKey key, int level) const {
+		return int(key >> (3 * (NBODY_MAX_LEVEL - 1 - level))) & 7;
+	}
+	int SkipLevels(int first, int count, int level) const;
+	void MakeChildren(int node, int level);
+	void BuildTop(int node, int level);
+	void BuildSubtree(int node, int level, bool grouped);
+	void SumChildren(int node);
+
+	void Forces(CParticlePool& pool, int node);
+
+public:
+
+	CBarnesHut();
+	~CBarnesHut();
+
+	void Shutdown();
+
+	void SetParams(const TBarnesHutParams& params) { m_params = params; }
+	const TBarnesHutParams& GetParams() const { return m_params; }
+
+	// Use SSE2 or AVX2 for the force sums when the processor has
+	// them, returns whether one is in use
+	bool SetSimd(bool simd);
+	bool GetSimd() const { return m_bSimd; }
+
+	// Heavy bodies, returns the id or RETURN_FAILURE when there is
+	// no room
+	int AddBody(const TVector& position, float mass);
+	void SetBody(int id, const TVector& position, float mass);
+	void ClearBodies() { m_iNumBodies = 0; }
+	int GetNumBodies() const { return m_iNumBodies; }
+
+	//-----------------------------------------------------------
+	// Work out the acceleration of every live particle whose
+	// emitter is flagged in nbodyEmitters, from the positions in
+	// the previous position columns.  They feel each other and
+	// the bodies only, the constant gravity the update takes off
+	// is put back.  Call after BeginStep and the spawns and
+	// before UpdateParticles.  jobs may be NULL.
+	//-----------------------------------------------------------
+	void Step(CParticlePool& pool, const bool *nbodyEmitters, int numEmitters, CJobSystem *jobs);
+
+	int GetCount() const { return m_iCount; }
+	int GetNumNodes() const { return m_iNumNodes.load(std::memory_order_relaxed); }
+	const TOctreeNode& GetNode(int i) const { return m_pNodes[i]; }
+};
+
+#endif
@@ -0,0 +1,522 @@
+/*-----------------------------------------------------------------------------------
+File:			batchMath.cpp
+Author:			Steve Costa
+Description:	The batch functions of vector.h and matrix.h, as scalar loops,
+SSE2 and AVX2.  The SIMD versions do the same operations in the
+same order as the scalar ones, with no fused multiply adds, so they
+give exactly the same bits.  The scalar loops also handle the tails.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "simUtil.h"						// Common Macros
+#include "vector.h"
+#include "matrix.h"
+#include "cpuFeatures.h"					// Instruction set detection
+#include "random.h"							// Test values
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+using namespace vec;
+using namespace matrix;
+
+/*-----------------------------------------------------------------------------------
+Scalar versions, from index first to the end
+-----------------------------------------------------------------------------------*/
+
+static void DotProductsScalar(const float *ax, const float *ay, const float *az,
+	const float *bx, const float *by, const float *bz, float *out, int first, int count)
+{
+	for (int i = first; i < count; i++)
+		out[i] = ax[i] * bx[i] + ay[i] * by[i] + az[i] * bz[i];
+}
+
+static void CrossProductsScalar(const float *ax, const float *ay, const float *az,
+	const float *bx, const float *by, const float *bz,
+	float *outX, float *outY, float *outZ, int first, int count)
+{
+	for (int i = first; i < count; i++)
+	{
+		float x = ay[i] * bz[i] - az[i] * by[i];
+		float y = az[i] * bx[i] - ax[i] * bz[i];
+		float z = ax[i] * by[i] - ay[i] * bx[i];
+
+		outX[i] = x;
+		outY[i] = y;
+		outZ[i] = z;
+	}
+}
+
+static void NormalizeVectorsScalar(float *x, float *y, float *z, int first, int count)
+{
+	for (int i = first; i < count; i++)
+	{
+		float mag_sq = x[i] * x[i] + y[i] * y[i] + z[i] * z[i];
+
+		if (mag_sq > 0.0f)
+		{
+			float flipped = 1.0f / sqrtf(mag_sq);
+
+			x[i] *= flipped;
+			y[i] *= flipped;
+			z[i] *= flipped;
+		}
+	}
+}
+
+// The translation is added when point is set
+static void TransformScalar(const float *m, const float *inX, const float *inY, const float *inZ,
+	float *outX, float *outY, float *outZ, int first, int count, bool point)
+{
+	float tx = point ? m[12] : 0.0f, ty = point ? m[13] : 0.0f, tz = point ? m[14] : 0.0f;
+
+	for (int i = first; i < count; i++)
+	{
+		float x = inX[i], y = inY[i], z = inZ[i];
+
+		if (point)
+		{
+			outX[i] = x * m[0] + y * m[4] + z * m[8] + tx;
+			outY[i] = x * m[1] + y * m[5] + z * m[9] + ty;
+			outZ[i] = x * m[2] + y * m[6] + z * m[10] + tz;
+		}
+		else
+		{
+			outX[i] = x * m[0] + y * m[4] + z * m[8];
+			outY[i] = x * m[1] + y * m[5] + z * m[9];
+			outZ[i] = x * m[2] + y * m[6] + z * m[10];
+		}
+	}
+}
+
+static void TransformScalar4(const TMatrix& mat, const TVector4 *in, TVector4 *out, int first, int count)
+{
+	for (int i = first; i < count; i++)
+		out[i] = in[i] * mat;
+}
+
+#ifdef CPU_X86
+
+/*-----------------------------------------------------------------------------------
+SSE2, four at a time.  Each returns where the scalar tail starts.
+-----------------------------------------------------------------------------------*/
+
+TARGET_SSE2 static int DotProductsSSE2(const float *ax, const float *ay, const float *az,
+	const float *bx, const float *by, const float *bz, float *out, int count)
+{
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(ax + i), _mm_loadu_ps(bx + i)),
+			_mm_mul_ps(_mm_loadu_ps(ay + i), _mm_loadu_ps(by + i))),
+			_mm_mul_ps(_mm_loadu_ps(az + i), _mm_loadu_ps(bz + i)));
+
+		_mm_storeu_ps(out + i, dot);
+	}
+
+	return i;
+}
+
+TARGET_SSE2 static int CrossProductsSSE2(const float *ax, const float *ay, const float *az,
+	const float *bx, const float *by, const float *bz,
+	float *outX, float *outY, float *outZ, int count)
+{
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		__m128 x1 = _mm_loadu_ps(ax + i), y1 = _mm_loadu_ps(ay + i), z1 = _mm_loadu_ps(az + i);
+		__m128 x2 = _mm_loadu_ps(bx + i), y2 = _mm_loadu_ps(by + i), z2 = _mm_loadu_ps(bz + i);
+
+		_mm_storeu_ps(outX + i, _mm_sub_ps(_mm_mul_ps(y1, z2), _mm_mul_ps(z1, y2)));
+		_mm_storeu_ps(outY + i, _mm_sub_ps(_mm_mul_ps(z1, x2), _mm_mul_ps(x1, z2)));
+		_mm_storeu_ps(outZ + i, _mm_sub_ps(_mm_mul_ps(x1, y2), _mm_mul_ps(y1, x2)));
+	}
+
+	return i;
+}
+
+// A true square root and divide, not the estimates, so the bits match
+TARGET_SSE2 static int NormalizeVectorsSSE2(float *x, float *y, float *z, int count)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		__m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+		__m128 magSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+		__m128 keep = _mm_cmpgt_ps(magSq, zero);
+		__m128 flipped = _mm_div_ps(one, _mm_sqrt_ps(magSq));
+
+		// Zero length lanes are multiplied by one
+		flipped = _mm_or_ps(_mm_and_ps(keep, flipped), _mm_andnot_ps(keep, one));
+		_mm_storeu_ps(x + i, _mm_mul_ps(vx, flipped));
+		_mm_storeu_ps(y + i, _mm_mul_ps(vy, flipped));
+		_mm_storeu_ps(z + i, _mm_mul_ps(vz, flipped));
+	}
+
+	return i;
+}
+
+TARGET_SSE2 static int TransformSSE2(const float *m, const float *inX, const float *inY, const float *inZ,
+	float *outX, float *outY, float *outZ, int count, bool point)
+{
+	__m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]), m2 = _mm_set1_ps(m[2]);
+	__m128 m4 = _mm_set1_ps(m[4]), m5 = _mm_set1_ps(m[5]), m6 = _mm_set1_ps(m[6]);
+	__m128 m8 = _mm_set1_ps(m[8]), m9 = _mm_set1_ps(m[9]), m10 = _mm_set1_ps(m[10]);
+	__m128 m12 = _mm_set1_ps(m[12]), m13 = _mm_set1_ps(m[13]), m14 = _mm_set1_ps(m[14]);
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(inX + i), y = _mm_loadu_ps(inY + i), z = _mm_loadu_ps(inZ + i);
+		__m128 rx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m0), _mm_mul_ps(y, m4)), _mm_mul_ps(z, m8));
+		__m128 ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m1), _mm_mul_ps(y, m5)), _mm_mul_ps(z, m9));
+		__m128 rz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m2), _mm_mul_ps(y, m6)), _mm_mul_ps(z, m10));
+
+		if (point)
+		{
+			rx = _mm_add_ps(rx, m12);
+			ry = _mm_add_ps(ry, m13);
+			rz = _mm_add_ps(rz, m14);
+		}
+		_mm_storeu_ps(outX + i, rx);
+		_mm_storeu_ps(outY + i, ry);
+		_mm_storeu_ps(outZ + i, rz);
+	}
+
+	return i;
+}
+
+// One whole TVector4 to a register, times each row of the matrix.  The
+// loads are unaligned as arrays from new need not be, but TVector4 never
+// straddles a cache line.
+TARGET_SSE2 static int TransformSSE2(const TMatrix& mat, const TVector4 *in, TVector4 *out, int count)
+{
+	__m128 row0 = _mm_loadu_ps(mat.m), row1 = _mm_loadu_ps(mat.m + 4);
+	__m128 row2 = _mm_loadu_ps(mat.m + 8), row3 = _mm_loadu_ps(mat.m + 12);
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		__m128 v = _mm_loadu_ps(&in[i].x);
+		__m128 r = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)), row0),
+			_mm_mul_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)), row1)),
+			_mm_mul_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2)), row2)),
+			_mm_mul_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3)), row3));
+
+		_mm_storeu_ps(&out[i].x, r);
+	}
+
+	return i;
+}
+
+/*-----------------------------------------------------------------------------------
+AVX2, eight at a time
+-----------------------------------------------------------------------------------*/
+
+TARGET_AVX2 static int DotProductsAVX2(const float *ax, const float *ay, const float *az,
+	const float *bx, const float *by, const float *bz, float *out, int count)
+{
+	int i;
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		__m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(ax + i), _mm256_loadu_ps(bx + i)),
+			_mm256_mul_ps(_mm256_loadu_ps(ay + i), _mm256_loadu_ps(by + i))),
+			_mm256_mul_ps(_mm256_loadu_ps(az + i), _mm256_loadu_ps(bz + i)));
+
+		_mm256_storeu_ps(out + i, dot);
+	}
+
+	return i;
+}
+
+TARGET_AVX2 static int CrossProductsAVX2(const float *ax, const float *ay, const float *az,
+	const float *bx, const float *by, const float *bz,
+	float *outX, float *outY, float *outZ, int count)
+{
+	int i;
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		__m256 x1 = _mm256_loadu_ps(ax + i), y1 = _mm256_loadu_ps(ay + i), z1 = _mm256_loadu_ps(az + i);
+		__m256 x2 = _mm256_loadu_ps(bx + i), y2 = _mm256_loadu_ps(by + i), z2 = _mm256_loadu_ps(bz + i);
+
+		_mm256_storeu_ps(outX + i, _mm256_sub_ps(_mm256_mul_ps(y1, z2), _mm256_mul_ps(z1, y2)));
+		_mm256_storeu_ps(outY + i, _mm256_sub_ps(_mm256_mul_ps(z1, x2), _mm256_mul_ps(x1, z2)));
+		_mm256_storeu_ps(outZ + i, _mm256_sub_ps(_mm256_mul_ps(x1, y2), _mm256_mul_ps(y1, x2)));
+	}
+
+	return i;
+}
+
+TARGET_AVX2 static int NormalizeVectorsAVX2(float *x, float *y, float *z, int count)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	int i;
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		__m256 vx = _mm256_loadu_ps(x + i), vy = _mm256_loadu_ps(y + i), vz = _mm256_loadu_ps(z + i);
+		__m256 magSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)),
+			_mm256_mul_ps(vz, vz));
+		__m256 keep = _mm256_cmp_ps(magSq, zero, _CMP_GT_OQ);
+		__m256 flipped = _mm256_blendv_ps(one, _mm256_div_ps(one, _mm256_sqrt_ps(magSq)), keep);
+
+		_mm256_storeu_ps(x + i, _mm256_mul_ps(vx, flipped));
+		_mm256_storeu_ps(y + i, _mm256_mul_ps(vy, flipped));
+		_mm256_storeu_ps(z + i, _mm256_mul_ps(vz, flipped));
+	}
+
+	return i;
+}
+
+TARGET_AVX2 static int TransformAVX2(const float *m, const float *inX, const float *inY, const float *inZ,
+	float *outX, float *outY, float *outZ, int count, bool point)
+{
+	__m256 m0 = _mm256_set1_ps(m[0]), m1 = _mm256_set1_ps(m[1]), m2 = _mm256_set1_ps(m[2]);
+	__m256 m4 = _mm256_set1_ps(m[4]), m5 = _mm256_set1_ps(m[5]), m6 = _mm256_set1_ps(m[6]);
+	__m256 m8 = _mm256_set1_ps(m[8]), m9 = _mm256_set1_ps(m[9]), m10 = _mm256_set1_ps(m[10]);
+	__m256 m12 = _mm256_set1_ps(m[12]), m13 = _mm256_set1_ps(m[13]), m14 = _mm256_set1_ps(m[14]);
+	int i;
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(inX + i), y = _mm256_loadu_ps(inY + i), z = _mm256_loadu_ps(inZ + i);
+		__m256 rx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m0), _mm256_mul_ps(y, m4)), _mm256_mul_ps(z, m8));
+		__m256 ry = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m1), _mm256_mul_ps(y, m5)), _mm256_mul_ps(z, m9));
+		__m256 rz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m2), _mm256_mul_ps(y, m6)), _mm256_mul_ps(z, m10));
+
+		if (point)
+		{
+			rx = _mm256_add_ps(rx, m12);
+			ry = _mm256_add_ps(ry, m13);
+			rz = _mm256_add_ps(rz, m14);
+		}
+		_mm256_storeu_ps(outX + i, rx);
+		_mm256_storeu_ps(outY + i, ry);
+		_mm256_storeu_ps(outZ + i, rz);
+	}
+
+	return i;
+}
+
+#endif
+
+/*-----------------------------------------------------------------------------------
+Dispatch
+-----------------------------------------------------------------------------------*/
+
+static bool UseSSE2()
+{
+	return (GetCpuFeatures() & CPU_FEATURE_SSE2) != 0;
+}
+
+static bool UseAVX2()
+{
+	return (GetCpuFeatures() & CPU_FEATURE_AVX2) != 0;
+}
+
+void vec::DotProducts(const float *ax, const float *ay, const float *az,
+	const float *bx, const float *by, const float *bz, float *out, int count)
+{
+	int first = 0;
+
+#ifdef CPU_X86
+	if (UseAVX2())
+		first = DotProductsAVX2(ax, ay, az, bx, by, bz, out, count);
+	else if (UseSSE2())
+		first = DotProductsSSE2(ax, ay, az, bx, by, bz, out, count);
+#endif
+	DotProductsScalar(ax, ay, az, bx, by, bz, out, first, count);
+}
+
+void vec::CrossProducts(const float *ax, const float *ay, const float *az,
+	const float *bx, const float *by, const float *bz,
+	float *outX, float *outY, float *outZ, int count)
+{
+	int first = 0;
+
+#ifdef CPU_X86
+	if (UseAVX2())
+		first = CrossProductsAVX2(ax, ay, az, bx, by, bz, outX, outY, outZ, count);
+	else if (UseSSE2())
+		first = CrossProductsSSE2(ax, ay, az, bx, by, bz, outX, outY, outZ, count);
+#endif
+	CrossProductsScalar(ax, ay, az, bx, by, bz, outX, outY, outZ, first, count);
+}
+
+void vec::NormalizeVectors(float *x, float *y, float *z, int count)
+{
+	int first = 0;
+
+#ifdef CPU_X86
+	if (UseAVX2())
+		first = NormalizeVectorsAVX2(x, y, z, count);
+	else if (UseSSE2())
+		first = NormalizeVectorsSSE2(x, y, z, count);
+#endif
+	NormalizeVectorsScalar(x, y, z, first, count);
+}
+
+static void Transform(const TMatrix& mat, const float *inX, const float *inY, const float *inZ,
+	float *outX, float *outY, float *outZ, int count, bool point)
+{
+	int first = 0;
+
+#ifdef CPU_X86
+	if (UseAVX2())
+		first = TransformAVX2(mat.m, inX, inY, inZ, outX, outY, outZ, count, point);
+	else if (UseSSE2())
+		first = TransformSSE2(mat.m, inX, inY, inZ, outX, outY, outZ, count, point);
+#endif
+	TransformScalar(mat.m, inX, inY, inZ, outX, outY, outZ, first, count, point);
+}
+
+void matrix::TransformPoints(const TMatrix& mat, const float *inX, const float *inY, const float *inZ,
+	float *outX, float *outY, float *outZ, int count)
+{
+	Transform(mat, inX, inY, inZ, outX, outY, outZ, count, true);
+}
+
+void matrix::TransformVectors(const TMatrix& mat, const float *inX, const float *inY, const float *inZ,
+	float *outX, float *outY, float *outZ, int count)
+{
+	Transform(mat, inX, inY, inZ, outX, outY, outZ, count, false);
+}
+
+void matrix::TransformPoints(const TMatrix& mat, const TVector4 *in, TVector4 *out, int count)
+{
+	int first = 0;
+
+#ifdef CPU_X86
+	if (UseSSE2())
+		first = TransformSSE2(mat, in, out, count);
+#endif
+	TransformScalar4(mat, in, out, first, count);
+}
+
+/*-----------------------------------------------------------------------------------
+Run every function with each instruction set the processor has on the same
+values and compare the results with the scalar ones bit for bit.  Some of the
+vectors are zero, and an odd count exercises the tails.
+-----------------------------------------------------------------------------------*/
+
+int matrix::CheckBatchMath()
+{
+#ifdef CPU_X86
+	const int numValues = 1021;
+	const int numArrays = 6;
+
+	float *values = new float[numArrays * numValues];
+	float *results[3];
+	TVector4 *points = new TVector4[3 * numValues];
+	TMatrix mat;
+	CRandomPcg32 rng;
+	int status = RETURN_SUCCESS;
+	int set, op, i;
+
+	rng.Seed(1, 0);
+	for (i = 0; i < numArrays * numValues; i++)
+		values[i] = float(int(RandomToRange(rng.NextUInt(), 20001)) - 10000) * 0.001f;
+	for (i = 0; i < numValues; i += 7)
+		values[i] = values[numValues + i] = values[2 * numValues + i] = 0.0f;
+	for (i = 0; i < 16; i++)
+		mat.m[i] = float(int(RandomToRange(rng.NextUInt(), 2001)) - 1000) * 0.01f;
+
+	for (set = 0; set < 3; set++)
+		results[set] = new float[3 * numValues];
+
+	for (op = 0; op < 5; op++)
+	{
+		for (set = 0; set < 3; set++)
+		{
+			const float *ax = values, *ay = values + numValues, *az = values + 2 * numValues;
+			const float *bx = values + 3 * numValues, *by = values + 4 * numValues, *bz = values + 5 * numValues;
+			float *outX = results[set], *outY = outX + numValues, *outZ = outY + numValues;
+			int first = 0;
+
+			if ((set == 1 && !UseSSE2()) || (set == 2 && !UseAVX2()))
+				continue;
+
+			switch (op)
+			{
+			case 0:
+				if (set == 1)
+					first = DotProductsSSE2(ax, ay, az, bx, by, bz, outX, numValues);
+				else if (set == 2)
+					first = DotProductsAVX2(ax, ay, az, bx, by, bz, outX, numValues);
+				DotProductsScalar(ax, ay, az, bx, by, bz, outX, first, numValues);
+				memset(outY, 0, sizeof(float) * 2 * numValues);
+				break;
+
+			case 1:
+				if (set == 1)
+					first = CrossProductsSSE2(ax, ay, az, bx, by, bz, outX, outY, outZ, numValues);
+				else if (set == 2)
+					first = CrossProductsAVX2(ax, ay, az, bx, by, bz, outX, outY, outZ, numValues);
+				CrossProductsScalar(ax, ay, az, bx, by, bz, outX, outY, outZ, first, numValues);
+				break;
+
+			case 2:
+				memcpy(outX, values, sizeof(float) * 3 * numValues);
+				if (set == 1)
+					first = NormalizeVectorsSSE2(outX, outY, outZ, numValues);
+				else if (set == 2)
+					first = NormalizeVectorsAVX2(outX, outY, outZ, numValues);
+				NormalizeVectorsScalar(outX, outY, outZ, first, numValues);
+				break;
+
+			case 3:
+			case 4:
+				if (set == 1)
+					first = TransformSSE2(mat.m, ax, ay, az, outX, outY, outZ, numValues, op == 3);
+				else if (set == 2)
+					first = TransformAVX2(mat.m, ax, ay, az, outX, outY, outZ, numValues, op == 3);
+				TransformScalar(mat.m, ax, ay, az, outX, outY, outZ, first, numValues, op == 3);
+				break;
+			}
+		}
+
+		for (set = 1; set < 3; set++)
+		{
+			if ((set == 1 && !UseSSE2()) || (set == 2 && !UseAVX2()))
+				continue;
+			if (memcmp(results[0], results[set], sizeof(float) * 3 * numValues))
+				status = RETURN_FAILURE;
+		}
+	}
+
+	// The whole matrix on aligned four element vectors
+	if (UseSSE2())
+	{
+		for (i = 0; i < numValues; i++)
+			points[i] = TVector4(values[i], values[numValues + i], values[2 * numValues + i], values[3 * numValues + i]);
+		TransformScalar4(mat, points, points + numValues, 0, numValues);
+		TransformSSE2(mat, points, points + 2 * numValues, numValues);
+		if (memcmp(points + numValues, points + 2 * numValues, sizeof(TVector4) * numValues))
+			status = RETURN_FAILURE;
+	}
+
+	for (set = 0; set < 3; set++)
+		delete[] results[set];
+	delete[] points;
+	delete[] values;
+
+	return status;
+#else
+	return RETURN_SUCCESS;
+#endif
+}
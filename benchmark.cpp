@@ -0,0 +1,279 @@
+/*-----------------------------------------------------------------------------------
+File:			benchmark.cpp
+Author:			Steve Costa
+Description:	Throughput benchmark for the particle simulation.  Steps pools
+from 1K to 10M particles with every update kernel the processor
+supports and reports particles per second, nanoseconds per
+particle and the memory bandwidth the update pass achieves.  Then
+times the update pass alone on the same particles held in the
+float pool and in each precision of CParticleStore, and moving
+points through a matrix one at a time against in batches.
+
+Usage:			particles_bench [threads] [max particles]
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "simUtil.h"						// Common Macros
+#include "timer.h"							// High resolution clock
+#include "particleSystem.h"					// Particle simulation
+#include "particleStorage.h"				// Compact particle storage
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define BENCH_DT				0.02f
+#define BENCH_WORK				200000000.0		// Particle steps timed per run
+#define BENCH_MIN_STEPS			5
+#define BENCH_WARMUP_STEPS		2
+#define BENCH_MAX_PARTICLES		10000000
+
+// Bytes moved per particle by one update: position, velocity, acceleration,
+// life and fade rate read, position, velocity and life written back
+#define BENCH_BYTES_PER_PARTICLE	((11 + 7) * sizeof(float))
+
+/*-----------------------------------------------------------------------------------
+Time one pool size with the currently selected kernel
+-----------------------------------------------------------------------------------*/
+
+static void RunCase(CJobSystem& jobs, int numParticles, int kernel)
+{
+	CParticleSystem system;
+	int step, numSteps;
+	double start, seconds, particleSteps;
+
+	if (system.Init(numParticles, &jobs) != RETURN_SUCCESS)
+	{
+		printf("%10d  %-7s  allocation failed\n", numParticles, GetUpdateKernelName(kernel));
+		return;
+	}
+	system.AddEmitter(CEmitter::Fountain(numParticles));
+
+	numSteps = MAX(BENCH_MIN_STEPS, int(BENCH_WORK / numParticles));
+
+	// First steps fault the pages in and spawn every particle
+	for (step = 0; step < BENCH_WARMUP_STEPS; step++)
+		system.Update(BENCH_DT);
+
+	start = CTimer::GetSeconds();
+
+	for (step = 0; step < numSteps; step++)
+		system.Update(BENCH_DT);
+
+	seconds = CTimer::GetSeconds() - start;
+	particleSteps = double(numParticles) * numSteps;
+
+	printf("%10d  %-7s  %8d  %12.1f  %10.3f  %8.2f\n",
+		numParticles, GetUpdateKernelName(kernel), numSteps,
+		particleSteps / seconds * 1.0e-6,
+		seconds * 1.0e9 / particleSteps,
+		particleSteps * BENCH_BYTES_PER_PARTICLE / seconds * 1.0e-9);
+
+	system.Shutdown();
+}
+
+/*-----------------------------------------------------------------------------------
+Print one row of the storage table
+-----------------------------------------------------------------------------------*/
+
+static void PrintStorage(int numParticles, const char *name, size_t bytes, size_t updateBytes,
+	int numSteps, double seconds)
+{
+	double particleSteps = double(numParticles) * numSteps;
+
+	printf("%10d  %-8s  %5d  %8d  %12.1f  %10.3f  %8.2f\n",
+		numParticles, name, (int)bytes, numSteps,
+		particleSteps / seconds * 1.0e-6,
+		seconds * 1.0e9 / particleSteps,
+		particleSteps * updateBytes / seconds * 1.0e-9);
+}
+
+/*-----------------------------------------------------------------------------------
+Time the update of the particles of a pool packed into a store
+-----------------------------------------------------------------------------------*/
+
+template <class P>
+static void RunStore(CJobSystem& jobs, const CParticlePool& pool, const char *name, int numSteps)
+{
+	CParticleStore<P> store;
+	TStorageRange reach[3] = { TStorageRange(64.0f), TStorageRange(128.0f), TStorageRange(64.0f) };
+	int numParticles = pool.GetLiveCount();
+	int first, step;
+	double start;
+
+	if (store.Init(numParticles, reach, 1, &jobs) != RETURN_SUCCESS)
+	{
+		printf("%10d  %-8s  allocation failed\n", numParticles, name);
+		return;
+	}
+
+	store.Allocate(numParticles, &first);
+	jobs.ParallelFor(numParticles, PARTICLE_STORE_GRAIN, [&](int first, int count, int worker) {
+		store.Pack(pool, first, count, first);
+	});
+
+	for (step = 0; step < BENCH_WARMUP_STEPS; step++)
+		store.Update(BENCH_DT);
+
+	start = CTimer::GetSeconds();
+
+	for (step = 0; step < numSteps; step++)
+		store.Update(BENCH_DT);
+
+	PrintStorage(numParticles, name, CParticleStore<P>::GetBytesPerParticle(),
+		CParticleStore<P>::GetUpdateBytesPerParticle(), numSteps, CTimer::GetSeconds() - start);
+}
+
+/*-----------------------------------------------------------------------------------
+Time the update pass alone on a fountain's particles, kept alive, as floats
+and then in each store precision
+-----------------------------------------------------------------------------------*/
+
+static void RunStorageCase(CJobSystem& jobs, int numParticles)
+{
+	CParticleSystem system;
+	int step, numSteps;
+	double start;
+
+	if (system.Init(numParticles, &jobs) != RETURN_SUCCESS)
+	{
+		printf("%10d  %-8s  allocation failed\n", numParticles, "float");
+		return;
+	}
+	system.AddEmitter(CEmitter::Fountain(numParticles));
+	system.Update(BENCH_DT);
+
+	CParticlePool& pool = system.GetPool();
+	numParticles = pool.GetLiveCount();
+	memset(pool.Column(PARTICLE_FADE_RATE), 0, sizeof(float) * numParticles);
+
+	numSteps = MAX(BENCH_MIN_STEPS, int(BENCH_WORK / numParticles));
+
+	// The pool on its own, as the system's update runs it
+	for (step = 0; step < BENCH_WARMUP_STEPS + numSteps; step++)
+	{
+		if (step == BENCH_WARMUP_STEPS)
+			start = CTimer::GetSeconds();
+
+		pool.BeginStep();
+		jobs.ParallelFor(numParticles, PARTICLE_STORE_GRAIN, [&](int first, int count, int worker) {
+			UpdateParticles(pool, first, count, BENCH_DT);
+		});
+	}
+	PrintStorage(numParticles, "float", sizeof(float) * PARTICLE_NUM_COLUMNS, BENCH_BYTES_PER_PARTICLE,
+		numSteps, CTimer::GetSeconds() - start);
+
+	RunStore<TFullPrecision>(jobs, pool, "full", numSteps);
+	RunStore<TMixedPrecision>(jobs, pool, "mixed", numSteps);
+	RunStore<TCompactPrecision>(jobs, pool, "compact", numSteps);
+
+	system.Shutdown();
+}
+
+/*-----------------------------------------------------------------------------------
+Time a view transform of numPoints points, one TVector at a time through
+operator * and as columns through TransformPoints, on one thread
+-----------------------------------------------------------------------------------*/
+
+static void RunTransformCase(int numPoints)
+{
+	TVector *points = new TVector[numPoints];
+	float *columns = new float[6 * numPoints];
+	float *x = columns, *y = columns + numPoints, *z = columns + 2 * numPoints;
+	double start, seconds[2];
+	TMatrix view;
+	int numRuns = MAX(BENCH_MIN_STEPS, int(BENCH_WORK * 0.1 / numPoints));
+	int method, run, i;
+
+	view.Rotate(TVector(0.0f, 0.6f, 0.8f), 0.5f);
+	view.Translate(TVector(1.0f, -2.0f, -30.0f));
+	for (i = 0; i < numPoints; i++)
+	{
+		x[i] = float(i % 101) * 0.1f;
+		y[i] = float(i % 67) * 0.1f;
+		z[i] = float(i % 43) * 0.1f;
+	}
+
+	for (method = 0; method < 2; method++)
+	{
+		start = CTimer::GetSeconds();
+		for (run = 0; run < numRuns; run++)
+		{
+			if (method == 0)
+			{
+				for (i = 0; i < numPoints; i++)
+					points[i] = TVector(x[i], y[i], z[i]) * view;
+			}
+			else
+				TransformPoints(view, x, y, z, x + 3 * numPoints, y + 3 * numPoints, z + 3 * numPoints, numPoints);
+		}
+		seconds[method] = CTimer::GetSeconds() - start;
+	}
+
+	printf("%10d  %12.3f  %12.3f\n", numPoints,
+		seconds[0] * 1.0e9 / (double(numPoints) * numRuns),
+		seconds[1] * 1.0e9 / (double(numPoints) * numRuns));
+
+	delete[] columns;
+	delete[] points;
+}
+
+/*-----------------------------------------------------------------------------------
+Program entry point
+-----------------------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+{
+	CJobSystem jobs;
+	int numThreads = (argc > 1) ? atoi(argv[1]) : 0;
+	int maxParticles = (argc > 2) ? atoi(argv[2]) : BENCH_MAX_PARTICLES;
+	int numParticles, kernel;
+
+	jobs.Init(numThreads);
+
+	if (CheckUpdateKernels() != RETURN_SUCCESS)
+		printf("warning: SIMD kernels disagree with the scalar path\n");
+	if (CheckParticleStorage() != RETURN_SUCCESS)
+		printf("warning: SIMD storage conversions disagree with the scalar path\n");
+	if (CheckBatchMath() != RETURN_SUCCESS)
+		printf("warning: SIMD batch transforms disagree with the scalar path\n");
+	if (CheckSpatialGrid(&jobs) != RETURN_SUCCESS)
+		printf("warning: spatial grid queries disagree with testing every particle\n");
+
+	printf("%d threads\n", jobs.GetNumThreads());
+	printf("%10s  %-7s  %8s  %12s  %10s  %8s\n",
+		"particles", "kernel", "steps", "M/s", "ns/part", "GB/s");
+
+	for (numParticles = 1000; numParticles <= maxParticles; numParticles *= 10)
+	{
+		for (kernel = UPDATE_KERNEL_SCALAR; kernel < UPDATE_KERNEL_COUNT; kernel++)
+		{
+			if (SelectUpdateKernel(kernel) != RETURN_SUCCESS)
+				continue;
+
+			RunCase(jobs, numParticles, kernel);
+		}
+	}
+
+	SelectUpdateKernel(UPDATE_KERNEL_AUTO);
+
+	printf("\nupdate pass by storage, %s kernel\n", GetUpdateKernelName(GetUpdateKernel()));
+	printf("%10s  %-8s  %5s  %8s  %12s  %10s  %8s\n",
+		"particles", "storage", "bytes", "steps", "M/s", "ns/part", "GB/s");
+
+	for (numParticles = 1000; numParticles <= maxParticles; numParticles *= 10)
+		RunStorageCase(jobs, numParticles);
+
+	printf("\nview transform, ns per point\n");
+	printf("%10s  %12s  %12s\n", "points", "operator *", "batch");
+
+	for (numParticles = 1000; numParticles <= maxParticles; numParticles *= 10)
+		RunTransformCase(numParticles);
+
+	jobs.Shutdown();
+
+	return 0;
+}
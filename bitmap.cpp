@@ -0,0 +1,161 @@
+/*-----------------------------------------------------------------------------------
+File:			bitmap.cpp
+Author:			Steve Costa
+Description:	Uncompressed bitmap reading and writing.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#define _CRT_SECURE_NO_WARNINGS				// fopen as it is everywhere else
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bitmap.h"							// Header file
+
+/*-----------------------------------------------------------------------------------
+Little endian reads and writes for the bitmap headers
+-----------------------------------------------------------------------------------*/
+
+static unsigned int ReadLE(const unsigned char *bytes, int size)
+{
+	unsigned int value = 0;
+	int i;
+
+	for (i = size - 1; i >= 0; i--)
+		value = (value << 8) | bytes[i];
+
+	return value;
+}
+
+static void WriteLE(unsigned char *bytes, unsigned int value, int size)
+{
+	int i;
+
+	for (i = 0; i < size; i++, value >>= 8)
+		bytes[i] = (unsigned char)(value & 0xFF);
+}
+
+/*-----------------------------------------------------------------------------------
+Read a 24 or 32 bit bitmap, top row first, keeping the brightest channel
+-----------------------------------------------------------------------------------*/
+
+unsigned char *ReadBMPCoverage(const char *filename, int *width, int *height)
+{
+	unsigned char header[54];
+	unsigned char *data, *coverage;
+	FILE *file;
+	int w, h, bits, stride, x, y;
+	unsigned int offset;
+	bool topDown;
+
+	if (!filename || !(file = fopen(filename, "rb")))
+		return NULL;
+
+	if (fread(header, 1, sizeof(header), file) != sizeof(header) || header[0] != 'B' || header[1] != 'M')
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	offset = ReadLE(header + 10, 4);
+	w = int(ReadLE(header + 18, 4));
+	h = int(ReadLE(header + 22, 4));
+	bits = int(ReadLE(header + 28, 2));
+	topDown = (h < 0);
+	h = ABS(h);
+
+	if ((bits != 24 && bits != 32) || ReadLE(header + 30, 4) != 0 ||
+		w <= 0 || h <= 0 || w > BITMAP_MAX_SIZE || h > BITMAP_MAX_SIZE)
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	stride = (w * (bits / 8) + 3) & ~3;
+	data = new unsigned char[stride * h];
+	coverage = new unsigned char[w * h];
+
+	if (fseek(file, long(offset), SEEK_SET) != 0 || fread(data, 1, stride * h, file) != size_t(stride * h))
+	{
+		delete[] coverage;
+		coverage = NULL;
+	}
+	else
+	{
+		// Brightest channel of each pixel
+		for (y = 0; y < h; y++)
+		{
+			const unsigned char *row = data + (topDown ? y : h - 1 - y) * stride;
+
+			for (x = 0; x < w; x++, row += bits / 8)
+				coverage[y * w + x] = MAX(row[0], MAX(row[1], row[2]));
+		}
+
+		*width = w;
+		*height = h;
+	}
+
+	delete[] data;
+	fclose(file);
+
+	return coverage;
+}
+
+/*-----------------------------------------------------------------------------------
+Write RGBA pixels, bottom row first, as a bottom up 24 bit bitmap
+-----------------------------------------------------------------------------------*/
+
+int WriteBMP(const char *filename, const unsigned char *pixels, int width, int height)
+{
+	unsigned char header[54];
+	unsigned char *row;
+	FILE *file;
+	int stride = (3 * width + 3) & ~3;
+	int x, y, status = RETURN_SUCCESS;
+
+	if (!pixels || !filename || width <= 0 || height <= 0 || !(file = fopen(filename, "wb")))
+		return RETURN_FAILURE;
+
+	memset(header, 0, sizeof(header));
+	header[0] = 'B';
+	header[1] = 'M';
+	WriteLE(header + 2, sizeof(header) + stride * height, 4);
+	WriteLE(header + 10, sizeof(header), 4);
+	WriteLE(header + 14, 40, 4);
+	WriteLE(header + 18, width, 4);
+	WriteLE(header + 22, height, 4);
+	WriteLE(header + 26, 1, 2);
+	WriteLE(header + 28, 24, 2);
+	WriteLE(header + 34, stride * height, 4);
+
+	if (fwrite(header, 1, sizeof(header), file) != sizeof(header))
+		status = RETURN_FAILURE;
+
+	row = new unsigned char[stride];
+	memset(row, 0, stride);
+
+	for (y = 0; y < height && status == RETURN_SUCCESS; y++)
+	{
+		const unsigned char *in = pixels + 4 * y * width;
+
+		for (x = 0; x < width; x++, in += 4)
+		{
+			row[3 * x + 0] = in[2];
+			row[3 * x + 1] = in[1];
+			row[3 * x + 2] = in[0];
+		}
+
+		if (fwrite(row, 1, stride, file) != size_t(stride))
+			status = RETURN_FAILURE;
+	}
+
+	delete[] row;
+	if (fclose(file) != 0)
+		status = RETURN_FAILURE;
+
+	return status;
+}
+
@@ -0,0 +1,40 @@
+/*-----------------------------------------------------------------------------------
+File:			bitmap.h
+Author:			Steve Costa
+Description:	Reading and writing of uncompressed Windows bitmaps without SDL,
+for the software rasterizer, frame capture and atlas cooking.
+-----------------------------------------------------------------------------------*/
+
+#ifndef BITMAP_H_
+#define BITMAP_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "simUtil.h"						// Common Macros
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define BITMAP_MAX_SIZE			16384			// Widest or tallest bitmap read
+
+/*-----------------------------------------------------------------------------------
+Functions
+-----------------------------------------------------------------------------------*/
+
+//-----------------------------------------------------------
+// Read a 24 or 32 bit bitmap as a coverage mask, the
+// brightest channel of each pixel, as the sprite textures
+// are kept.  The rows are returned from the top of the
+// picture down, the way SDL hands them to glTexImage2D.
+// Returns an array to delete[], or NULL.
+//-----------------------------------------------------------
+unsigned char *ReadBMPCoverage(const char *filename, int *width, int *height);
+
+// Write RGBA pixels, bottom row first as OpenGL reads them, to a
+// 24 bit bitmap
+int WriteBMP(const char *filename, const unsigned char *pixels, int width, int height);
+
+#endif
@@ -0,0 +1,23 @@
+/*-----------------------------------------------------------------------------------
+File:			cpuFeatures.cpp
+Author:			Steve Costa
+Description:	The features of this processor, asked for once.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "cpuFeatures.h"					// Header file for these functions
+
+/*-----------------------------------------------------------------------------------
+Filled in while the program starts, before any worker thread exists, so the
+threads only ever read it
+-----------------------------------------------------------------------------------*/
+
+static const int s_iCpuFeatures = DetectCpuFeatures();
+
+int GetCpuFeatures()
+{
+	return s_iCpuFeatures;
+}
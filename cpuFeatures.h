@@ -0,0 +1,130 @@
+/*-----------------------------------------------------------------------------------
+File:			cpuFeatures.h
+Author:			Steve Costa
+Description:	Runtime detection of the SIMD instruction sets supported by the
+processor and operating system, plus the macros needed to compile
+a function for an instruction set the rest of the program is not
+built for.
+-----------------------------------------------------------------------------------*/
+
+#ifndef CPU_FEATURES_H_
+#define CPU_FEATURES_H_
+
+/*-----------------------------------------------------------------------------------
+Platform detection
+-----------------------------------------------------------------------------------*/
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define CPU_X86
+#endif
+
+#ifdef CPU_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+/*-----------------------------------------------------------------------------------
+Function attributes for compiling a kernel against a wider instruction set.
+MSVC allows any intrinsic in any function, GCC and Clang must be told.
+-----------------------------------------------------------------------------------*/
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSE2				__attribute__((target("sse2")))
+#define TARGET_AVX2				__attribute__((target("avx2")))
+#define TARGET_AVX512			__attribute__((target("avx512f")))
+#define TARGET_AVX2_F16C		__attribute__((target("avx2,f16c")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#define TARGET_AVX512
+#define TARGET_AVX2_F16C
+#endif
+
+// AVX-512 intrinsics need VS2017 or a GCC/Clang of the same age
+#if defined(CPU_X86) && (defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1910))
+#define CPU_COMPILER_AVX512
+#endif
+
+/*-----------------------------------------------------------------------------------
+Feature flags
+-----------------------------------------------------------------------------------*/
+
+#define CPU_FEATURE_SSE2		0x01
+#define CPU_FEATURE_AVX			0x02
+#define CPU_FEATURE_AVX2		0x04
+#define CPU_FEATURE_AVX512F		0x08
+#define CPU_FEATURE_F16C		0x10			// Half float conversions
+
+/*-----------------------------------------------------------------------------------
+Query the processor.  The AVX flags are only reported when the operating system
+also saves the wider registers on a context switch.
+-----------------------------------------------------------------------------------*/
+
+inline int DetectCpuFeatures()
+{
+	int features = 0;
+
+#ifdef CPU_X86
+	unsigned int regs[4] = { 0, 0, 0, 0 };			// eax, ebx, ecx, edx
+	unsigned int maxLeaf;
+	unsigned long long xcr0 = 0;
+
+#if defined(_MSC_VER)
+	__cpuid((int *)regs, 0);
+	maxLeaf = regs[0];
+	__cpuid((int *)regs, 1);
+#else
+	__cpuid(0, regs[0], regs[1], regs[2], regs[3]);
+	maxLeaf = regs[0];
+	__cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+#endif
+
+	if (regs[3] & (1u << 26))
+		features |= CPU_FEATURE_SSE2;
+
+	// OSXSAVE and AVX
+	if ((regs[2] & (1u << 27)) && (regs[2] & (1u << 28)))
+	{
+#if defined(_MSC_VER)
+		xcr0 = _xgetbv(0);
+#else
+		unsigned int lo, hi;
+		__asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		xcr0 = ((unsigned long long)hi << 32) | lo;
+#endif
+		// XMM and YMM state enabled
+		if ((xcr0 & 0x06) == 0x06)
+		{
+			features |= CPU_FEATURE_AVX;
+			if (regs[2] & (1u << 29))
+				features |= CPU_FEATURE_F16C;
+		}
+	}
+
+	if (maxLeaf >= 7 && (features & CPU_FEATURE_AVX))
+	{
+#if defined(_MSC_VER)
+		__cpuidex((int *)regs, 7, 0);
+#else
+		__cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+		if (regs[1] & (1u << 5))
+			features |= CPU_FEATURE_AVX2;
+
+		// Opmask, upper ZMM and high ZMM state enabled
+		if ((regs[1] & (1u << 16)) && (xcr0 & 0xE6) == 0xE6)
+			features |= CPU_FEATURE_AVX512F;
+	}
+#endif
+
+	return features;
+}
+
+// DetectCpuFeatures run once as the program starts, for the dispatch of free
+// functions called from any thread
+int GetCpuFeatures();
+
+#endif
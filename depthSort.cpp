@@ -0,0 +1,381 @@
+/*-----------------------------------------------------------------------------------
+File:			depthSort.cpp
+Author:			Steve Costa
+Description:	Depth keys, the parallel radix sort and the coherent refine for
+back to front particle drawing.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "depthSort.h"						// Class header file
+#include "profiler.h"						// Frame zones
+
+/*-----------------------------------------------------------------------------------
+Make a float into a key which sorts the same way as unsigned integers: the sign
+bit is flipped for positive values and every bit for negative ones
+-----------------------------------------------------------------------------------*/
+
+static inline unsigned int FloatKey(float f)
+{
+	unsigned int bits;
+
+	memcpy(&bits, &f, sizeof(bits));
+	return bits ^ ((unsigned int)((int)bits >> 31) | 0x80000000u);
+}
+
+/*-----------------------------------------------------------------------------------
+Constructor and destructor
+-----------------------------------------------------------------------------------*/
+
+CDepthSort::CDepthSort()
+{
+	m_bCoherent = true;
+	m_bValid = false;
+	m_bRefined = false;
+	m_iCount = 0;
+	m_iCapacity = 0;
+	m_iMaxOutliers = 0;
+	m_iNumOutliers = 0;
+	m_puiDepth = NULL;
+	m_puiKeys[0] = m_puiKeys[1] = NULL;
+	m_piOrder[0] = m_piOrder[1] = NULL;
+	m_iCurrent = 0;
+	m_puiOutlierKeys[0] = m_puiOutlierKeys[1] = NULL;
+	m_piOutliers[0] = m_piOutliers[1] = NULL;
+	m_piHistogram = NULL;
+}
+
+CDepthSort::~CDepthSort()
+{
+	Shutdown();
+}
+
+/*-----------------------------------------------------------------------------------
+Free the arrays
+-----------------------------------------------------------------------------------*/
+
+void CDepthSort::Shutdown()
+{
+	delete[] m_puiDepth;
+	delete[] m_puiKeys[0];
+	delete[] m_puiKeys[1];
+	delete[] m_piOrder[0];
+	delete[] m_piOrder[1];
+	delete[] m_puiOutlierKeys[0];
+	delete[] m_puiOutlierKeys[1];
+	delete[] m_piOutliers[0];
+	delete[] m_piOutliers[1];
+	delete[] m_piHistogram;
+
+	m_puiDepth = NULL;
+	m_puiKeys[0] = m_puiKeys[1] = NULL;
+	m_piOrder[0] = m_piOrder[1] = NULL;
+	m_puiOutlierKeys[0] = m_puiOutlierKeys[1] = NULL;
+	m_piOutliers[0] = m_piOutliers[1] = NULL;
+	m_piHistogram = NULL;
+
+	m_bValid = false;
+	m_bRefined = false;
+	m_iCount = 0;
+	m_iCapacity = 0;
+	m_iMaxOutliers = 0;
+	m_iNumOutliers = 0;
+	m_iCurrent = 0;
+}
+
+/*-----------------------------------------------------------------------------------
+Make room for count particles.  The last order is lost, so the next sort is a
+full one.  The refine gives up before it has more outliers than the outlier
+buffers hold, see Refine.
+-----------------------------------------------------------------------------------*/
+
+void CDepthSort::Grow(int count)
+{
+	int numChunks = (count + DEPTH_SORT_CHUNK - 1) / DEPTH_SORT_CHUNK;
+
+	if (count <= m_iCapacity)
+		return;
+
+	Shutdown();
+
+	m_iCapacity = count;
+	m_iMaxOutliers = (count + DEPTH_REFINE_SLACK) / DEPTH_MAX_OUTLIERS + 1;
+	m_puiDepth = new unsigned int[count];
+	m_puiKeys[0] = new unsigned int[count];
+	m_puiKeys[1] = new unsigned int[count];
+	m_piOrder[0] = new int[count];
+	m_piOrder[1] = new int[count];
+	m_puiOutlierKeys[0] = new unsigned int[m_iMaxOutliers];
+	m_puiOutlierKeys[1] = new unsigned int[m_iMaxOutliers];
+	m_piOutliers[0] = new int[m_iMaxOutliers];
+	m_piOutliers[1] = new int[m_iMaxOutliers];
+	m_piHistogram = new int[numChunks * DEPTH_RADIX_BUCKETS];
+}
+
+/*-----------------------------------------------------------------------------------
+Key every particle by its depth.  The third row of the modelview matrix gives
+the view space z, which is more negative further from the viewer, so the keys
+go up from back to front.
+-----------------------------------------------------------------------------------*/
+
+void CDepthSort::Keys(const CParticlePool& pool, int count, const TMatrix& modelView, float blend,
+	CJobSystem *jobs)
+{
+	const float *prevX = pool.Column(PARTICLE_PREV_X);
+	const float *prevY = pool.Column(PARTICLE_PREV_Y);
+	const float *prevZ = pool.Column(PARTICLE_PREV_Z);
+	const float *posX = pool.Column(PARTICLE_POS_X);
+	const float *posY = pool.Column(PARTICLE_POS_Y);
+	const float *posZ = pool.Column(PARTICLE_POS_Z);
+	float rowX = modelView.m[2], rowY = modelView.m[6], rowZ = modelView.m[10], rowW = modelView.m[14];
+	unsigned int *depth = m_puiDepth;
+
+	RunJobs(jobs, count, DEPTH_KEY_GRAIN, [=](int first, int num, int worker) {
+		for (int i = first; i < first + num; i++)
+		{
+			float x = prevX[i] + blend * (posX[i] - prevX[i]);
+			float y = prevY[i] + blend * (posY[i] - prevY[i]);
+			float z = prevZ[i] + blend * (posZ[i] - prevZ[i]);
+
+			depth[i] = FloatKey(rowX * x + rowY * y + rowZ * z + rowW);
+		}
+	});
+}
+
+/*-----------------------------------------------------------------------------------
+Least significant digit first radix sort of count keys and their indices in
+keys[0] and order[0], using keys[1] and order[1] as well.  Each chunk of keys
+is counted and scattered by its own job, and a pass is skipped when every key
+has the same digit.  Returns the buffer the sort finished in.
+-----------------------------------------------------------------------------------*/
+
+int CDepthSort::RadixSort(unsigned int **keys, int **order, int count, CJobSystem *jobs)
+{
+	int numChunks = (count + DEPTH_SORT_CHUNK - 1) / DEPTH_SORT_CHUNK;
+	int *histogram = m_piHistogram;
+	int pass, digit, chunk, total;
+	int src = 0;
+
+	if (count <= 1)
+		return src;
+
+	for (pass = 0; pass < DEPTH_RADIX_PASSES; pass++)
+	{
+		int shift = pass * DEPTH_RADIX_BITS;
+		const unsigned int *srcKeys = keys[src];
+		const int *srcOrder = order[src];
+		unsigned int *dstKeys = keys[src ^ 1];
+		int *dstOrder = order[src ^ 1];
+
+		RunJobs(jobs, numChunks, 1, [=](int first, int num, int worker) {
+			for (int c = first; c < first + num; c++)
+			{
+				int *counts = histogram + c * DEPTH_RADIX_BUCKETS;
+				int last = MIN((c + 1) * DEPTH_SORT_CHUNK, count);
+
+				memset(counts, 0, sizeof(int) * DEPTH_RADIX_BUCKETS);
+				for (int i = c * DEPTH_SORT_CHUNK; i < last; i++)
+					counts[(srcKeys[i] >> shift) & (DEPTH_RADIX_BUCKETS - 1)]++;
+			}
+		});
+
+		// Nothing would move
+		digit = int((srcKeys[0] >> shift) & (DEPTH_RADIX_BUCKETS - 1));
+		for (chunk = 0, total = 0; chunk < numChunks; chunk++)
+			total += histogram[chunk * DEPTH_RADIX_BUCKETS + digit];
+		if (total == count)
+			continue;
+
+		// First slot of each digit in each chunk
+		for (digit = 0, total = 0; digit < DEPTH_RADIX_BUCKETS; digit++)
+		{
+			for (chunk = 0; chunk < numChunks; chunk++)
+			{
+				int *counter = histogram + chunk * DEPTH_RADIX_BUCKETS + digit;
+				int n = *counter;
+				*counter = total;
+				total += n;
+			}
+		}
+
+		RunJobs(jobs, numChunks, 1, [=](int first, int num, int worker) {
+			for (int c = first; c < first + num; c++)
+			{
+				int *offset = histogram + c * DEPTH_RADIX_BUCKETS;
+				int last = MIN((c + 1) * DEPTH_SORT_CHUNK, count);
+
+				for (int i = c * DEPTH_SORT_CHUNK; i < last; i++)
+				{
+					int slot = offset[(srcKeys[i] >> shift) & (DEPTH_RADIX_BUCKETS - 1)]++;
+					dstKeys[slot] = srcKeys[i];
+					dstOrder[slot] = srcOrder[i];
+				}
+			}
+		});
+
+		src ^= 1;
+	}
+
+	return src;
+}
+
+/*-----------------------------------------------------------------------------------
+Sort every particle from scratch
+-----------------------------------------------------------------------------------*/
+
+void CDepthSort::FullSort(int count, CJobSystem *jobs)
+{
+	const unsigned int *depth = m_puiDepth;
+	unsigned int *keys = m_puiKeys[0];
+	int *order = m_piOrder[0];
+
+	RunJobs(jobs, count, DEPTH_KEY_GRAIN, [=](int first, int num, int worker) {
+		for (int i = first; i < first + num; i++)
+		{
+			keys[i] = depth[i];
+			order[i] = i;
+		}
+	});
+
+	m_iCurrent = RadixSort(m_puiKeys, m_piOrder, count, jobs);
+	m_iNumOutliers = count;
+}
+
+/*-----------------------------------------------------------------------------------
+Bring the last order up to date.  It is walked front to back and each particle
+is moved back into place among the ones already kept, but no further than
+DEPTH_REFINE_WINDOW.  A particle which belongs further back, or whose key is
+above the one DEPTH_REFINE_WINDOW ahead of it in the last order so it belongs
+further forward, is put aside as an outlier along with the particles spawned
+since.  The outliers are radix sorted and merged with the kept particles.
+
+Particles which die are replaced by the last live one, so a slot can hold a
+different particle from the last frame.  Those mostly turn up as outliers.
+Gives up, leaving the last order as it was, once more than one particle in
+DEPTH_MAX_OUTLIERS of those walked so far is an outlier or the particles have
+been moved more than DEPTH_MAX_MOVES places each on average.
+-----------------------------------------------------------------------------------*/
+
+bool CDepthSort::Refine(int count, CJobSystem *jobs)
+{
+	const unsigned int *depth = m_puiDepth;
+	const int *last = m_piOrder[m_iCurrent];
+	unsigned int *lastKeys = m_puiKeys[m_iCurrent];
+	unsigned int *keys = m_puiKeys[m_iCurrent ^ 1];
+	int *kept = m_piOrder[m_iCurrent ^ 1];
+	unsigned int *outlierKeys = m_puiOutlierKeys[0];
+	int *outliers = m_piOutliers[0];
+	int *order = m_piOrder[m_iCurrent];
+	int numKept = 0, numOutliers = 0, numMoves = 0, gathered = 0;
+	int i, j, k, src;
+
+	for (k = 0; k < m_iCount; k++)
+	{
+		int p = last[k];
+		int ahead = k + DEPTH_REFINE_WINDOW;
+		int lowest = MAX(0, numKept - DEPTH_REFINE_WINDOW);
+		unsigned int key;
+
+		// Gather the keys in the last order a chunk at a time so the
+		// walk reads them in turn, and stops short when it gives up
+		if (ahead >= gathered && gathered < m_iCount)
+		{
+			int from = gathered;
+
+			gathered = MIN(gathered + DEPTH_SORT_CHUNK, m_iCount);
+			RunJobs(jobs, gathered - from, DEPTH_KEY_GRAIN, [=](int first, int num, int worker) {
+				for (int g = from + first; g < from + first + num; g++)
+					lastKeys[g] = (last[g] < count) ? depth[last[g]] : 0;
+			});
+		}
+
+		// Died off the end of the live range
+		if (p >= count)
+			continue;
+
+		key = lastKeys[k];
+
+		if ((lowest > 0 && keys[lowest - 1] > key) ||
+			(ahead < m_iCount && last[ahead] < count && key > lastKeys[ahead]))
+		{
+			if (numOutliers * DEPTH_MAX_OUTLIERS > k + DEPTH_REFINE_SLACK)
+				return false;
+
+			outlierKeys[numOutliers] = key;
+			outliers[numOutliers++] = p;
+			continue;
+		}
+
+		for (j = numKept; j > lowest && keys[j - 1] > key; j--)
+		{
+			keys[j] = keys[j - 1];
+			kept[j] = kept[j - 1];
+		}
+		numMoves += numKept - j;
+		if (numMoves > DEPTH_MAX_MOVES * (k + DEPTH_REFINE_SLACK))
+			return false;
+
+		keys[j] = key;
+		kept[j] = p;
+		numKept++;
+	}
+
+	// Spawned since the last sort
+	for (i = m_iCount; i < count; i++)
+	{
+		if (numOutliers * DEPTH_MAX_OUTLIERS > count + DEPTH_REFINE_SLACK)
+			return false;
+
+		outlierKeys[numOutliers] = depth[i];
+		outliers[numOutliers++] = i;
+	}
+
+	src = RadixSort(m_puiOutlierKeys, m_piOutliers, numOutliers, jobs);
+	outlierKeys = m_puiOutlierKeys[src];
+	outliers = m_piOutliers[src];
+
+	// Merge into the buffer the last order was in, kept particles
+	// first when the keys are equal
+	for (i = 0, j = 0, k = 0; i < numKept && j < numOutliers; k++)
+		order[k] = (outlierKeys[j] < keys[i]) ? outliers[j++] : kept[i++];
+	while (i < numKept)
+		order[k++] = kept[i++];
+	while (j < numOutliers)
+		order[k++] = outliers[j++];
+
+	m_iNumOutliers = numOutliers;
+
+	return true;
+}
+
+/*-----------------------------------------------------------------------------------
+Order the particles from back to front
+-----------------------------------------------------------------------------------*/
+
+const int *CDepthSort::Sort(const CParticlePool& pool, int count, const TMatrix& modelView, float blend,
+	CJobSystem *jobs)
+{
+	PROFILE_ZONE("sort");
+
+	if (count <= 0)
+	{
+		m_iCount = 0;
+		return m_piOrder[m_iCurrent];
+	}
+
+	Grow(count);
+	Keys(pool, count, modelView, blend, jobs);
+
+	m_bRefined = m_bCoherent && m_bValid && Refine(count, jobs);
+	if (!m_bRefined)
+		FullSort(count, jobs);
+
+	m_iCount = count;
+	m_bValid = true;
+
+	return m_piOrder[m_iCurrent];
+}
@@ -0,0 +1,115 @@
+/*-----------------------------------------------------------------------------------
+File:			depthSort.h
+Author:			Steve Costa
+Description:	Orders the particles back to front along the view direction so
+alpha blended sprites can be drawn without a depth buffer.  The
+view space depth of each particle is worked out from the
+modelview matrix and made into an unsigned key which sorts the
+same way as the float.
+
+A full sort is a parallel radix sort of the keys.  From one frame
+to the next the camera and the particles barely move, so the last
+order is nearly right and is refined instead: it is walked with
+an insertion sort which may only move a particle a short way, the
+particles which would have to move further, mostly ones which have
+just been spawned or moved into a dead particle's slot, are sorted
+on their own and merged back in.  When too many have to move, or
+move far, the refine gives up early and the full sort runs, so it
+is never much slower than sorting from scratch.
+-----------------------------------------------------------------------------------*/
+
+#ifndef DEPTH_SORT_H_
+#define DEPTH_SORT_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "simUtil.h"						// Common Macros
+#include "matrix.h"
+using namespace matrix;
+#include "particlePool.h"					// Particle attribute columns
+#include "jobSystem.h"						// Worker threads
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define DEPTH_SORT_CHUNK		16384			// Keys per radix sort job
+#define DEPTH_RADIX_BITS		11
+#define DEPTH_RADIX_BUCKETS		(1 << DEPTH_RADIX_BITS)
+#define DEPTH_RADIX_PASSES		3				// Enough passes for 32 bit keys
+#define DEPTH_KEY_GRAIN			4096			// Particles per depth key job
+#define DEPTH_REFINE_WINDOW		32				// Furthest the refine moves a particle back
+#define DEPTH_MAX_OUTLIERS		8				// Refine gives up past 1 / this of the particles
+#define DEPTH_MAX_MOVES			2				// or past this many moves a particle walked
+#define DEPTH_REFINE_SLACK		1024			// Particles walked before either limit bites
+
+/*-----------------------------------------------------------------------------------
+Depth sort class definition
+-----------------------------------------------------------------------------------*/
+
+class CDepthSort
+{
+	// Attributes
+private:
+
+	bool			m_bCoherent;			// Refine the last order when it can
+	bool			m_bValid;				// The last order can be refined
+	bool			m_bRefined;				// The last sort was a refine
+
+	int				m_iCount;				// Particles in the last order
+	int				m_iCapacity;
+	int				m_iMaxOutliers;
+	int				m_iNumOutliers;			// Moved by the last refine
+
+	unsigned int	*m_puiDepth;			// Key of each particle in pool order
+	unsigned int	*m_puiKeys[2];			// Sort buffers
+	int				*m_piOrder[2];
+	int				m_iCurrent;				// Buffer holding the last order
+	unsigned int	*m_puiOutlierKeys[2];
+	int				*m_piOutliers[2];
+	int				*m_piHistogram;			// Digit counts of each sort chunk
+
+	// Methods
+private:
+
+	void Grow(int count);
+	void Keys(const CParticlePool& pool, int count, const TMatrix& modelView, float blend,
+		CJobSystem *jobs);
+	int RadixSort(unsigned int **keys, int **order, int count, CJobSystem *jobs);
+	void FullSort(int count, CJobSystem *jobs);
+	bool Refine(int count, CJobSystem *jobs);
+
+public:
+
+	CDepthSort();
+	~CDepthSort();
+
+	void Shutdown();
+
+	// Refine the last order rather than sort from scratch when the
+	// particles are nearly in order, on by default
+	void SetCoherent(bool coherent) { m_bCoherent = coherent; }
+	bool GetCoherent() const { return m_bCoherent; }
+
+	// The next sort starts from scratch
+	void Invalidate() { m_bValid = false; }
+
+	//-----------------------------------------------------------
+	// Order the first count particles of a pool from furthest to
+	// nearest the viewer, as seen through modelView, an OpenGL
+	// modelview matrix.  Positions are blended between the last
+	// two simulation steps as the sprites are.  Returns count
+	// pool indices.  jobs may be NULL.
+	//-----------------------------------------------------------
+	const int *Sort(const CParticlePool& pool, int count, const TMatrix& modelView, float blend,
+		CJobSystem *jobs);
+
+	const int *GetOrder() const { return m_piOrder[m_iCurrent]; }
+	int GetCount() const { return m_iCount; }
+	bool GetRefined() const { return m_bRefined; }
+	int GetNumOutliers() const { return m_iNumOutliers; }
+};
+
+#endif
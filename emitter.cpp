@@ -0,0 +1,268 @@
+/*-----------------------------------------------------------------------------------
+File:			emitter.cpp
+Author:			Steve Costa
+Description:	Spawn scheduling and spawn shapes of an emitter.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <float.h>
+
+#include "emitter.h"						// Class header file
+
+/*-----------------------------------------------------------------------------------
+Initialize colours
+-----------------------------------------------------------------------------------*/
+
+const float CEmitter::s_fFountainColors[NUM_COLORS][3] =
+{
+	{ 1.0f, 0.5f, 0.5f }, { 1.0f, 0.75f, 0.5f }, { 1.0f, 1.0f, 0.5f }, { 0.75f, 1.0f, 0.5f },
+	{ 0.5f, 1.0f, 0.5f }, { 0.5f, 1.0f, 0.75f }, { 0.5f, 1.0f, 1.0f }, { 0.5f, 0.75f, 1.0f },
+	{ 0.5f, 0.5f, 1.0f }, { 0.75f, 0.5f, 1.0f }, { 1.0f, 0.5f, 1.0f }, { 1.0f, 0.5f, 0.75f }
+};
+
+/*-----------------------------------------------------------------------------------
+Set any initial values for class state variables.
+-----------------------------------------------------------------------------------*/
+
+CEmitter::CEmitter()
+{
+	m_bEnabled = true;
+	m_iLive = 0;
+	m_uiSerial = 0;
+	Reset();
+}
+
+/*-----------------------------------------------------------------------------------
+Replace the description, the schedule starts again
+-----------------------------------------------------------------------------------*/
+
+void CEmitter::SetDesc(const TEmitterDesc& desc)
+{
+	m_desc = desc;
+	Reset();
+}
+
+void CEmitter::Reset()
+{
+	m_fRateCarry = 0.0f;
+	m_fTime = 0.0f;
+	m_fNextBurst = 0.0f;
+	m_iBursts = 0;
+}
+
+/*-----------------------------------------------------------------------------------
+Work out how many particles to spawn over the next dt seconds.  The rate
+carries the fraction of a particle over to the next step so low rates still
+spawn, and bursts fire on their interval until burstCycles have gone off.
+Never more than room or than the budget has left.
+-----------------------------------------------------------------------------------*/
+
+int CEmitter::Schedule(float dt, int room)
+{
+	int count = 0;
+
+	if (!m_bEnabled)
+		return 0;
+
+	if (m_desc.mode == EMITTER_MODE_SUSTAIN)
+		count = room;
+	else
+	{
+		m_fRateCarry += m_desc.rate * dt;
+		count = int(m_fRateCarry);
+		m_fRateCarry -= float(count);
+
+		while (m_desc.burstCount > 0 && m_fNextBurst <= m_fTime &&
+			(m_desc.burstCycles <= 0 || m_iBursts < m_desc.burstCycles))
+		{
+			count += m_desc.burstCount;
+			m_iBursts++;
+
+			// Without an interval there is only the one burst
+			if (m_desc.burstInterval <= 0.0f)
+			{
+				m_fNextBurst = FLT_MAX;
+				break;
+			}
+			m_fNextBurst += m_desc.burstInterval;
+		}
+	}
+
+	m_fTime += dt;
+
+	if (m_desc.budget > 0)
+		count = MIN(count, m_desc.budget - m_iLive);
+
+	return MAX(0, MIN(count, room));
+}
+
+/*-----------------------------------------------------------------------------------
+Fill in a batch of new particles.  Every attribute is made from its own
+stream of random words (see ESpawnWord), so the shape and distributions are
+applied one attribute at a time across the whole batch rather than one
+particle at a time.
+-----------------------------------------------------------------------------------*/
+
+void CEmitter::SpawnBatch(CParticlePool& pool, int first, int count, unsigned int id, float dt,
+	TRandU32 random[EMITTER_RANDOM_WORDS][SPAWN_BATCH]) const
+{
+	float dirX[SPAWN_BATCH], dirY[SPAWN_BATCH], dirZ[SPAWN_BATCH];
+	const float (*palette)[3] = m_desc.palette ? m_desc.palette : s_fFountainColors;
+	int numColors = m_desc.palette ? m_desc.numColors : NUM_COLORS;
+	int i;
+
+	float *prevX = pool.Column(PARTICLE_PREV_X) + first;
+	float *prevY = pool.Column(PARTICLE_PREV_Y) + first;
+	float *prevZ = pool.Column(PARTICLE_PREV_Z) + first;
+	float *velX = pool.Column(PARTICLE_VEL_X) + first;
+	float *velY = pool.Column(PARTICLE_VEL_Y) + first;
+	float *velZ = pool.Column(PARTICLE_VEL_Z) + first;
+	float *accelX = pool.Column(PARTICLE_ACCEL_X) + first;
+	float *accelY = pool.Column(PARTICLE_ACCEL_Y) + first;
+	float *accelZ = pool.Column(PARTICLE_ACCEL_Z) + first;
+	float *colR = pool.Column(PARTICLE_COL_R) + first;
+	float *colG = pool.Column(PARTICLE_COL_G) + first;
+	float *colB = pool.Column(PARTICLE_COL_B) + first;
+	float *life = pool.Column(PARTICLE_LIFE) + first;
+	float *fadeRate = pool.Column(PARTICLE_FADE_RATE) + first;
+	unsigned int *emitter = pool.UIntColumn(PARTICLE_EMITTER) + first;
+	unsigned int *sprite = pool.UIntColumn(PARTICLE_SPRITE) + first;
+
+	assert(count <= SPAWN_BATCH);
+
+	// Position and direction in the local space of the shape, the
+	// position straight into the previous position columns
+	switch (m_desc.shape)
+	{
+	case EMITTER_SHAPE_SPHERE:
+		for (i = 0; i < count; i++)
+		{
+			// Uniform direction, radius by the cube root so the
+			// volume is filled evenly
+			float z = 1.0f - 2.0f * RandomToFloat(random[SPAWN_WORD_SHAPE_0][i]);
+			float r = sqrtf(MAX(0.0f, 1.0f - z * z));
+			float phi = PI2 * RandomToFloat(random[SPAWN_WORD_SHAPE_1][i]);
+			float radius = m_desc.size.x * cbrtf(RandomToFloat(random[SPAWN_WORD_SHAPE_2][i]));
+
+			dirX[i] = r * cosf(phi);	dirY[i] = r * sinf(phi);	dirZ[i] = z;
+			prevX[i] = dirX[i] * radius;
+			prevY[i] = dirY[i] * radius;
+			prevZ[i] = dirZ[i] * radius;
+		}
+		break;
+
+	case EMITTER_SHAPE_CONE:
+	{
+		float cosAngle = cosf(m_desc.coneAngle);
+
+		for (i = 0; i < count; i++)
+		{
+			// Start on the base disk, leave with the cosine of the
+			// angle from the axis uniform so the cap is even
+			float radius = m_desc.size.x * sqrtf(RandomToFloat(random[SPAWN_WORD_SHAPE_0][i]));
+			float phi = PI2 * RandomToFloat(random[SPAWN_WORD_SHAPE_1][i]);
+			float c = 1.0f - (1.0f - cosAngle) * RandomToFloat(random[SPAWN_WORD_SHAPE_2][i]);
+			float s = sqrtf(MAX(0.0f, 1.0f - c * c));
+
+			prevX[i] = radius * cosf(phi);	prevY[i] = 0.0f;	prevZ[i] = radius * sinf(phi);
+			dirX[i] = s * cosf(phi);		dirY[i] = c;		dirZ[i] = s * sinf(phi);
+		}
+		break;
+	}
+
+	case EMITTER_SHAPE_BOX:
+		for (i = 0; i < count; i++)
+		{
+			prevX[i] = m_desc.size.x * (2.0f * RandomToFloat(random[SPAWN_WORD_SHAPE_0][i]) - 1.0f);
+			prevY[i] = m_desc.size.y * (2.0f * RandomToFloat(random[SPAWN_WORD_SHAPE_1][i]) - 1.0f);
+			prevZ[i] = m_desc.size.z * (2.0f * RandomToFloat(random[SPAWN_WORD_SHAPE_2][i]) - 1.0f);
+			dirX[i] = 0.0f;	dirY[i] = 1.0f;	dirZ[i] = 0.0f;
+		}
+		break;
+
+	case EMITTER_SHAPE_DISK:
+		for (i = 0; i < count; i++)
+		{
+			float radius = m_desc.size.x * sqrtf(RandomToFloat(random[SPAWN_WORD_SHAPE_0][i]));
+			float phi = PI2 * RandomToFloat(random[SPAWN_WORD_SHAPE_1][i]);
+
+			prevX[i] = radius * cosf(phi);	prevY[i] = 0.0f;	prevZ[i] = radius * sinf(phi);
+			dirX[i] = 0.0f;	dirY[i] = 1.0f;	dirZ[i] = 0.0f;
+		}
+		break;
+
+	default:
+		for (i = 0; i < count; i++)
+		{
+			prevX[i] = 0.0f;	prevY[i] = 0.0f;	prevZ[i] = 0.0f;
+			dirX[i] = 0.0f;	dirY[i] = 1.0f;	dirZ[i] = 0.0f;
+		}
+		break;
+	}
+
+	// Local velocity is the direction times the speed plus the jitter
+	for (i = 0; i < count; i++)
+	{
+		float speed = m_desc.speed.Sample(random[SPAWN_WORD_SPEED][i]);
+
+		dirX[i] = dirX[i] * speed + m_desc.jitterMin.x + (m_desc.jitterMax.x - m_desc.jitterMin.x) * RandomToFloat(random[SPAWN_WORD_JITTER_X][i]);
+		dirY[i] = dirY[i] * speed + m_desc.jitterMin.y + (m_desc.jitterMax.y - m_desc.jitterMin.y) * RandomToFloat(random[SPAWN_WORD_JITTER_Y][i]);
+		dirZ[i] = dirZ[i] * speed + m_desc.jitterMin.z + (m_desc.jitterMax.z - m_desc.jitterMin.z) * RandomToFloat(random[SPAWN_WORD_JITTER_Z][i]);
+	}
+
+	// Into world space, row vectors as in matrix.h.  The position
+	// stays in the previous position columns, the step which follows
+	// moves it on.
+	TransformPoints(m_desc.transform, prevX, prevY, prevZ, prevX, prevY, prevZ, count);
+	TransformVectors(m_desc.transform, dirX, dirY, dirZ, velX, velY, velZ, count);
+	for (i = 0; i < count; i++)
+	{
+		accelX[i] = 0.0f;
+		accelY[i] = 0.0f;
+		accelZ[i] = 0.0f;
+	}
+
+	// Life is set to 1 so that it can be used as the alpha value for the
+	// colour, the update takes fadeRate off it every step
+	for (i = 0; i < count; i++)
+	{
+		TRandU32 colour = RandomToRange(random[SPAWN_WORD_COLOUR][i], TRandU32(numColors));
+
+		life[i] = 1.0f;
+		fadeRate[i] = m_desc.fade.Sample(random[SPAWN_WORD_FADE][i]) * dt;
+
+		colR[i] = palette[colour][0];
+		colG[i] = palette[colour][1];
+		colB[i] = palette[colour][2];
+
+		emitter[i] = id;
+		sprite[i] = m_desc.sprite;
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+The original fountain.  It gave every new particle an integer velocity of
+(1 + {-2.5 .. 1.5}, 1 + {0 .. 14}, {-2.5 .. 1.5}) and took off one of 100
+steps of 0.001 between 0.003 and 0.102 of its life every 50 Hz step.  The
+continuous ranges below have the same means and spreads.
+-----------------------------------------------------------------------------------*/
+
+TEmitterDesc CEmitter::Fountain(int budget)
+{
+	TEmitterDesc desc;
+
+	desc.shape = EMITTER_SHAPE_POINT;
+	desc.mode = EMITTER_MODE_SUSTAIN;
+	desc.budget = budget;
+	desc.speed = TEmitterRange(0.0f, 0.0f);
+	desc.jitterMin = TVector(-2.0f, 0.5f, -3.0f);
+	desc.jitterMax = TVector(3.0f, 15.5f, 2.0f);
+	desc.fade = TEmitterRange(0.15f, 5.15f);
+	desc.palette = s_fFountainColors;
+	desc.numColors = NUM_COLORS;
+
+	return desc;
+}
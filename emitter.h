@@ -0,0 +1,212 @@
+/*-----------------------------------------------------------------------------------
+File:			emitter.h
+Author:			Steve Costa
+Description:	Emitters decide where, when and how particles are born.  Each
+one has its own transform, spawn shape, spawn schedule and
+velocity, lifetime and colour distributions, and a budget of
+live particles it may hold in the shared pool.  The particle
+system asks every emitter how many particles it wants each step
+and then has it fill in its new particles as one batch.
+-----------------------------------------------------------------------------------*/
+
+#ifndef EMITTER_H_
+#define EMITTER_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "simUtil.h"						// Common Macros
+#include "vector.h"
+using namespace vec;
+#include "matrix.h"
+using namespace matrix;
+#include "random.h"							// Random number generators
+#include "particlePool.h"					// Particle attribute columns
+#include "affectors.h"						// Per emitter accelerations
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define NUM_COLORS				12				// Colours in the fountain palette
+#define SPAWN_BATCH				256				// New particles per random fill
+#define EMITTER_RANDOM_BLOCKS	3				// Philox blocks of 4 words per particle
+#define EMITTER_RANDOM_WORDS	(EMITTER_RANDOM_BLOCKS * 4)
+
+/*-----------------------------------------------------------------------------------
+Spawn shapes, all of them emit along the local y-axis
+-----------------------------------------------------------------------------------*/
+
+enum EEmitterShape
+{
+	EMITTER_SHAPE_POINT,		// At the origin
+	EMITTER_SHAPE_SPHERE,		// Inside a sphere of radius size.x, moving outwards
+	EMITTER_SHAPE_CONE,			// On a disk of radius size.x, within coneAngle of the y-axis
+	EMITTER_SHAPE_BOX,			// Inside a box with half extents size
+	EMITTER_SHAPE_DISK			// On a disk of radius size.x in the xz plane
+};
+
+/*-----------------------------------------------------------------------------------
+When an emitter spawns
+-----------------------------------------------------------------------------------*/
+
+enum EEmitterMode
+{
+	EMITTER_MODE_RATE,			// rate particles a second plus any bursts
+	EMITTER_MODE_SUSTAIN		// Replace every particle that dies, keeps the budget full
+};
+
+/*-----------------------------------------------------------------------------------
+How the particles of an emitter move once they are born
+-----------------------------------------------------------------------------------*/
+
+enum EParticleBehaviour
+{
+	PARTICLE_BEHAVIOUR_BALLISTIC,	// Gravity and their own velocity only
+	PARTICLE_BEHAVIOUR_FLUID,		// Part of the SPH fluid of the particle system, see sphFluid.h
+	PARTICLE_BEHAVIOUR_NBODY		// Pulled by the other n-body particles, see barnesHut.h
+};
+
+/*-----------------------------------------------------------------------------------
+Which random word each attribute of a new particle is made from
+-----------------------------------------------------------------------------------*/
+
+enum ESpawnWord
+{
+	SPAWN_WORD_SHAPE_0, SPAWN_WORD_SHAPE_1, SPAWN_WORD_SHAPE_2,
+	SPAWN_WORD_SPEED,
+	SPAWN_WORD_JITTER_X, SPAWN_WORD_JITTER_Y, SPAWN_WORD_JITTER_Z,
+	SPAWN_WORD_FADE,
+	SPAWN_WORD_COLOUR
+};
+
+/*-----------------------------------------------------------------------------------
+Uniform distribution between two values
+-----------------------------------------------------------------------------------*/
+
+struct TEmitterRange
+{
+	float	min, max;
+
+	TEmitterRange() : min(0.0f), max(0.0f) { }
+	TEmitterRange(float lo, float hi) : min(lo), max(hi) { }
+
+	float Sample(TRandU32 random) const {
+		return min + (max - min) * RandomToFloat(random);
+	}
+};
+
+/*-----------------------------------------------------------------------------------
+Everything that describes an emitter
+-----------------------------------------------------------------------------------*/
+
+struct TEmitterDesc
+{
+	TMatrix			transform;				// Local to world, the shape is placed by it
+	int				shape;					// EEmitterShape
+	TVector			size;					// Radius in x, or box half extents
+	float			coneAngle;				// Radians from the y-axis for cones
+
+	int				mode;					// EEmitterMode
+	float			rate;					// Particles a second
+	int				burstCount;				// Particles in each burst, 0 for none
+	float			burstInterval;			// Seconds between bursts, 0 for just one
+	int				burstCycles;			// Number of bursts, 0 for no limit
+	int				budget;					// Most live particles, 0 for the whole pool
+
+	TEmitterRange	speed;					// Along the shape direction
+	TVector			jitterMin, jitterMax;	// Random velocity added in local space
+	TEmitterRange	fade;					// Life lost a second, lives 1 / fade seconds
+
+	const float		(*palette)[3];			// Colours picked from at random
+	int				numColors;
+
+	int				behaviour;				// EParticleBehaviour
+	const CAffectorKernel *affectors;		// Not owned, NULL for none
+	float			turbulence;				// Scale of the shared turbulence field, 0 for none
+	unsigned int	sprite;					// Index in the sprite atlas
+
+	TEmitterDesc() {
+		transform.LoadIdentity();
+		shape = EMITTER_SHAPE_POINT;
+		size = TVector(1.0f, 1.0f, 1.0f);
+		coneAngle = 0.5f;
+		mode = EMITTER_MODE_RATE;
+		rate = 0.0f;
+		burstCount = 0;
+		burstInterval = 0.0f;
+		burstCycles = 0;
+		budget = 0;
+		speed = TEmitterRange(1.0f, 1.0f);
+		jitterMin = TVector(0.0f, 0.0f, 0.0f);
+		jitterMax = TVector(0.0f, 0.0f, 0.0f);
+		fade = TEmitterRange(1.0f, 1.0f);
+		palette = NULL;
+		numColors = 0;
+		behaviour = PARTICLE_BEHAVIOUR_BALLISTIC;
+		affectors = NULL;
+		turbulence = 0.0f;
+		sprite = 0;
+	}
+};
+
+/*-----------------------------------------------------------------------------------
+Emitter class definition
+-----------------------------------------------------------------------------------*/
+
+class CEmitter
+{
+	// Attributes
+private:
+
+	TEmitterDesc	m_desc;
+	bool			m_bEnabled;
+	int				m_iLive;					// Particles of ours in the pool
+	float			m_fRateCarry;				// Fraction of a particle owed by the rate
+	float			m_fTime;					// Seconds since the emitter started
+	float			m_fNextBurst;
+	int				m_iBursts;					// Bursts fired so far
+	TRandU64		m_uiSerial;					// Particles spawned so far
+
+	static const float s_fFountainColors[NUM_COLORS][3];
+
+	// Methods
+public:
+
+	CEmitter();
+
+	void SetDesc(const TEmitterDesc& desc);
+	const TEmitterDesc& GetDesc() const { return m_desc; }
+
+	// Move the emitter, affects particles spawned from now on
+	void SetTransform(const TMatrix& transform) { m_desc.transform = transform; }
+
+	void SetEnabled(bool enabled) { m_bEnabled = enabled; }
+	bool IsEnabled() const { return m_bEnabled; }
+
+	int GetLiveCount() const { return m_iLive; }
+	TRandU64 GetSerial() const { return m_uiSerial; }
+
+	// Start the schedule again, live particles are left alone
+	void Reset();
+
+	// Number of particles wanted this step, at most room
+	int Schedule(float dt, int room);
+
+	// Book keeping once the pool has handed out slots and when
+	// particles die
+	void Spawned(int count) { m_iLive += count; m_uiSerial += TRandU64(count); }
+	void Died(int count) { m_iLive -= count; }
+
+	// Fill in new particles [first, first + count) of the pool from
+	// EMITTER_RANDOM_WORDS streams of random words, one per particle
+	void SpawnBatch(CParticlePool& pool, int first, int count, unsigned int id, float dt,
+		TRandU32 random[EMITTER_RANDOM_WORDS][SPAWN_BATCH]) const;
+
+	// The original effect: a fountain from the origin which keeps
+	// budget particles alive
+	static TEmitterDesc Fountain(int budget);
+};
+
+#endif
@@ -0,0 +1,207 @@
+/*-----------------------------------------------------------------------------------
+File:			frameCapture.cpp
+Author:			Steve Costa
+Description:	Asynchronous readback of the frames drawn to the window.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <string.h>
+#include "frameCapture.h"					// Class header file
+
+/*-----------------------------------------------------------------------------------
+Set any initial values for class state variables.
+-----------------------------------------------------------------------------------*/
+
+CFrameCapture::CFrameCapture()
+{
+	int i;
+
+	m_iMode = CAPTURE_MODE_DIRECT;
+	m_iNext = 0;
+	m_iOldest = 0;
+	m_iNumPending = 0;
+	m_iSkipped = 0;
+
+	for (i = 0; i < FRAME_CAPTURE_BUFFERS; i++)
+	{
+		m_uiBuffers[i] = 0;
+		m_fences[i] = NULL;
+		m_bPending[i] = false;
+	}
+}
+
+CFrameCapture::~CFrameCapture()
+{
+	Stop();
+}
+
+/*-----------------------------------------------------------------------------------
+Choose a readback mode, create the buffers and start the writer
+-----------------------------------------------------------------------------------*/
+
+int CFrameCapture::Start(const char *path, int format, int width, int height, int maxMode)
+{
+	int caps = glext::GetCaps();
+	int i;
+
+	Stop();
+
+	if ((caps & GLEXT_BUFFER_OBJECTS) && (caps & GLEXT_SYNC) && maxMode >= CAPTURE_MODE_FENCED)
+		m_iMode = CAPTURE_MODE_FENCED;
+	else if ((caps & GLEXT_BUFFER_OBJECTS) && maxMode >= CAPTURE_MODE_DELAYED)
+		m_iMode = CAPTURE_MODE_DELAYED;
+	else
+		m_iMode = CAPTURE_MODE_DIRECT;
+
+	if (m_writer.Open(path, format, width, height) != RETURN_SUCCESS)
+		return RETURN_FAILURE;
+
+	m_iNext = 0;
+	m_iOldest = 0;
+	m_iNumPending = 0;
+	m_iSkipped = 0;
+
+	if (m_iMode != CAPTURE_MODE_DIRECT)
+	{
+		glext::GenBuffers(FRAME_CAPTURE_BUFFERS, m_uiBuffers);
+		for (i = 0; i < FRAME_CAPTURE_BUFFERS; i++)
+		{
+			glext::BindBuffer(GL_PIXEL_PACK_BUFFER, m_uiBuffers[i]);
+			glext::BufferData(GL_PIXEL_PACK_BUFFER, 4 * width * height, NULL, GL_STREAM_READ);
+		}
+		glext::BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Wait for the readbacks in flight, hand them to the writer and let it finish
+-----------------------------------------------------------------------------------*/
+
+void CFrameCapture::Stop()
+{
+	int i;
+
+	while (m_iNumPending)
+	{
+		if (m_fences[m_iOldest])
+			glext::ClientWaitSync(m_fences[m_iOldest], GL_SYNC_FLUSH_COMMANDS_BIT, ~(GLuint64)0);
+		Collect(m_iOldest);
+	}
+
+	if (m_uiBuffers[0])
+	{
+		glext::DeleteBuffers(FRAME_CAPTURE_BUFFERS, m_uiBuffers);
+		for (i = 0; i < FRAME_CAPTURE_BUFFERS; i++)
+			m_uiBuffers[i] = 0;
+	}
+
+	m_writer.Close();
+}
+
+/*-----------------------------------------------------------------------------------
+Has the driver finished filling a buffer
+-----------------------------------------------------------------------------------*/
+
+bool CFrameCapture::Ready(int buffer)
+{
+	GLenum result;
+
+	if (m_iMode == CAPTURE_MODE_DELAYED)
+	{
+		// No fences, take it once the ring has come round to it
+		return m_iNumPending >= FRAME_CAPTURE_BUFFERS - 1;
+	}
+
+	result = glext::ClientWaitSync(m_fences[buffer], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+
+	return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED;
+}
+
+/*-----------------------------------------------------------------------------------
+Copy a finished readback into a writer slot.  When the writer has no slot free
+the frame is dropped, the buffer is freed either way.
+-----------------------------------------------------------------------------------*/
+
+void CFrameCapture::Collect(int buffer)
+{
+	const void *mapped;
+	unsigned char *pixels;
+
+	glext::BindBuffer(GL_PIXEL_PACK_BUFFER, m_uiBuffers[buffer]);
+	mapped = glext::MapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+	if (mapped)
+	{
+		if ((pixels = m_writer.Acquire()) != NULL)
+		{
+			memcpy(pixels, mapped, 4 * m_writer.GetWidth() * m_writer.GetHeight());
+			m_writer.Submit(pixels);
+		}
+		glext::UnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	else
+	{
+		m_iSkipped++;
+	}
+	glext::BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	if (m_fences[buffer])
+	{
+		glext::DeleteSync(m_fences[buffer]);
+		m_fences[buffer] = NULL;
+	}
+
+	m_bPending[buffer] = false;
+	m_iNumPending--;
+	m_iOldest = (m_iOldest + 1) % FRAME_CAPTURE_BUFFERS;
+}
+
+/*-----------------------------------------------------------------------------------
+Start reading this frame back, and pass on the frames which have arrived
+-----------------------------------------------------------------------------------*/
+
+void CFrameCapture::Capture()
+{
+	int width = m_writer.GetWidth(), height = m_writer.GetHeight();
+	unsigned char *pixels;
+
+	if (!IsCapturing())
+		return;
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	if (m_iMode == CAPTURE_MODE_DIRECT)
+	{
+		if ((pixels = m_writer.Acquire()) != NULL)
+		{
+			glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+			m_writer.Submit(pixels);
+		}
+		return;
+	}
+
+	while (m_iNumPending && Ready(m_iOldest))
+		Collect(m_iOldest);
+
+	// The GPU is a whole ring behind, skip the frame rather than wait
+	if (m_bPending[m_iNext])
+	{
+		m_iSkipped++;
+		return;
+	}
+
+	glext::BindBuffer(GL_PIXEL_PACK_BUFFER, m_uiBuffers[m_iNext]);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glext::BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	if (m_iMode == CAPTURE_MODE_FENCED)
+		m_fences[m_iNext] = glext::FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	m_bPending[m_iNext] = true;
+	m_iNumPending++;
+	m_iNext = (m_iNext + 1) % FRAME_CAPTURE_BUFFERS;
+}
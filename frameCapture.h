@@ -0,0 +1,98 @@
+/*-----------------------------------------------------------------------------------
+File:			frameCapture.h
+Author:			Steve Costa
+Description:	Records what is drawn to the window without stalling the frame.
+Each frame is read into the next of a ring of pixel pack buffers,
+which the driver fills in the background, and a fence marks when
+it is done.  A buffer is only mapped once its fence has passed, a
+frame or two later, so the render loop never waits on the copy.
+The pixels are then handed to a CFrameWriter which writes them on
+its own thread.
+
+The best method the context supports is used, as with
+CStreamBuffer:
+
+	fenced		pixel pack buffers polled with fence objects
+	delayed		pixel pack buffers without fences, each mapped once
+				the ring has come round to it
+	direct		no buffer objects, glReadPixels straight into the
+				writer's slot, which waits for the frame to finish
+				but still leaves the writing to the thread
+-----------------------------------------------------------------------------------*/
+
+#ifndef FRAME_CAPTURE_H_
+#define FRAME_CAPTURE_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "glExtensions.h"					// Buffer object entry points
+#include "frameWriter.h"					// Background frame writing
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define FRAME_CAPTURE_BUFFERS	3				// Readbacks in flight
+
+enum ECaptureMode
+{
+	CAPTURE_MODE_DIRECT,
+	CAPTURE_MODE_DELAYED,
+	CAPTURE_MODE_FENCED
+};
+
+/*-----------------------------------------------------------------------------------
+Frame capture class definition
+-----------------------------------------------------------------------------------*/
+
+class CFrameCapture
+{
+	// Attributes
+private:
+
+	int				m_iMode;								// One of ECaptureMode
+	CFrameWriter	m_writer;
+	GLuint			m_uiBuffers[FRAME_CAPTURE_BUFFERS];		// Pixel pack buffers
+	GLsync			m_fences[FRAME_CAPTURE_BUFFERS];		// Set when a readback is done
+	bool			m_bPending[FRAME_CAPTURE_BUFFERS];		// Holding a frame not yet collected
+	int				m_iNext;								// Buffer the next frame goes to
+	int				m_iOldest;								// Pending frame read longest ago
+	int				m_iNumPending;
+	int				m_iSkipped;								// Frames with no free buffer
+
+	// Methods
+private:
+
+	bool Ready(int buffer);
+	void Collect(int buffer);
+
+public:
+
+	CFrameCapture();
+	~CFrameCapture();
+
+	//-----------------------------------------------------------
+	// Start capturing width by height frames from the bottom
+	// left of the window, see CFrameWriter::Open for path and
+	// format.  Needs the rendering context to be current.
+	//-----------------------------------------------------------
+	int Start(const char *path, int format, int width, int height, int maxMode = CAPTURE_MODE_FENCED);
+
+	// Collect the frames still being read, and write them out
+	void Stop();
+
+	bool IsCapturing() const { return m_writer.IsOpen(); }
+
+	// Call once a frame has been drawn and before the buffers are
+	// swapped.  Never waits on the disk, and only waits on the GPU
+	// in the direct mode.
+	void Capture();
+
+	int GetMode() const { return m_iMode; }
+	int GetNumWritten() { return m_writer.GetNumWritten(); }
+	int GetNumDropped() { return m_writer.GetNumDropped() + m_iSkipped; }
+};
+
+#endif
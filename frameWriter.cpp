@@ -0,0 +1,287 @@
+/*-----------------------------------------------------------------------------------
+File:			frameWriter.cpp
+Author:			Steve Costa
+Description:	Background writing of captured frames to bitmaps or a raw video
+stream.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#define _CRT_SECURE_NO_WARNINGS				// fopen as it is everywhere else
+
+#include <string.h>
+
+#include "frameWriter.h"					// Class header file
+#include "bitmap.h"							// Bitmap writing
+#include "simUtil.h"						// snprintf on Visual Studio 2013
+
+/*-----------------------------------------------------------------------------------
+Set any initial values for class state variables.
+-----------------------------------------------------------------------------------*/
+
+CFrameWriter::CFrameWriter()
+{
+	int i;
+
+	m_iFormat = FRAME_FORMAT_BMP;
+	m_iWidth = m_iHeight = 0;
+	m_szPath[0] = '\0';
+	m_pStream = NULL;
+	m_pucRow = NULL;
+
+	for (i = 0; i < FRAME_WRITER_SLOTS; i++)
+	{
+		m_pucSlots[i] = NULL;
+		m_iSlotFrame[i] = 0;
+		m_bSlotBusy[i] = false;
+		m_iQueue[i] = 0;
+	}
+	m_iQueueHead = m_iQueueCount = 0;
+
+	m_iNextFrame = 0;
+	m_iWritten = 0;
+	m_iDropped = 0;
+	m_bFailed = false;
+	m_bQuit = false;
+}
+
+CFrameWriter::~CFrameWriter()
+{
+	Close();
+}
+
+/*-----------------------------------------------------------------------------------
+Allocate the slots and start the writing thread
+-----------------------------------------------------------------------------------*/
+
+int CFrameWriter::Open(const char *path, int format, int width, int height)
+{
+	int i;
+
+	Close();
+
+	if (!path || width <= 0 || height <= 0 || strlen(path) >= FRAME_WRITER_PATH)
+		return RETURN_FAILURE;
+
+	if (format == FRAME_FORMAT_RAW && !(m_pStream = fopen(path, "wb")))
+		return RETURN_FAILURE;
+
+	strcpy(m_szPath, path);
+	m_iFormat = format;
+	m_iWidth = width;
+	m_iHeight = height;
+	m_pucRow = new unsigned char[3 * width];
+
+	for (i = 0; i < FRAME_WRITER_SLOTS; i++)
+	{
+		m_pucSlots[i] = new unsigned char[4 * width * height];
+		m_bSlotBusy[i] = false;
+	}
+	m_iQueueHead = m_iQueueCount = 0;
+
+	m_iNextFrame = 0;
+	m_iWritten = 0;
+	m_iDropped = 0;
+	m_bFailed = false;
+	m_bQuit = false;
+
+	m_thread = std::thread(&CFrameWriter::WriterMain, this);
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Let the thread finish the queue, then free everything
+-----------------------------------------------------------------------------------*/
+
+void CFrameWriter::Close()
+{
+	int i;
+
+	if (m_thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_bQuit = true;
+		}
+		m_wake.notify_all();
+		m_thread.join();
+	}
+
+	if (m_pStream)
+	{
+		fclose(m_pStream);
+		m_pStream = NULL;
+	}
+
+	for (i = 0; i < FRAME_WRITER_SLOTS; i++)
+	{
+		delete[] m_pucSlots[i];
+		m_pucSlots[i] = NULL;
+		m_bSlotBusy[i] = false;
+	}
+	delete[] m_pucRow;
+	m_pucRow = NULL;
+
+	m_iQueueHead = m_iQueueCount = 0;
+}
+
+/*-----------------------------------------------------------------------------------
+Hand out a free slot, waiting for the thread to free one if asked to
+-----------------------------------------------------------------------------------*/
+
+unsigned char *CFrameWriter::Acquire(bool wait)
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	int i;
+
+	if (!m_pucRow)
+		return NULL;
+
+	while (!m_bFailed)
+	{
+		for (i = 0; i < FRAME_WRITER_SLOTS; i++)
+		{
+			if (!m_bSlotBusy[i])
+			{
+				m_bSlotBusy[i] = true;
+				return m_pucSlots[i];
+			}
+		}
+
+		if (!wait)
+			break;
+		m_freed.wait(lock);
+	}
+
+	m_iDropped++;
+
+	return NULL;
+}
+
+/*-----------------------------------------------------------------------------------
+Queue a slot from Acquire.  Frames are numbered in the order they are queued.
+-----------------------------------------------------------------------------------*/
+
+void CFrameWriter::Submit(unsigned char *pixels)
+{
+	int i;
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		for (i = 0; i < FRAME_WRITER_SLOTS; i++)
+		{
+			if (m_pucSlots[i] == pixels && m_bSlotBusy[i])
+				break;
+		}
+		if (i == FRAME_WRITER_SLOTS)
+			return;
+
+		m_iSlotFrame[i] = m_iNextFrame++;
+		m_iQueue[(m_iQueueHead + m_iQueueCount) % FRAME_WRITER_SLOTS] = i;
+		m_iQueueCount++;
+	}
+	m_wake.notify_one();
+}
+
+/*-----------------------------------------------------------------------------------
+Counters, read under the lock as the thread updates them
+-----------------------------------------------------------------------------------*/
+
+int CFrameWriter::GetNumWritten()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_iWritten;
+}
+
+int CFrameWriter::GetNumDropped()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_iDropped;
+}
+
+/*-----------------------------------------------------------------------------------
+Write a frame out.  Only the writing thread calls this, and the slot it is
+given stays busy until it returns.
+-----------------------------------------------------------------------------------*/
+
+bool CFrameWriter::WriteFrame(const unsigned char *pixels, int frame)
+{
+	char name[FRAME_WRITER_PATH];
+	int x, y;
+
+	if (m_iFormat == FRAME_FORMAT_BMP)
+	{
+		snprintf(name, sizeof(name), m_szPath, frame);
+		return WriteBMP(name, pixels, m_iWidth, m_iHeight) == RETURN_SUCCESS;
+	}
+
+	// Raw streams go top row first
+	for (y = m_iHeight - 1; y >= 0; y--)
+	{
+		const unsigned char *in = pixels + 4 * y * m_iWidth;
+
+		for (x = 0; x < m_iWidth; x++, in += 4)
+		{
+			m_pucRow[3 * x + 0] = in[0];
+			m_pucRow[3 * x + 1] = in[1];
+			m_pucRow[3 * x + 2] = in[2];
+		}
+
+		if (fwrite(m_pucRow, 1, 3 * m_iWidth, m_pStream) != size_t(3 * m_iWidth))
+			return false;
+	}
+
+	return true;
+}
+
+/*-----------------------------------------------------------------------------------
+Writing thread, takes queued slots oldest first until told to quit with the
+queue empty
+-----------------------------------------------------------------------------------*/
+
+void CFrameWriter::WriterMain()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	for (;;)
+	{
+		int slot;
+		bool written;
+
+		while (!m_iQueueCount && !m_bQuit)
+			m_wake.wait(lock);
+
+		if (!m_iQueueCount)
+			break;
+
+		slot = m_iQueue[m_iQueueHead];
+		m_iQueueHead = (m_iQueueHead + 1) % FRAME_WRITER_SLOTS;
+		m_iQueueCount--;
+
+		// Write without holding the lock so the caller can keep
+		// acquiring the other slots
+		if (!m_bFailed)
+		{
+			int frame = m_iSlotFrame[slot];
+
+			lock.unlock();
+			written = WriteFrame(m_pucSlots[slot], frame);
+			lock.lock();
+
+			if (written)
+				m_iWritten++;
+			else
+				m_bFailed = true;
+		}
+
+		if (m_bFailed)
+			m_iDropped++;
+
+		m_bSlotBusy[slot] = false;
+		m_freed.notify_all();
+	}
+}
@@ -0,0 +1,111 @@
+/*-----------------------------------------------------------------------------------
+File:			frameWriter.h
+Author:			Steve Costa
+Description:	Writes captured frames to disk on a thread of its own, so the
+render loop only ever copies pixels into a free slot and moves on.
+Frames go out as a numbered sequence of bitmaps or appended to one
+raw video stream, 24 bit RGB with the top row first, which most
+encoders read as rawvideo rgb24.
+
+A small ring of slots is kept.  When the disk falls behind and
+every slot is waiting to be written, Acquire hands back nothing and
+the frame is counted as dropped rather than holding up the caller.
+-----------------------------------------------------------------------------------*/
+
+#ifndef FRAME_WRITER_H_
+#define FRAME_WRITER_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "simUtil.h"						// Common Macros
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define FRAME_WRITER_SLOTS		4				// Frames waiting to be written
+#define FRAME_WRITER_PATH		260				// Longest file name
+
+enum EFrameFormat
+{
+	FRAME_FORMAT_BMP,							// One bitmap a frame, the name a printf pattern
+	FRAME_FORMAT_RAW							// Every frame appended to one file
+};
+
+/*-----------------------------------------------------------------------------------
+Frame writer class definition
+-----------------------------------------------------------------------------------*/
+
+class CFrameWriter
+{
+	// Attributes
+private:
+
+	int				m_iFormat;				// One of EFrameFormat
+	int				m_iWidth, m_iHeight;
+	char			m_szPath[FRAME_WRITER_PATH];
+	FILE			*m_pStream;				// Raw video file
+	unsigned char	*m_pucRow;				// One converted row
+
+	unsigned char	*m_pucSlots[FRAME_WRITER_SLOTS];	// RGBA, bottom row first
+	int				m_iSlotFrame[FRAME_WRITER_SLOTS];	// Frame number of each queued slot
+	bool			m_bSlotBusy[FRAME_WRITER_SLOTS];	// Acquired or waiting to be written
+	int				m_iQueue[FRAME_WRITER_SLOTS];		// Slots in the order they came in
+	int				m_iQueueHead, m_iQueueCount;
+
+	int				m_iNextFrame;
+	int				m_iWritten;
+	int				m_iDropped;
+	bool			m_bFailed;				// A write went wrong, the rest are dropped
+	bool			m_bQuit;
+
+	std::thread				m_thread;
+	std::mutex				m_lock;			// Guards the slots, queue and counters
+	std::condition_variable	m_wake;			// Frames queued or told to quit
+	std::condition_variable	m_freed;		// Slot written
+
+	// Methods
+private:
+
+	void WriterMain();
+	bool WriteFrame(const unsigned char *pixels, int frame);
+
+public:
+
+	CFrameWriter();
+	~CFrameWriter();
+
+	//-----------------------------------------------------------
+	// Start writing width by height frames.  For bitmaps path is
+	// a printf pattern given the frame number, such as
+	// "capture%05d.bmp", for a raw stream it is the file.
+	//-----------------------------------------------------------
+	int Open(const char *path, int format, int width, int height);
+
+	// Write out the frames still queued and stop the thread
+	void Close();
+
+	bool IsOpen() const { return m_thread.joinable(); }
+
+	// A slot to fill with the next frame, or NULL when every slot
+	// is still queued, in which case the frame is dropped.  Offline
+	// recording can wait for a slot instead.
+	unsigned char *Acquire(bool wait = false);
+
+	// Queue a filled slot to be written
+	void Submit(unsigned char *pixels);
+
+	int GetWidth() const { return m_iWidth; }
+	int GetHeight() const { return m_iHeight; }
+	int GetNumWritten();
+	int GetNumDropped();
+};
+
+#endif
@@ -0,0 +1,378 @@
+/*-----------------------------------------------------------------------------------
+File:			frustumCull.cpp
+Author:			Steve Costa
+Description:	Frustum plane extraction and the scalar, SSE2 and AVX2 sphere
+culling kernels.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <math.h>
+#include <string.h>
+
+#include "frustumCull.h"					// Class header file
+#include "profiler.h"						// Frame zones
+#include "cpuFeatures.h"					// Instruction set detection
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/*-----------------------------------------------------------------------------------
+Pull the planes out of the matrix taking world space to clip space.  A point is
+inside when -w <= x, y, z <= w in clip space, so each plane is the w row of the
+matrix plus or minus one of the others.  The matrices multiply row vectors, so
+the rows of the OpenGL matrix are the columns here.
+-----------------------------------------------------------------------------------*/
+
+void TFrustum::Extract(const TMatrix& projection, const TMatrix& modelView)
+{
+	TMatrix clip = modelView * projection;
+	int axis, side, i;
+
+	for (axis = 0; axis < 3; axis++)
+	{
+		for (side = 0; side < 2; side++)
+		{
+			float *plane = planes[2 * axis + side];
+			float sign = side ? -1.0f : 1.0f;
+			float length;
+
+			for (i = 0; i < 4; i++)
+				plane[i] = clip.m[4 * i + 3] + sign * clip.m[4 * i + axis];
+
+			length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+			if (length > 0.0f)
+			{
+				for (i = 0; i < 4; i++)
+					plane[i] /= length;
+			}
+		}
+	}
+}
+
+bool TFrustum::TestSphere(float x, float y, float z, float radius) const
+{
+	int p;
+
+	for (p = 0; p < FRUSTUM_PLANES; p++)
+	{
+		if (planes[p][0] * x + planes[p][1] * y + planes[p][2] * z + planes[p][3] < -radius)
+			return false;
+	}
+
+	return true;
+}
+
+/*-----------------------------------------------------------------------------------
+Scalar cull.  Every slot writes its index and only the visible ones move the
+end of the list on, so there is no branch on the result.
+-----------------------------------------------------------------------------------*/
+
+static int CullScalar(const TCullInput& in, int first, int count, int *out)
+{
+	int k, p, n = 0;
+
+	for (k = first; k < first + count; k++)
+	{
+		int i = in.order ? in.order[k] : k;
+		float x = in.prevX[i] + in.blend * (in.posX[i] - in.prevX[i]);
+		float y = in.prevY[i] + in.blend * (in.posY[i] - in.prevY[i]);
+		float z = in.prevZ[i] + in.blend * (in.posZ[i] - in.prevZ[i]);
+		int inside = 1;
+
+		for (p = 0; p < FRUSTUM_PLANES; p++)
+			inside &= (in.planes[p][0] * x + in.planes[p][1] * y + in.planes[p][2] * z + in.planes[p][3] >= 0.0f);
+
+		out[n] = i;
+		n += inside;
+	}
+
+	return n;
+}
+
+#ifdef CPU_X86
+
+/*-----------------------------------------------------------------------------------
+SSE2 cull, four slots at a time.  Particles in order are loaded one by one,
+the rest straight from the columns.
+-----------------------------------------------------------------------------------*/
+
+TARGET_SSE2 static int CullSSE2(const TCullInput& in, int first, int count, int *out)
+{
+	__m128 a[FRUSTUM_PLANES], b[FRUSTUM_PLANES], c[FRUSTUM_PLANES], d[FRUSTUM_PLANES];
+	__m128 vblend = _mm_set1_ps(in.blend);
+	__m128 vzero = _mm_setzero_ps();
+	int last = first + (count & ~3);
+	int k, p, j, n = 0;
+
+	for (p = 0; p < FRUSTUM_PLANES; p++)
+	{
+		a[p] = _mm_set1_ps(in.planes[p][0]);
+		b[p] = _mm_set1_ps(in.planes[p][1]);
+		c[p] = _mm_set1_ps(in.planes[p][2]);
+		d[p] = _mm_set1_ps(in.planes[p][3]);
+	}
+
+	for (k = first; k < last; k += 4)
+	{
+		int index[4];
+		__m128 prevX, prevY, prevZ, posX, posY, posZ;
+
+		if (in.order)
+		{
+			memcpy(index, in.order + k, sizeof(index));
+			prevX = _mm_setr_ps(in.prevX[index[0]], in.prevX[index[1]], in.prevX[index[2]], in.prevX[index[3]]);
+			prevY = _mm_setr_ps(in.prevY[index[0]], in.prevY[index[1]], in.prevY[index[2]], in.prevY[index[3]]);
+			prevZ = _mm_setr_ps(in.prevZ[index[0]], in.prevZ[index[1]], in.prevZ[index[2]], in.prevZ[index[3]]);
+			posX = _mm_setr_ps(in.posX[index[0]], in.posX[index[1]], in.posX[index[2]], in.posX[index[3]]);
+			posY = _mm_setr_ps(in.posY[index[0]], in.posY[index[1]], in.posY[index[2]], in.posY[index[3]]);
+			posZ = _mm_setr_ps(in.posZ[index[0]], in.posZ[index[1]], in.posZ[index[2]], in.posZ[index[3]]);
+		}
+		else
+		{
+			for (j = 0; j < 4; j++)
+				index[j] = k + j;
+			prevX = _mm_loadu_ps(in.prevX + k);
+			prevY = _mm_loadu_ps(in.prevY + k);
+			prevZ = _mm_loadu_ps(in.prevZ + k);
+			posX = _mm_loadu_ps(in.posX + k);
+			posY = _mm_loadu_ps(in.posY + k);
+			posZ = _mm_loadu_ps(in.posZ + k);
+		}
+
+		__m128 x = _mm_add_ps(prevX, _mm_mul_ps(vblend, _mm_sub_ps(posX, prevX)));
+		__m128 y = _mm_add_ps(prevY, _mm_mul_ps(vblend, _mm_sub_ps(posY, prevY)));
+		__m128 z = _mm_add_ps(prevZ, _mm_mul_ps(vblend, _mm_sub_ps(posZ, prevZ)));
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+		for (p = 0; p < FRUSTUM_PLANES; p++)
+		{
+			__m128 dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a[p], x), _mm_mul_ps(b[p], y)),
+				_mm_mul_ps(c[p], z)), d[p]);
+
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, vzero));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+
+		for (j = 0; j < 4; j++)
+		{
+			out[n] = index[j];
+			n += (mask >> j) & 1;
+		}
+	}
+
+	return n + CullScalar(in, last, first + count - last, out + n);
+}
+
+/*-----------------------------------------------------------------------------------
+AVX2 cull, eight slots at a time, gathering the particles in order
+-----------------------------------------------------------------------------------*/
+
+TARGET_AVX2 static int CullAVX2(const TCullInput& in, int first, int count, int *out)
+{
+	__m256 a[FRUSTUM_PLANES], b[FRUSTUM_PLANES], c[FRUSTUM_PLANES], d[FRUSTUM_PLANES];
+	__m256 vblend = _mm256_set1_ps(in.blend);
+	__m256 vzero = _mm256_setzero_ps();
+	__m256i vstep = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	int last = first + (count & ~7);
+	int k, p, j, n = 0;
+
+	for (p = 0; p < FRUSTUM_PLANES; p++)
+	{
+		a[p] = _mm256_set1_ps(in.planes[p][0]);
+		b[p] = _mm256_set1_ps(in.planes[p][1]);
+		c[p] = _mm256_set1_ps(in.planes[p][2]);
+		d[p] = _mm256_set1_ps(in.planes[p][3]);
+	}
+
+	for (k = first; k < last; k += 8)
+	{
+		int index[8];
+		__m256 prevX, prevY, prevZ, posX, posY, posZ;
+
+		if (in.order)
+		{
+			__m256i vindex = _mm256_loadu_si256((const __m256i *)(in.order + k));
+
+			_mm256_storeu_si256((__m256i *)index, vindex);
+			prevX = _mm256_i32gather_ps(in.prevX, vindex, 4);
+			prevY = _mm256_i32gather_ps(in.prevY, vindex, 4);
+			prevZ = _mm256_i32gather_ps(in.prevZ, vindex, 4);
+			posX = _mm256_i32gather_ps(in.posX, vindex, 4);
+			posY = _mm256_i32gather_ps(in.posY, vindex, 4);
+			posZ = _mm256_i32gather_ps(in.posZ, vindex, 4);
+		}
+		else
+		{
+			_mm256_storeu_si256((__m256i *)index, _mm256_add_epi32(_mm256_set1_epi32(k), vstep));
+			prevX = _mm256_loadu_ps(in.prevX + k);
+			prevY = _mm256_loadu_ps(in.prevY + k);
+			prevZ = _mm256_loadu_ps(in.prevZ + k);
+			posX = _mm256_loadu_ps(in.posX + k);
+			posY = _mm256_loadu_ps(in.posY + k);
+			posZ = _mm256_loadu_ps(in.posZ + k);
+		}
+
+		__m256 x = _mm256_add_ps(prevX, _mm256_mul_ps(vblend, _mm256_sub_ps(posX, prevX)));
+		__m256 y = _mm256_add_ps(prevY, _mm256_mul_ps(vblend, _mm256_sub_ps(posY, prevY)));
+		__m256 z = _mm256_add_ps(prevZ, _mm256_mul_ps(vblend, _mm256_sub_ps(posZ, prevZ)));
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+		for (p = 0; p < FRUSTUM_PLANES; p++)
+		{
+			__m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a[p], x), _mm256_mul_ps(b[p], y)),
+				_mm256_mul_ps(c[p], z)), d[p]);
+
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(dist, vzero, _CMP_GE_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(inside);
+
+		for (j = 0; j < 8; j++)
+		{
+			out[n] = index[j];
+			n += (mask >> j) & 1;
+		}
+	}
+
+	return n + CullScalar(in, last, first + count - last, out + n);
+}
+
+#endif
+
+/*-----------------------------------------------------------------------------------
+Set any initial values for class state variables.
+-----------------------------------------------------------------------------------*/
+
+CFrustumCull::CFrustumCull()
+{
+	m_piVisible = NULL;
+	m_iNumVisible = 0;
+	m_iCapacity = 0;
+	m_piChunkCounts = NULL;
+
+	// Everything is inside until a frustum is set
+	memset(&m_frustum, 0, sizeof(m_frustum));
+
+	SetSimd(true);
+}
+
+CFrustumCull::~CFrustumCull()
+{
+	Shutdown();
+}
+
+/*-----------------------------------------------------------------------------------
+Free the arrays
+-----------------------------------------------------------------------------------*/
+
+void CFrustumCull::Shutdown()
+{
+	delete[] m_piVisible;
+	delete[] m_piChunkCounts;
+
+	m_piVisible = NULL;
+	m_piChunkCounts = NULL;
+	m_iNumVisible = 0;
+	m_iCapacity = 0;
+}
+
+/*-----------------------------------------------------------------------------------
+Make room for count particles
+-----------------------------------------------------------------------------------*/
+
+void CFrustumCull::Grow(int count)
+{
+	if (count <= m_iCapacity)
+		return;
+
+	Shutdown();
+
+	m_iCapacity = count;
+	m_piVisible = new int[count];
+	m_piChunkCounts = new int[(count + FRUSTUM_CULL_CHUNK - 1) / FRUSTUM_CULL_CHUNK];
+}
+
+/*-----------------------------------------------------------------------------------
+Choose the widest kernel
+-----------------------------------------------------------------------------------*/
+
+bool CFrustumCull::SetSimd(bool simd)
+{
+	m_pfnCull = CullScalar;
+	m_bSimd = false;
+
+#ifdef CPU_X86
+	int features = DetectCpuFeatures();
+
+	if (simd && (features & CPU_FEATURE_AVX2))
+		m_pfnCull = CullAVX2;
+	else if (simd && (features & CPU_FEATURE_SSE2))
+		m_pfnCull = CullSSE2;
+
+	m_bSimd = (m_pfnCull != CullScalar);
+#endif
+
+	return m_bSimd;
+}
+
+/*-----------------------------------------------------------------------------------
+Cull a chunk per job, then close the gaps between the chunks
+-----------------------------------------------------------------------------------*/
+
+const int *CFrustumCull::Cull(const CParticlePool& pool, int count, float radius, float blend,
+	const int *order, CJobSystem *jobs)
+{
+	PROFILE_ZONE("cull");
+
+	int numChunks = (count + FRUSTUM_CULL_CHUNK - 1) / FRUSTUM_CULL_CHUNK;
+	TCullInput in;
+	int p, i, chunk;
+
+	m_iNumVisible = 0;
+	if (count <= 0)
+		return m_piVisible;
+
+	Grow(count);
+
+	in.prevX = pool.Column(PARTICLE_PREV_X);
+	in.prevY = pool.Column(PARTICLE_PREV_Y);
+	in.prevZ = pool.Column(PARTICLE_PREV_Z);
+	in.posX = pool.Column(PARTICLE_POS_X);
+	in.posY = pool.Column(PARTICLE_POS_Y);
+	in.posZ = pool.Column(PARTICLE_POS_Z);
+	in.order = order;
+	in.blend = blend;
+
+	for (p = 0; p < FRUSTUM_PLANES; p++)
+	{
+		for (i = 0; i < 4; i++)
+			in.planes[p][i] = m_frustum.planes[p][i];
+		in.planes[p][3] += radius;
+	}
+
+	RunJobs(jobs, numChunks, 1, [this, &in, count](int first, int num, int worker) {
+		for (int c = first; c < first + num; c++)
+		{
+			int start = c * FRUSTUM_CULL_CHUNK;
+
+			m_piChunkCounts[c] = m_pfnCull(in, start, MIN(FRUSTUM_CULL_CHUNK, count - start),
+				m_piVisible + start);
+		}
+	});
+
+	for (chunk = 0; chunk < numChunks; chunk++)
+	{
+		int start = chunk * FRUSTUM_CULL_CHUNK;
+
+		if (start != m_iNumVisible)
+			memmove(m_piVisible + m_iNumVisible, m_piVisible + start, sizeof(int) * m_piChunkCounts[chunk]);
+		m_iNumVisible += m_piChunkCounts[chunk];
+	}
+
+	return m_piVisible;
+}
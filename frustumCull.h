@@ -0,0 +1,128 @@
+/*-----------------------------------------------------------------------------------
+File:			frustumCull.h
+Author:			Steve Costa
+Description:	Throws away the particles the camera cannot see before any
+sprites are built for them.  The six planes of the view frustum
+are pulled out of the projection and modelview matrices, and the
+bounding sphere of every sprite is tested against them four
+particles at a time with SSE2 or eight with AVX2.  What is left
+is a packed list of the indices of the visible particles, which
+the sprite batch draws from.
+
+The particles are culled a chunk per job, each chunk writing its
+visible indices where the chunk starts, and the chunks are then
+moved down next to each other.
+-----------------------------------------------------------------------------------*/
+
+#ifndef FRUSTUM_CULL_H_
+#define FRUSTUM_CULL_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "simUtil.h"						// Common Macros
+#include "matrix.h"
+using namespace matrix;
+#include "particlePool.h"					// Particle attribute columns
+#include "jobSystem.h"						// Worker threads
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define FRUSTUM_PLANES			6				// Left, right, bottom, top, near and far
+#define FRUSTUM_CULL_CHUNK		4096			// Particles per cull job
+
+/*-----------------------------------------------------------------------------------
+The frustum as planes ax + by + cz + d = 0 facing inwards, with unit normals
+so the value is the distance inside
+-----------------------------------------------------------------------------------*/
+
+struct TFrustum
+{
+	float		planes[FRUSTUM_PLANES][4];
+
+	// The frustum of OpenGL projection and modelview matrices, in
+	// world space
+	void Extract(const TMatrix& projection, const TMatrix& modelView);
+
+	bool TestSphere(float x, float y, float z, float radius) const;
+};
+
+/*-----------------------------------------------------------------------------------
+What a cull kernel needs.  Slot k of the range is particle order[k], or
+particle k when there is no order.
+-----------------------------------------------------------------------------------*/
+
+struct TCullInput
+{
+	const float	*prevX, *prevY, *prevZ;
+	const float	*posX, *posY, *posZ;
+	const int	*order;
+	float		blend;
+	float		planes[FRUSTUM_PLANES][4];	// d has the radius added on
+};
+
+// Writes the particles of slots [first, first + count) whose sprites are
+// in the frustum to out, returns how many
+typedef int (*PFNCULLRANGE)(const TCullInput& in, int first, int count, int *out);
+
+/*-----------------------------------------------------------------------------------
+Frustum cull class definition
+-----------------------------------------------------------------------------------*/
+
+class CFrustumCull
+{
+	// Attributes
+private:
+
+	bool			m_bSimd;
+	PFNCULLRANGE	m_pfnCull;				// Widest kernel the processor has
+	TFrustum		m_frustum;
+
+	int				*m_piVisible;			// Indices of the visible particles
+	int				m_iNumVisible;
+	int				m_iCapacity;
+	int				*m_piChunkCounts;		// Visible particles found by each chunk
+
+	// Methods
+private:
+
+	void Grow(int count);
+
+public:
+
+	CFrustumCull();
+	~CFrustumCull();
+
+	void Shutdown();
+
+	// Use SSE2 or AVX2 when the processor has them, returns
+	// whether one is in use
+	bool SetSimd(bool simd);
+	bool GetSimd() const { return m_bSimd; }
+
+	void SetFrustum(const TMatrix& projection, const TMatrix& modelView) {
+		m_frustum.Extract(projection, modelView);
+	}
+	void SetFrustum(const TFrustum& frustum) { m_frustum = frustum; }
+	const TFrustum& GetFrustum() const { return m_frustum; }
+
+	//-----------------------------------------------------------
+	// Find the particles whose sprites, spheres of radius round
+	// the position blended between the last two steps, are at
+	// least partly in the frustum.  order, when given, holds
+	// count pool indices and the ones kept stay in that order,
+	// otherwise the first count particles of the pool are
+	// tested.  Returns GetNumVisible pool indices.  jobs may be
+	// NULL.
+	//-----------------------------------------------------------
+	const int *Cull(const CParticlePool& pool, int count, float radius, float blend,
+		const int *order, CJobSystem *jobs);
+
+	const int *GetVisible() const { return m_piVisible; }
+	int GetNumVisible() const { return m_iNumVisible; }
+};
+
+#endif
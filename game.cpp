@@ -12,43 +12,130 @@ Header files
 #include "main.h"
 
 /*-----------------------------------------------------------------------------------
-Initialize colours
+Declare static orientation and projection matrices for the point sprite class
 -----------------------------------------------------------------------------------*/
 
-GLfloat CGame::colors[NUM_COLORS][3] =
+TMatrix CPointSprite::orientation;
+TMatrix CPointSprite::projection;
+
+/*-----------------------------------------------------------------------------------
+Set any initial values for class state variables.
+-----------------------------------------------------------------------------------*/
+
+CGame::CGame()
 {
-	{ 1.0f, 0.5f, 0.5f }, { 1.0f, 0.75f, 0.5f }, { 1.0f, 1.0f, 0.5f }, { 0.75f, 1.0f, 0.5f },
-	{ 0.5f, 1.0f, 0.5f }, { 0.5f, 1.0f, 0.75f }, { 0.5f, 1.0f, 1.0f }, { 0.5f, 0.75f, 1.0f },
-	{ 0.5f, 0.5f, 1.0f }, { 0.75f, 0.5f, 1.0f }, { 1.0f, 0.5f, 1.0f }, { 1.0f, 0.5f, 0.75f }
-};
+	// Set y rotation to 0
+	m_RotY = 0.0f;
+
+	m_frameStart = 0.0;
+	m_accumulator = 0.0;
+	SetTickRate(DEFAULT_TICK_RATE);
+
+	m_iBlendMode = DEFAULT_BLEND_MODE;
+	m_iCaptureKey = 0;
+	m_bLod = true;
+}
 
 /*-----------------------------------------------------------------------------------
-Declare static orientation matrix for the point sprite class
+Set how many fixed simulation steps are run per second of real time
 -----------------------------------------------------------------------------------*/
 
-TMatrix CPointSprite::orientation;
+void CGame::SetTickRate(float ticksPerSecond)
+{
+	m_simStep = 1.0f / ticksPerSecond;
+}
 
 /*-----------------------------------------------------------------------------------
-Initialize particle gravity
+Additive sprites only ever brighten the frame so the order they are drawn in
+does not matter.  Alpha blended ones cover what is behind them and must be
+sorted back to front, there is no depth test either way.
 -----------------------------------------------------------------------------------*/
 
-float CParticle::m_sfGravity = 9.8f;
+void CGame::SetBlendMode(int mode)
+{
+	m_iBlendMode = mode;
+
+	if (mode == BLEND_ALPHA)
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	else
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+
+	// The order is stale by the time it is next wanted
+	m_depthSort.Invalidate();
+}
 
 /*-----------------------------------------------------------------------------------
-Set any initial values for class state variables.
+Start recording the window, or stop and finish writing what was recorded
 -----------------------------------------------------------------------------------*/
 
-CGame::CGame()
+void CGame::ToggleCapture(int format)
 {
-	// Set y rotation to 0
-	m_RotY = 0.0f;
+	if (m_capture.IsCapturing()) {
+		m_capture.Stop();
+		return;
+	}
+
+	m_capture.Start((format == FRAME_FORMAT_RAW) ? CAPTURE_STREAM : CAPTURE_SEQUENCE, format,
+		SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+/*-----------------------------------------------------------------------------------
+Record the particles every step, or stop and finish the file
+-----------------------------------------------------------------------------------*/
+
+void CGame::ToggleRecording()
+{
+	if (m_recorder.IsOpen()) {
+		m_recorder.Close();
+		return;
+	}
+
+	if (!m_replay.IsOpen())
+		m_recorder.Open(SNAPSHOT_FILE, m_system.GetCapacity());
+}
+
+/*-----------------------------------------------------------------------------------
+Play the recording back in a loop in place of the simulation, or go back to
+simulating from where the simulation was left
+-----------------------------------------------------------------------------------*/
+
+void CGame::ToggleReplay()
+{
+	if (m_replay.IsOpen()) {
+		m_replay.Close();
+	}
+	else {
+		m_recorder.Close();
+		if (m_replay.Open(SNAPSHOT_FILE) == RETURN_SUCCESS && m_replay.Seek(0, &m_jobs) != RETURN_SUCCESS)
+			m_replay.Close();
+	}
+
+	// The order is of the other particles
+	m_depthSort.Invalidate();
+}
+
+/*-----------------------------------------------------------------------------------
+Start keeping the positions of the particles and draw them as ribbons, or stop
+and free them.  A trail starts from where the particle is when it is shown.
+-----------------------------------------------------------------------------------*/
+
+void CGame::ToggleTrails()
+{
+	if (m_trails.IsEnabled()) {
+		m_system.SetTrails(NULL);
+		m_trails.Shutdown();
+		return;
+	}
+
+	if (m_trails.Init(m_system.GetCapacity(), TRAIL_LENGTH) == RETURN_SUCCESS)
+		m_system.SetTrails(&m_trails);
 }
 
 /*-----------------------------------------------------------------------------------
 Initialize the class
 -----------------------------------------------------------------------------------*/
 
-int CGame::Init()
+int CGame::Init(int numParticles, int numThreads)
 {
 	//----------------------------------------------------------------------
 	// Set the viewport to the dimensions of the window
@@ -73,7 +160,7 @@ int CGame::Init()
 	glLoadIdentity();
 
 	//----------------------------------------------------------------------
-	// No need for z-buffering
+	// No need for z-buffering, alpha blended particles are sorted instead
 	//----------------------------------------------------------------------
 	glDisable(GL_DEPTH_TEST);
 
@@ -92,7 +179,7 @@ int CGame::Init()
 	// Enable blending for transparency
 	//----------------------------------------------------------------------
 	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+	SetBlendMode(m_iBlendMode);
 
 	//----------------------------------------------------------------------
 	// Specify how we want perspective correction and point smoothing
@@ -110,15 +197,46 @@ int CGame::Init()
 	//----------------------------------------------------------------------
 	SetupLights();
 
+	//----------------------------------------------------------------------
+	// Load the buffer object entry points used for batched drawing
+	//----------------------------------------------------------------------
+	glext::Load();
+
 	//----------------------------------------------------------------------
 	// Initialize the point sprite object
 	//----------------------------------------------------------------------
-	m_pointSprite.Init(TEXTURE_FILE, 1.0f, 1.0f);
+	if (m_pointSprite.Init(TEXTURE_FILE, 1.0f, 1.0f) != RETURN_SUCCESS ||
+		m_ribbons.Init(TRAIL_WIDTH, TRAIL_LENGTH) != RETURN_SUCCESS)
+	{
+		return RETURN_FAILURE;
+	}
+	if (m_atlas.LoadCached(ATLAS_FILE, TEXTURE_FILE) == RETURN_SUCCESS)
+		m_pointSprite.SetAtlas(&m_atlas);
 
 	//----------------------------------------------------------------------
-	// Set up the timing variable
+	// Pick the widest update kernel this processor supports, debug builds
+	// make sure it agrees with the scalar path first
 	//----------------------------------------------------------------------
-	m_currentTime = GetTickCount();
+	assert(CheckUpdateKernels() == RETURN_SUCCESS);
+	SelectUpdateKernel(UPDATE_KERNEL_AUTO);
+
+	//----------------------------------------------------------------------
+	// Start the worker threads and allocate the particles, this thread is
+	// named in the profile beside them
+	//----------------------------------------------------------------------
+	CProfiler::SetThreadName("main");
+	m_jobs.Init(numThreads);
+	if (m_system.Init(numParticles, &m_jobs) != RETURN_SUCCESS)
+		return RETURN_FAILURE;
+	m_system.AddEmitter(CEmitter::Fountain(numParticles));
+
+	//----------------------------------------------------------------------
+	// Set up the timing variables, asking for 1 ms scheduler slices so
+	// the frame pacing sleeps are not rounded up to 15 ms
+	//----------------------------------------------------------------------
+	timeBeginPeriod(1);
+	m_frameStart = CTimer::GetSeconds();
+	m_accumulator = 0.0;
 
 	return RETURN_SUCCESS;
 }
@@ -142,16 +260,125 @@ int CGame::SetupLights()
 	return RETURN_SUCCESS;
 }
 
+/*-----------------------------------------------------------------------------------
+Write the zones the profiler still holds as a Chrome trace, and the percentiles
+of each phase of the frame beside it
+-----------------------------------------------------------------------------------*/
+
+void CGame::WriteProfile()
+{
+	FILE *file;
+
+	CProfiler::WriteTrace(PROFILE_TRACE_FILE);
+
+	file = fopen(PROFILE_STATS_FILE, "w");
+	if (file) {
+		CProfiler::PrintStats(file);
+		fclose(file);
+	}
+}
+
 /*-----------------------------------------------------------------------------------
 Handle user input commands which control the camera and exit the program.
 -----------------------------------------------------------------------------------*/
 
 void CGame::GetInput()
 {
+	PROFILE_ZONE("input");
+
 	// Exit program if escape pressed
 	if (GetAsyncKeyState(VK_ESCAPE) & 0x8000) {
 		SendMessage(CWin::m_sWinHandle, WM_CLOSE, 0, 0);
 	}
+
+	// 1 and 2 switch between additive and alpha blending
+	if ((GetAsyncKeyState('1') & 0x8000) && m_iBlendMode != BLEND_ADDITIVE) {
+		SetBlendMode(BLEND_ADDITIVE);
+	}
+	if ((GetAsyncKeyState('2') & 0x8000) && m_iBlendMode != BLEND_ALPHA) {
+		SetBlendMode(BLEND_ALPHA);
+	}
+
+	// C records a bitmap sequence and V a raw video stream, R the
+	// particles themselves and P plays them back, T shows the
+	// trails, L turns the merging of distant particles on and
+	// off and F writes the profile, on the press rather than
+	// every frame the key is held
+	if (GetAsyncKeyState('C') & 0x8000) {
+		if (m_iCaptureKey != 'C')
+			ToggleCapture(FRAME_FORMAT_BMP);
+		m_iCaptureKey = 'C';
+	}
+	else if (GetAsyncKeyState('V') & 0x8000) {
+		if (m_iCaptureKey != 'V')
+			ToggleCapture(FRAME_FORMAT_RAW);
+		m_iCaptureKey = 'V';
+	}
+	else if (GetAsyncKeyState('R') & 0x8000) {
+		if (m_iCaptureKey != 'R')
+			ToggleRecording();
+		m_iCaptureKey = 'R';
+	}
+	else if (GetAsyncKeyState('P') & 0x8000) {
+		if (m_iCaptureKey != 'P')
+			ToggleReplay();
+		m_iCaptureKey = 'P';
+	}
+	else if (GetAsyncKeyState('T') & 0x8000) {
+		if (m_iCaptureKey != 'T')
+			ToggleTrails();
+		m_iCaptureKey = 'T';
+	}
+	else if (GetAsyncKeyState('L') & 0x8000) {
+		if (m_iCaptureKey != 'L')
+			m_bLod = !m_bLod;
+		m_iCaptureKey = 'L';
+	}
+	else if (GetAsyncKeyState('F') & 0x8000) {
+		if (m_iCaptureKey != 'F')
+			WriteProfile();
+		m_iCaptureKey = 'F';
+	}
+	else {
+		m_iCaptureKey = 0;
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Draw the particles in view, back to front when they are alpha blended, over
+their trails.  Distant ones are merged into impostors drawn behind the rest.
+The trails are of the simulation so are not drawn behind a recording.
+-----------------------------------------------------------------------------------*/
+
+void CGame::Draw(float blend)
+{
+	PROFILE_ZONE("draw");
+
+	const int *order = NULL, *visible;
+
+	m_pointSprite.GetModelView();
+	m_cull.SetFrustum(CPointSprite::GetProjection(), CPointSprite::GetOrientation());
+
+	const CParticlePool& pool = m_replay.IsOpen() ? m_replay.GetPool() : m_system.GetPool();
+
+	if (m_iBlendMode == BLEND_ALPHA) {
+		order = m_depthSort.Sort(pool, pool.GetLiveCount(), CPointSprite::GetOrientation(), blend, &m_jobs);
+	}
+
+	if (m_trails.IsEnabled() && !m_replay.IsOpen())
+		m_ribbons.Render(pool, m_trails, pool.GetLiveCount(), m_pointSprite, &m_jobs, blend, order);
+
+	visible = m_cull.Cull(pool, pool.GetLiveCount(), m_pointSprite.GetRadius(), blend, order, &m_jobs);
+
+	if (m_bLod) {
+		visible = m_lod.Build(pool, m_cull.GetNumVisible(), visible, blend, CPointSprite::GetProjection(),
+			CPointSprite::GetOrientation(), SCREEN_WIDTH, SCREEN_HEIGHT, m_pointSprite.GetSize(), &m_jobs);
+		m_pointSprite.RenderImpostors(m_lod.GetImpostors(), m_lod.GetNumImpostors(), &m_jobs);
+		m_pointSprite.RenderBatch(pool, m_lod.GetNumNear(), &m_jobs, blend, visible);
+	}
+	else {
+		m_pointSprite.RenderBatch(pool, m_cull.GetNumVisible(), &m_jobs, blend, visible);
+	}
 }
 
 /*-----------------------------------------------------------------------------------
@@ -160,20 +387,27 @@ Translate and rotate the scene according to the user's preferences.
 
 int CGame::Main()
 {
-	int i;
+	double now, frameTime;
+	float blend;
+	int steps;
 
 	//----------------------------------------------------------------------
-	// Keep track of elapsed time since last frame
+	// Keep track of elapsed time since last frame, after a long stall
+	// only catch up on a bounded amount of it
 	//----------------------------------------------------------------------
-	m_elapsedTime = GetTickCount() - m_currentTime;
-	m_currentTime += m_elapsedTime;
-	m_elapsedSecs = m_elapsedTime * 0.001f;
+	now = CTimer::GetSeconds();
+	frameTime = MIN(now - m_frameStart, MAX_FRAME_TIME);
+	m_frameStart = now;
+	m_accumulator += frameTime;
 
 	//----------------------------------------------------------------------
 	// Clear the buffer and load identity matrix
 	//----------------------------------------------------------------------
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glLoadIdentity();
+	{
+		PROFILE_ZONE("clear");
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glLoadIdentity();
+	}
 
 	//----------------------------------------------------------------------
 	// Get user input
@@ -183,65 +417,65 @@ int CGame::Main()
 	//----------------------------------------------------------------------
 	// Change positioning and orientation of camera
 	//----------------------------------------------------------------------
-	glTranslatef(0.0f, 0.0f, -25.0f);
-	glRotatef(45.0f, 1.0f, 0.0f, 0.0f);
-	glRotatef(m_RotY, 0.0f, 1.0f, 0.0f);
-	m_RotY += 0.5f;
+	{
+		PROFILE_ZONE("camera");
+		glTranslatef(0.0f, 0.0f, -25.0f);
+		glRotatef(45.0f, 1.0f, 0.0f, 0.0f);
+		glRotatef(m_RotY, 0.0f, 1.0f, 0.0f);
+		m_RotY += CAMERA_SPIN_RATE * float(frameTime);
+	}
 
 	//----------------------------------------------------------------------
-	// Update the particles
+	// Run the simulation in fixed steps for the time that has built up,
+	// whatever is left over is used to blend between the last two steps.
+	// A recording plays back a frame a step, from the start again once
+	// it runs out.
 	//----------------------------------------------------------------------
-	for (i = 0; i < NUM_PARTICLES; i++)
+	for (steps = 0; m_accumulator >= m_simStep && steps < MAX_STEPS_PER_FRAME; steps++)
 	{
-		// Restart any particles that have died
-		if (!m_particles[i].IsAlive()) {
-			m_particles[i].ReStart();
-
-			// Set position to origin
-			m_particles[i].m_fPosX = 0.0f;
-			m_particles[i].m_fPosY = 0.0f;
-			m_particles[i].m_fPosZ = 0.0f;
-
-			// Set a random velocity
-			m_particles[i].m_fVelX = 1.0f + float((rand() % 5) - 2.5f);
-			m_particles[i].m_fVelY = 1.0f + float((rand() % 15));
-			m_particles[i].m_fVelZ = float((rand() % 5) - 2.5f);
-
-			// Set the acceleration to 0
-			m_particles[i].m_fAccelX = 0.0f;
-			m_particles[i].m_fAccelY = 0.0f;
-			m_particles[i].m_fAccelZ = 0.0f;
-
-			// Set a colour
-			int randCol = rand() % NUM_COLORS;
-			m_particles[i].m_fColR = colors[randCol][0];
-			m_particles[i].m_fColG = colors[randCol][1];
-			m_particles[i].m_fColB = colors[randCol][2];
-		}
+		PROFILE_ZONE("update");
 
-		// Update the particle positions
-		m_particles[i].Update(m_elapsedSecs);
+		if (m_replay.IsOpen()) {
+			if (m_replay.Next(&m_jobs) != RETURN_SUCCESS)
+				m_replay.Seek(0, &m_jobs);
+		}
+		else {
+			m_system.Update(m_simStep);
+			if (m_recorder.IsOpen())
+				m_recorder.Append(m_system.GetPool(), m_recorder.GetNumFrames() * m_simStep, &m_jobs);
+		}
+		m_accumulator -= m_simStep;
 	}
 
+	// Too far behind, drop the time rather than spiral
+	if (steps == MAX_STEPS_PER_FRAME)
+		m_accumulator = MIN(m_accumulator, double(m_simStep));
+
+	blend = float(m_accumulator / m_simStep);
+
 	//----------------------------------------------------------------------
-	// Draw the particles
+	// Draw the particles where they are between the last two steps
+	//----------------------------------------------------------------------
+	Draw(blend);
+
+	//----------------------------------------------------------------------
+	// Start reading the frame back when recording, the frames read back
+	// earlier are handed to the writer thread
 	//----------------------------------------------------------------------
-	m_pointSprite.GetModelView();
-	for (i = 0; i < NUM_PARTICLES; i++)
 	{
-		glColor4f(m_particles[i].m_fColR, m_particles[i].m_fColG,
-			m_particles[i].m_fColB, m_particles[i].GetLifeValue());
-		m_pointSprite.Render(m_particles[i].m_fPosX,
-			m_particles[i].m_fPosY,
-			m_particles[i].m_fPosZ);
+		PROFILE_ZONE("capture");
+		m_capture.Capture();
 	}
 
 	//----------------------------------------------------------------------
-	// Ensure that we keep a constant frame rate
+	// Cap the frame rate, waking up on time rather than a slice late
 	//----------------------------------------------------------------------
-	m_timeLeft = GetTickCount() - m_currentTime;
-	m_timeLeft = (m_timeLeft > FRAME_INTERVAL) ? 0 : FRAME_INTERVAL - m_timeLeft;
-	Sleep(m_timeLeft);
+	{
+		PROFILE_ZONE("sleep");
+		CTimer::SleepUntil(m_frameStart + FRAME_INTERVAL * 0.001);
+	}
+
+	CProfiler::EndFrame();
 
 	return 0;
 }
@@ -252,5 +486,18 @@ When shutting down the program clear the dynamic arrays
 
 int CGame::Shutdown()
 {
+	timeEndPeriod(1);
+	m_capture.Stop();
+	m_recorder.Close();
+	m_replay.Close();
+	m_system.SetTrails(NULL);
+	m_trails.Shutdown();
+	m_pointSprite.SetAtlas(NULL);
+	m_atlas.Shutdown();
+	m_depthSort.Shutdown();
+	m_cull.Shutdown();
+	m_lod.Shutdown();
+	m_system.Shutdown();
+	m_jobs.Shutdown();
 	return 0;
 }
@@ -13,15 +13,41 @@ Header files
 
 #include "commonUtil.h"						// Common Macros, and headers
 #include "pointSprite.h"					// Point sprite object
-#include "particle.h"						// Particle object
+#include "particleSystem.h"					// Particle simulation
+#include "depthSort.h"						// Back to front ordering
+#include "frustumCull.h"					// Visible particles
+#include "particleLod.h"					// Impostors for distant particles
+#include "frameCapture.h"					// Recording the window
+#include "spriteAtlas.h"					// Packed sprite images
+#include "snapshot.h"						// Recording and replay
+#include "trails.h"							// Recent positions
+#include "ribbons.h"						// Trails drawn behind the particles
+#include "jobSystem.h"						// Worker threads
+#include "timer.h"							// High resolution clock
+#include "profiler.h"						// Frame phases
 
 /*-----------------------------------------------------------------------------------
 Constants
 -----------------------------------------------------------------------------------*/
 
 #define	TEXTURE_FILE		"particle.bmp"
-#define	NUM_PARTICLES		300
-#define NUM_COLORS			12
+#define ATLAS_FILE			"particles.atlas"	// TEXTURE_FILE cooked, again when it changes
+#define	DEFAULT_NUM_PARTICLES	300
+#define DEFAULT_NUM_THREADS		0				// One per hardware thread
+#define DEFAULT_TICK_RATE		50.0f			// Simulation steps per second
+#define MAX_FRAME_TIME			0.25			// Longest frame the simulation catches up on
+#define MAX_STEPS_PER_FRAME		8				// Steps run before dropping time
+#define CAMERA_SPIN_RATE		25.0f			// Degrees per second
+
+#define DEFAULT_BLEND_MODE		BLEND_ADDITIVE
+
+#define CAPTURE_SEQUENCE		"capture%05d.bmp"	// Bitmap per frame, C starts and stops
+#define CAPTURE_STREAM			"capture.rgb"		// Raw rgb24 video, V starts and stops
+#define SNAPSHOT_FILE			"particles.snap"	// Particle state, R records and P plays back
+#define TRAIL_LENGTH			16				// Steps behind each particle, T shows and hides
+#define TRAIL_WIDTH				0.5f			// World units across the head of a trail
+#define PROFILE_TRACE_FILE		"profile.json"	// Chrome trace of the recent frames, F writes it
+#define PROFILE_STATS_FILE		"profile.txt"	// And the percentiles of each phase
 
 /*-----------------------------------------------------------------------------------
 Game class definition
@@ -33,26 +59,45 @@ class CGame
 private:
 
 	CPointSprite m_pointSprite;				// Point sprite to draw particles
-	CParticle m_particles[NUM_PARTICLES];	// Array of particles
-	static GLfloat colors[NUM_COLORS][3];	// Colours to use in game
+	CSpriteAtlas m_atlas;					// Images the batches are drawn from
+	CParticleSystem m_system;				// Particle simulation
+	CJobSystem m_jobs;						// Workers for the particle passes
+	CDepthSort m_depthSort;					// Draw order for alpha blending
+	CFrustumCull m_cull;					// Particles in view
+	CParticleLod m_lod;						// Distant particles merged into impostors
+	bool m_bLod;							// Whether distant particles are merged, L toggles
+	int m_iBlendMode;						// One of EBlendMode
+	CFrameCapture m_capture;				// Frames being recorded
+	CSnapshotWriter m_recorder;				// Particle state being recorded
+	CSnapshotReader m_replay;				// Recording played back in place of the simulation
+	CTrails m_trails;						// Recent positions while trails are shown
+	CRibbons m_ribbons;						// Draws the trails
+	int m_iCaptureKey;						// Capture, replay, trails, LOD or profile key held last frame, 0 for none
 
 	float m_RotY;							// Scene rotation
 
-	DWORD	m_currentTime,
-		m_timeLeft,
-		m_elapsedTime;					// Timing variables
-	float	m_elapsedSecs;					// Elapsed time in seconds
+	double	m_frameStart;					// When the current frame began
+	double	m_accumulator;					// Real time not yet simulated
+	float	m_simStep;						// Seconds per simulation step
 
 	// Methods
 private:
 
 	void GetInput();							// Get user input
+	void Draw(float blend);						// Draw the particles blended between the last two steps
 	int SetupLights();							// Enable the OpenGL lights
 
 public:
 
 	CGame();
-	int Init();
+	void SetTickRate(float ticksPerSecond);		// Simulation steps per second
+	void SetBlendMode(int mode);				// Set the blend function for the sprites
+	void ToggleCapture(int format);				// Start or stop recording, format is one of EFrameFormat
+	void ToggleRecording();						// Start or stop recording the particles
+	void ToggleReplay();						// Start or stop playing back the recording
+	void ToggleTrails();						// Show or hide the trails behind the particles
+	void WriteProfile();						// Write the trace and phase percentiles
+	int Init(int numParticles = DEFAULT_NUM_PARTICLES, int numThreads = DEFAULT_NUM_THREADS);
 	int Main();
 	int Shutdown();
 };
@@ -0,0 +1,108 @@
+/*-----------------------------------------------------------------------------------
+File:			glExtensions.cpp
+Author:			Steve Costa
+Description:	Runtime loading of the OpenGL entry points declared in
+glExtensions.h.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <string.h>
+#include "glExtensions.h"					// Header file for these functions
+
+namespace glext
+{
+
+	/*-----------------------------------------------------------------------------------
+	Entry points, NULL until loaded
+	-----------------------------------------------------------------------------------*/
+
+	PFNGENBUFFERS		GenBuffers = NULL;
+	PFNDELETEBUFFERS	DeleteBuffers = NULL;
+	PFNBINDBUFFER		BindBuffer = NULL;
+	PFNBUFFERDATA		BufferData = NULL;
+	PFNMAPBUFFER		MapBuffer = NULL;
+	PFNUNMAPBUFFER		UnmapBuffer = NULL;
+	PFNMAPBUFFERRANGE	MapBufferRange = NULL;
+	PFNFENCESYNC		FenceSync = NULL;
+	PFNCLIENTWAITSYNC	ClientWaitSync = NULL;
+	PFNDELETESYNC		DeleteSync = NULL;
+	PFNBUFFERSTORAGE	BufferStorage = NULL;
+
+	static int			s_iCaps = 0;
+
+	/*-----------------------------------------------------------------------------------
+	Look up a single entry point in the current context
+	-----------------------------------------------------------------------------------*/
+
+	static void *GetProc(const char *name)
+	{
+#ifdef _WIN32
+		return (void *)wglGetProcAddress(name);
+#else
+		return SDL_GL_GetProcAddress(name);
+#endif
+	}
+
+	/*-----------------------------------------------------------------------------------
+	Check the context version or extension string for a feature
+	-----------------------------------------------------------------------------------*/
+
+	static bool HasFeature(int major, int minor, const char *extension)
+	{
+		const char *version = (const char *)glGetString(GL_VERSION);
+		const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+
+		if (version && (version[0] - '0' > major ||
+			(version[0] - '0' == major && version[2] - '0' >= minor)))
+			return true;
+
+		return extensions && strstr(extensions, extension) != NULL;
+	}
+
+	/*-----------------------------------------------------------------------------------
+	Load every entry point, a feature is only reported when the context claims
+	it and all of its functions were found.
+	-----------------------------------------------------------------------------------*/
+
+	int Load()
+	{
+		s_iCaps = 0;
+
+		GenBuffers = (PFNGENBUFFERS)GetProc("glGenBuffers");
+		DeleteBuffers = (PFNDELETEBUFFERS)GetProc("glDeleteBuffers");
+		BindBuffer = (PFNBINDBUFFER)GetProc("glBindBuffer");
+		BufferData = (PFNBUFFERDATA)GetProc("glBufferData");
+		MapBuffer = (PFNMAPBUFFER)GetProc("glMapBuffer");
+		UnmapBuffer = (PFNUNMAPBUFFER)GetProc("glUnmapBuffer");
+		MapBufferRange = (PFNMAPBUFFERRANGE)GetProc("glMapBufferRange");
+		FenceSync = (PFNFENCESYNC)GetProc("glFenceSync");
+		ClientWaitSync = (PFNCLIENTWAITSYNC)GetProc("glClientWaitSync");
+		DeleteSync = (PFNDELETESYNC)GetProc("glDeleteSync");
+		BufferStorage = (PFNBUFFERSTORAGE)GetProc("glBufferStorage");
+
+		if (HasFeature(1, 5, "GL_ARB_vertex_buffer_object") && GenBuffers && DeleteBuffers &&
+			BindBuffer && BufferData && MapBuffer && UnmapBuffer)
+			s_iCaps |= GLEXT_BUFFER_OBJECTS;
+
+		if ((s_iCaps & GLEXT_BUFFER_OBJECTS) && HasFeature(3, 0, "GL_ARB_map_buffer_range") && MapBufferRange)
+			s_iCaps |= GLEXT_MAP_RANGE;
+
+		if (HasFeature(3, 2, "GL_ARB_sync") && FenceSync && ClientWaitSync && DeleteSync)
+			s_iCaps |= GLEXT_SYNC;
+
+		if ((s_iCaps & GLEXT_MAP_RANGE) && (s_iCaps & GLEXT_SYNC) &&
+			HasFeature(4, 4, "GL_ARB_buffer_storage") && BufferStorage)
+			s_iCaps |= GLEXT_BUFFER_STORAGE;
+
+		return s_iCaps;
+	}
+
+	int GetCaps()
+	{
+		return s_iCaps;
+	}
+
+}
@@ -0,0 +1,115 @@
+/*-----------------------------------------------------------------------------------
+File:			glExtensions.h
+Author:			Steve Costa
+Description:	The OpenGL headers shipped with Windows stop at version 1.1, so
+the buffer object and sync entry points used for streaming
+vertices are declared here and loaded at runtime once a rendering
+context exists.
+-----------------------------------------------------------------------------------*/
+
+#ifndef GL_EXTENSIONS_H_
+#define GL_EXTENSIONS_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <stddef.h>
+#include "commonUtil.h"						// Common Macros, and headers
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+/*-----------------------------------------------------------------------------------
+Types and constants missing from the 1.1 headers
+-----------------------------------------------------------------------------------*/
+
+#ifndef GL_VERSION_1_2
+#define GL_TEXTURE_MAX_LEVEL			0x813D
+#endif
+
+#ifndef GL_VERSION_1_5
+typedef ptrdiff_t GLintptr;
+typedef ptrdiff_t GLsizeiptr;
+#define GL_ARRAY_BUFFER					0x8892
+#define GL_STREAM_DRAW					0x88E0
+#define GL_WRITE_ONLY					0x88B9
+#endif
+
+#ifndef GL_VERSION_2_1
+#define GL_PIXEL_PACK_BUFFER			0x88EB
+#define GL_STREAM_READ					0x88E1
+#define GL_READ_ONLY					0x88B8
+#endif
+
+#ifndef GL_VERSION_3_0
+#define GL_MAP_WRITE_BIT				0x0002
+#define GL_MAP_INVALIDATE_BUFFER_BIT	0x0008
+#define GL_MAP_UNSYNCHRONIZED_BIT		0x0020
+#endif
+
+#ifndef GL_VERSION_3_2
+typedef struct __GLsync *GLsync;
+typedef unsigned long long GLuint64;
+#define GL_SYNC_GPU_COMMANDS_COMPLETE	0x9117
+#define GL_SYNC_FLUSH_COMMANDS_BIT		0x00000001
+#define GL_ALREADY_SIGNALED				0x911A
+#define GL_TIMEOUT_EXPIRED				0x911B
+#define GL_CONDITION_SATISFIED			0x911C
+#define GL_WAIT_FAILED					0x911D
+#endif
+
+#ifndef GL_VERSION_4_4
+#define GL_MAP_PERSISTENT_BIT			0x0040
+#define GL_MAP_COHERENT_BIT				0x0080
+#endif
+
+/*-----------------------------------------------------------------------------------
+Capability flags reported by glext::Load
+-----------------------------------------------------------------------------------*/
+
+#define GLEXT_BUFFER_OBJECTS		0x01		// glGenBuffers and friends
+#define GLEXT_MAP_RANGE				0x02		// glMapBufferRange
+#define GLEXT_SYNC					0x04		// Fence objects
+#define GLEXT_BUFFER_STORAGE		0x08		// Immutable, persistently mappable storage
+
+/*-----------------------------------------------------------------------------------
+Encapsulate the entry points in their own namespace so they never clash with
+prototypes a platform's headers may already declare.
+-----------------------------------------------------------------------------------*/
+
+namespace glext
+{
+	typedef void (APIENTRY *PFNGENBUFFERS)(GLsizei n, GLuint *buffers);
+	typedef void (APIENTRY *PFNDELETEBUFFERS)(GLsizei n, const GLuint *buffers);
+	typedef void (APIENTRY *PFNBINDBUFFER)(GLenum target, GLuint buffer);
+	typedef void (APIENTRY *PFNBUFFERDATA)(GLenum target, GLsizeiptr size, const void *data, GLenum usage);
+	typedef void * (APIENTRY *PFNMAPBUFFER)(GLenum target, GLenum access);
+	typedef GLboolean (APIENTRY *PFNUNMAPBUFFER)(GLenum target);
+	typedef void * (APIENTRY *PFNMAPBUFFERRANGE)(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+	typedef GLsync (APIENTRY *PFNFENCESYNC)(GLenum condition, GLbitfield flags);
+	typedef GLenum (APIENTRY *PFNCLIENTWAITSYNC)(GLsync sync, GLbitfield flags, GLuint64 timeout);
+	typedef void (APIENTRY *PFNDELETESYNC)(GLsync sync);
+	typedef void (APIENTRY *PFNBUFFERSTORAGE)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+
+	extern PFNGENBUFFERS		GenBuffers;
+	extern PFNDELETEBUFFERS		DeleteBuffers;
+	extern PFNBINDBUFFER		BindBuffer;
+	extern PFNBUFFERDATA		BufferData;
+	extern PFNMAPBUFFER			MapBuffer;
+	extern PFNUNMAPBUFFER		UnmapBuffer;
+	extern PFNMAPBUFFERRANGE	MapBufferRange;
+	extern PFNFENCESYNC			FenceSync;
+	extern PFNCLIENTWAITSYNC	ClientWaitSync;
+	extern PFNDELETESYNC		DeleteSync;
+	extern PFNBUFFERSTORAGE		BufferStorage;
+
+	// Load the entry points for the current context, returns GLEXT_ flags
+	int Load();
+
+	// Flags from the last call to Load
+	int GetCaps();
+}
+
+#endif
@@ -0,0 +1,823 @@
+/*-----------------------------------------------------------------------------------
+File:			headless.cpp
+Author:			Steve Costa
+Description:	Runs the particle simulation without a window or a GPU and prints
+a summary of the particles every so often.  Useful for profiling
+the simulation on its own.
+
+Usage:			particles_headless [particles] [steps] [threads] [seed] [emitters]
+				[collision radius] [behaviour] [affectors] [turbulence]
+				[frame] [blend] [snapshot] [trace]
+				particles_headless replay snapshot [frame] [blend] [threads]
+				particles_headless compact [particles] [steps] [threads]
+				[seed] [emitters] [frame] [blend]
+
+				behaviour is 1 for a block of fluid, 2 for an n-body swarm
+				affectors is 1 for a fused stack, 2 for the same stack
+				as a runtime list
+				turbulence scales the shared turbulence field for
+				every emitter
+				frame is a bitmap the last step is drawn to with the
+				software rasterizer, or with a % in it, such as
+				frame%05d.bmp, a bitmap for every step.  A name
+				ending in .rgb records every step as raw rgb24 video.
+				blend 1 draws alpha blended back to front rather
+				than added
+				frame - draws nothing, to record without drawing
+				snapshot records every step, or - nothing, replay
+				plays it back without simulating
+				compact keeps the fountains' particles in a store of
+				TCompactPrecision, spawned into it, stepped there and
+				unpacked to draw and report
+				trace is a Chrome trace of the last steps, written
+				at the end.  The percentiles of each phase of a step
+				are printed either way.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "simUtil.h"						// Common Macros
+#include "timer.h"							// High resolution clock
+#include "profiler.h"						// Phases of each step
+#include "particleSystem.h"					// Particle simulation
+#include "softRaster.h"						// CPU sprite rasterizer
+#include "depthSort.h"						// Back to front ordering
+#include "frustumCull.h"					// Visible particles
+#include "frameWriter.h"					// Background frame writing
+#include "snapshot.h"						// Recording and replay
+#include "particleStorage.h"				// Compact particle storage
+#include "vector.h"							// Vector math
+using namespace vec;
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define HEADLESS_PARTICLES		100000
+#define HEADLESS_STEPS			500
+#define HEADLESS_DT				0.02f			// Same step as the 50 FPS game loop
+#define HEADLESS_REPORTS		10				// Summaries printed over the run
+#define HEADLESS_RING_RADIUS	20.0f			// Where extra emitters are placed
+#define HEADLESS_FLUID_DEPTH	2.0f			// Depth the fluid settles to
+#define HEADLESS_SWARM_RADIUS	10.0f
+#define HEADLESS_SWARM_MASS		1000.0f			// Mass of the whole swarm, and of the body in its middle
+#define HEADLESS_FRAME_WIDTH	800				// Same frame and camera as the game window
+#define HEADLESS_FRAME_HEIGHT	600
+#define HEADLESS_SPRITE_SIZE	1.0f
+#define HEADLESS_TEXTURE_FILE	"Particle.bmp"
+#define HEADLESS_ATLAS_FILE		"particles.atlas"
+#define HEADLESS_SEEKS			100				// Random seeks timed on replay
+#define HEADLESS_STORE_REACH	64.0f			// Furthest a compact particle goes from its emitter
+
+/*-----------------------------------------------------------------------------------
+Print the number of live particles and where they are on average.  The sums
+are made over the first count particles of a pool, a block at a time for a
+store.
+-----------------------------------------------------------------------------------*/
+
+static int SumPositions(const CParticlePool& pool, int count, TVector *sum)
+{
+	const float *posX = pool.Column(PARTICLE_POS_X);
+	const float *posY = pool.Column(PARTICLE_POS_Y);
+	const float *posZ = pool.Column(PARTICLE_POS_Z);
+	const float *life = pool.Column(PARTICLE_LIFE);
+	int i, alive = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		if (life[i] > 0.0f)
+		{
+			*sum += TVector(posX[i], posY[i], posZ[i]);
+			alive++;
+		}
+	}
+
+	return alive;
+}
+
+static void PrintReport(int step, int alive, TVector centre)
+{
+	if (alive)
+		centre /= float(alive);
+
+	printf("step %6d  alive %9d  centre (%7.3f, %7.3f, %7.3f)\n",
+		step, alive, centre.x, centre.y, centre.z);
+}
+
+static void Report(const CParticlePool& pool, int step)
+{
+	TVector centre(0.0f, 0.0f, 0.0f);
+	int alive = SumPositions(pool, pool.GetLiveCount(), &centre);
+
+	PrintReport(step, alive, centre);
+}
+
+/*-----------------------------------------------------------------------------------
+One fountain, or a ring of emitters going through every spawn shape with the
+particles shared out between them
+-----------------------------------------------------------------------------------*/
+
+static TEmitterDesc GetEmitterDesc(int capacity, int i, int numEmitters)
+{
+	TEmitterDesc desc;
+	float angle;
+
+	if (numEmitters <= 1)
+		return CEmitter::Fountain(capacity);
+
+	desc = CEmitter::Fountain(capacity / numEmitters);
+	angle = PI2 * float(i) / float(numEmitters);
+	desc.transform.Translate(TVector(HEADLESS_RING_RADIUS * cosf(angle), 0.0f,
+		HEADLESS_RING_RADIUS * sinf(angle)));
+	desc.shape = i % (EMITTER_SHAPE_DISK + 1);
+	desc.speed = TEmitterRange(2.0f, 6.0f);
+	desc.jitterMin = TVector(-0.5f, 0.0f, -0.5f);
+	desc.jitterMax = TVector(0.5f, 4.0f, 0.5f);
+
+	return desc;
+}
+
+static void AddEmitters(CParticleSystem& system, int numEmitters)
+{
+	int i;
+
+	for (i = 0; i < MAX(numEmitters, 1); i++)
+	{
+		if (system.AddEmitter(GetEmitterDesc(system.GetCapacity(), i, numEmitters)) == RETURN_FAILURE)
+			break;
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+A block of fluid dropped into a tank, the tank is sized so the fluid settles
+about HEADLESS_FLUID_DEPTH deep
+-----------------------------------------------------------------------------------*/
+
+static void AddFluid(CParticleSystem& system)
+{
+	TSphParams params;
+	TEmitterDesc desc;
+	float volume = float(system.GetCapacity()) * params.particleMass / params.restDensity;
+	float halfWidth = 0.5f * sqrtf(volume / HEADLESS_FLUID_DEPTH);
+
+	params.boundsMin = TVector(-halfWidth, 0.0f, -halfWidth);
+	params.boundsMax = TVector(halfWidth, 1000.0f, halfWidth);
+	system.SetFluidParams(params);
+
+	// Half as wide and four times as deep as it will settle
+	desc.transform.Translate(TVector(0.0f, 2.0f * HEADLESS_FLUID_DEPTH + 1.0f, 0.0f));
+	desc.shape = EMITTER_SHAPE_BOX;
+	desc.size = TVector(0.5f * halfWidth, 2.0f * HEADLESS_FLUID_DEPTH, 0.5f * halfWidth);
+	desc.burstCount = system.GetCapacity();
+	desc.speed = TEmitterRange(0.0f, 0.0f);
+	desc.fade = TEmitterRange(0.0f, 0.0f);
+	desc.behaviour = PARTICLE_BEHAVIOUR_FLUID;
+
+	system.AddEmitter(desc);
+}
+
+/*-----------------------------------------------------------------------------------
+A ball of particles at rest round a heavy body, well above the floor, which
+falls in on itself under its own gravity
+-----------------------------------------------------------------------------------*/
+
+static void AddSwarm(CParticleSystem& system)
+{
+	TBarnesHutParams params;
+	TEmitterDesc desc;
+	TVector centre(0.0f, 3.0f * HEADLESS_SWARM_RADIUS, 0.0f);
+
+	params.particleMass = HEADLESS_SWARM_MASS / float(system.GetCapacity());
+	params.softening = 0.1f * HEADLESS_SWARM_RADIUS;
+	system.SetNBodyParams(params);
+	system.GetNBody().AddBody(centre, HEADLESS_SWARM_MASS);
+
+	desc.transform.Translate(centre);
+	desc.shape = EMITTER_SHAPE_SPHERE;
+	desc.size = TVector(HEADLESS_SWARM_RADIUS, 0.0f, 0.0f);
+	desc.burstCount = system.GetCapacity();
+	desc.speed = TEmitterRange(0.0f, 0.0f);
+	desc.fade = TEmitterRange(0.0f, 0.0f);
+	desc.behaviour = PARTICLE_BEHAVIOUR_NBODY;
+
+	system.AddEmitter(desc);
+}
+
+/*-----------------------------------------------------------------------------------
+Give every emitter a swirl round the y-axis, drag, a breeze and a pull towards
+a point above the origin, either fused at compile time or as a runtime list.
+Both should give the same position hash.
+-----------------------------------------------------------------------------------*/
+
+static void SetAffectors(CParticleSystem& system, int mode)
+{
+	static const TVortexAffector vortex = { 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 20.0f, 2.0f };
+	static const TDragAffector drag = { 0.1f, 0.02f };
+	static const TWindAffector wind = { 2.0f, 0.0f, 0.0f, 0.2f };
+	static const TAttractorAffector attractor = { 0.0f, 10.0f, 0.0f, 50.0f, 1.0f };
+	static CFusedAffectors<TVortexAffector, TDragAffector, TWindAffector, TAttractorAffector>
+		fused(vortex, drag, wind, attractor);
+	static CAffectorList list;
+	int i;
+
+	if (!list.GetCount())
+	{
+		list.Add(vortex);
+		list.Add(drag);
+		list.Add(wind);
+		list.Add(attractor);
+	}
+
+	for (i = 0; i < system.GetNumEmitters(); i++)
+	{
+		TEmitterDesc desc = system.GetEmitter(i).GetDesc();
+
+		desc.affectors = (mode == 1) ? (const CAffectorKernel *)&fused : &list;
+		system.GetEmitter(i).SetDesc(desc);
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Let every emitter feel the turbulence field
+-----------------------------------------------------------------------------------*/
+
+static void SetTurbulence(CParticleSystem& system, float scale)
+{
+	int i;
+
+	for (i = 0; i < system.GetNumEmitters(); i++)
+	{
+		TEmitterDesc desc = system.GetEmitter(i).GetDesc();
+
+		desc.turbulence = scale;
+		system.GetEmitter(i).SetDesc(desc);
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+FNV-1a hash of every particle position.  With the default counter based
+respawns it is the same whatever the number of threads.
+-----------------------------------------------------------------------------------*/
+
+static unsigned int HashFloats(unsigned int hash, const float *values, int count)
+{
+	const unsigned char *bytes = (const unsigned char *)values;
+	int i;
+
+	for (i = 0; i < count * int(sizeof(float)); i++)
+		hash = (hash ^ bytes[i]) * 16777619u;
+
+	return hash;
+}
+
+static unsigned int HashPositions(const CParticlePool& pool)
+{
+	unsigned int hash = 2166136261u;
+	int column;
+
+	for (column = PARTICLE_POS_X; column <= PARTICLE_POS_Z; column++)
+		hash = HashFloats(hash, pool.Column(column), pool.GetLiveCount());
+
+	return hash;
+}
+
+/*-----------------------------------------------------------------------------------
+What the software rasterizer needs to draw the particles as the game would see
+them
+-----------------------------------------------------------------------------------*/
+
+struct THeadlessView
+{
+	CSpriteAtlas	atlas;
+	CSoftRasterizer	raster;
+	CDepthSort		depthSort;
+	CFrustumCull	cull;
+	TMatrix			projection, modelView;
+	int				blendMode;
+};
+
+/*-----------------------------------------------------------------------------------
+Set up the game camera.  Particle.bmp is cooked to particles.atlas the first
+time, and the built in sprite texture is used when neither is in the working
+directory.
+-----------------------------------------------------------------------------------*/
+
+static int InitView(THeadlessView& view, int blendMode)
+{
+	TMatrix rotX, rotY, trans;
+
+	if (view.raster.Init(HEADLESS_FRAME_WIDTH, HEADLESS_FRAME_HEIGHT) != RETURN_SUCCESS)
+		return RETURN_FAILURE;
+	if (view.atlas.LoadCached(HEADLESS_ATLAS_FILE, HEADLESS_TEXTURE_FILE) != RETURN_SUCCESS ||
+		view.raster.SetAtlas(&view.atlas) != RETURN_SUCCESS)
+	{
+		printf("%s not found, using the built in texture\n", HEADLESS_TEXTURE_FILE);
+	}
+
+	// glTranslatef(0, 0, -25), then glRotatef(45, 1, 0, 0)
+	view.projection.Perspective(45.0f, float(HEADLESS_FRAME_WIDTH) / float(HEADLESS_FRAME_HEIGHT), 0.1f, 200.0f);
+	trans.LoadIdentity();
+	trans.Translate(TVector(0.0f, 0.0f, -25.0f));
+	rotX.Rotate(1, PI / 4.0f);
+	rotY.Rotate(2, 0.0f);
+	view.modelView = rotY * rotX * trans;
+
+	view.raster.SetCamera(view.projection, view.modelView);
+	view.raster.SetSpriteSize(HEADLESS_SPRITE_SIZE, HEADLESS_SPRITE_SIZE);
+	view.raster.SetBlendMode(blendMode);
+	view.cull.SetFrustum(view.projection, view.modelView);
+	view.blendMode = blendMode;
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Cull, sort when alpha blending, and draw the latest step, returns the seconds
+it took
+-----------------------------------------------------------------------------------*/
+
+static double DrawView(const CParticlePool& pool, CJobSystem& jobs, THeadlessView& view)
+{
+	PROFILE_ZONE("draw");
+
+	float radius = sqrtf(0.5f) * HEADLESS_SPRITE_SIZE;
+	const int *order = NULL;
+	const int *visible;
+	double start = CTimer::GetSeconds();
+
+	if (view.blendMode == BLEND_ALPHA)
+		order = view.depthSort.Sort(pool, pool.GetLiveCount(), view.modelView, 1.0f, &jobs);
+	visible = view.cull.Cull(pool, pool.GetLiveCount(), radius, 1.0f, order, &jobs);
+	view.raster.Render(pool, view.cull.GetNumVisible(), 1.0f, visible, &jobs);
+
+	return CTimer::GetSeconds() - start;
+}
+
+/*-----------------------------------------------------------------------------------
+Set up drawing to a frame name.  A pattern with a % or a .rgb file records
+every step through the writer, anything else is the last step's bitmap.
+-----------------------------------------------------------------------------------*/
+
+static int OpenFrames(THeadlessView& view, CFrameWriter& writer, const char *frame, int blendMode)
+{
+	if (InitView(view, blendMode) != RETURN_SUCCESS)
+	{
+		fprintf(stderr, "Failed to allocate a %d by %d frame\n", HEADLESS_FRAME_WIDTH, HEADLESS_FRAME_HEIGHT);
+		return RETURN_FAILURE;
+	}
+
+	if (strchr(frame, '%') || (strlen(frame) > 4 && !strcmp(frame + strlen(frame) - 4, ".rgb")))
+	{
+		if (writer.Open(frame, strchr(frame, '%') ? FRAME_FORMAT_BMP : FRAME_FORMAT_RAW,
+			HEADLESS_FRAME_WIDTH, HEADLESS_FRAME_HEIGHT) != RETURN_SUCCESS)
+		{
+			fprintf(stderr, "Failed to open %s\n", frame);
+			return RETURN_FAILURE;
+		}
+	}
+
+	return RETURN_SUCCESS;
+}
+
+// Draw a step into a writer slot, waiting for one when the disk
+// falls behind as every frame is wanted.  Returns the seconds it
+// took to draw.
+static double RecordFrame(const CParticlePool& pool, CJobSystem& jobs, THeadlessView& view,
+	CFrameWriter& writer)
+{
+	double seconds = DrawView(pool, jobs, view);
+	unsigned char *pixels;
+
+	if ((pixels = writer.Acquire(true)) != NULL)
+	{
+		memcpy(pixels, view.raster.GetPixels(), 4 * HEADLESS_FRAME_WIDTH * HEADLESS_FRAME_HEIGHT);
+		writer.Submit(pixels);
+	}
+
+	return seconds;
+}
+
+// Finish the recording, or draw the last step to its bitmap
+static void CloseFrames(const CParticlePool& pool, CJobSystem& jobs, THeadlessView& view,
+	CFrameWriter& writer, const char *frame, int numFrames, double drawSeconds)
+{
+	const char *order = (view.blendMode == BLEND_ALPHA) ? "back to front" : "additively";
+
+	if (writer.IsOpen())
+	{
+		writer.Close();
+		printf("%d frames drawn %s to %s, %.2f ms a frame, %d dropped\n", writer.GetNumWritten(),
+			order, frame, drawSeconds * 1000.0 / MAX(1, numFrames), writer.GetNumDropped());
+		return;
+	}
+
+	drawSeconds = DrawView(pool, jobs, view);
+	printf("%d of %d sprites drawn %s to %s in %.2f ms, %s spans\n", view.cull.GetNumVisible(),
+		pool.GetLiveCount(), order, frame, drawSeconds * 1000.0, view.raster.GetSimd() ? "SSE2" : "scalar");
+
+	if (view.raster.SaveBMP(frame) != RETURN_SUCCESS)
+		fprintf(stderr, "Failed to write %s\n", frame);
+}
+
+/*-----------------------------------------------------------------------------------
+Play a recording back through the same reports and drawing as a run, with no
+simulation.  The hash at the end matches the one printed by the run which made
+the recording.  Then seek about it at random and back to the end.
+-----------------------------------------------------------------------------------*/
+
+static int Replay(int argc, char *argv[])
+{
+	CJobSystem jobs;
+	CSnapshotReader reader;
+	const char *snapshot = argv[2];
+	const char *frame = (argc > 3) ? argv[3] : NULL;
+	int blendMode = (argc > 4) ? atoi(argv[4]) : BLEND_ADDITIVE;
+	int numThreads = (argc > 5) ? atoi(argv[5]) : 0;
+	THeadlessView view;
+	CFrameWriter writer;
+	int i, numFrames, reportEvery;
+	unsigned int hash;
+	double start, seconds, drawSeconds = 0.0;
+
+	if (reader.Open(snapshot) != RETURN_SUCCESS)
+	{
+		fprintf(stderr, "Failed to read %s\n", snapshot);
+		return 1;
+	}
+
+	jobs.Init(numThreads);
+	if (frame && OpenFrames(view, writer, frame, blendMode) != RETURN_SUCCESS)
+		return 1;
+
+	numFrames = reader.GetNumFrames();
+	reportEvery = MAX(1, numFrames / HEADLESS_REPORTS);
+	printf("%s: %d frames, %d threads\n", snapshot, numFrames, jobs.GetNumThreads());
+
+	start = CTimer::GetSeconds();
+
+	for (i = 1; i <= numFrames; i++)
+	{
+		if (reader.Next(&jobs) != RETURN_SUCCESS)
+		{
+			fprintf(stderr, "Frame %d of %s is damaged\n", i - 1, snapshot);
+			return 1;
+		}
+
+		if (i % reportEvery == 0)
+			Report(reader.GetPool(), i);
+
+		if (writer.IsOpen())
+			drawSeconds += RecordFrame(reader.GetPool(), jobs, view, writer);
+
+		CProfiler::EndFrame();
+	}
+
+	seconds = CTimer::GetSeconds() - start - drawSeconds;
+	hash = HashPositions(reader.GetPool());
+
+	printf("%.3f s, %.2f ms a frame, position hash %08x\n", seconds, seconds * 1000.0 / numFrames, hash);
+
+	// Seeking needs the key frame before and the deltas after it
+	start = CTimer::GetSeconds();
+	for (i = 0; i < HEADLESS_SEEKS; i++)
+		reader.Seek(int((i * 2654435761u) % (unsigned int)numFrames), &jobs);
+	reader.Seek(numFrames - 1, &jobs);
+	seconds = CTimer::GetSeconds() - start;
+
+	printf("%d random seeks, %.2f ms each, last frame hash %s\n", HEADLESS_SEEKS + 1,
+		seconds * 1000.0 / (HEADLESS_SEEKS + 1), (HashPositions(reader.GetPool()) == hash) ? "matches" : "differs");
+
+	if (frame)
+		CloseFrames(reader.GetPool(), jobs, view, writer, frame, numFrames, drawSeconds);
+
+	CProfiler::PrintStats(stdout);
+
+	reader.Close();
+	jobs.Shutdown();
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------------
+A run with the particles kept in a compact store instead of the system's pool.
+The fountains are those of a run with the same arguments and each particle gets
+the same random numbers, so the reports of the two can be compared.  New
+particles are spawned into a pool of one batch and packed into the store, and
+the store is unpacked a batch at a time to report, or into a pool of every
+particle to draw.
+-----------------------------------------------------------------------------------*/
+
+struct TCompactRun
+{
+	CParticleStore<TCompactPrecision>	store;
+	CEmitter		*emitters;
+	int				*dead;						// Deaths per emitter this step
+	int				numEmitters;
+	CRandomPhilox	random;						// Keyed as CParticleSystem's RANDOM_MODE_COUNTER
+	CParticlePool	batch;
+	CParticlePool	draw;						// Only allocated when drawing
+};
+
+// Remove the dead, spawn as the system's emitters would and step
+static void StepCompact(TCompactRun& run, float dt)
+{
+	PROFILE_ZONE("step");
+
+	TRandU32 random[EMITTER_RANDOM_WORDS][SPAWN_BATCH];
+	TRandU64 serial;
+	int i, axis, block, p, n, wanted, given, first;
+
+	memset(run.dead, 0, sizeof(int) * run.numEmitters);
+	run.store.RemoveDead(run.dead, run.numEmitters);
+
+	for (i = 0; i < run.numEmitters; i++)
+	{
+		run.emitters[i].Died(run.dead[i]);
+
+		wanted = run.emitters[i].Schedule(dt, run.store.GetCapacity() - run.store.GetLiveCount());
+		given = run.store.Allocate(wanted, &first);
+		serial = run.emitters[i].GetSerial();
+		run.emitters[i].Spawned(given);
+
+		for (p = 0; p < given; p += n)
+		{
+			n = MIN(SPAWN_BATCH, given - p);
+
+			for (block = 0; block < EMITTER_RANDOM_BLOCKS; block++)
+			{
+				run.random.FillRange(TRandU32(serial + TRandU64(p)), n, TRandU32((serial + TRandU64(p)) >> 32),
+					TRandU32(block), TRandU32(i), random[block * 4], random[block * 4 + 1], random[block * 4 + 2],
+					random[block * 4 + 3]);
+			}
+			run.emitters[i].SpawnBatch(run.batch, 0, n, (unsigned int)i, dt, random);
+
+			// The store takes the latest positions, which for a new
+			// particle is where it was spawned
+			for (axis = 0; axis < 3; axis++)
+				memcpy(run.batch.Column(PARTICLE_POS_X + axis), run.batch.Column(PARTICLE_PREV_X + axis), sizeof(float) * n);
+			run.store.Pack(run.batch, 0, n, first + p);
+		}
+	}
+
+	run.store.Update(dt);
+}
+
+static void ReportCompact(TCompactRun& run, int step)
+{
+	TVector centre(0.0f, 0.0f, 0.0f);
+	int first, n, alive = 0;
+
+	for (first = 0; first < run.store.GetLiveCount(); first += n)
+	{
+		n = MIN(SPAWN_BATCH, run.store.GetLiveCount() - first);
+		run.store.UnpackDraw(run.batch, first, n, 0);
+		alive += SumPositions(run.batch, n, &centre);
+	}
+
+	PrintReport(step, alive, centre);
+}
+
+// HashPositions of the positions as they are unpacked
+static unsigned int HashCompact(TCompactRun& run)
+{
+	unsigned int hash = 2166136261u;
+	int column, first, n;
+
+	for (column = PARTICLE_POS_X; column <= PARTICLE_POS_Z; column++)
+	{
+		for (first = 0; first < run.store.GetLiveCount(); first += n)
+		{
+			n = MIN(SPAWN_BATCH, run.store.GetLiveCount() - first);
+			run.store.UnpackDraw(run.batch, first, n, 0);
+			hash = HashFloats(hash, run.batch.Column(column), n);
+		}
+	}
+
+	return hash;
+}
+
+// Unpack every particle into the draw pool, returns the seconds it took
+static double UnpackCompact(TCompactRun& run, CJobSystem& jobs)
+{
+	double start = CTimer::GetSeconds();
+
+	run.draw.SetLiveCount(run.store.GetLiveCount());
+	jobs.ParallelFor(run.store.GetLiveCount(), PARTICLE_STORE_GRAIN, [&](int first, int count, int worker) {
+		run.store.UnpackDraw(run.draw, first, count, first);
+	});
+
+	return CTimer::GetSeconds() - start;
+}
+
+static int RunCompact(int argc, char *argv[])
+{
+	CJobSystem jobs;
+	TCompactRun run;
+	int numParticles = (argc > 2) ? atoi(argv[2]) : HEADLESS_PARTICLES;
+	int numSteps = (argc > 3) ? atoi(argv[3]) : HEADLESS_STEPS;
+	int numThreads = (argc > 4) ? atoi(argv[4]) : 0;
+	TRandU64 seed = (argc > 5) ? strtoull(argv[5], NULL, 0) : DEFAULT_RANDOM_SEED;
+	int numEmitters = (argc > 6) ? atoi(argv[6]) : 1;
+	const char *frame = (argc > 7 && strcmp(argv[7], "-")) ? argv[7] : NULL;
+	int blendMode = (argc > 8) ? atoi(argv[8]) : BLEND_ADDITIVE;
+	TStorageRange reach[3] = { TStorageRange(HEADLESS_STORE_REACH), TStorageRange(HEADLESS_STORE_REACH),
+		TStorageRange(HEADLESS_STORE_REACH) };
+	THeadlessView view;
+	CFrameWriter writer;
+	int i, step, reportEvery;
+	double start, seconds, drawSeconds = 0.0;
+
+	CProfiler::SetThreadName("main");
+	jobs.Init(numThreads);
+
+	// As many emitters as AddEmitters gets into the system
+	run.numEmitters = MIN(MAX(numEmitters, 1), MAX_EMITTERS);
+	if (run.store.Init(numParticles, reach, run.numEmitters, &jobs) != RETURN_SUCCESS ||
+		run.batch.Init(SPAWN_BATCH) != RETURN_SUCCESS || (frame && run.draw.Init(numParticles) != RETURN_SUCCESS))
+	{
+		fprintf(stderr, "Failed to allocate %d particles\n", numParticles);
+		return 1;
+	}
+
+	run.emitters = new CEmitter[run.numEmitters];
+	run.dead = new int[run.numEmitters];
+	for (i = 0; i < run.numEmitters; i++)
+	{
+		TEmitterDesc desc = GetEmitterDesc(numParticles, i, numEmitters);
+		TVector origin = desc.transform.GetTranslation();
+
+		run.emitters[i].SetDesc(desc);
+		run.store.SetOrigin(i, origin.x, origin.y, origin.z);
+	}
+	run.random.Seed(seed);
+
+	if (frame && OpenFrames(view, writer, frame, blendMode) != RETURN_SUCCESS)
+		return 1;
+
+	printf("%d particles, %d emitters, %d steps, %d threads, compact store of %d bytes a particle\n", numParticles,
+		run.numEmitters, numSteps, jobs.GetNumThreads(), (int)CParticleStore<TCompactPrecision>::GetBytesPerParticle());
+
+	reportEvery = MAX(1, numSteps / HEADLESS_REPORTS);
+
+	start = CTimer::GetSeconds();
+
+	for (step = 1; step <= numSteps; step++)
+	{
+		StepCompact(run, HEADLESS_DT);
+
+		if (step % reportEvery == 0)
+			ReportCompact(run, step);
+
+		if (writer.IsOpen())
+		{
+			drawSeconds += UnpackCompact(run, jobs);
+			drawSeconds += RecordFrame(run.draw, jobs, view, writer);
+		}
+
+		CProfiler::EndFrame();
+	}
+
+	seconds = CTimer::GetSeconds() - start - drawSeconds;
+
+	printf("%.3f s, %.1f M particle steps/s, position hash %08x\n", seconds,
+		double(numParticles) * numSteps / seconds * 1.0e-6, HashCompact(run));
+
+	if (frame)
+	{
+		if (!writer.IsOpen())
+			UnpackCompact(run, jobs);
+		CloseFrames(run.draw, jobs, view, writer, frame, numSteps, drawSeconds);
+	}
+
+	CProfiler::PrintStats(stdout);
+
+	delete[] run.emitters;
+	delete[] run.dead;
+	run.store.Shutdown();
+	jobs.Shutdown();
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------------
+Program entry point
+-----------------------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+{
+	if (argc > 2 && !strcmp(argv[1], "replay"))
+		return Replay(argc, argv);
+	if (argc > 1 && !strcmp(argv[1], "compact"))
+		return RunCompact(argc, argv);
+
+	CJobSystem jobs;
+	CParticleSystem system;
+	int numParticles = (argc > 1) ? atoi(argv[1]) : HEADLESS_PARTICLES;
+	int numSteps = (argc > 2) ? atoi(argv[2]) : HEADLESS_STEPS;
+	int numThreads = (argc > 3) ? atoi(argv[3]) : 0;
+	TRandU64 seed = (argc > 4) ? strtoull(argv[4], NULL, 0) : DEFAULT_RANDOM_SEED;
+	int numEmitters = (argc > 5) ? atoi(argv[5]) : 1;
+	float collideRadius = (argc > 6) ? float(atof(argv[6])) : 0.0f;
+	int behaviour = (argc > 7) ? atoi(argv[7]) : PARTICLE_BEHAVIOUR_BALLISTIC;
+	int affectors = (argc > 8) ? atoi(argv[8]) : 0;
+	float turbulence = (argc > 9) ? float(atof(argv[9])) : 0.0f;
+	const char *frame = (argc > 10 && strcmp(argv[10], "-")) ? argv[10] : NULL;
+	int blendMode = (argc > 11) ? atoi(argv[11]) : BLEND_ADDITIVE;
+	const char *snapshot = (argc > 12 && strcmp(argv[12], "-")) ? argv[12] : NULL;
+	const char *trace = (argc > 13) ? argv[13] : NULL;
+	THeadlessView view;
+	CFrameWriter writer;
+	CSnapshotWriter recorder;
+	int step, reportEvery;
+	double start, seconds, drawSeconds = 0.0, recordSeconds = 0.0, rawBytes = 0.0;
+
+	CProfiler::SetThreadName("main");
+	jobs.Init(numThreads);
+	if (system.Init(numParticles, &jobs) != RETURN_SUCCESS)
+	{
+		fprintf(stderr, "Failed to allocate %d particles\n", numParticles);
+		return 1;
+	}
+	system.SetRandomSeed(seed);
+	if (behaviour == PARTICLE_BEHAVIOUR_FLUID)
+		AddFluid(system);
+	else if (behaviour == PARTICLE_BEHAVIOUR_NBODY)
+		AddSwarm(system);
+	else
+		AddEmitters(system, numEmitters);
+	if (affectors)
+		SetAffectors(system, affectors);
+	if (turbulence != 0.0f)
+		SetTurbulence(system, turbulence);
+	system.SetCollisions(collideRadius, 0.5f);
+
+	if (frame && OpenFrames(view, writer, frame, blendMode) != RETURN_SUCCESS)
+		return 1;
+
+	if (snapshot && recorder.Open(snapshot, system.GetCapacity()) != RETURN_SUCCESS)
+	{
+		fprintf(stderr, "Failed to open %s\n", snapshot);
+		return 1;
+	}
+
+	printf("%d particles, %d emitters, %d steps, %d threads, %s kernel\n", numParticles,
+		system.GetNumEmitters(), numSteps, jobs.GetNumThreads(), GetUpdateKernelName(GetUpdateKernel()));
+
+	reportEvery = MAX(1, numSteps / HEADLESS_REPORTS);
+
+	start = CTimer::GetSeconds();
+
+	for (step = 1; step <= numSteps; step++)
+	{
+		system.Update(HEADLESS_DT);
+
+		if (step % reportEvery == 0)
+			Report(system.GetPool(), step);
+
+		if (writer.IsOpen())
+			drawSeconds += RecordFrame(system.GetPool(), jobs, view, writer);
+
+		if (recorder.IsOpen())
+		{
+			double recordStart = CTimer::GetSeconds();
+
+			recorder.Append(system.GetPool(), step * HEADLESS_DT, &jobs);
+			rawBytes += double(system.GetNumParticles()) * PARTICLE_NUM_COLUMNS * sizeof(float);
+			recordSeconds += CTimer::GetSeconds() - recordStart;
+		}
+
+		CProfiler::EndFrame();
+	}
+
+	seconds = CTimer::GetSeconds() - start - drawSeconds - recordSeconds;
+
+	printf("%.3f s, %.1f M particle steps/s, position hash %08x\n", seconds,
+		double(numParticles) * numSteps / seconds * 1.0e-6, HashPositions(system.GetPool()));
+
+	if (recorder.IsOpen())
+	{
+		int numFrames = recorder.GetNumFrames();
+
+		if (recorder.Close() != RETURN_SUCCESS)
+			fprintf(stderr, "Failed to write all of %s\n", snapshot);
+		printf("%d frames recorded to %s, %.1f MB, %.1f%% of the pool, %.2f ms a frame\n", numFrames,
+			snapshot, double(recorder.GetBytesWritten()) / (1024.0 * 1024.0),
+			100.0 * double(recorder.GetBytesWritten()) / MAX(rawBytes, 1.0), recordSeconds * 1000.0 / MAX(1, numFrames));
+	}
+
+	if (frame)
+		CloseFrames(system.GetPool(), jobs, view, writer, frame, numSteps, drawSeconds);
+
+	CProfiler::PrintStats(stdout);
+	if (trace && CProfiler::WriteTrace(trace) != RETURN_SUCCESS)
+		fprintf(stderr, "Failed to write %s\n", trace);
+
+	system.Shutdown();
+	jobs.Shutdown();
+
+	return 0;
+}
@@ -0,0 +1,319 @@
+/*-----------------------------------------------------------------------------------
+File:			jobSystem.cpp
+Author:			Steve Costa
+Description:	Worker pool and work stealing deques used to run the particle
+passes across all cores.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "jobSystem.h"						// Class header file
+#include "simUtil.h"						// Common Macros, snprintf on Visual Studio 2013
+#include "profiler.h"						// Job zones
+
+/*-----------------------------------------------------------------------------------
+Worker index of the current thread, threads outside the pool count as worker 0
+-----------------------------------------------------------------------------------*/
+
+#if defined(_MSC_VER)
+static __declspec(thread) int s_iWorker = 0;
+#else
+static __thread int s_iWorker = 0;
+#endif
+
+/*-----------------------------------------------------------------------------------
+Deque methods.  A spin lock is enough here, the critical sections are a handful
+of instructions and are rarely contended since owners and thieves work at
+opposite ends.
+-----------------------------------------------------------------------------------*/
+
+CJobDeque::CJobDeque()
+{
+	m_lock.clear();
+	m_iTop = 0;
+	m_iBottom = 0;
+}
+
+bool CJobDeque::Push(const TJob& job)
+{
+	bool pushed = false;
+
+	while (m_lock.test_and_set(std::memory_order_acquire));
+
+	if (m_iBottom - m_iTop < JOB_QUEUE_SIZE)
+	{
+		m_jobs[m_iBottom % JOB_QUEUE_SIZE] = job;
+		m_iBottom++;
+		pushed = true;
+	}
+
+	m_lock.clear(std::memory_order_release);
+
+	return pushed;
+}
+
+bool CJobDeque::Pop(TJob& job)
+{
+	bool popped = false;
+
+	while (m_lock.test_and_set(std::memory_order_acquire));
+
+	if (m_iBottom > m_iTop)
+	{
+		m_iBottom--;
+		job = m_jobs[m_iBottom % JOB_QUEUE_SIZE];
+		popped = true;
+
+		// Rewind the indices when empty so they never overflow
+		if (m_iBottom == m_iTop)
+			m_iBottom = m_iTop = 0;
+	}
+
+	m_lock.clear(std::memory_order_release);
+
+	return popped;
+}
+
+bool CJobDeque::Steal(TJob& job)
+{
+	bool stolen = false;
+
+	while (m_lock.test_and_set(std::memory_order_acquire));
+
+	if (m_iBottom > m_iTop)
+	{
+		job = m_jobs[m_iTop % JOB_QUEUE_SIZE];
+		m_iTop++;
+		stolen = true;
+
+		if (m_iBottom == m_iTop)
+			m_iBottom = m_iTop = 0;
+	}
+
+	m_lock.clear(std::memory_order_release);
+
+	return stolen;
+}
+
+/*-----------------------------------------------------------------------------------
+Set any initial values for class state variables.
+-----------------------------------------------------------------------------------*/
+
+CJobSystem::CJobSystem()
+{
+	m_iNumThreads = 0;
+	m_iPending = 0;
+	m_bQuit = false;
+}
+
+CJobSystem::~CJobSystem()
+{
+	Shutdown();
+}
+
+/*-----------------------------------------------------------------------------------
+Create the deques and start the background workers
+-----------------------------------------------------------------------------------*/
+
+int CJobSystem::Init(int numThreads)
+{
+	int i;
+
+	Shutdown();
+
+	if (numThreads <= 0)
+		numThreads = (int)std::thread::hardware_concurrency();
+	if (numThreads <= 0)
+		numThreads = 1;
+
+	m_iNumThreads = numThreads;
+	m_iPending = 0;
+	m_bQuit = false;
+
+	for (i = 0; i < m_iNumThreads; i++)
+		m_deques.push_back(new CJobDeque());
+
+	for (i = 1; i < m_iNumThreads; i++)
+		m_threads.push_back(std::thread(&CJobSystem::WorkerMain, this, i));
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Stop the workers and free the deques
+-----------------------------------------------------------------------------------*/
+
+int CJobSystem::Shutdown()
+{
+	size_t i;
+
+	{
+		std::lock_guard<std::mutex> lock(m_sleepLock);
+		m_bQuit = true;
+	}
+	m_wake.notify_all();
+
+	for (i = 0; i < m_threads.size(); i++)
+		m_threads[i].join();
+	m_threads.clear();
+
+	for (i = 0; i < m_deques.size(); i++)
+		delete m_deques[i];
+	m_deques.clear();
+
+	m_iNumThreads = 0;
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Take a job from our own deque, otherwise try to steal from the others starting
+with the next worker along so thieves spread out.
+-----------------------------------------------------------------------------------*/
+
+bool CJobSystem::FindJob(int worker, TJob& job)
+{
+	int i;
+
+	if (m_deques[worker]->Pop(job))
+		return true;
+
+	for (i = 1; i < m_iNumThreads; i++)
+	{
+		if (m_deques[(worker + i) % m_iNumThreads]->Steal(job))
+			return true;
+	}
+
+	return false;
+}
+
+/*-----------------------------------------------------------------------------------
+Keep splitting the job in half on grain boundaries, leaving the upper halves
+in our deque for others to steal, then run what remains.
+-----------------------------------------------------------------------------------*/
+
+void CJobSystem::RunJob(int worker, TJob job)
+{
+	TJobGroup *group = job.pGroup;
+
+	while (job.iCount > group->iGrain)
+	{
+		TJob upper;
+		int half = ((job.iCount / group->iGrain) >> 1) * group->iGrain;
+
+		if (half <= 0)
+			break;
+
+		upper.pGroup = group;
+		upper.iFirst = job.iFirst + half;
+		upper.iCount = job.iCount - half;
+
+		// Deque full, just run the whole thing here
+		if (!m_deques[worker]->Push(upper))
+			break;
+
+		job.iCount = half;
+
+		// Wake a sleeping worker to come and steal it
+		m_wake.notify_one();
+	}
+
+	{
+		CProfileZone zone(group->pszName, true);
+		group->pfnFunc(group->pData, job.iFirst, job.iCount, worker);
+	}
+
+	group->iRemaining -= job.iCount;
+	m_iPending -= job.iCount;
+}
+
+/*-----------------------------------------------------------------------------------
+Background worker loop.  Spin for a while looking for work before going to
+sleep until more is queued.
+-----------------------------------------------------------------------------------*/
+
+void CJobSystem::WorkerMain(int worker)
+{
+	TJob job;
+	int spins = 0;
+	char name[32];
+
+	s_iWorker = worker;
+	snprintf(name, sizeof(name), "worker %d", worker);
+	CProfiler::SetThreadName(name);
+
+	while (!m_bQuit)
+	{
+		if (FindJob(worker, job))
+		{
+			RunJob(worker, job);
+			spins = 0;
+			continue;
+		}
+
+		if (++spins < JOB_SPIN_COUNT)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_sleepLock);
+		m_wake.wait(lock, [this] { return m_bQuit || m_iPending > 0; });
+		spins = 0;
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Run a function over a range on every worker and wait for it to finish.  The
+calling thread takes part instead of sitting idle.
+-----------------------------------------------------------------------------------*/
+
+void CJobSystem::ParallelFor(int count, int grain, PFNJOBRANGE func, void *data)
+{
+	TJobGroup group;
+	TJob job;
+	int worker = s_iWorker;
+
+	if (count <= 0)
+		return;
+
+	if (grain <= 0)
+		grain = 1;
+
+	// Nothing to share, or no workers to share with
+	if (m_iNumThreads <= 1 || count <= grain)
+	{
+		func(data, 0, count, worker);
+		return;
+	}
+
+	group.pfnFunc = func;
+	group.pData = data;
+	group.iGrain = grain;
+	group.pszName = CProfiler::GetZoneName();
+	if (!group.pszName)
+		group.pszName = "job";
+	group.iRemaining = count;
+
+	{
+		std::lock_guard<std::mutex> lock(m_sleepLock);
+		m_iPending += count;
+	}
+	m_wake.notify_all();
+
+	job.pGroup = &group;
+	job.iFirst = 0;
+	job.iCount = count;
+	RunJob(worker, job);
+
+	// Help out until every piece of this range is done
+	while (group.iRemaining > 0)
+	{
+		if (FindJob(worker, job))
+			RunJob(worker, job);
+		else
+			std::this_thread::yield();
+	}
+}
@@ -0,0 +1,151 @@
+/*-----------------------------------------------------------------------------------
+File:			jobSystem.h
+Author:			Steve Costa
+Description:	A fixed pool of worker threads that share out ranges of work.
+Each worker owns a deque of jobs, it takes work from the back of
+its own deque and steals from the front of the others when it
+runs dry.  Ranges are split recursively on multiples of the grain
+size so that, with a grain of whole cache lines, two jobs never
+write to the same line of a particle column.
+-----------------------------------------------------------------------------------*/
+
+#ifndef JOB_SYSTEM_H_
+#define JOB_SYSTEM_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define JOB_QUEUE_SIZE			256				// Jobs held by one worker deque
+#define JOB_CACHE_LINE			64				// Padding to keep workers apart
+#define JOB_SPIN_COUNT			2000			// Steal attempts before sleeping
+
+/*-----------------------------------------------------------------------------------
+A job runs func(data, first, count, worker) over part of a range
+-----------------------------------------------------------------------------------*/
+
+typedef void (*PFNJOBRANGE)(void *data, int first, int count, int worker);
+
+struct TJobGroup
+{
+	PFNJOBRANGE			pfnFunc;				// Function to run
+	void				*pData;					// User data for the function
+	int					iGrain;					// Split granularity
+	const char			*pszName;				// Zone the range was started in, its jobs are profiled as
+	std::atomic<int>	iRemaining;				// Items not yet processed
+};
+
+struct TJob
+{
+	TJobGroup			*pGroup;				// Range this job belongs to
+	int					iFirst;					// First item
+	int					iCount;					// Number of items
+};
+
+/*-----------------------------------------------------------------------------------
+Work stealing deque owned by a single worker.  The owner pushes and pops at
+the bottom, other workers steal from the top.  It is padded out to whole
+cache lines so neighbouring deques do not falsely share.
+-----------------------------------------------------------------------------------*/
+
+class CJobDeque
+{
+	// Attributes
+private:
+
+	char				m_padFront[JOB_CACHE_LINE];
+	std::atomic_flag	m_lock;					// Guards top and bottom
+	int					m_iTop;					// Oldest job, stolen first
+	int					m_iBottom;				// Newest job, run first by the owner
+	TJob				m_jobs[JOB_QUEUE_SIZE];
+	char				m_padBack[JOB_CACHE_LINE];
+
+	// Methods
+public:
+
+	CJobDeque();
+
+	bool Push(const TJob& job);					// Owner adds a job
+	bool Pop(TJob& job);						// Owner takes its newest job
+	bool Steal(TJob& job);						// Another worker takes the oldest job
+};
+
+/*-----------------------------------------------------------------------------------
+Job system class definition
+-----------------------------------------------------------------------------------*/
+
+class CJobSystem
+{
+	// Attributes
+private:
+
+	int							m_iNumThreads;		// Workers including the caller
+	std::vector<CJobDeque *>	m_deques;			// One deque per worker
+	std::vector<std::thread>	m_threads;			// Background workers
+
+	std::mutex					m_sleepLock;		// Guards sleeping workers
+	std::condition_variable		m_wake;				// Signalled when work is queued
+	std::atomic<int>			m_iPending;			// Items queued but not finished
+	std::atomic<bool>			m_bQuit;			// Tell workers to exit
+
+	// Methods
+private:
+
+	void WorkerMain(int worker);					// Background worker loop
+	bool FindJob(int worker, TJob& job);			// Pop own work or steal
+	void RunJob(int worker, TJob job);				// Split and run a job
+
+	template <class F>
+	static void InvokeRange(void *data, int first, int count, int worker) {
+		(*(const F *)data)(first, count, worker);
+	}
+
+public:
+
+	CJobSystem();
+	~CJobSystem();
+
+	// Start numThreads - 1 workers, the calling thread is worker 0.
+	// Zero uses one thread per hardware thread.
+	int Init(int numThreads);
+	int Shutdown();
+
+	int GetNumThreads() const { return m_iNumThreads; }
+
+	// Run func over [0, count) in pieces no smaller than grain and wait
+	// for all of them.  Pieces start on multiples of grain.  Must only
+	// be called from worker 0 or from inside a running job.
+	void ParallelFor(int count, int grain, PFNJOBRANGE func, void *data);
+
+	// Same as above for any callable taking (first, count, worker)
+	template <class F>
+	void ParallelFor(int count, int grain, const F& func) {
+		ParallelFor(count, grain, &InvokeRange<F>, (void *)&func);
+	}
+};
+
+/*-----------------------------------------------------------------------------------
+ParallelFor on the given job system, or all on the calling thread as worker 0
+when there is none
+-----------------------------------------------------------------------------------*/
+
+template <class F>
+inline void RunJobs(CJobSystem *jobs, int count, int grain, const F& func)
+{
+	if (jobs)
+		jobs->ParallelFor(count, grain, func);
+	else if (count > 0)
+		func(0, count, 0);
+}
+
+#endif
@@ -0,0 +1,155 @@
+/*-----------------------------------------------------------------------------------
+File:			mappedFile.h
+Author:			Steve Costa
+Description:	A file mapped read only into memory.  The operating system pages
+it in as it is touched, so data kept in the layout it is used in
+can be used straight from the mapping with no reading or decoding.
+-----------------------------------------------------------------------------------*/
+
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "simUtil.h"						// Common Macros
+
+/*-----------------------------------------------------------------------------------
+Mapped file class definition
+-----------------------------------------------------------------------------------*/
+
+class CMappedFile
+{
+	// Attributes
+private:
+
+	const unsigned char	*m_pucData;
+	size_t				m_uiSize;
+
+	// Methods
+private:
+
+	// A mapping has one owner, see Swap
+	CMappedFile(const CMappedFile&);
+	CMappedFile& operator=(const CMappedFile&);
+
+public:
+
+	CMappedFile() {
+		m_pucData = NULL;
+		m_uiSize = 0;
+	}
+
+	~CMappedFile() {
+		Close();
+	}
+
+	//-----------------------------------------------------------
+	// Map a whole file, empty files cannot be mapped
+	//-----------------------------------------------------------
+	int Open(const char *filename) {
+		Close();
+
+		if (!filename)
+			return RETURN_FAILURE;
+
+#ifdef _WIN32
+		HANDLE file, mapping;
+		LARGE_INTEGER size;
+
+		file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return RETURN_FAILURE;
+
+		if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0 ||
+			!(mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL)))
+		{
+			CloseHandle(file);
+			return RETURN_FAILURE;
+		}
+
+		// The view keeps the file open once the handles are gone
+		m_pucData = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		m_uiSize = size_t(size.QuadPart);
+		CloseHandle(mapping);
+		CloseHandle(file);
+#else
+		struct stat info;
+		void *data;
+		int file = open(filename, O_RDONLY);
+
+		if (file < 0)
+			return RETURN_FAILURE;
+
+		if (fstat(file, &info) != 0 || info.st_size <= 0)
+		{
+			close(file);
+			return RETURN_FAILURE;
+		}
+
+		// The mapping keeps the file open once it is closed
+		data = mmap(NULL, size_t(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+		close(file);
+
+		m_pucData = (data == MAP_FAILED) ? NULL : (const unsigned char *)data;
+		m_uiSize = size_t(info.st_size);
+#endif
+
+		if (!m_pucData)
+		{
+			m_uiSize = 0;
+			return RETURN_FAILURE;
+		}
+
+		return RETURN_SUCCESS;
+	}
+
+	//-----------------------------------------------------------
+	// Unmap the file
+	//-----------------------------------------------------------
+	void Close() {
+		if (m_pucData)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(m_pucData);
+#else
+			munmap((void *)m_pucData, m_uiSize);
+#endif
+		}
+
+		m_pucData = NULL;
+		m_uiSize = 0;
+	}
+
+	//-----------------------------------------------------------
+	// Trade mappings, to check a file before giving up the one
+	// in use
+	//-----------------------------------------------------------
+	void Swap(CMappedFile& other) {
+		const unsigned char *data = m_pucData;
+		size_t size = m_uiSize;
+
+		m_pucData = other.m_pucData;
+		m_uiSize = other.m_uiSize;
+		other.m_pucData = data;
+		other.m_uiSize = size;
+	}
+
+	const unsigned char *GetData() const { return m_pucData; }
+	size_t GetSize() const { return m_uiSize; }
+};
+
+#endif
@@ -145,6 +145,20 @@ namespace matrix
 			m[15] = 1.0f;
 		}
 
+		// Perspective projection as gluPerspective makes it.
+		// fovY is the vertical field of view in degrees.
+		void Perspective(float fovY, float aspect, float zNear, float zFar)
+		{
+			float f = 1.0f / tan(fovY * 3.14159265f / 360.0f);
+
+			LoadZero();
+			m[0] = f / aspect;
+			m[5] = f;
+			m[10] = (zFar + zNear) / (zNear - zFar);
+			m[11] = -1.0f;
+			m[14] = 2.0f * zFar * zNear / (zNear - zFar);
+		}
+
 		// Return the translation vector stored in the matrix
 		TVector GetTranslation() const
 		{
@@ -176,6 +190,15 @@ namespace matrix
 		return lhs;
 	}
 
+	// Overload * operator for a 1x4 vector, w is used as it is
+	inline TVector4 operator * (const TVector4& lhs, const TMatrix& rhs)
+	{
+		return TVector4(lhs.x * rhs.m[0] + lhs.y * rhs.m[4] + lhs.z * rhs.m[8] + lhs.w * rhs.m[12],
+			lhs.x * rhs.m[1] + lhs.y * rhs.m[5] + lhs.z * rhs.m[9] + lhs.w * rhs.m[13],
+			lhs.x * rhs.m[2] + lhs.y * rhs.m[6] + lhs.z * rhs.m[10] + lhs.w * rhs.m[14],
+			lhs.x * rhs.m[3] + lhs.y * rhs.m[7] + lhs.z * rhs.m[11] + lhs.w * rhs.m[15]);
+	}
+
 	// Overload * operator for matrix * matrix multiplication
 	// This allows for concatenation of multiple transformation matrices
 	inline TMatrix operator * (const TMatrix& lhs, const TMatrix& rhs)
@@ -212,6 +235,35 @@ namespace matrix
 		return lhs;
 	}
 
+	// Concatenate two affine matrices, those whose last column is 0 0 0 1,
+	// with 36 multiplies rather than the 64 of the general one
+	inline TMatrix MultiplyAffine(const TMatrix& lhs, const TMatrix& rhs)
+	{
+		TMatrix temp;
+
+		temp.m[0] = lhs.m[0] * rhs.m[0] + lhs.m[1] * rhs.m[4] + lhs.m[2] * rhs.m[8];
+		temp.m[1] = lhs.m[0] * rhs.m[1] + lhs.m[1] * rhs.m[5] + lhs.m[2] * rhs.m[9];
+		temp.m[2] = lhs.m[0] * rhs.m[2] + lhs.m[1] * rhs.m[6] + lhs.m[2] * rhs.m[10];
+		temp.m[3] = 0.0f;
+
+		temp.m[4] = lhs.m[4] * rhs.m[0] + lhs.m[5] * rhs.m[4] + lhs.m[6] * rhs.m[8];
+		temp.m[5] = lhs.m[4] * rhs.m[1] + lhs.m[5] * rhs.m[5] + lhs.m[6] * rhs.m[9];
+		temp.m[6] = lhs.m[4] * rhs.m[2] + lhs.m[5] * rhs.m[6] + lhs.m[6] * rhs.m[10];
+		temp.m[7] = 0.0f;
+
+		temp.m[8] = lhs.m[8] * rhs.m[0] + lhs.m[9] * rhs.m[4] + lhs.m[10] * rhs.m[8];
+		temp.m[9] = lhs.m[8] * rhs.m[1] + lhs.m[9] * rhs.m[5] + lhs.m[10] * rhs.m[9];
+		temp.m[10] = lhs.m[8] * rhs.m[2] + lhs.m[9] * rhs.m[6] + lhs.m[10] * rhs.m[10];
+		temp.m[11] = 0.0f;
+
+		temp.m[12] = lhs.m[12] * rhs.m[0] + lhs.m[13] * rhs.m[4] + lhs.m[14] * rhs.m[8] + rhs.m[12];
+		temp.m[13] = lhs.m[12] * rhs.m[1] + lhs.m[13] * rhs.m[5] + lhs.m[14] * rhs.m[9] + rhs.m[13];
+		temp.m[14] = lhs.m[12] * rhs.m[2] + lhs.m[13] * rhs.m[6] + lhs.m[14] * rhs.m[10] + rhs.m[14];
+		temp.m[15] = 1.0f;
+
+		return temp;
+	}
+
 	// Compute the determinant of a matrix
 	inline float Determinant(const TMatrix& mat) {
 		return	mat.m[0] * (mat.m[5] * mat.m[10] - mat.m[6] * mat.m[9])
@@ -219,8 +271,8 @@ namespace matrix
 			+ mat.m[2] * (mat.m[4] * mat.m[9] - mat.m[5] * mat.m[8]);
 	}
 
-	// Computer the inverse of a matrix by calculating the adjoint and dividing
-	// by the determinant
+	// Computer the inverse of an affine matrix by calculating the adjoint and
+	// dividing by the determinant
 	inline TMatrix Inverse(const TMatrix& mat) {
 
 		TMatrix result;
@@ -238,22 +290,68 @@ namespace matrix
 		result.m[0] = (mat.m[5] * mat.m[10] - mat.m[6] * mat.m[9]) * oneOverDet;
 		result.m[1] = (mat.m[2] * mat.m[9] - mat.m[1] * mat.m[10]) * oneOverDet;
 		result.m[2] = (mat.m[1] * mat.m[6] - mat.m[2] * mat.m[5]) * oneOverDet;
+		result.m[3] = 0.0f;
 
 		result.m[4] = (mat.m[6] * mat.m[8] - mat.m[4] * mat.m[10]) * oneOverDet;
 		result.m[5] = (mat.m[0] * mat.m[10] - mat.m[2] * mat.m[8]) * oneOverDet;
 		result.m[6] = (mat.m[2] * mat.m[4] - mat.m[0] * mat.m[6]) * oneOverDet;
+		result.m[7] = 0.0f;
 
 		result.m[8] = (mat.m[4] * mat.m[9] - mat.m[5] * mat.m[8]) * oneOverDet;
 		result.m[9] = (mat.m[1] * mat.m[8] - mat.m[0] * mat.m[9]) * oneOverDet;
 		result.m[10] = (mat.m[0] * mat.m[5] - mat.m[1] * mat.m[4]) * oneOverDet;
+		result.m[11] = 0.0f;
+
+		result.m[12] = -(mat.m[12] * result.m[0] + mat.m[13] * result.m[4] + mat.m[14] * result.m[8]);
+		result.m[13] = -(mat.m[12] * result.m[1] + mat.m[13] * result.m[5] + mat.m[14] * result.m[9]);
+		result.m[14] = -(mat.m[12] * result.m[2] + mat.m[13] * result.m[6] + mat.m[14] * result.m[10]);
+		result.m[15] = 1.0f;
+
+		return result;
+	}
+
+	// The inverse of a rotation and translation, such as a camera's model
+	// view matrix, needs no determinant.  The rotation is transposed and the
+	// translation turned back through it.
+	inline TMatrix InverseRigid(const TMatrix& mat) {
+
+		TMatrix result;
+
+		result.m[0] = mat.m[0];		result.m[1] = mat.m[4];		result.m[2] = mat.m[8];		result.m[3] = 0.0f;
+		result.m[4] = mat.m[1];		result.m[5] = mat.m[5];		result.m[6] = mat.m[9];		result.m[7] = 0.0f;
+		result.m[8] = mat.m[2];		result.m[9] = mat.m[6];		result.m[10] = mat.m[10];	result.m[11] = 0.0f;
 
 		result.m[12] = -(mat.m[12] * result.m[0] + mat.m[13] * result.m[4] + mat.m[14] * result.m[8]);
 		result.m[13] = -(mat.m[12] * result.m[1] + mat.m[13] * result.m[5] + mat.m[14] * result.m[9]);
 		result.m[14] = -(mat.m[12] * result.m[2] + mat.m[13] * result.m[6] + mat.m[14] * result.m[10]);
+		result.m[15] = 1.0f;
 
 		return result;
 	}
 
+	/*-----------------------------------------------------------------------------------
+	Batches of points and directions held as an array for each element, for the
+	paths which move many of them through one matrix.  Each is the row vector
+	times matrix of operator * run four or eight at a time with SSE2 or AVX2
+	when the processor has them, giving the same bits.  out may be in.  They
+	are defined in batchMath.cpp.
+	-----------------------------------------------------------------------------------*/
+
+	// Points, the 3x4 affine part with the translation
+	void TransformPoints(const TMatrix& mat, const float *inX, const float *inY, const float *inZ,
+		float *outX, float *outY, float *outZ, int count);
+
+	// Directions, the 3x3 part without it
+	void TransformVectors(const TMatrix& mat, const float *inX, const float *inY, const float *inZ,
+		float *outX, float *outY, float *outZ, int count);
+
+	// The whole 4x4 matrix, for projections
+	void TransformPoints(const TMatrix& mat, const TVector4 *in, TVector4 *out, int count);
+
+	// Compare each instruction set with the scalar path bit for bit,
+	// returns RETURN_SUCCESS when they agree
+	int CheckBatchMath();
+
 }
 
 #endif
\ No newline at end of file
@@ -11,6 +11,10 @@ such as gravity.
 #ifndef PARTICLE_H_
 #define PARTICLE_H_
 
+#include <stdlib.h>
+
+#include "random.h"						// Random number generators
+
 /*-----------------------------------------------------------------------------------
 Define particle attributes and methods
 -----------------------------------------------------------------------------------*/
@@ -53,11 +57,19 @@ public:
 	//-----------------------------------------------------------
 	// Set the particle to alive and set its fading rate
 	//-----------------------------------------------------------
-	void ReStart() {
+	void ReStart(TRandU32 random) {
 		// Life is set to 1 so that it can be used as the alpha
 		// value for the colour, when it dies it will fade out
 		m_fLife = 1.0f;
-		m_fFadeRate = float(rand() % 100) * 0.001f + 0.003f;
+		m_fFadeRate = FadeRate(random);
+	}
+
+	//-----------------------------------------------------------
+	// Fade rate for a restarted particle from one random word,
+	// one of 100 steps between 0.003 and 0.102
+	//-----------------------------------------------------------
+	static float FadeRate(TRandU32 random) {
+		return float(RandomToRange(random, 100)) * 0.001f + 0.003f;
 	}
 
 	//-----------------------------------------------------------
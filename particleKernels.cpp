@@ -0,0 +1,404 @@
+/*-----------------------------------------------------------------------------------
+File:			particleKernels.cpp
+Author:			Steve Costa
+Description:	Scalar and SIMD kernels for integrating a batch of particles and
+the runtime dispatch between them.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <assert.h>
+
+#include "particleKernels.h"				// Header file for these functions
+#include "particlePool.h"					// Particle attribute columns
+#include "cpuFeatures.h"					// Instruction set detection
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/*-----------------------------------------------------------------------------------
+Column pointers handed to a kernel, already offset to the first particle
+-----------------------------------------------------------------------------------*/
+
+struct TUpdateStreams
+{
+	const float *prevX, *prevY, *prevZ;
+	float *posX, *posY, *posZ;
+	float *velX, *velY, *velZ;
+	const float *accelX, *accelY, *accelZ;
+	float *life;
+	const float *fadeRate;
+};
+
+typedef void (*PFNUPDATEKERNEL)(const TUpdateStreams& s, int count, float dt, float gravity);
+
+/*-----------------------------------------------------------------------------------
+Scalar kernel, also used for the tail of the SIMD kernels
+-----------------------------------------------------------------------------------*/
+
+static void UpdateScalar(const TUpdateStreams& s, int count, float dt, float gravity)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		// Update the velocity vector
+		s.velX[i] += dt * s.accelX[i];
+		s.velY[i] += dt * (s.accelY[i] - gravity);
+		s.velZ[i] += dt * s.accelZ[i];
+
+		// Update the positon vector
+		s.posX[i] = s.prevX[i] + dt * s.velX[i];
+		s.posY[i] = s.prevY[i] + dt * s.velY[i];
+		s.posZ[i] = s.prevZ[i] + dt * s.velZ[i];
+
+		// Bounce off the floor at 0 along the y-axis
+		s.velY[i] *= (s.posY[i] < 0.0f) ? -0.75f : 1.0f;
+
+		// Particle fades
+		s.life[i] -= s.fadeRate[i];
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Offset the column pointers by a number of particles
+-----------------------------------------------------------------------------------*/
+
+static TUpdateStreams Advance(const TUpdateStreams& s, int n)
+{
+	TUpdateStreams result;
+
+	result.prevX = s.prevX + n;		result.prevY = s.prevY + n;		result.prevZ = s.prevZ + n;
+	result.posX = s.posX + n;		result.posY = s.posY + n;		result.posZ = s.posZ + n;
+	result.velX = s.velX + n;		result.velY = s.velY + n;		result.velZ = s.velZ + n;
+	result.accelX = s.accelX + n;	result.accelY = s.accelY + n;	result.accelZ = s.accelZ + n;
+	result.life = s.life + n;
+	result.fadeRate = s.fadeRate + n;
+
+	return result;
+}
+
+#ifdef CPU_X86
+
+/*-----------------------------------------------------------------------------------
+SSE2 kernel, 4 particles per iteration.  The floor bounce selects between a
+factor of 1 and -0.75 with a compare mask instead of branching.
+-----------------------------------------------------------------------------------*/
+
+TARGET_SSE2 static void UpdateSSE2(const TUpdateStreams& s, int count, float dt, float gravity)
+{
+	int i;
+	__m128 vdt = _mm_set1_ps(dt);
+	__m128 vgravity = _mm_set1_ps(gravity);
+	__m128 vzero = _mm_setzero_ps();
+	__m128 vone = _mm_set1_ps(1.0f);
+	__m128 vbounce = _mm_set1_ps(-0.75f);
+
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		__m128 vx = _mm_add_ps(_mm_loadu_ps(s.velX + i), _mm_mul_ps(vdt, _mm_loadu_ps(s.accelX + i)));
+		__m128 vy = _mm_add_ps(_mm_loadu_ps(s.velY + i), _mm_mul_ps(vdt, _mm_sub_ps(_mm_loadu_ps(s.accelY + i), vgravity)));
+		__m128 vz = _mm_add_ps(_mm_loadu_ps(s.velZ + i), _mm_mul_ps(vdt, _mm_loadu_ps(s.accelZ + i)));
+
+		__m128 px = _mm_add_ps(_mm_loadu_ps(s.prevX + i), _mm_mul_ps(vdt, vx));
+		__m128 py = _mm_add_ps(_mm_loadu_ps(s.prevY + i), _mm_mul_ps(vdt, vy));
+		__m128 pz = _mm_add_ps(_mm_loadu_ps(s.prevZ + i), _mm_mul_ps(vdt, vz));
+
+		__m128 below = _mm_cmplt_ps(py, vzero);
+		vy = _mm_mul_ps(vy, _mm_or_ps(_mm_and_ps(below, vbounce), _mm_andnot_ps(below, vone)));
+
+		_mm_storeu_ps(s.velX + i, vx);
+		_mm_storeu_ps(s.velY + i, vy);
+		_mm_storeu_ps(s.velZ + i, vz);
+		_mm_storeu_ps(s.posX + i, px);
+		_mm_storeu_ps(s.posY + i, py);
+		_mm_storeu_ps(s.posZ + i, pz);
+		_mm_storeu_ps(s.life + i, _mm_sub_ps(_mm_loadu_ps(s.life + i), _mm_loadu_ps(s.fadeRate + i)));
+	}
+
+	UpdateScalar(Advance(s, i), count - i, dt, gravity);
+}
+
+/*-----------------------------------------------------------------------------------
+AVX2 kernel, 8 particles per iteration
+-----------------------------------------------------------------------------------*/
+
+TARGET_AVX2 static void UpdateAVX2(const TUpdateStreams& s, int count, float dt, float gravity)
+{
+	int i;
+	__m256 vdt = _mm256_set1_ps(dt);
+	__m256 vgravity = _mm256_set1_ps(gravity);
+	__m256 vzero = _mm256_setzero_ps();
+	__m256 vone = _mm256_set1_ps(1.0f);
+	__m256 vbounce = _mm256_set1_ps(-0.75f);
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		__m256 vx = _mm256_add_ps(_mm256_loadu_ps(s.velX + i), _mm256_mul_ps(vdt, _mm256_loadu_ps(s.accelX + i)));
+		__m256 vy = _mm256_add_ps(_mm256_loadu_ps(s.velY + i), _mm256_mul_ps(vdt, _mm256_sub_ps(_mm256_loadu_ps(s.accelY + i), vgravity)));
+		__m256 vz = _mm256_add_ps(_mm256_loadu_ps(s.velZ + i), _mm256_mul_ps(vdt, _mm256_loadu_ps(s.accelZ + i)));
+
+		__m256 px = _mm256_add_ps(_mm256_loadu_ps(s.prevX + i), _mm256_mul_ps(vdt, vx));
+		__m256 py = _mm256_add_ps(_mm256_loadu_ps(s.prevY + i), _mm256_mul_ps(vdt, vy));
+		__m256 pz = _mm256_add_ps(_mm256_loadu_ps(s.prevZ + i), _mm256_mul_ps(vdt, vz));
+
+		__m256 below = _mm256_cmp_ps(py, vzero, _CMP_LT_OQ);
+		vy = _mm256_mul_ps(vy, _mm256_blendv_ps(vone, vbounce, below));
+
+		_mm256_storeu_ps(s.velX + i, vx);
+		_mm256_storeu_ps(s.velY + i, vy);
+		_mm256_storeu_ps(s.velZ + i, vz);
+		_mm256_storeu_ps(s.posX + i, px);
+		_mm256_storeu_ps(s.posY + i, py);
+		_mm256_storeu_ps(s.posZ + i, pz);
+		_mm256_storeu_ps(s.life + i, _mm256_sub_ps(_mm256_loadu_ps(s.life + i), _mm256_loadu_ps(s.fadeRate + i)));
+	}
+
+	UpdateScalar(Advance(s, i), count - i, dt, gravity);
+}
+
+#ifdef CPU_COMPILER_AVX512
+
+/*-----------------------------------------------------------------------------------
+AVX-512 kernel, 16 particles per iteration.  The tail is handled with masked
+loads and stores rather than falling back to scalar code.
+-----------------------------------------------------------------------------------*/
+
+TARGET_AVX512 static void UpdateAVX512(const TUpdateStreams& s, int count, float dt, float gravity)
+{
+	int i;
+	__m512 vdt = _mm512_set1_ps(dt);
+	__m512 vgravity = _mm512_set1_ps(gravity);
+	__m512 vzero = _mm512_setzero_ps();
+	__m512 vbounce = _mm512_set1_ps(-0.75f);
+
+	for (i = 0; i < count; i += 16)
+	{
+		__mmask16 m = (count - i >= 16) ? (__mmask16)0xFFFF : (__mmask16)((1u << (count - i)) - 1);
+
+		__m512 vx = _mm512_add_ps(_mm512_maskz_loadu_ps(m, s.velX + i), _mm512_mul_ps(vdt, _mm512_maskz_loadu_ps(m, s.accelX + i)));
+		__m512 vy = _mm512_add_ps(_mm512_maskz_loadu_ps(m, s.velY + i), _mm512_mul_ps(vdt, _mm512_sub_ps(_mm512_maskz_loadu_ps(m, s.accelY + i), vgravity)));
+		__m512 vz = _mm512_add_ps(_mm512_maskz_loadu_ps(m, s.velZ + i), _mm512_mul_ps(vdt, _mm512_maskz_loadu_ps(m, s.accelZ + i)));
+
+		__m512 px = _mm512_add_ps(_mm512_maskz_loadu_ps(m, s.prevX + i), _mm512_mul_ps(vdt, vx));
+		__m512 py = _mm512_add_ps(_mm512_maskz_loadu_ps(m, s.prevY + i), _mm512_mul_ps(vdt, vy));
+		__m512 pz = _mm512_add_ps(_mm512_maskz_loadu_ps(m, s.prevZ + i), _mm512_mul_ps(vdt, vz));
+
+		__mmask16 below = _mm512_cmp_ps_mask(py, vzero, _CMP_LT_OQ);
+		vy = _mm512_mask_mul_ps(vy, below, vy, vbounce);
+
+		_mm512_mask_storeu_ps(s.velX + i, m, vx);
+		_mm512_mask_storeu_ps(s.velY + i, m, vy);
+		_mm512_mask_storeu_ps(s.velZ + i, m, vz);
+		_mm512_mask_storeu_ps(s.posX + i, m, px);
+		_mm512_mask_storeu_ps(s.posY + i, m, py);
+		_mm512_mask_storeu_ps(s.posZ + i, m, pz);
+		_mm512_mask_storeu_ps(s.life + i, m, _mm512_sub_ps(_mm512_maskz_loadu_ps(m, s.life + i), _mm512_maskz_loadu_ps(m, s.fadeRate + i)));
+	}
+}
+
+#endif
+#endif
+
+/*-----------------------------------------------------------------------------------
+Dispatch state
+-----------------------------------------------------------------------------------*/
+
+static PFNUPDATEKERNEL	s_pfnUpdate = NULL;			// Kernel in use
+static int				s_iKernel = UPDATE_KERNEL_AUTO;		// Until one is chosen
+
+/*-----------------------------------------------------------------------------------
+Return the kernel function for a given kernel id, or NULL when it is not
+supported by the processor or the compiler
+-----------------------------------------------------------------------------------*/
+
+static PFNUPDATEKERNEL GetKernelFunction(int kernel)
+{
+	int features = DetectCpuFeatures();
+
+	switch (kernel)
+	{
+	case UPDATE_KERNEL_SCALAR:
+		return UpdateScalar;
+#ifdef CPU_X86
+	case UPDATE_KERNEL_SSE2:
+		return (features & CPU_FEATURE_SSE2) ? UpdateSSE2 : NULL;
+	case UPDATE_KERNEL_AVX2:
+		return (features & CPU_FEATURE_AVX2) ? UpdateAVX2 : NULL;
+#ifdef CPU_COMPILER_AVX512
+	case UPDATE_KERNEL_AVX512:
+		return (features & CPU_FEATURE_AVX512F) ? UpdateAVX512 : NULL;
+#endif
+#endif
+	default:
+		break;
+	}
+
+	return NULL;
+}
+
+/*-----------------------------------------------------------------------------------
+Choose the kernel used by UpdateParticles
+-----------------------------------------------------------------------------------*/
+
+int SelectUpdateKernel(int kernel)
+{
+	PFNUPDATEKERNEL pfn = NULL;
+
+	if (kernel == UPDATE_KERNEL_AUTO)
+	{
+		// Take the widest kernel available
+		for (kernel = UPDATE_KERNEL_COUNT - 1; kernel > UPDATE_KERNEL_SCALAR; kernel--)
+		{
+			if ((pfn = GetKernelFunction(kernel)) != NULL)
+				break;
+		}
+	}
+
+	if (!pfn)
+		pfn = GetKernelFunction(kernel);
+
+	if (!pfn)
+		return RETURN_FAILURE;
+
+	s_pfnUpdate = pfn;
+	s_iKernel = kernel;
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Kernel currently in use
+-----------------------------------------------------------------------------------*/
+
+int GetUpdateKernel()
+{
+	return s_iKernel;
+}
+
+const char *GetUpdateKernelName(int kernel)
+{
+	static const char *names[UPDATE_KERNEL_COUNT] = { "auto", "scalar", "sse2", "avx2", "avx512" };
+
+	if (kernel < 0 || kernel >= UPDATE_KERNEL_COUNT)
+		return "unknown";
+
+	return names[kernel];
+}
+
+/*-----------------------------------------------------------------------------------
+Gather the column pointers of a range of particles in a pool
+-----------------------------------------------------------------------------------*/
+
+static TUpdateStreams GetStreams(CParticlePool& pool, int first)
+{
+	TUpdateStreams s;
+
+	s.prevX = pool.Column(PARTICLE_PREV_X) + first;
+	s.prevY = pool.Column(PARTICLE_PREV_Y) + first;
+	s.prevZ = pool.Column(PARTICLE_PREV_Z) + first;
+	s.posX = pool.Column(PARTICLE_POS_X) + first;
+	s.posY = pool.Column(PARTICLE_POS_Y) + first;
+	s.posZ = pool.Column(PARTICLE_POS_Z) + first;
+	s.velX = pool.Column(PARTICLE_VEL_X) + first;
+	s.velY = pool.Column(PARTICLE_VEL_Y) + first;
+	s.velZ = pool.Column(PARTICLE_VEL_Z) + first;
+	s.accelX = pool.Column(PARTICLE_ACCEL_X) + first;
+	s.accelY = pool.Column(PARTICLE_ACCEL_Y) + first;
+	s.accelZ = pool.Column(PARTICLE_ACCEL_Z) + first;
+	s.life = pool.Column(PARTICLE_LIFE) + first;
+	s.fadeRate = pool.Column(PARTICLE_FADE_RATE) + first;
+
+	return s;
+}
+
+/*-----------------------------------------------------------------------------------
+Integrate a range of particles with the selected kernel.  Workers call this
+all at once, so the kernel is chosen before, never here.
+-----------------------------------------------------------------------------------*/
+
+void UpdateParticles(CParticlePool& pool, int first, int count, float dt)
+{
+	assert(s_pfnUpdate);
+
+	if (count <= 0)
+		return;
+
+	s_pfnUpdate(GetStreams(pool, first), count, dt, CParticle::m_sfGravity);
+}
+
+/*-----------------------------------------------------------------------------------
+Fill every column of a pool with the same pseudo random state, some of the
+particles start below the floor so the bounce is exercised
+-----------------------------------------------------------------------------------*/
+
+static void FillTestState(CParticlePool& pool, int numParticles)
+{
+	CRandomPcg32 rng;
+	int column, i;
+
+	rng.Seed(1, 0);
+	for (column = 0; column < PARTICLE_NUM_COLUMNS; column++)
+	{
+		float *data = pool.Column(column);
+		for (i = 0; i < numParticles; i++)
+			data[i] = float(int(RandomToRange(rng.NextUInt(), 2000)) - 500) * 0.01f;
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Compare every supported kernel against the scalar path.  An odd particle count
+is used so the tail handling of each kernel is exercised as well.
+-----------------------------------------------------------------------------------*/
+
+int CheckUpdateKernels()
+{
+	const int numParticles = 1021;
+	const int numSteps = 8;
+	const float dt = 0.02f;
+
+	CParticlePool reference, test;
+	int kernel, column, step, i;
+	int status = RETURN_SUCCESS;
+
+	if (reference.Init(numParticles) != RETURN_SUCCESS || test.Init(numParticles) != RETURN_SUCCESS)
+		return RETURN_FAILURE;
+
+	FillTestState(reference, numParticles);
+	for (step = 0; step < numSteps; step++)
+	{
+		reference.BeginStep();
+		UpdateScalar(GetStreams(reference, 0), numParticles, dt, CParticle::m_sfGravity);
+	}
+
+	for (kernel = UPDATE_KERNEL_SCALAR + 1; kernel < UPDATE_KERNEL_COUNT; kernel++)
+	{
+		PFNUPDATEKERNEL pfn = GetKernelFunction(kernel);
+		if (!pfn)
+			continue;
+
+		FillTestState(test, numParticles);
+		for (step = 0; step < numSteps; step++)
+		{
+			test.BeginStep();
+			pfn(GetStreams(test, 0), numParticles, dt, CParticle::m_sfGravity);
+		}
+
+		for (column = 0; column < PARTICLE_NUM_COLUMNS; column++)
+		{
+			const float *expected = reference.Column(column);
+			const float *actual = test.Column(column);
+			for (i = 0; i < numParticles; i++)
+			{
+				float diff = ABS(expected[i] - actual[i]);
+				if (diff > UPDATE_KERNEL_TOLERANCE * MAX(1.0f, ABS(expected[i])))
+					status = RETURN_FAILURE;
+			}
+		}
+	}
+
+	return status;
+}
@@ -0,0 +1,61 @@
+/*-----------------------------------------------------------------------------------
+File:			particleKernels.h
+Author:			Steve Costa
+Description:	Batch integration of particles held in a CParticlePool.  The
+same step as CParticle::Update is provided as a scalar loop and as
+SSE2, AVX2 and AVX-512 kernels, the widest one the processor
+supports is picked at runtime.
+-----------------------------------------------------------------------------------*/
+
+#ifndef PARTICLE_KERNELS_H_
+#define PARTICLE_KERNELS_H_
+
+class CParticlePool;
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+// Largest difference allowed between a SIMD kernel and the scalar path
+#define UPDATE_KERNEL_TOLERANCE		1.0e-5f
+
+/*-----------------------------------------------------------------------------------
+Available update kernels
+-----------------------------------------------------------------------------------*/
+
+enum EUpdateKernel
+{
+	UPDATE_KERNEL_AUTO,						// Widest supported kernel
+	UPDATE_KERNEL_SCALAR,
+	UPDATE_KERNEL_SSE2,
+	UPDATE_KERNEL_AVX2,
+	UPDATE_KERNEL_AVX512,
+
+	UPDATE_KERNEL_COUNT
+};
+
+/*-----------------------------------------------------------------------------------
+Batch update functions
+-----------------------------------------------------------------------------------*/
+
+// Integrate particles [first, first + count) over dt seconds.  Positions are
+// read from the previous position columns and written to the position
+// columns, see CParticlePool::BeginStep.
+void UpdateParticles(CParticlePool& pool, int first, int count, float dt);
+
+// Choose the kernel used by UpdateParticles, returns RETURN_FAILURE when the
+// processor does not support it and leaves the current choice alone.  Call it
+// before any update runs, CParticleSystem::Init takes UPDATE_KERNEL_AUTO when
+// nothing has been chosen yet.
+int SelectUpdateKernel(int kernel);
+
+// Kernel currently used by UpdateParticles, UPDATE_KERNEL_AUTO before one is
+// chosen, and its name
+int GetUpdateKernel();
+const char *GetUpdateKernelName(int kernel);
+
+// Run every supported kernel on the same random particles and compare them
+// against the scalar path using UPDATE_KERNEL_TOLERANCE
+int CheckUpdateKernels();
+
+#endif
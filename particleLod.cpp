@@ -0,0 +1,444 @@
+/*-----------------------------------------------------------------------------------
+File:			particleLod.cpp
+Author:			Steve Costa
+Description:	Merging of distant particles into impostors, see particleLod.h
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <math.h>
+#include <string.h>
+
+#include "particleLod.h"					// Class header file
+#include "profiler.h"						// Frame zones
+#include "random.h"							// SplitMix64
+
+/*-----------------------------------------------------------------------------------
+Start with nothing allocated
+-----------------------------------------------------------------------------------*/
+
+CParticleLod::CParticleLod()
+{
+	m_iCapacity = 0;
+	m_piNear = NULL;
+	m_iNumNear = 0;
+	m_piChunkNear = NULL;
+	m_piCell = NULL;
+	m_piChunkCounts = NULL;
+	m_pSamples = NULL;
+
+	m_iCellCapacity = 0;
+	m_pImpostors = NULL;
+	m_iNumImpostors = 0;
+	m_pCells = NULL;
+	m_iSumCapacity = 0;
+}
+
+CParticleLod::~CParticleLod()
+{
+	Shutdown();
+}
+
+/*-----------------------------------------------------------------------------------
+Free the arrays
+-----------------------------------------------------------------------------------*/
+
+void CParticleLod::Shutdown()
+{
+	delete[] m_piNear;
+	delete[] m_piChunkNear;
+	delete[] m_piCell;
+	delete[] m_piChunkCounts;
+	delete[] m_pSamples;
+	m_piNear = NULL;
+	m_piChunkNear = NULL;
+	m_piCell = NULL;
+	m_piChunkCounts = NULL;
+	m_pSamples = NULL;
+	m_iCapacity = 0;
+	m_iNumNear = 0;
+
+	delete[] m_pImpostors;
+	delete[] m_pCells;
+	m_pImpostors = NULL;
+	m_pCells = NULL;
+	m_iCellCapacity = 0;
+	m_iSumCapacity = 0;
+	m_iNumImpostors = 0;
+}
+
+/*-----------------------------------------------------------------------------------
+Make room for count particles
+-----------------------------------------------------------------------------------*/
+
+void CParticleLod::Grow(int count)
+{
+	int numChunks = (count + LOD_CHUNK - 1) / LOD_CHUNK;
+
+	if (count <= m_iCapacity)
+		return;
+
+	delete[] m_piNear;
+	delete[] m_piChunkNear;
+	delete[] m_piCell;
+	delete[] m_piChunkCounts;
+	delete[] m_pSamples;
+
+	m_iCapacity = count;
+	m_piNear = new int[count];
+	m_piChunkNear = new int[numChunks];
+	m_piCell = new int[count];
+	m_piChunkCounts = new int[numChunks * LOD_MAX_BUCKETS];
+	m_pSamples = new TLodSample[count];
+}
+
+/*-----------------------------------------------------------------------------------
+Make room for an impostor per cell of the screen and the sums of the workers
+-----------------------------------------------------------------------------------*/
+
+void CParticleLod::GrowCells(int cells, int sums)
+{
+	if (cells > m_iCellCapacity)
+	{
+		delete[] m_pImpostors;
+		m_iCellCapacity = cells;
+		m_pImpostors = new TParticleImpostor[cells];
+	}
+
+	if (sums > m_iSumCapacity)
+	{
+		delete[] m_pCells;
+		m_iSumCapacity = sums;
+		m_pCells = new TLodCell[sums];
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Split the particles into near and far, sort the far ones by bucket and sum
+each bucket into its cells.  A particle lies on the screen where its centre
+projects to and its depth is along the view axis.  The light a sprite adds is
+its alpha times its area in pixels, which the impostor of a cell keeps the sum
+of.  The sort works as the radix sort in CDepthSort does, each chunk counts
+its particles into the buckets and is given a run of every bucket to copy
+them to.
+-----------------------------------------------------------------------------------*/
+
+const int *CParticleLod::Build(const CParticlePool& pool, int count, const int *order, float blend,
+	const TMatrix& projection, const TMatrix& modelView, int width, int height, float size,
+	CJobSystem *jobs)
+{
+	PROFILE_ZONE("lod");
+
+	int numChunks = (count + LOD_CHUNK - 1) / LOD_CHUNK;
+	int tile = MAX(1, m_params.tilePixels);
+	int tilesX = (width + tile - 1) / tile;
+	int tilesY = (height + tile - 1) / tile;
+	int slices = MAX(1, m_params.maxSlices);
+	int tiles = tilesX * tilesY;
+	int numCells = tiles * slices;
+	int workers = jobs ? jobs->GetNumThreads() : 1;
+	int shift, cellsPerBucket, numBuckets, bucket, chunk, numFar, i;
+
+	// Pixels across of something a world unit across a world unit
+	// away, and the depth past which sprites are too small to keep
+	float focal = projection.m[5] * 0.5f * float(height);
+	float farDepth = (m_params.lodPixels > 0.0f) ? size * focal / m_params.lodPixels : 0.0f;
+	float minArea = m_params.minPixels * m_params.minPixels;
+
+	const float *prevX = pool.Column(PARTICLE_PREV_X);
+	const float *prevY = pool.Column(PARTICLE_PREV_Y);
+	const float *prevZ = pool.Column(PARTICLE_PREV_Z);
+	const float *posX = pool.Column(PARTICLE_POS_X);
+	const float *posY = pool.Column(PARTICLE_POS_Y);
+	const float *posZ = pool.Column(PARTICLE_POS_Z);
+	const float *mv = modelView.m;
+	const float *p = projection.m;
+
+	m_iNumNear = 0;
+	m_iNumImpostors = 0;
+	if (count <= 0)
+		return m_piNear;
+
+	Grow(count);
+
+	// Nothing is far with no camera to measure by
+	if (focal <= 0.0f || farDepth <= 0.0f || tiles <= 0)
+	{
+		for (i = 0; i < count; i++)
+			m_piNear[i] = order ? order[i] : i;
+		m_iNumNear = count;
+		return m_piNear;
+	}
+
+	// Buckets of neighbouring cells, few enough to count per chunk
+	for (shift = 0; ((numCells - 1) >> shift) + 1 > LOD_MAX_BUCKETS; shift++)
+		;
+	cellsPerBucket = 1 << shift;
+	numBuckets = ((numCells - 1) >> shift) + 1;
+
+	GrowCells(numCells, workers * cellsPerBucket);
+
+	//----------------------------------------------------------------------
+	// Near particles are kept where each chunk starts, far ones are given
+	// a cell and counted into its bucket
+	//----------------------------------------------------------------------
+	RunJobs(jobs, numChunks, 1, [&](int firstChunk, int num, int worker) {
+		float scaleX = 0.5f * float(width) / float(tile);
+		float scaleY = 0.5f * float(height) / float(tile);
+		float slicesPerOctave = float(m_params.slicesPerOctave) * (1.0f / 8388608.0f);
+		float invFarDepth = 1.0f / farDepth;
+		float viewX[LOD_VIEW_BATCH], viewY[LOD_VIEW_BATCH], viewZ[LOD_VIEW_BATCH];
+
+		for (int c = firstChunk; c < firstChunk + num; c++)
+		{
+			int start = c * LOD_CHUNK;
+			int last = MIN(start + LOD_CHUNK, count);
+			int *counts = m_piChunkCounts + c * LOD_MAX_BUCKETS;
+			int n = 0;
+
+			memset(counts, 0, sizeof(int) * numBuckets);
+
+			for (int k = start; k < last; k++)
+			{
+				int index = order ? order[k] : k;
+				int j = (k - start) % LOD_VIEW_BATCH;
+
+				// The next batch of positions to view space together
+				if (j == 0)
+				{
+					int batch = MIN(LOD_VIEW_BATCH, last - k);
+
+					pool.BlendPositions(k, batch, order, blend, viewX, viewY, viewZ);
+					TransformPoints(modelView, viewX, viewY, viewZ, viewX, viewY, viewZ, batch);
+				}
+
+				float vx = viewX[j], vy = viewY[j], vz = viewZ[j];
+
+				if (-vz <= farDepth)
+				{
+					m_piNear[start + n++] = index;
+					m_piCell[k] = -1;
+					continue;
+				}
+
+				float cx = p[0] * vx + p[4] * vy + p[8] * vz + p[12];
+				float cy = p[1] * vx + p[5] * vy + p[9] * vz + p[13];
+				float cw = p[3] * vx + p[7] * vy + p[11] * vz + p[15];
+				float invW = 1.0f / cw;
+				float tx = (cx * invW + 1.0f) * scaleX;
+				float ty = (cy * invW + 1.0f) * scaleY;
+				float octaves = -vz * invFarDepth;
+				unsigned int bits;
+				int slice;
+
+				// The exponent and mantissa of a float are a close
+				// enough log2 for picking a slice
+				memcpy(&bits, &octaves, sizeof(float));
+				slice = int(float(int(bits) - 0x3F800000) * slicesPerOctave);
+				int cellX = (int)MAX(0.0f, MIN(float(tilesX - 1), tx));
+				int cellY = (int)MAX(0.0f, MIN(float(tilesY - 1), ty));
+
+				// Furthest slices first
+				slice = MIN(slice, slices - 1);
+				m_piCell[k] = (slices - 1 - slice) * tiles + cellY * tilesX + cellX;
+				counts[m_piCell[k] >> shift]++;
+			}
+
+			m_piChunkNear[c] = n;
+		}
+	});
+
+	for (chunk = 0; chunk < numChunks; chunk++)
+	{
+		int start = chunk * LOD_CHUNK;
+
+		if (start != m_iNumNear)
+			memmove(m_piNear + m_iNumNear, m_piNear + start, sizeof(int) * m_piChunkNear[chunk]);
+		m_iNumNear += m_piChunkNear[chunk];
+	}
+
+	if (m_iNumNear == count)
+		return m_piNear;
+
+	//----------------------------------------------------------------------
+	// Each chunk's run of each bucket, the buckets one after the other
+	//----------------------------------------------------------------------
+	numFar = 0;
+	for (bucket = 0; bucket < numBuckets; bucket++)
+	{
+		m_piBucketStart[bucket] = numFar;
+		for (chunk = 0; chunk < numChunks; chunk++)
+		{
+			int *counts = m_piChunkCounts + chunk * LOD_MAX_BUCKETS;
+			int n = counts[bucket];
+
+			counts[bucket] = numFar;
+			numFar += n;
+		}
+	}
+	m_piBucketStart[numBuckets] = numFar;
+
+	//----------------------------------------------------------------------
+	// What a cell needs of each far particle is copied along, so the cells
+	// are summed from one array in order rather than gathered from every
+	// column
+	//----------------------------------------------------------------------
+	RunJobs(jobs, numChunks, 1, [&](int firstChunk, int num, int worker) {
+		const float *colR = pool.Column(PARTICLE_COL_R);
+		const float *colG = pool.Column(PARTICLE_COL_G);
+		const float *colB = pool.Column(PARTICLE_COL_B);
+		const float *life = pool.Column(PARTICLE_LIFE);
+		const float *fade = pool.Column(PARTICLE_FADE_RATE);
+		const unsigned int *sprite = pool.UIntColumn(PARTICLE_SPRITE);
+
+		for (int c = firstChunk; c < firstChunk + num; c++)
+		{
+			int last = MIN((c + 1) * LOD_CHUNK, count);
+			int *cursor = m_piChunkCounts + c * LOD_MAX_BUCKETS;
+
+			for (int k = c * LOD_CHUNK; k < last; k++)
+			{
+				int cell = m_piCell[k];
+
+				if (cell < 0)
+					continue;
+
+				int index = order ? order[k] : k;
+				TLodSample& sample = m_pSamples[cursor[cell >> shift]++];
+				float alpha = MAX(0.0f, MIN(1.0f, life[index]));
+				unsigned int bits[2];
+				TRandU64 key;
+
+				sample.x = prevX[index] + blend * (posX[index] - prevX[index]);
+				sample.y = prevY[index] + blend * (posY[index] - prevY[index]);
+				sample.z = prevZ[index] + blend * (posZ[index] - prevZ[index]);
+
+				float depth = -(mv[2] * sample.x + mv[6] * sample.y + mv[10] * sample.z + mv[14]);
+				float pixels = size * focal / depth;
+				sample.light = alpha * pixels * pixels;
+				sample.r = (unsigned char)(MAX(0.0f, MIN(1.0f, colR[index])) * 255.0f + 0.5f);
+				sample.g = (unsigned char)(MAX(0.0f, MIN(1.0f, colG[index])) * 255.0f + 0.5f);
+				sample.b = (unsigned char)(MAX(0.0f, MIN(1.0f, colB[index])) * 255.0f + 0.5f);
+				sample.age = (unsigned char)((1.0f - alpha) * 255.0f + 0.5f);
+				sample.sprite = sprite[index];
+				sample.cell = cell;
+
+				// Same for a particle every frame, so it is thinned
+				// out the same way
+				memcpy(&bits[0], fade + index, sizeof(float));
+				memcpy(&bits[1], colR + index, sizeof(float));
+				key = ((TRandU64)bits[0] << 32) | bits[1];
+				sample.hash = (unsigned int)SplitMix64(key);
+			}
+		}
+	});
+
+	//----------------------------------------------------------------------
+	// Sum each bucket into its cells and make an impostor of each, or none
+	// when the cell is empty or one smaller than a pixel loses the draw.
+	// A bucket's impostors are kept where its cells start, then packed.
+	//----------------------------------------------------------------------
+	RunJobs(jobs, numBuckets, 1, [&](int firstBucket, int num, int worker) {
+		TLodCell *sums = m_pCells + worker * cellsPerBucket;
+
+		for (int b = firstBucket; b < firstBucket + num; b++)
+		{
+			int firstCell = b << shift;
+			int numBucketCells = MIN(cellsPerBucket, numCells - firstCell);
+			int s, c, made = 0;
+
+			m_piBucketImpostors[b] = 0;
+			if (m_piBucketStart[b] == m_piBucketStart[b + 1])
+				continue;
+
+			memset(sums, 0, sizeof(TLodCell) * numBucketCells);
+			for (c = 0; c < numBucketCells; c++)
+				sums[c].sprite = 0xFFFFFFFF;
+
+			for (s = m_piBucketStart[b]; s < m_piBucketStart[b + 1]; s++)
+			{
+				const TLodSample& sample = m_pSamples[s];
+				TLodCell& sum = sums[sample.cell - firstCell];
+				float e = sample.light;
+
+				sum.sumX += sample.x;	sum.sumY += sample.y;	sum.sumZ += sample.z;
+				sum.sumSq += sample.x * sample.x + sample.y * sample.y + sample.z * sample.z;
+				sum.light += e;
+				sum.lightR += e * float(sample.r);
+				sum.lightG += e * float(sample.g);
+				sum.lightB += e * float(sample.b);
+				sum.lightAge += e * float(sample.age);
+				sum.sprite = MIN(sum.sprite, sample.sprite);
+				sum.hash ^= sample.hash;
+				sum.count++;
+			}
+
+			for (c = 0; c < numBucketCells; c++)
+			{
+				const TLodCell& sum = sums[c];
+				TParticleImpostor& imp = m_pImpostors[firstCell + made];
+
+				if (!sum.count || sum.light <= 0.0f)
+					continue;
+
+				float n = float(sum.count);
+				imp.x = sum.sumX / n;
+				imp.y = sum.sumY / n;
+				imp.z = sum.sumZ / n;
+				imp.sprite = sum.sprite;
+
+				float depth = -(mv[2] * imp.x + mv[6] * imp.y + mv[10] * imp.z + mv[14]);
+				float spread = sqrtf(MAX(0.0f, sum.sumSq / n - (imp.x * imp.x + imp.y * imp.y + imp.z * imp.z)));
+				depth = MAX(depth, farDepth);
+
+				// Cover the particles, growing when that would need an
+				// alpha over 1 to give off the same light
+				imp.size = size + 2.0f * spread;
+				float pixels = imp.size * focal / depth;
+				imp.a = sum.light / (pixels * pixels);
+				if (imp.a > 1.0f)
+				{
+					pixels = sqrtf(sum.light);
+					imp.size = pixels * depth / focal;
+					imp.a = 1.0f;
+				}
+
+				// Kept a pixel across with the chance of its area in
+				// pixels, so on average the light is the same
+				if (pixels < m_params.minPixels)
+				{
+					float chance = pixels * pixels / minArea;
+
+					if (float(sum.hash >> 8) * (1.0f / 16777216.0f) >= chance)
+						continue;
+					imp.size = m_params.minPixels * depth / focal;
+				}
+
+				float scale = 1.0f / (255.0f * sum.light);
+				imp.r = sum.lightR * scale;
+				imp.g = sum.lightG * scale;
+				imp.b = sum.lightB * scale;
+				imp.age = sum.lightAge * scale;
+				made++;
+			}
+
+			m_piBucketImpostors[b] = made;
+		}
+	});
+
+	for (bucket = 0; bucket < numBuckets; bucket++)
+	{
+		int start = bucket << shift;
+
+		if (start != m_iNumImpostors)
+		{
+			memmove(m_pImpostors + m_iNumImpostors, m_pImpostors + start,
+				sizeof(TParticleImpostor) * m_piBucketImpostors[bucket]);
+		}
+		m_iNumImpostors += m_piBucketImpostors[bucket];
+	}
+
+	return m_piNear;
+}
@@ -0,0 +1,171 @@
+/*-----------------------------------------------------------------------------------
+File:			particleLod.h
+Author:			Steve Costa
+Description:	Level of detail for the sprites, so a wide shot of a huge number of
+particles costs what the screen they cover costs rather than what
+the particles do.  Every sprite is the same size in the world, so
+past a certain depth each one is smaller on the screen than
+lodPixels across.  Those particles are gathered into cells, a tile
+of the screen by a slice of depth, and each cell is drawn as one
+impostor sprite instead: at the middle of its particles, big enough
+to cover how far they spread, with their colours averaged.  Its
+alpha is set so it adds the same light to the screen as they did.
+
+An impostor which is still smaller than a pixel is kept with a
+chance in proportion to its area and drawn a pixel across, so on
+average the light of the faint distant ones is kept too.  The chance
+comes from the particles, not the frame, so they do not flicker.
+
+The near particles are passed through in the order given, and the
+impostors come out furthest slice first, which is back to front
+behind them.  Each pass runs on the job system and none of them
+shares a counter between threads: the particles are split into near
+and far a chunk per job, and the far ones radix sorted on the top
+bits of their cell into buckets of neighbouring cells, what the
+cells need of each copied along.  Each bucket is then summed into
+its cells in one pass over it, so the result does not depend on the
+number of threads.
+-----------------------------------------------------------------------------------*/
+
+#ifndef PARTICLE_LOD_H_
+#define PARTICLE_LOD_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "simUtil.h"						// Common Macros
+#include "matrix.h"
+using namespace matrix;
+#include "particlePool.h"					// Particle attribute columns
+#include "jobSystem.h"						// Worker threads
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define LOD_CHUNK				4096			// Particles per job
+#define LOD_MAX_BUCKETS			256 			// Radix sort buckets, a run of cells each
+#define LOD_VIEW_BATCH			256				// Particles taken to view space together
+
+/*-----------------------------------------------------------------------------------
+Settings
+-----------------------------------------------------------------------------------*/
+
+struct TLodParams
+{
+	float		lodPixels;				// Sprites smaller than this are merged
+	int			tilePixels;				// Width and height of a cell on the screen
+	int			slicesPerOctave;		// Depth slices each time the distance doubles
+	int			maxSlices;				// Everything further goes in the last slice
+	float		minPixels;				// Impostors smaller than this are thinned out
+
+	TLodParams() {
+		lodPixels = 4.0f;
+		tilePixels = 8;
+		slicesPerOctave = 2;
+		maxSlices = 16;
+		minPixels = 1.0f;
+	}
+};
+
+/*-----------------------------------------------------------------------------------
+A sprite standing in for the particles of a cell
+-----------------------------------------------------------------------------------*/
+
+struct TParticleImpostor
+{
+	float			x, y, z;				// World space centre
+	float			size;					// World units across
+	float			r, g, b, a;
+	float			age;					// Through the particles' lives, for flipbooks
+	unsigned int	sprite;					// Atlas sprite
+};
+
+/*-----------------------------------------------------------------------------------
+What a cell keeps of each of its particles, light is alpha times area in pixels
+-----------------------------------------------------------------------------------*/
+
+struct TLodSample
+{
+	float			x, y, z;
+	float			light;
+	unsigned char	r, g, b, age;			// 0 to 255
+	unsigned int	hash;					// Fixed for the particle, for thinning out
+	unsigned int	sprite;
+	int				cell;
+};
+
+// Sums over the particles of a cell
+struct TLodCell
+{
+	float			sumX, sumY, sumZ, sumSq;
+	float			light, lightR, lightG, lightB, lightAge;
+	unsigned int	sprite;					// Lowest sprite index
+	unsigned int	hash;
+	int				count;
+};
+
+/*-----------------------------------------------------------------------------------
+Particle level of detail class definition
+-----------------------------------------------------------------------------------*/
+
+class CParticleLod
+{
+	// Attributes
+private:
+
+	TLodParams		m_params;
+
+	int				m_iCapacity;			// Particles the arrays hold
+	int				*m_piNear;				// Particles drawn as they are, chunk by chunk then packed
+	int				m_iNumNear;
+	int				*m_piChunkNear;			// Near particles found by each chunk
+	int				*m_piCell;				// Cell of each particle in the order given, -1 when near
+	int				*m_piChunkCounts;		// Far particles of each chunk in each bucket, then where they go
+	int				m_piBucketStart[LOD_MAX_BUCKETS + 1];
+	int				m_piBucketImpostors[LOD_MAX_BUCKETS];	// Made from each bucket
+	TLodSample		*m_pSamples;			// Far particles by bucket
+
+	int				m_iCellCapacity;
+	TParticleImpostor	*m_pImpostors;		// Room for one per cell, packed
+	int				m_iNumImpostors;
+	TLodCell		*m_pCells;				// Each worker's sums for the bucket it is on
+	int				m_iSumCapacity;
+
+	// Methods
+private:
+
+	void Grow(int count);
+	void GrowCells(int cells, int sums);
+
+public:
+
+	CParticleLod();
+	~CParticleLod();
+
+	void Shutdown();
+
+	void SetParams(const TLodParams& params) { m_params = params; }
+	const TLodParams& GetParams() const { return m_params; }
+
+	//-----------------------------------------------------------
+	// Sort the count particles in order, pool indices, or the
+	// first count particles of the pool, into those drawn as
+	// they are and the impostors for the rest.  The camera is
+	// given by OpenGL matrices and a viewport width by height
+	// pixels, and every sprite is a square size world units
+	// across.  Positions are blended between the last two steps
+	// as the sprites are.  Returns GetNumNear pool indices.
+	//-----------------------------------------------------------
+	const int *Build(const CParticlePool& pool, int count, const int *order, float blend,
+		const TMatrix& projection, const TMatrix& modelView, int width, int height, float size,
+		CJobSystem *jobs);
+
+	const int *GetNear() const { return m_piNear; }
+	int GetNumNear() const { return m_iNumNear; }
+	const TParticleImpostor *GetImpostors() const { return m_pImpostors; }
+	int GetNumImpostors() const { return m_iNumImpostors; }
+};
+
+#endif
@@ -0,0 +1,298 @@
+/*-----------------------------------------------------------------------------------
+File:			particlePool.h
+Author:			Steve Costa
+Description:	Structure-of-arrays storage for a system of particles.  Each
+particle attribute lives in its own contiguous, cache line aligned
+column so that a pass over the particles only streams the
+attributes it actually reads or writes.  The capacity of the pool
+is chosen at runtime.
+
+The live particles are kept packed at the front of the columns in
+[0, live count).  New particles are taken from the end of that
+range and a dead particle is removed by moving the last live
+particle into its slot, so passes over the pool never visit
+empty slots.
+-----------------------------------------------------------------------------------*/
+
+#ifndef PARTICLE_POOL_H_
+#define PARTICLE_POOL_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "simUtil.h"						// Common Macros
+#include "particle.h"						// Particle object (shared gravity)
+#include "particleKernels.h"				// Batch update kernels
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define PARTICLE_POOL_ALIGN			64							// Column alignment in bytes
+#define PARTICLE_POOL_ALIGN_FLOATS	((int)(PARTICLE_POOL_ALIGN / sizeof(float)))
+
+/*-----------------------------------------------------------------------------------
+Column identifiers, one per particle attribute
+-----------------------------------------------------------------------------------*/
+
+enum EParticleColumn
+{
+	PARTICLE_POS_X, PARTICLE_POS_Y, PARTICLE_POS_Z,				// Position
+	PARTICLE_VEL_X, PARTICLE_VEL_Y, PARTICLE_VEL_Z,				// Velocity
+	PARTICLE_ACCEL_X, PARTICLE_ACCEL_Y, PARTICLE_ACCEL_Z,		// Acceleration
+	PARTICLE_COL_R, PARTICLE_COL_G, PARTICLE_COL_B,				// Colour
+	PARTICLE_LIFE,												// Life span (alpha)
+	PARTICLE_FADE_RATE,											// How fast it fades out
+	PARTICLE_PREV_X, PARTICLE_PREV_Y, PARTICLE_PREV_Z,			// Position one step ago
+	PARTICLE_EMITTER,											// Emitter id, unsigned int, see UIntColumn
+	PARTICLE_SPRITE,											// Atlas sprite index, unsigned int
+
+	PARTICLE_NUM_COLUMNS
+};
+
+/*-----------------------------------------------------------------------------------
+Define the particle pool attributes and methods
+-----------------------------------------------------------------------------------*/
+
+class CParticlePool
+{
+	// Attributes
+private:
+
+	int		m_iCapacity;							// Number of particles held
+	int		m_iLiveCount;							// Live particles, packed at the front
+	int		m_iStride;								// Column length padded to alignment
+	void	*m_pBlock;								// Single allocation for all columns
+	float	*m_pfColumns[PARTICLE_NUM_COLUMNS];		// Aligned start of each column
+
+	// Methods
+public:
+
+	//-----------------------------------------------------------
+	// Standard constructor
+	//-----------------------------------------------------------
+	CParticlePool() {
+		m_iCapacity = 0;
+		m_iLiveCount = 0;
+		m_iStride = 0;
+		m_pBlock = NULL;
+		memset(m_pfColumns, 0, sizeof(m_pfColumns));
+	}
+
+	//-----------------------------------------------------------
+	// Standard destructor
+	//-----------------------------------------------------------
+	~CParticlePool() {
+		Shutdown();
+	}
+
+	//-----------------------------------------------------------
+	// Allocate the columns for the given number of particles.
+	// Every column is padded to a whole number of cache lines so
+	// each one starts on its own line and they never share one.
+	// All particles start out dead.
+	//-----------------------------------------------------------
+	int Init(int capacity) {
+		int i;
+		char *base;
+
+		Shutdown();
+
+		if (capacity <= 0)
+			return RETURN_FAILURE;
+
+		m_iStride = (capacity + PARTICLE_POOL_ALIGN_FLOATS - 1) & ~(PARTICLE_POOL_ALIGN_FLOATS - 1);
+
+		m_pBlock = malloc(sizeof(float) * m_iStride * PARTICLE_NUM_COLUMNS + PARTICLE_POOL_ALIGN);
+		if (!m_pBlock)
+			return RETURN_FAILURE;
+
+		// Align the start of the first column, the rest follow
+		base = (char *)(((size_t)m_pBlock + PARTICLE_POOL_ALIGN - 1) & ~(size_t)(PARTICLE_POOL_ALIGN - 1));
+		memset(base, 0, sizeof(float) * m_iStride * PARTICLE_NUM_COLUMNS);
+
+		for (i = 0; i < PARTICLE_NUM_COLUMNS; i++)
+			m_pfColumns[i] = (float *)base + i * m_iStride;
+
+		m_iCapacity = capacity;
+		m_iLiveCount = 0;
+
+		return RETURN_SUCCESS;
+	}
+
+	//-----------------------------------------------------------
+	// Free the columns
+	//-----------------------------------------------------------
+	void Shutdown() {
+		free(m_pBlock);
+		m_pBlock = NULL;
+		memset(m_pfColumns, 0, sizeof(m_pfColumns));
+		m_iCapacity = 0;
+		m_iLiveCount = 0;
+		m_iStride = 0;
+	}
+
+	//-----------------------------------------------------------
+	// Return the number of particles in the pool
+	//-----------------------------------------------------------
+	int GetCapacity() const {
+		return m_iCapacity;
+	}
+
+	//-----------------------------------------------------------
+	// Return the number of live particles, they are [0, count)
+	//-----------------------------------------------------------
+	int GetLiveCount() const {
+		return m_iLiveCount;
+	}
+
+	//-----------------------------------------------------------
+	// Take up to count slots for new particles from the end of
+	// the live range.  Returns how many were given, which is less
+	// than asked for when the pool is full, and the first one.
+	// The caller fills in every column of the new particles.
+	//-----------------------------------------------------------
+	int Allocate(int count, int *pFirst) {
+		count = MIN(count, m_iCapacity - m_iLiveCount);
+		count = MAX(count, 0);
+
+		*pFirst = m_iLiveCount;
+		m_iLiveCount += count;
+
+		return count;
+	}
+
+	//-----------------------------------------------------------
+	// Set the number of live particles outright, for restoring
+	// saved state.  The caller fills in every column of any
+	// slots this brings to life.
+	//-----------------------------------------------------------
+	void SetLiveCount(int count) {
+		m_iLiveCount = MAX(0, MIN(count, m_iCapacity));
+	}
+
+	//-----------------------------------------------------------
+	// Remove a live particle by moving the last live particle
+	// into its slot.  This changes the order of the particles.
+	//-----------------------------------------------------------
+	void Remove(int i) {
+		int column;
+		int last = --m_iLiveCount;
+
+		if (i == last)
+			return;
+
+		for (column = 0; column < PARTICLE_NUM_COLUMNS; column++)
+			m_pfColumns[column][i] = m_pfColumns[column][last];
+	}
+
+	//-----------------------------------------------------------
+	// Remove every live particle whose life has run out.  A slot
+	// is checked again after a particle is moved into it, as the
+	// moved particle may be dead too.  Returns the number removed.
+	// When given, deadPerEmitter[id] is increased for every
+	// particle removed whose emitter id is below numEmitters.
+	// When given, removedSlots gets the slot of each removal in
+	// order.  The n'th took the particle n from the end of the
+	// live range as it was before.
+	//-----------------------------------------------------------
+	int RemoveDead(int *deadPerEmitter = NULL, int numEmitters = 0, int *removedSlots = NULL) {
+		const float *life = m_pfColumns[PARTICLE_LIFE];
+		const unsigned int *emitter = UIntColumn(PARTICLE_EMITTER);
+		int i = 0;
+		int removed = 0;
+
+		while (i < m_iLiveCount)
+		{
+			if (life[i] > 0.0f)
+			{
+				i++;
+				continue;
+			}
+
+			if (deadPerEmitter && emitter[i] < (unsigned int)numEmitters)
+				deadPerEmitter[emitter[i]]++;
+			if (removedSlots)
+				removedSlots[removed] = i;
+
+			Remove(i);
+			removed++;
+		}
+
+		return removed;
+	}
+
+	//-----------------------------------------------------------
+	// Return the start of an attribute column
+	//-----------------------------------------------------------
+	float *Column(int column) {
+		return m_pfColumns[column];
+	}
+
+	const float *Column(int column) const {
+		return m_pfColumns[column];
+	}
+
+	//-----------------------------------------------------------
+	// Return an integer column such as PARTICLE_EMITTER.  It is
+	// the same 4 byte storage, moved around with the rest.
+	//-----------------------------------------------------------
+	unsigned int *UIntColumn(int column) {
+		return (unsigned int *)m_pfColumns[column];
+	}
+
+	const unsigned int *UIntColumn(int column) const {
+		return (const unsigned int *)m_pfColumns[column];
+	}
+
+	//-----------------------------------------------------------
+	// Exchange two columns without copying them
+	//-----------------------------------------------------------
+	void SwapColumns(int a, int b) {
+		float *temp;
+		SWAP(m_pfColumns[a], m_pfColumns[b], temp);
+	}
+
+	//-----------------------------------------------------------
+	// Call before each simulation step.  The current positions
+	// become the previous positions, the step then reads those
+	// and writes the new positions so both states are kept for
+	// interpolating between them when drawing.
+	//-----------------------------------------------------------
+	void BeginStep() {
+		SwapColumns(PARTICLE_POS_X, PARTICLE_PREV_X);
+		SwapColumns(PARTICLE_POS_Y, PARTICLE_PREV_Y);
+		SwapColumns(PARTICLE_POS_Z, PARTICLE_PREV_Z);
+	}
+
+	//-----------------------------------------------------------
+	// Gather the positions of particles [first, first + count),
+	// or of order[first...] when there is an order, blended
+	// between the last two steps as they are drawn, into count
+	// elements of x, y and z
+	//-----------------------------------------------------------
+	void BlendPositions(int first, int count, const int *order, float blend,
+		float *x, float *y, float *z) const {
+		const float *prevX = m_pfColumns[PARTICLE_PREV_X];
+		const float *prevY = m_pfColumns[PARTICLE_PREV_Y];
+		const float *prevZ = m_pfColumns[PARTICLE_PREV_Z];
+		const float *posX = m_pfColumns[PARTICLE_POS_X];
+		const float *posY = m_pfColumns[PARTICLE_POS_Y];
+		const float *posZ = m_pfColumns[PARTICLE_POS_Z];
+
+		for (int j = 0; j < count; j++)
+		{
+			int i = order ? order[first + j] : first + j;
+
+			x[j] = prevX[i] + blend * (posX[i] - prevX[i]);
+			y[j] = prevY[i] + blend * (posY[i] - prevY[i]);
+			z[j] = prevZ[i] + blend * (posZ[i] - prevZ[i]);
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,1113 @@
+/*-----------------------------------------------------------------------------------
+File:			particleStorage.cpp
+Author:			Steve Costa
+Description:	Conversions between float columns and the compact encodings of
+CParticleStore, as scalar loops and SSE2.  The SSE2 versions give
+exactly the same bits as the scalar ones, which also handle the
+tails.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "particleStorage.h"				// Header file for these functions
+#include "cpuFeatures.h"					// Instruction set detection
+#include "random.h"							// Test values
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/*-----------------------------------------------------------------------------------
+Reinterpret the bits of a float and back
+-----------------------------------------------------------------------------------*/
+
+static inline unsigned int FloatBits(float value)
+{
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static inline float BitsFloat(unsigned int bits)
+{
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+/*-----------------------------------------------------------------------------------
+Single values.  A float is rounded to the nearest half, ties to even, anything
+too big for a half becomes infinity and a NaN stays a NaN.  Halves smaller than
+the smallest normal one are rounded by adding a float whose last mantissa bit
+is worth the smallest half.
+-----------------------------------------------------------------------------------*/
+
+static inline unsigned short FloatToHalf(float value)
+{
+	unsigned int f = FloatBits(value);
+	unsigned int sign = f & 0x80000000u;
+	unsigned int h;
+
+	f ^= sign;
+	if (f >= (127u + 16) << 23)
+		h = (f > 0x7F800000u) ? 0x7E00 : 0x7C00;
+	else if (f < (127u - 14) << 23)
+		h = FloatBits(BitsFloat(f) + 0.5f) - FloatBits(0.5f);
+	else
+	{
+		unsigned int odd = (f >> 13) & 1;
+
+		// Take the exponent bias down to a half's and round
+		f += ((15u - 127) << 23) + 0xFFF + odd;
+		h = f >> 13;
+	}
+
+	return (unsigned short)(h | (sign >> 16));
+}
+
+// The exponent and mantissa move up into a float's and the scale makes up the
+// difference in bias, infinities and NaNs then get the whole exponent
+static inline float HalfToFloat(unsigned short half)
+{
+	unsigned int expMant = half & 0x7FFF;
+	unsigned int bits = FloatBits(BitsFloat(expMant << 13) * BitsFloat((254u - 15) << 23));
+
+	if (expMant >= 0x7C00)
+		bits |= 255u << 23;
+
+	return BitsFloat(bits | ((unsigned int)(half & 0x8000) << 16));
+}
+
+// Offset in steps from the origin, rounded half away from zero and clamped to
+// what 16 bits and the remainder byte hold
+static inline int FloatToOffset(float value, float origin, float scale)
+{
+	float q = (value - origin) * scale;
+
+	q = MAX(q, -float(STORE_OFFSET_MAX) - 1.0f);
+	q = MIN(q, float(STORE_OFFSET_MAX));
+
+	return (int)(q + ((q < 0.0f) ? -0.5f : 0.5f));
+}
+
+static inline float OffsetToFloat(int offset, float origin, float step)
+{
+	return float(offset) * step + origin;
+}
+
+// An offset is the stored 16 bits times 256 and the remainder byte
+static inline int JoinOffset(short coarse, unsigned char remainder)
+{
+	return int(coarse) * 256 + remainder;
+}
+
+static inline void SplitOffset(int offset, short *coarse, unsigned char *remainder)
+{
+	*coarse = (short)(offset >> 8);
+	*remainder = (unsigned char)(offset & 0xFF);
+}
+
+// Move an offset by a distance, rounded to whole steps as the position is,
+// so what is under a step carries over in the remainder byte
+static inline int MoveOffset(int offset, float move, float scale)
+{
+	float d = move * scale;
+
+	d = MAX(d, -2.0f * float(STORE_OFFSET_MAX));
+	d = MIN(d, 2.0f * float(STORE_OFFSET_MAX));
+	offset += (int)(d + ((d < 0.0f) ? -0.5f : 0.5f));
+
+	offset = MAX(offset, -STORE_OFFSET_MAX - 1);
+	offset = MIN(offset, STORE_OFFSET_MAX);
+
+	return offset;
+}
+
+static inline unsigned int FloatToUnorm8(float value)
+{
+	value = MAX(value, 0.0f);
+	value = MIN(value, 1.0f);
+
+	return (unsigned int)(int)(value * 255.0f + 0.5f);
+}
+
+/*-----------------------------------------------------------------------------------
+Scalar loops, also used for the tails of the SSE2 ones
+-----------------------------------------------------------------------------------*/
+
+static void PackHalfScalar(const float *in, unsigned short *out, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		out[i] = FloatToHalf(in[i]);
+}
+
+static void UnpackHalfScalar(const unsigned short *in, float *out, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		out[i] = HalfToFloat(in[i]);
+}
+
+static void PackOffset16Scalar(const float *in, const unsigned short *emitter, const float *origin, short *out,
+	unsigned char *remainder, int count, float scale)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		SplitOffset(FloatToOffset(in[i], origin[emitter[i]], scale), out + i, remainder + i);
+}
+
+static void UnpackOffset16Scalar(const short *in, const unsigned char *remainder, const unsigned short *emitter,
+	const float *origin, float *out, int count, float step)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		out[i] = OffsetToFloat(JoinOffset(in[i], remainder[i]), origin[emitter[i]], step);
+}
+
+static void PackRgba8Scalar(const float *r, const float *g, const float *b, unsigned int *out, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		out[i] = FloatToUnorm8(r[i]) | (FloatToUnorm8(g[i]) << 8) | (FloatToUnorm8(b[i]) << 16) | 0xFF000000u;
+}
+
+static void UnpackRgba8Scalar(const unsigned int *in, float *r, float *g, float *b, int count)
+{
+	const float scale = 1.0f / 255.0f;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		r[i] = float(in[i] & 0xFF) * scale;
+		g[i] = float((in[i] >> 8) & 0xFF) * scale;
+		b[i] = float((in[i] >> 16) & 0xFF) * scale;
+	}
+}
+
+#ifdef CPU_X86
+
+/*-----------------------------------------------------------------------------------
+SSE2 conversions of four values, the same steps as the single ones with masks
+in place of the branches.  Stored 16 bit values are carried zero extended in
+32 bit lanes.
+-----------------------------------------------------------------------------------*/
+
+TARGET_SSE2 static inline __m128i FloatToHalf4(__m128 value)
+{
+	__m128i f = _mm_castps_si128(value);
+	__m128i sign = _mm_and_si128(f, _mm_set1_epi32((int)0x80000000u));
+	__m128i absF = _mm_xor_si128(f, sign);
+	__m128i subnormalMagic = _mm_set1_epi32(126 << 23);
+
+	__m128i isNaN = _mm_castps_si128(_mm_cmpunord_ps(_mm_castsi128_ps(absF), _mm_castsi128_ps(absF)));
+	__m128i isFinite = _mm_cmpgt_epi32(_mm_set1_epi32((127 + 16) << 23), absF);
+	__m128i isSubnormal = _mm_cmpgt_epi32(_mm_set1_epi32((127 - 14) << 23), absF);
+
+	__m128i special = _mm_or_si128(_mm_set1_epi32(0x7C00), _mm_and_si128(isNaN, _mm_set1_epi32(0x0200)));
+	__m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(absF),
+		_mm_castsi128_ps(subnormalMagic))), subnormalMagic);
+	__m128i odd = _mm_and_si128(_mm_srli_epi32(absF, 13), _mm_set1_epi32(1));
+	__m128i normal = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(absF,
+		_mm_set1_epi32((int)((15u - 127) << 23) + 0xFFF)), odd), 13);
+
+	__m128i h = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal), _mm_andnot_si128(isSubnormal, normal));
+	h = _mm_or_si128(_mm_and_si128(isFinite, h), _mm_andnot_si128(isFinite, special));
+
+	// The sign lands in bit 15 and the lane stays in range for a signed
+	// saturating pack
+	return _mm_or_si128(h, _mm_srai_epi32(sign, 16));
+}
+
+TARGET_SSE2 static inline __m128 HalfToFloat4(__m128i half)
+{
+	__m128i expMant = _mm_and_si128(half, _mm_set1_epi32(0x7FFF));
+	__m128i sign = _mm_slli_epi32(_mm_xor_si128(half, expMant), 16);
+	__m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(expMant, 13)),
+		_mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23)));
+	__m128 special = _mm_and_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(expMant, _mm_set1_epi32(0x7BFF))),
+		_mm_castsi128_ps(_mm_set1_epi32(255 << 23)));
+
+	return _mm_or_ps(scaled, _mm_or_ps(special, _mm_castsi128_ps(sign)));
+}
+
+// Half with the sign of the value added before truncating
+TARGET_SSE2 static inline __m128i RoundAway4(__m128 q)
+{
+	__m128 half = _mm_or_ps(_mm_set1_ps(0.5f), _mm_and_ps(q, _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000u))));
+
+	return _mm_cvttps_epi32(_mm_add_ps(q, half));
+}
+
+TARGET_SSE2 static inline __m128i FloatToOffset4(__m128 value, __m128 origin, __m128 scale)
+{
+	__m128 q = _mm_mul_ps(_mm_sub_ps(value, origin), scale);
+
+	q = _mm_min_ps(_mm_max_ps(q, _mm_set1_ps(-float(STORE_OFFSET_MAX) - 1.0f)), _mm_set1_ps(float(STORE_OFFSET_MAX)));
+
+	return RoundAway4(q);
+}
+
+TARGET_SSE2 static inline __m128 OffsetToFloat4(__m128i offset, __m128 origin, __m128 step)
+{
+	return _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(offset), step), origin);
+}
+
+// Integer lanes clamped without the SSE4.1 min and max
+TARGET_SSE2 static inline __m128i ClampOffset4(__m128i offset)
+{
+	__m128i lo = _mm_set1_epi32(-STORE_OFFSET_MAX - 1);
+	__m128i hi = _mm_set1_epi32(STORE_OFFSET_MAX);
+	__m128i below = _mm_cmplt_epi32(offset, lo);
+	__m128i above = _mm_cmpgt_epi32(offset, hi);
+
+	offset = _mm_or_si128(_mm_and_si128(below, lo), _mm_andnot_si128(below, offset));
+	return _mm_or_si128(_mm_and_si128(above, hi), _mm_andnot_si128(above, offset));
+}
+
+TARGET_SSE2 static inline __m128i MoveOffset4(__m128i offset, __m128 move, __m128 scale)
+{
+	__m128 d = _mm_mul_ps(move, scale);
+
+	d = _mm_min_ps(_mm_max_ps(d, _mm_set1_ps(-2.0f * float(STORE_OFFSET_MAX))), _mm_set1_ps(2.0f * float(STORE_OFFSET_MAX)));
+
+	return ClampOffset4(_mm_add_epi32(offset, RoundAway4(d)));
+}
+
+// Four offsets from their 16 bits, sign extended, and remainder bytes
+TARGET_SSE2 static inline __m128i LoadOffset4(const short *in, const unsigned char *remainder)
+{
+	__m128i coarse = _mm_loadl_epi64((const __m128i *)in);
+	__m128i low;
+	int bytes;
+
+	memcpy(&bytes, remainder, sizeof(bytes));
+	low = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), _mm_setzero_si128()), _mm_setzero_si128());
+	coarse = _mm_srai_epi32(_mm_unpacklo_epi16(coarse, coarse), 16);
+
+	return _mm_add_epi32(_mm_slli_epi32(coarse, 8), low);
+}
+
+TARGET_SSE2 static inline void StoreOffset4(short *out, unsigned char *remainder, __m128i offset)
+{
+	__m128i coarse = _mm_srai_epi32(offset, 8);
+	__m128i low = _mm_and_si128(offset, _mm_set1_epi32(0xFF));
+	int bytes;
+
+	low = _mm_packs_epi32(low, low);
+	bytes = _mm_cvtsi128_si32(_mm_packus_epi16(low, low));
+	_mm_storel_epi64((__m128i *)out, _mm_packs_epi32(coarse, coarse));
+	memcpy(remainder, &bytes, sizeof(bytes));
+}
+
+// The origins of the emitters of four particles
+TARGET_SSE2 static inline __m128 LoadOrigin4(const float *origin, const unsigned short *emitter)
+{
+	return _mm_set_ps(origin[emitter[3]], origin[emitter[2]], origin[emitter[1]], origin[emitter[0]]);
+}
+
+TARGET_SSE2 static inline __m128i FloatToUnorm8x4(__m128 value)
+{
+	value = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+
+	return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+}
+
+// Four 16 bit values to and from the low halves of 32 bit lanes, the high
+// halves of the stored values are put back by the caller where needed
+TARGET_SSE2 static inline __m128i Load4x16(const unsigned short *in)
+{
+	return _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)in), _mm_setzero_si128());
+}
+
+TARGET_SSE2 static inline void Store4x16(unsigned short *out, __m128i lanes)
+{
+	_mm_storel_epi64((__m128i *)out, _mm_packs_epi32(lanes, lanes));
+}
+
+/*-----------------------------------------------------------------------------------
+SSE2 runs of values
+-----------------------------------------------------------------------------------*/
+
+TARGET_SSE2 static void PackHalfSSE2(const float *in, unsigned short *out, int count)
+{
+	int i;
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		__m128i lo = FloatToHalf4(_mm_loadu_ps(in + i));
+		__m128i hi = FloatToHalf4(_mm_loadu_ps(in + i + 4));
+
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(lo, hi));
+	}
+
+	PackHalfScalar(in + i, out + i, count - i);
+}
+
+TARGET_SSE2 static void UnpackHalfSSE2(const unsigned short *in, float *out, int count)
+{
+	int i;
+	__m128i zero = _mm_setzero_si128();
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		__m128i packed = _mm_loadu_si128((const __m128i *)(in + i));
+
+		_mm_storeu_ps(out + i, HalfToFloat4(_mm_unpacklo_epi16(packed, zero)));
+		_mm_storeu_ps(out + i + 4, HalfToFloat4(_mm_unpackhi_epi16(packed, zero)));
+	}
+
+	UnpackHalfScalar(in + i, out + i, count - i);
+}
+
+TARGET_SSE2 static void PackOffset16SSE2(const float *in, const unsigned short *emitter, const float *origin, short *out,
+	unsigned char *remainder, int count, float scale)
+{
+	int i;
+	__m128 vscale = _mm_set1_ps(scale);
+
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		StoreOffset4(out + i, remainder + i, FloatToOffset4(_mm_loadu_ps(in + i),
+			LoadOrigin4(origin, emitter + i), vscale));
+	}
+
+	PackOffset16Scalar(in + i, emitter + i, origin, out + i, remainder + i, count - i, scale);
+}
+
+TARGET_SSE2 static void UnpackOffset16SSE2(const short *in, const unsigned char *remainder, const unsigned short *emitter,
+	const float *origin, float *out, int count, float step)
+{
+	int i;
+	__m128 vstep = _mm_set1_ps(step);
+
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		_mm_storeu_ps(out + i, OffsetToFloat4(LoadOffset4(in + i, remainder + i),
+			LoadOrigin4(origin, emitter + i), vstep));
+	}
+
+	UnpackOffset16Scalar(in + i, remainder + i, emitter + i, origin, out + i, count - i, step);
+}
+
+TARGET_SSE2 static void PackRgba8SSE2(const float *r, const float *g, const float *b, unsigned int *out, int count)
+{
+	int i;
+	__m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		__m128i vr = FloatToUnorm8x4(_mm_loadu_ps(r + i));
+		__m128i vg = FloatToUnorm8x4(_mm_loadu_ps(g + i));
+		__m128i vb = FloatToUnorm8x4(_mm_loadu_ps(b + i));
+
+		_mm_storeu_si128((__m128i *)(out + i), _mm_or_si128(_mm_or_si128(vr, _mm_slli_epi32(vg, 8)),
+			_mm_or_si128(_mm_slli_epi32(vb, 16), alpha)));
+	}
+
+	PackRgba8Scalar(r + i, g + i, b + i, out + i, count - i);
+}
+
+TARGET_SSE2 static void UnpackRgba8SSE2(const unsigned int *in, float *r, float *g, float *b, int count)
+{
+	int i;
+	__m128i mask = _mm_set1_epi32(0xFF);
+	__m128 scale = _mm_set1_ps(1.0f / 255.0f);
+
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		__m128i packed = _mm_loadu_si128((const __m128i *)(in + i));
+
+		_mm_storeu_ps(r + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(packed, mask)), scale));
+		_mm_storeu_ps(g + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(packed, 8), mask)), scale));
+		_mm_storeu_ps(b + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(packed, 16), mask)), scale));
+	}
+
+	UnpackRgba8Scalar(in + i, r + i, g + i, b + i, count - i);
+}
+
+#endif
+
+/*-----------------------------------------------------------------------------------
+Dispatch
+-----------------------------------------------------------------------------------*/
+
+static bool UseSSE2()
+{
+	return (GetCpuFeatures() & CPU_FEATURE_SSE2) != 0;
+}
+
+// The update also needs F16C for its half floats
+static bool UseAVX2()
+{
+	return (GetCpuFeatures() & (CPU_FEATURE_AVX2 | CPU_FEATURE_F16C)) == (CPU_FEATURE_AVX2 | CPU_FEATURE_F16C);
+}
+
+void PackHalf(const float *in, unsigned short *out, int count)
+{
+#ifdef CPU_X86
+	if (UseSSE2())
+	{
+		PackHalfSSE2(in, out, count);
+		return;
+	}
+#endif
+	PackHalfScalar(in, out, count);
+}
+
+void UnpackHalf(const unsigned short *in, float *out, int count)
+{
+#ifdef CPU_X86
+	if (UseSSE2())
+	{
+		UnpackHalfSSE2(in, out, count);
+		return;
+	}
+#endif
+	UnpackHalfScalar(in, out, count);
+}
+
+void PackOffset16(const float *in, const unsigned short *emitter, const float *origin, short *out,
+	unsigned char *remainder, int count, const TStorageRange& range)
+{
+#ifdef CPU_X86
+	if (UseSSE2())
+	{
+		PackOffset16SSE2(in, emitter, origin, out, remainder, count, range.scale);
+		return;
+	}
+#endif
+	PackOffset16Scalar(in, emitter, origin, out, remainder, count, range.scale);
+}
+
+void UnpackOffset16(const short *in, const unsigned char *remainder, const unsigned short *emitter,
+	const float *origin, float *out, int count, const TStorageRange& range)
+{
+#ifdef CPU_X86
+	if (UseSSE2())
+	{
+		UnpackOffset16SSE2(in, remainder, emitter, origin, out, count, range.step);
+		return;
+	}
+#endif
+	UnpackOffset16Scalar(in, remainder, emitter, origin, out, count, range.step);
+}
+
+void PackRgba8(const float *r, const float *g, const float *b, unsigned int *out, int count)
+{
+#ifdef CPU_X86
+	if (UseSSE2())
+	{
+		PackRgba8SSE2(r, g, b, out, count);
+		return;
+	}
+#endif
+	PackRgba8Scalar(r, g, b, out, count);
+}
+
+void UnpackRgba8(const unsigned int *in, float *r, float *g, float *b, int count)
+{
+#ifdef CPU_X86
+	if (UseSSE2())
+	{
+		UnpackRgba8SSE2(in, r, g, b, count);
+		return;
+	}
+#endif
+	UnpackRgba8Scalar(in, r, g, b, count);
+}
+
+/*-----------------------------------------------------------------------------------
+Each encoding read and written a value at a time and, with SSE2, four at a time.
+Position encodings also move particle i of a column by a distance and give back
+where it is now, origin being that of its emitter.
+-----------------------------------------------------------------------------------*/
+
+template <class E>
+struct TEncodingOps;
+
+template <>
+struct TEncodingOps<TFloatEncoding>
+{
+	static float Get(const float *in) { return *in; }
+	static void Set(float *out, float value) { *out = value; }
+
+	// Positions are where they are, the emitter does not matter
+	static float Origin(const float *origin, const unsigned short *emitter) { return 0.0f; }
+	static float Advance(float *pos, unsigned char *remainder, int i, float move, float origin,
+		const TStorageRange& range) {
+		pos[i] += move;
+		return pos[i];
+	}
+
+#ifdef CPU_X86
+	TARGET_SSE2 static __m128 Load(const float *in) {
+		return _mm_loadu_ps(in);
+	}
+	TARGET_SSE2 static void Store(float *out, __m128 value) {
+		_mm_storeu_ps(out, value);
+	}
+	TARGET_SSE2 static __m128 Origin4(const float *origin, const unsigned short *emitter) {
+		return _mm_setzero_ps();
+	}
+	TARGET_SSE2 static __m128 Advance4(float *pos, unsigned char *remainder, int i, __m128 move, __m128 origin,
+		__m128 step, __m128 scale) {
+		__m128 p = _mm_add_ps(_mm_loadu_ps(pos + i), move);
+		_mm_storeu_ps(pos + i, p);
+		return p;
+	}
+
+	TARGET_AVX2_F16C static __m256 Load8(const float *in) {
+		return _mm256_loadu_ps(in);
+	}
+	TARGET_AVX2_F16C static void Store8(float *out, __m256 value) {
+		_mm256_storeu_ps(out, value);
+	}
+	TARGET_AVX2_F16C static __m256 Origin8(const float *origin, const unsigned short *emitter) {
+		return _mm256_setzero_ps();
+	}
+	TARGET_AVX2_F16C static __m256 Advance8(float *pos, unsigned char *remainder, int i, __m256 move, __m256 origin,
+		__m256 step, __m256 scale) {
+		__m256 p = _mm256_add_ps(_mm256_loadu_ps(pos + i), move);
+		_mm256_storeu_ps(pos + i, p);
+		return p;
+	}
+#endif
+};
+
+template <>
+struct TEncodingOps<THalfEncoding>
+{
+	static float Get(const unsigned short *in) { return HalfToFloat(*in); }
+	static void Set(unsigned short *out, float value) { *out = FloatToHalf(value); }
+
+#ifdef CPU_X86
+	TARGET_SSE2 static __m128 Load(const unsigned short *in) {
+		return HalfToFloat4(Load4x16(in));
+	}
+	TARGET_SSE2 static void Store(unsigned short *out, __m128 value) {
+		Store4x16(out, FloatToHalf4(value));
+	}
+	TARGET_AVX2_F16C static __m256 Load8(const unsigned short *in) {
+		return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)in));
+	}
+	TARGET_AVX2_F16C static void Store8(unsigned short *out, __m256 value) {
+		_mm_storeu_si128((__m128i *)out, _mm256_cvtps_ph(value, _MM_FROUND_TO_NEAREST_INT));
+	}
+#endif
+};
+
+template <>
+struct TEncodingOps<TFixed16Encoding>
+{
+	static float Origin(const float *origin, const unsigned short *emitter) { return origin[*emitter]; }
+	static float Advance(short *pos, unsigned char *remainder, int i, float move, float origin,
+		const TStorageRange& range) {
+		int offset = MoveOffset(JoinOffset(pos[i], remainder[i]), move, range.scale);
+
+		SplitOffset(offset, pos + i, remainder + i);
+		return OffsetToFloat(offset, origin, range.step);
+	}
+
+#ifdef CPU_X86
+	TARGET_SSE2 static __m128 Origin4(const float *origin, const unsigned short *emitter) {
+		return LoadOrigin4(origin, emitter);
+	}
+	TARGET_SSE2 static __m128 Advance4(short *pos, unsigned char *remainder, int i, __m128 move, __m128 origin,
+		__m128 step, __m128 scale) {
+		__m128i offset = MoveOffset4(LoadOffset4(pos + i, remainder + i), move, scale);
+
+		StoreOffset4(pos + i, remainder + i, offset);
+		return OffsetToFloat4(offset, origin, step);
+	}
+
+	// Eight at a time, the integer clamps and the origins gathered
+	// with AVX2
+	TARGET_AVX2_F16C static __m256 Origin8(const float *origin, const unsigned short *emitter) {
+		__m256i index = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)emitter));
+		return _mm256_i32gather_ps(origin, index, 4);
+	}
+	TARGET_AVX2_F16C static __m256 Advance8(short *pos, unsigned char *remainder, int i, __m256 move, __m256 origin,
+		__m256 step, __m256 scale) {
+		__m256i coarse = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(pos + i)));
+		__m256i low = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(remainder + i)));
+		__m256i offset = _mm256_add_epi32(_mm256_slli_epi32(coarse, 8), low);
+		__m256 d = _mm256_mul_ps(move, scale);
+		__m256 half;
+		__m128i packed;
+
+		d = _mm256_min_ps(_mm256_max_ps(d, _mm256_set1_ps(-2.0f * float(STORE_OFFSET_MAX))),
+			_mm256_set1_ps(2.0f * float(STORE_OFFSET_MAX)));
+		half = _mm256_or_ps(_mm256_set1_ps(0.5f), _mm256_and_ps(d, _mm256_castsi256_ps(_mm256_set1_epi32((int)0x80000000u))));
+		offset = _mm256_add_epi32(offset, _mm256_cvttps_epi32(_mm256_add_ps(d, half)));
+		offset = _mm256_min_epi32(_mm256_max_epi32(offset, _mm256_set1_epi32(-STORE_OFFSET_MAX - 1)),
+			_mm256_set1_epi32(STORE_OFFSET_MAX));
+
+		coarse = _mm256_srai_epi32(offset, 8);
+		_mm_storeu_si128((__m128i *)(pos + i), _mm_packs_epi32(_mm256_castsi256_si128(coarse),
+			_mm256_extracti128_si256(coarse, 1)));
+		low = _mm256_and_si256(offset, _mm256_set1_epi32(0xFF));
+		packed = _mm_packs_epi32(_mm256_castsi256_si128(low), _mm256_extracti128_si256(low, 1));
+		_mm_storel_epi64((__m128i *)(remainder + i), _mm_packus_epi16(packed, packed));
+
+		return _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(offset), step), origin);
+	}
+#endif
+};
+
+/*-----------------------------------------------------------------------------------
+The update of the particle kernels, unpacking each value as it is read and
+packing it as it is written.  The positions are moved in place.  The scalar
+loop also does the tail of the SSE2 one from particle first.
+-----------------------------------------------------------------------------------*/
+
+template <class P>
+static void UpdateStoredScalar(const TStoreStreams<P>& s, int first, int count, float dt, float gravity)
+{
+	typedef TEncodingOps<typename P::Position> Position;
+	typedef TEncodingOps<typename P::Vector> Vector;
+	typedef TEncodingOps<typename P::Scalar> Scalar;
+
+	int i;
+
+	for (i = first; i < count; i++)
+	{
+		// Update the velocity vector
+		float vx = Vector::Get(s.vel[0] + i) + dt * Vector::Get(s.accel[0] + i);
+		float vy = Vector::Get(s.vel[1] + i) + dt * (Vector::Get(s.accel[1] + i) - gravity);
+		float vz = Vector::Get(s.vel[2] + i) + dt * Vector::Get(s.accel[2] + i);
+
+		// Update the positon vector
+		float py = Position::Advance(s.pos[1], s.remainder[1], i, dt * vy,
+			Position::Origin(s.originY, s.emitter + i), s.range[1]);
+		Position::Advance(s.pos[0], s.remainder[0], i, dt * vx, 0.0f, s.range[0]);
+		Position::Advance(s.pos[2], s.remainder[2], i, dt * vz, 0.0f, s.range[2]);
+
+		// Bounce off the floor at 0 along the y-axis
+		vy *= (py < 0.0f) ? -0.75f : 1.0f;
+
+		Vector::Set(s.vel[0] + i, vx);
+		Vector::Set(s.vel[1] + i, vy);
+		Vector::Set(s.vel[2] + i, vz);
+
+		// Particle fades
+		Scalar::Set(s.life + i, Scalar::Get(s.life + i) - Scalar::Get(s.fadeRate + i));
+	}
+}
+
+#ifdef CPU_X86
+
+template <class P>
+TARGET_SSE2 static void UpdateStoredSSE2(const TStoreStreams<P>& s, int count, float dt, float gravity)
+{
+	typedef TEncodingOps<typename P::Position> Position;
+	typedef TEncodingOps<typename P::Vector> Vector;
+	typedef TEncodingOps<typename P::Scalar> Scalar;
+
+	int i, axis;
+	__m128 vdt = _mm_set1_ps(dt);
+	__m128 vgravity = _mm_set1_ps(gravity);
+	__m128 vzero = _mm_setzero_ps();
+	__m128 vone = _mm_set1_ps(1.0f);
+	__m128 vbounce = _mm_set1_ps(-0.75f);
+	__m128 step[3], scale[3];
+
+	for (axis = 0; axis < 3; axis++)
+	{
+		step[axis] = _mm_set1_ps(s.range[axis].step);
+		scale[axis] = _mm_set1_ps(s.range[axis].scale);
+	}
+
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		__m128 vx = _mm_add_ps(Vector::Load(s.vel[0] + i), _mm_mul_ps(vdt, Vector::Load(s.accel[0] + i)));
+		__m128 vy = _mm_add_ps(Vector::Load(s.vel[1] + i), _mm_mul_ps(vdt, _mm_sub_ps(Vector::Load(s.accel[1] + i), vgravity)));
+		__m128 vz = _mm_add_ps(Vector::Load(s.vel[2] + i), _mm_mul_ps(vdt, Vector::Load(s.accel[2] + i)));
+
+		__m128 py = Position::Advance4(s.pos[1], s.remainder[1], i, _mm_mul_ps(vdt, vy),
+			Position::Origin4(s.originY, s.emitter + i), step[1], scale[1]);
+		Position::Advance4(s.pos[0], s.remainder[0], i, _mm_mul_ps(vdt, vx), vzero, step[0], scale[0]);
+		Position::Advance4(s.pos[2], s.remainder[2], i, _mm_mul_ps(vdt, vz), vzero, step[2], scale[2]);
+
+		__m128 below = _mm_cmplt_ps(py, vzero);
+		vy = _mm_mul_ps(vy, _mm_or_ps(_mm_and_ps(below, vbounce), _mm_andnot_ps(below, vone)));
+
+		Vector::Store(s.vel[0] + i, vx);
+		Vector::Store(s.vel[1] + i, vy);
+		Vector::Store(s.vel[2] + i, vz);
+		Scalar::Store(s.life + i, _mm_sub_ps(Scalar::Load(s.life + i), Scalar::Load(s.fadeRate + i)));
+	}
+
+	UpdateStoredScalar(s, i, count, dt, gravity);
+}
+
+// Eight particles at a time, with the half floats converted by F16C
+template <class P>
+TARGET_AVX2_F16C static void UpdateStoredAVX2(const TStoreStreams<P>& s, int count, float dt, float gravity)
+{
+	typedef TEncodingOps<typename P::Position> Position;
+	typedef TEncodingOps<typename P::Vector> Vector;
+	typedef TEncodingOps<typename P::Scalar> Scalar;
+
+	int i, axis;
+	__m256 vdt = _mm256_set1_ps(dt);
+	__m256 vgravity = _mm256_set1_ps(gravity);
+	__m256 vzero = _mm256_setzero_ps();
+	__m256 vone = _mm256_set1_ps(1.0f);
+	__m256 vbounce = _mm256_set1_ps(-0.75f);
+	__m256 step[3], scale[3];
+
+	for (axis = 0; axis < 3; axis++)
+	{
+		step[axis] = _mm256_set1_ps(s.range[axis].step);
+		scale[axis] = _mm256_set1_ps(s.range[axis].scale);
+	}
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		__m256 vx = _mm256_add_ps(Vector::Load8(s.vel[0] + i), _mm256_mul_ps(vdt, Vector::Load8(s.accel[0] + i)));
+		__m256 vy = _mm256_add_ps(Vector::Load8(s.vel[1] + i), _mm256_mul_ps(vdt, _mm256_sub_ps(Vector::Load8(s.accel[1] + i), vgravity)));
+		__m256 vz = _mm256_add_ps(Vector::Load8(s.vel[2] + i), _mm256_mul_ps(vdt, Vector::Load8(s.accel[2] + i)));
+
+		__m256 py = Position::Advance8(s.pos[1], s.remainder[1], i, _mm256_mul_ps(vdt, vy),
+			Position::Origin8(s.originY, s.emitter + i), step[1], scale[1]);
+		Position::Advance8(s.pos[0], s.remainder[0], i, _mm256_mul_ps(vdt, vx), vzero, step[0], scale[0]);
+		Position::Advance8(s.pos[2], s.remainder[2], i, _mm256_mul_ps(vdt, vz), vzero, step[2], scale[2]);
+
+		__m256 below = _mm256_cmp_ps(py, vzero, _CMP_LT_OQ);
+		vy = _mm256_mul_ps(vy, _mm256_blendv_ps(vone, vbounce, below));
+
+		Vector::Store8(s.vel[0] + i, vx);
+		Vector::Store8(s.vel[1] + i, vy);
+		Vector::Store8(s.vel[2] + i, vz);
+		Scalar::Store8(s.life + i, _mm256_sub_ps(Scalar::Load8(s.life + i), Scalar::Load8(s.fadeRate + i)));
+	}
+
+	UpdateStoredScalar(s, i, count, dt, gravity);
+}
+
+#endif
+
+template <class P>
+void UpdateStored(const TStoreStreams<P>& s, int count, float dt)
+{
+#ifdef CPU_X86
+	if (UseAVX2())
+	{
+		UpdateStoredAVX2(s, count, dt, CParticle::m_sfGravity);
+		return;
+	}
+	if (UseSSE2())
+	{
+		UpdateStoredSSE2(s, count, dt, CParticle::m_sfGravity);
+		return;
+	}
+#endif
+	UpdateStoredScalar(s, 0, count, dt, CParticle::m_sfGravity);
+}
+
+// The precisions in particleStorage.h
+template void UpdateStored<TFullPrecision>(const TStoreStreams<TFullPrecision>& s, int count, float dt);
+template void UpdateStored<TMixedPrecision>(const TStoreStreams<TMixedPrecision>& s, int count, float dt);
+template void UpdateStored<TCompactPrecision>(const TStoreStreams<TCompactPrecision>& s, int count, float dt);
+
+/*-----------------------------------------------------------------------------------
+Step the same compact particles of a few emitters with each update kernel the
+processor has and compare them bit for bit.  Some emitters are below the floor
+so the bounce is taken, and an odd count exercises the tails.
+-----------------------------------------------------------------------------------*/
+
+static int CheckStoredUpdate()
+{
+#ifdef CPU_X86
+	const int numParticles = 1021;
+	const int numColumns = 11;					// Positions, velocity, acceleration, life and fade
+	const int numEmitters = 5;
+	const int numSteps = 8;
+	const float dt = 0.02f;
+	const TStorageRange range(20.0f);
+
+	unsigned short *columns[3];
+	unsigned char *remainders[3];
+	unsigned short *emitter = new unsigned short[numParticles];
+	float *values = new float[numParticles];
+	float origin[numEmitters];
+	CRandomPcg32 rng;
+	int status = RETURN_SUCCESS;
+	int kernel, column, axis, step, i;
+
+	rng.Seed(1, 0);
+	for (kernel = 0; kernel < 3; kernel++)
+	{
+		columns[kernel] = new unsigned short[numColumns * numParticles];
+		remainders[kernel] = new unsigned char[3 * numParticles];
+	}
+
+	// The same origins on every axis
+	for (i = 0; i < numEmitters; i++)
+		origin[i] = float(i) * 3.0f - 6.0f;
+	for (i = 0; i < numParticles; i++)
+		emitter[i] = (unsigned short)RandomToRange(rng.NextUInt(), numEmitters);
+
+	for (column = 0; column < numColumns; column++)
+	{
+		for (i = 0; i < numParticles; i++)
+			values[i] = float(int(RandomToRange(rng.NextUInt(), 2000)) - 500) * 0.01f;
+		if (column < 3)
+		{
+			PackOffset16Scalar(values, emitter, origin, (short *)columns[0] + column * numParticles,
+				remainders[0] + column * numParticles, numParticles, range.scale);
+		}
+		else
+			PackHalfScalar(values, columns[0] + column * numParticles, numParticles);
+	}
+	for (kernel = 1; kernel < 3; kernel++)
+	{
+		memcpy(columns[kernel], columns[0], sizeof(unsigned short) * numColumns * numParticles);
+		memcpy(remainders[kernel], remainders[0], 3 * numParticles);
+	}
+
+	for (kernel = 0; kernel < 3; kernel++)
+	{
+		TStoreStreams<TCompactPrecision> streams;
+		unsigned short *base = columns[kernel];
+
+		if ((kernel == 1 && !UseSSE2()) || (kernel == 2 && !UseAVX2()))
+			continue;
+
+		for (axis = 0; axis < 3; axis++)
+		{
+			streams.pos[axis] = (short *)base + axis * numParticles;
+			streams.remainder[axis] = remainders[kernel] + axis * numParticles;
+			streams.vel[axis] = base + (3 + axis) * numParticles;
+			streams.accel[axis] = base + (6 + axis) * numParticles;
+			streams.range[axis] = range;
+		}
+		streams.life = base + 9 * numParticles;
+		streams.fadeRate = base + 10 * numParticles;
+		streams.emitter = emitter;
+		streams.originY = origin;
+
+		for (step = 0; step < numSteps; step++)
+		{
+			if (kernel == 0)
+				UpdateStoredScalar(streams, 0, numParticles, dt, CParticle::m_sfGravity);
+			else if (kernel == 1)
+				UpdateStoredSSE2(streams, numParticles, dt, CParticle::m_sfGravity);
+			else
+				UpdateStoredAVX2(streams, numParticles, dt, CParticle::m_sfGravity);
+		}
+
+		if (memcmp(base, columns[0], sizeof(unsigned short) * numColumns * numParticles) ||
+			memcmp(remainders[kernel], remainders[0], 3 * numParticles))
+		{
+			status = RETURN_FAILURE;
+		}
+	}
+
+	for (kernel = 0; kernel < 3; kernel++)
+	{
+		delete[] columns[kernel];
+		delete[] remainders[kernel];
+	}
+	delete[] emitter;
+	delete[] values;
+
+	return status;
+#else
+	return RETURN_SUCCESS;
+#endif
+}
+
+/*-----------------------------------------------------------------------------------
+Particles far slower than a 16 bit step a frame, which would stay put if each
+position were rounded to 16 bits, should move as far as their velocity says to
+within half a step of the remainder a frame
+-----------------------------------------------------------------------------------*/
+
+static int CheckSlowParticles()
+{
+	const int numParticles = 16;
+	const int numSteps = 1000;
+	const float dt = 0.02f;
+	const TStorageRange range(128.0f);
+	const float origin = 10.0f;
+
+	short pos[3][numParticles];
+	unsigned char remainder[3][numParticles];
+	unsigned short vel[3][numParticles], accel[3][numParticles];
+	unsigned short life[numParticles], fadeRate[numParticles], emitter[numParticles];
+	float values[numParticles], start[numParticles], speed[numParticles], end[numParticles];
+	TStoreStreams<TCompactPrecision> streams;
+	int axis, step, i;
+
+	for (i = 0; i < numParticles; i++)
+	{
+		speed[i] = 0.01f * float(i + 1);
+		start[i] = origin + 0.37f * float(i);
+		values[i] = 1.0f;
+		emitter[i] = 0;
+	}
+
+	for (axis = 0; axis < 3; axis++)
+	{
+		PackOffset16Scalar(start, emitter, &origin, pos[axis], remainder[axis], numParticles, range.scale);
+		PackHalfScalar((axis == 0) ? speed : values, vel[axis], numParticles);
+		memset(accel[axis], 0, sizeof(accel[axis]));
+		streams.pos[axis] = pos[axis];
+		streams.remainder[axis] = remainder[axis];
+		streams.vel[axis] = vel[axis];
+		streams.accel[axis] = accel[axis];
+		streams.range[axis] = range;
+	}
+	PackHalfScalar(values, life, numParticles);
+	memset(fadeRate, 0, sizeof(fadeRate));
+	streams.life = life;
+	streams.fadeRate = fadeRate;
+	streams.emitter = emitter;
+	streams.originY = &origin;
+
+	for (step = 0; step < numSteps; step++)
+		UpdateStored(streams, numParticles, dt);
+
+	UnpackOffset16Scalar(pos[0], remainder[0], emitter, &origin, end, numParticles, range.step);
+	UnpackHalfScalar(vel[0], speed, numParticles);
+
+	for (i = 0; i < numParticles; i++)
+	{
+		float expected = speed[i] * dt * float(numSteps);
+
+		if (ABS(end[i] - start[i] - expected) > 0.5f * range.step * float(numSteps) + 1.0e-4f)
+			return RETURN_FAILURE;
+	}
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Compare the SSE2 conversions with the scalar ones bit for bit.  Every half is
+unpacked, and floats spread over every exponent, with random mantissas, either
+sign, infinities, NaNs and halfway cases, are packed.  An odd count exercises
+the tails.  Then the update kernels are compared, and slow particles moved.
+-----------------------------------------------------------------------------------*/
+
+int CheckParticleStorage()
+{
+	int status = RETURN_SUCCESS;
+
+#ifdef CPU_X86
+	const int numValues = 65536 + 3;
+	const int numEmitters = 4;
+	const float origin[numEmitters] = { -30.0f, 0.0f, 12.5f, 70.0f };
+	const TStorageRange range(100.0f);
+
+	unsigned short *halves = new unsigned short[numValues];
+	unsigned short *shorts[2] = { new unsigned short[numValues], new unsigned short[numValues] };
+	unsigned char *bytes[2] = { new unsigned char[numValues], new unsigned char[numValues] };
+	unsigned short *emitters = new unsigned short[numValues];
+	unsigned int *colours[2] = { new unsigned int[numValues], new unsigned int[numValues] };
+	float *values = new float[3 * numValues];
+	float *floats[2] = { new float[3 * numValues], new float[3 * numValues] };
+	CRandomPcg32 rng;
+	int i;
+
+	if (UseSSE2())
+	{
+		rng.Seed(1, 0);
+		for (i = 0; i < numValues; i++)
+			halves[i] = (unsigned short)i;
+		for (i = 0; i < 3 * numValues; i++)
+		{
+			unsigned int bits = rng.NextUInt();
+
+			// Mostly values around the range of a half, with a
+			// halfway mantissa now and again
+			if (i & 1)
+				bits = (bits & 0x807FFFFFu) | ((unsigned int)(RandomToRange(rng.NextUInt(), 50) + 97) << 23);
+			if ((i & 7) == 3)
+				bits = (bits & ~0x1FFFu) | 0x1000u;
+			values[i] = BitsFloat(bits);
+		}
+		values[0] = BitsFloat(0x7F800000u);
+		values[1] = BitsFloat(0xFFC00001u);
+		values[2] = -0.0f;
+
+		// Half floats
+		UnpackHalfScalar(halves, floats[0], numValues);
+		UnpackHalfSSE2(halves, floats[1], numValues);
+		if (memcmp(floats[0], floats[1], sizeof(float) * numValues))
+			status = RETURN_FAILURE;
+
+		PackHalfScalar(values, shorts[0], numValues);
+		PackHalfSSE2(values, shorts[1], numValues);
+		if (memcmp(shorts[0], shorts[1], sizeof(unsigned short) * numValues))
+			status = RETURN_FAILURE;
+
+		// Every half that is not a NaN comes back the same
+		for (i = 0; i < 65536; i++)
+		{
+			if ((i & 0x7FFF) <= 0x7C00 && FloatToHalf(HalfToFloat((unsigned short)i)) != i)
+				status = RETURN_FAILURE;
+		}
+
+		// Offsets from a few emitters, mostly in reach with some outside
+		for (i = 0; i < numValues; i++)
+		{
+			values[i] = float(int(RandomToRange(rng.NextUInt(), 240000)) - 120000) * 0.001f;
+			emitters[i] = (unsigned short)RandomToRange(rng.NextUInt(), numEmitters);
+		}
+
+		PackOffset16Scalar(values, emitters, origin, (short *)shorts[0], bytes[0], numValues, range.scale);
+		PackOffset16SSE2(values, emitters, origin, (short *)shorts[1], bytes[1], numValues, range.scale);
+		if (memcmp(shorts[0], shorts[1], sizeof(unsigned short) * numValues) || memcmp(bytes[0], bytes[1], numValues))
+			status = RETURN_FAILURE;
+
+		// Every 16 bits under random remainders
+		for (i = 0; i < numValues; i++)
+			bytes[0][i] = (unsigned char)rng.NextUInt();
+
+		UnpackOffset16Scalar((const short *)halves, bytes[0], emitters, origin, floats[0], numValues, range.step);
+		UnpackOffset16SSE2((const short *)halves, bytes[0], emitters, origin, floats[1], numValues, range.step);
+		if (memcmp(floats[0], floats[1], sizeof(float) * numValues))
+			status = RETURN_FAILURE;
+
+		// Colour, some of each channel outside [0, 1]
+		for (i = 0; i < 3 * numValues; i++)
+			values[i] = float(int(RandomToRange(rng.NextUInt(), 1400)) - 200) * 0.001f;
+
+		PackRgba8Scalar(values, values + numValues, values + 2 * numValues, colours[0], numValues);
+		PackRgba8SSE2(values, values + numValues, values + 2 * numValues, colours[1], numValues);
+		if (memcmp(colours[0], colours[1], sizeof(unsigned int) * numValues))
+			status = RETURN_FAILURE;
+
+		UnpackRgba8Scalar(colours[0], floats[0], floats[0] + numValues, floats[0] + 2 * numValues, numValues);
+		UnpackRgba8SSE2(colours[0], floats[1], floats[1] + numValues, floats[1] + 2 * numValues, numValues);
+		if (memcmp(floats[0], floats[1], sizeof(float) * 3 * numValues))
+			status = RETURN_FAILURE;
+	}
+
+	delete[] halves;
+	delete[] shorts[0];
+	delete[] shorts[1];
+	delete[] bytes[0];
+	delete[] bytes[1];
+	delete[] emitters;
+	delete[] colours[0];
+	delete[] colours[1];
+	delete[] values;
+	delete[] floats[0];
+	delete[] floats[1];
+#endif
+
+	if (CheckStoredUpdate() != RETURN_SUCCESS || CheckSlowParticles() != RETURN_SUCCESS)
+		status = RETURN_FAILURE;
+
+	return status;
+}
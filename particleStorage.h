@@ -0,0 +1,636 @@
+/*-----------------------------------------------------------------------------------
+File:			particleStorage.h
+Author:			Steve Costa
+Description:	Compact storage for very large numbers of particles.  Every
+column of CParticlePool is a 32 bit float, which is far more than
+colour or life need, and at tens of millions of particles the
+update spends its time waiting on memory rather than computing.
+CParticleStore keeps the same columns at a precision chosen at
+compile time by a policy naming an encoding for each kind of
+attribute:
+
+	TFloatEncoding		4 bytes, as the pool keeps them
+	THalfEncoding		2 bytes, IEEE half float
+	TFixed16Encoding	2 bytes, 16 bit offset from the origin of
+						the particle's emitter, and a byte more
+						carrying the remainder of the step
+	TRgba8Colour		4 bytes for all three colour channels,
+						one byte each and a spare alpha byte
+
+TCompactPrecision stores positions as 16 bit offsets from their
+emitter, velocity, acceleration, life and fade rate as half floats
+and the colour as RGBA8.  With the emitter id in 16 bits that is
+35 bytes a particle against the pool's 76, and the update moves
+44 bytes a particle instead of 72.
+
+The positions are integrated in the 24 bit steps of the offset and
+its remainder, so a particle slower than a 16 bit step a frame
+still moves, to within half a step of the remainder a frame.  Only
+the latest position is kept.  The one before, which drawing blends from, is
+worked back from the velocity when particles are unpacked.
+
+Nothing else reads the store directly.  Particles are packed into
+it from a CParticlePool and unpacked back into one, a block at a
+time for drawing.  The update is the same integration as the pool's
+kernels with the conversions fused into it, so four particles are
+unpacked into SSE2 registers, stepped and packed straight back
+without the floats ever going to memory.
+-----------------------------------------------------------------------------------*/
+
+#ifndef PARTICLE_STORAGE_H_
+#define PARTICLE_STORAGE_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "simUtil.h"						// Common Macros
+#include "particlePool.h"					// Particle attribute columns
+#include "jobSystem.h"						// Worker threads
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define PARTICLE_STORE_GRAIN	4096			// Particles updated per job
+#define STORE_MAX_EMITTERS		65536			// Emitter ids kept in 16 bits
+#define STORE_OFFSET_MAX		8388607			// Largest offset in steps, 16 bits and the remainder byte
+
+/*-----------------------------------------------------------------------------------
+How far the positions along one axis may go from the origin of their emitter,
+for the fixed point encoding.  Offsets further out are clamped to the reach.
+-----------------------------------------------------------------------------------*/
+
+struct TStorageRange
+{
+	float		step;					// Value of one step of the offset and its remainder
+	float		scale;					// One over the step
+
+	TStorageRange() {
+		step = 1.0f;
+		scale = 1.0f;
+	}
+	TStorageRange(float reach) {
+		step = MAX(reach, 1.0e-6f) / float(STORE_OFFSET_MAX);
+		scale = 1.0f / step;
+	}
+};
+
+/*-----------------------------------------------------------------------------------
+Conversions between float columns and the stored encodings, SSE2 when the
+processor has it
+-----------------------------------------------------------------------------------*/
+
+void PackHalf(const float *in, unsigned short *out, int count);
+void UnpackHalf(const unsigned short *in, float *out, int count);
+
+// Offsets from origin[emitter[i]] rounded to the nearest step of the range,
+// the top 16 bits in out and the low 8 in remainder
+void PackOffset16(const float *in, const unsigned short *emitter, const float *origin, short *out,
+	unsigned char *remainder, int count, const TStorageRange& range);
+void UnpackOffset16(const short *in, const unsigned char *remainder, const unsigned short *emitter,
+	const float *origin, float *out, int count, const TStorageRange& range);
+
+// Channels clamped to [0, 1], red in the lowest byte, the alpha byte is 255
+void PackRgba8(const float *r, const float *g, const float *b, unsigned int *out, int count);
+void UnpackRgba8(const unsigned int *in, float *r, float *g, float *b, int count);
+
+// Check the SIMD conversions and updates against the scalar ones, over every
+// half float and a spread of values for the rest, and that slow particles
+// still move
+int CheckParticleStorage();
+
+/*-----------------------------------------------------------------------------------
+Encodings of a single value.  Each has the type it is stored as, conversions
+of a whole run of values and a test of whether a stored life is above zero.
+Those which can hold positions also convert them given the emitter of each
+particle, and say how many remainder bytes they keep under each one.
+-----------------------------------------------------------------------------------*/
+
+struct TFloatEncoding
+{
+	typedef float TStored;
+	enum { REMAINDER_BYTES = 0 };
+
+	static void Pack(const float *in, TStored *out, int count) {
+		memcpy(out, in, sizeof(float) * count);
+	}
+	static void Unpack(const TStored *in, float *out, int count) {
+		memcpy(out, in, sizeof(float) * count);
+	}
+
+	// Positions are kept as they are, wherever their emitter is
+	static void PackPosition(const float *in, const unsigned short *emitter, const float *origin, TStored *out,
+		unsigned char *remainder, int count, const TStorageRange& range) {
+		memcpy(out, in, sizeof(float) * count);
+	}
+	static void UnpackPosition(const TStored *in, const unsigned char *remainder, const unsigned short *emitter,
+		const float *origin, float *out, int count, const TStorageRange& range) {
+		memcpy(out, in, sizeof(float) * count);
+	}
+
+	static bool IsPositive(TStored value) { return value > 0.0f; }
+};
+
+struct THalfEncoding
+{
+	typedef unsigned short TStored;
+
+	static void Pack(const float *in, TStored *out, int count) {
+		PackHalf(in, out, count);
+	}
+	static void Unpack(const TStored *in, float *out, int count) {
+		UnpackHalf(in, out, count);
+	}
+	// Sign bit clear and not zero, a NaN never gets this far
+	static bool IsPositive(TStored value) { return value != 0 && !(value & 0x8000); }
+};
+
+// Positions only
+struct TFixed16Encoding
+{
+	typedef short TStored;
+	enum { REMAINDER_BYTES = 1 };
+
+	static void PackPosition(const float *in, const unsigned short *emitter, const float *origin, TStored *out,
+		unsigned char *remainder, int count, const TStorageRange& range) {
+		PackOffset16(in, emitter, origin, out, remainder, count, range);
+	}
+	static void UnpackPosition(const TStored *in, const unsigned char *remainder, const unsigned short *emitter,
+		const float *origin, float *out, int count, const TStorageRange& range) {
+		UnpackOffset16(in, remainder, emitter, origin, out, count, range);
+	}
+};
+
+// The three colour channels kept as the pool keeps them
+struct TFloatColour
+{
+	struct TStored
+	{
+		float	r, g, b;
+	};
+
+	static void Pack(const float *r, const float *g, const float *b, TStored *out, int count) {
+		int i;
+		for (i = 0; i < count; i++)
+		{
+			out[i].r = r[i];
+			out[i].g = g[i];
+			out[i].b = b[i];
+		}
+	}
+	static void Unpack(const TStored *in, float *r, float *g, float *b, int count) {
+		int i;
+		for (i = 0; i < count; i++)
+		{
+			r[i] = in[i].r;
+			g[i] = in[i].g;
+			b[i] = in[i].b;
+		}
+	}
+};
+
+struct TRgba8Colour
+{
+	typedef unsigned int TStored;
+
+	static void Pack(const float *r, const float *g, const float *b, TStored *out, int count) {
+		PackRgba8(r, g, b, out, count);
+	}
+	static void Unpack(const TStored *in, float *r, float *g, float *b, int count) {
+		UnpackRgba8(in, r, g, b, count);
+	}
+};
+
+/*-----------------------------------------------------------------------------------
+Precision policies.  Position covers the position columns, Vector the
+velocity and acceleration, Scalar the life and fade rate.
+-----------------------------------------------------------------------------------*/
+
+// What the pool holds bit for bit, but for the previous position
+struct TFullPrecision
+{
+	typedef TFloatEncoding		Position;
+	typedef TFloatEncoding		Vector;
+	typedef TFloatEncoding		Scalar;
+	typedef TFloatColour		Colour;
+};
+
+// Full positions for particles which go far from their emitters, the rest
+// compact
+struct TMixedPrecision
+{
+	typedef TFloatEncoding		Position;
+	typedef THalfEncoding		Vector;
+	typedef THalfEncoding		Scalar;
+	typedef TRgba8Colour		Colour;
+};
+
+// Positions within the reach of their emitter to 1/8388607 of the reach
+struct TCompactPrecision
+{
+	typedef TFixed16Encoding	Position;
+	typedef THalfEncoding		Vector;
+	typedef THalfEncoding		Scalar;
+	typedef TRgba8Colour		Colour;
+};
+
+/*-----------------------------------------------------------------------------------
+Columns of a store handed to the update, already offset to the first particle
+-----------------------------------------------------------------------------------*/
+
+template <class P>
+struct TStoreStreams
+{
+	typename P::Position::TStored			*pos[3];
+	unsigned char							*remainder[3];		// Unused by float positions
+	typename P::Vector::TStored				*vel[3];
+	const typename P::Vector::TStored		*accel[3];
+	typename P::Scalar::TStored				*life;
+	const typename P::Scalar::TStored		*fadeRate;
+	const unsigned short					*emitter;
+	const float								*originY;			// Height of each emitter, for the floor
+	TStorageRange							range[3];
+};
+
+// Integrate count particles over dt seconds as UpdateParticles does.  Defined
+// in particleStorage.cpp for each of the precisions above, a new precision
+// adds its own line there.
+template <class P>
+void UpdateStored(const TStoreStreams<P>& s, int count, float dt);
+
+/*-----------------------------------------------------------------------------------
+Particle store class definition
+-----------------------------------------------------------------------------------*/
+
+template <class P>
+class CParticleStore
+{
+	// Types
+private:
+
+	typedef typename P::Position::TStored	TStoredPosition;
+	typedef typename P::Vector::TStored		TStoredVector;
+	typedef typename P::Scalar::TStored		TStoredScalar;
+	typedef typename P::Colour::TStored		TStoredColour;
+
+	enum { REMAINDER_BYTES = P::Position::REMAINDER_BYTES };
+
+	// Attributes
+private:
+
+	int				m_iCapacity;
+	int				m_iLiveCount;			// Live particles, packed at the front
+	int				m_iMaxEmitters;
+	void			*m_pBlock;				// Single allocation for all columns
+	TStoredPosition	*m_pPos[3];
+	unsigned char	*m_pRemainder[3];		// Empty unless the positions keep a remainder
+	TStoredVector	*m_pVel[3];
+	TStoredVector	*m_pAccel[3];
+	TStoredScalar	*m_pLife;
+	TStoredScalar	*m_pFadeRate;
+	TStoredColour	*m_pColour;
+	unsigned short	*m_pusEmitter;
+	unsigned int	*m_puiSprite;
+	float			*m_pfOrigin[3];			// Where each emitter's positions are offset from
+	TStorageRange	m_range[3];				// Reach of the positions from their emitter along each axis
+	float			m_fStepDt;				// Seconds of the last update, to work back the previous position
+	CJobSystem		*m_pJobs;
+
+	// Methods
+private:
+
+	// Carve an aligned column of count values out of the block
+	template <class T>
+	static T *Carve(char *& base, int count) {
+		T *column = (T *)base;
+		base += (sizeof(T) * count + PARTICLE_POOL_ALIGN - 1) & ~(size_t)(PARTICLE_POOL_ALIGN - 1);
+		return column;
+	}
+
+	template <class T>
+	static void Move(T *column, int i, int last) {
+		column[i] = column[last];
+	}
+
+	// Unpack the positions of particles [first, first + count)
+	// into the position columns of a pool from slot to on
+	void UnpackPositions(CParticlePool& pool, int first, int count, int to) const {
+		int axis;
+
+		for (axis = 0; axis < 3; axis++)
+		{
+			P::Position::UnpackPosition(m_pPos[axis] + first, m_pRemainder[axis] + first * REMAINDER_BYTES,
+				m_pusEmitter + first, m_pfOrigin[axis], pool.Column(PARTICLE_POS_X + axis) + to, count, m_range[axis]);
+		}
+	}
+
+public:
+
+	//-----------------------------------------------------------
+	// Standard constructor and destructor
+	//-----------------------------------------------------------
+	CParticleStore() {
+		m_iCapacity = 0;
+		m_iLiveCount = 0;
+		m_iMaxEmitters = 0;
+		m_pBlock = NULL;
+		m_fStepDt = 0.0f;
+		m_pJobs = NULL;
+	}
+
+	~CParticleStore() {
+		Shutdown();
+	}
+
+	//-----------------------------------------------------------
+	// Room for capacity particles of up to maxEmitters emitters.
+	// reach gives how far the positions go from their emitter
+	// along x, y and z, used by fixed point positions.  Every
+	// emitter starts at the origin.  The update runs on jobs if
+	// there are any.
+	//-----------------------------------------------------------
+	int Init(int capacity, const TStorageRange reach[3], int maxEmitters, CJobSystem *jobs = NULL) {
+		int axis, i;
+		size_t bytes;
+		char *base;
+
+		Shutdown();
+
+		if (capacity <= 0 || maxEmitters <= 0 || maxEmitters > STORE_MAX_EMITTERS)
+			return RETURN_FAILURE;
+
+		bytes = GetBytesPerParticle() * (size_t)capacity + 3 * sizeof(float) * maxEmitters +
+			(PARTICLE_NUM_COLUMNS + 3) * PARTICLE_POOL_ALIGN;
+		m_pBlock = malloc(bytes + PARTICLE_POOL_ALIGN);
+		if (!m_pBlock)
+			return RETURN_FAILURE;
+
+		base = (char *)(((size_t)m_pBlock + PARTICLE_POOL_ALIGN - 1) & ~(size_t)(PARTICLE_POOL_ALIGN - 1));
+		memset(base, 0, bytes);
+
+		for (axis = 0; axis < 3; axis++)
+		{
+			m_pPos[axis] = Carve<TStoredPosition>(base, capacity);
+			m_pRemainder[axis] = Carve<unsigned char>(base, capacity * REMAINDER_BYTES);
+			m_pVel[axis] = Carve<TStoredVector>(base, capacity);
+			m_pAccel[axis] = Carve<TStoredVector>(base, capacity);
+			m_pfOrigin[axis] = Carve<float>(base, maxEmitters);
+			m_range[axis] = reach[axis];
+		}
+		m_pLife = Carve<TStoredScalar>(base, capacity);
+		m_pFadeRate = Carve<TStoredScalar>(base, capacity);
+		m_pColour = Carve<TStoredColour>(base, capacity);
+		m_pusEmitter = Carve<unsigned short>(base, capacity);
+		m_puiSprite = Carve<unsigned int>(base, capacity);
+
+		for (axis = 0; axis < 3; axis++)
+		{
+			for (i = 0; i < maxEmitters; i++)
+				m_pfOrigin[axis][i] = 0.0f;
+		}
+
+		m_pJobs = jobs;
+		m_iCapacity = capacity;
+		m_iLiveCount = 0;
+		m_iMaxEmitters = maxEmitters;
+		m_fStepDt = 0.0f;
+
+		return RETURN_SUCCESS;
+	}
+
+	//-----------------------------------------------------------
+	// Free the columns
+	//-----------------------------------------------------------
+	void Shutdown() {
+		free(m_pBlock);
+		m_pBlock = NULL;
+		m_pJobs = NULL;
+		m_iCapacity = 0;
+		m_iLiveCount = 0;
+		m_iMaxEmitters = 0;
+	}
+
+	//-----------------------------------------------------------
+	// Bytes each particle takes, position, its remainder,
+	// velocity, acceleration, life, fade rate, colour and the
+	// two ids
+	//-----------------------------------------------------------
+	static size_t GetBytesPerParticle() {
+		return 3 * sizeof(TStoredPosition) + 3 * REMAINDER_BYTES + 6 * sizeof(TStoredVector) +
+			2 * sizeof(TStoredScalar) + sizeof(TStoredColour) + sizeof(unsigned short) + sizeof(unsigned int);
+	}
+
+	// Bytes the update reads and writes for each particle, the
+	// emitter is read for its origin when positions are offsets
+	static size_t GetUpdateBytesPerParticle() {
+		return 6 * sizeof(TStoredPosition) + 6 * REMAINDER_BYTES + 9 * sizeof(TStoredVector) +
+			3 * sizeof(TStoredScalar) + (REMAINDER_BYTES ? sizeof(unsigned short) : 0);
+	}
+
+	int GetCapacity() const { return m_iCapacity; }
+	int GetLiveCount() const { return m_iLiveCount; }
+	int GetMaxEmitters() const { return m_iMaxEmitters; }
+
+	//-----------------------------------------------------------
+	// Where the positions of an emitter's particles are offset
+	// from.  Set it before any of them are packed.
+	//-----------------------------------------------------------
+	void SetOrigin(int emitter, float x, float y, float z) {
+		m_pfOrigin[0][emitter] = x;
+		m_pfOrigin[1][emitter] = y;
+		m_pfOrigin[2][emitter] = z;
+	}
+
+	//-----------------------------------------------------------
+	// Take up to count slots from the end of the live range, as
+	// CParticlePool::Allocate.  Fill them in with Pack.
+	//-----------------------------------------------------------
+	int Allocate(int count, int *pFirst) {
+		count = MAX(0, MIN(count, m_iCapacity - m_iLiveCount));
+
+		*pFirst = m_iLiveCount;
+		m_iLiveCount += count;
+
+		return count;
+	}
+
+	//-----------------------------------------------------------
+	// Remove a live particle by moving the last one into its
+	// slot, then every particle whose life has run out.  As with
+	// the pool, deadPerEmitter[id] is increased for each one
+	// removed whose emitter is below numEmitters.
+	//-----------------------------------------------------------
+	void Remove(int i) {
+		int axis;
+		int last = --m_iLiveCount;
+
+		if (i == last)
+			return;
+
+		for (axis = 0; axis < 3; axis++)
+		{
+			Move(m_pPos[axis], i, last);
+			Move(m_pVel[axis], i, last);
+			Move(m_pAccel[axis], i, last);
+			if (REMAINDER_BYTES)
+				Move(m_pRemainder[axis], i, last);
+		}
+		Move(m_pLife, i, last);
+		Move(m_pFadeRate, i, last);
+		Move(m_pColour, i, last);
+		Move(m_pusEmitter, i, last);
+		Move(m_puiSprite, i, last);
+	}
+
+	int RemoveDead(int *deadPerEmitter = NULL, int numEmitters = 0) {
+		int i = 0;
+		int removed = 0;
+
+		while (i < m_iLiveCount)
+		{
+			if (P::Scalar::IsPositive(m_pLife[i]))
+			{
+				i++;
+				continue;
+			}
+
+			if (deadPerEmitter && m_pusEmitter[i] < numEmitters)
+				deadPerEmitter[m_pusEmitter[i]]++;
+
+			Remove(i);
+			removed++;
+		}
+
+		return removed;
+	}
+
+	//-----------------------------------------------------------
+	// Copy particles [from, from + count) of a pool into live
+	// slots of the store from slot to on, every column converted
+	// to its encoding.  The positions are the latest ones, and
+	// the emitter ids must be below the store's maxEmitters.
+	//-----------------------------------------------------------
+	void Pack(const CParticlePool& pool, int from, int count, int to) {
+		const unsigned int *emitter = pool.UIntColumn(PARTICLE_EMITTER) + from;
+		int axis, i;
+
+		count = MIN(count, m_iLiveCount - to);
+		if (count <= 0)
+			return;
+
+		for (i = 0; i < count; i++)
+			m_pusEmitter[to + i] = (unsigned short)emitter[i];
+
+		for (axis = 0; axis < 3; axis++)
+		{
+			P::Position::PackPosition(pool.Column(PARTICLE_POS_X + axis) + from, m_pusEmitter + to, m_pfOrigin[axis],
+				m_pPos[axis] + to, m_pRemainder[axis] + to * REMAINDER_BYTES, count, m_range[axis]);
+			P::Vector::Pack(pool.Column(PARTICLE_VEL_X + axis) + from, m_pVel[axis] + to, count);
+			P::Vector::Pack(pool.Column(PARTICLE_ACCEL_X + axis) + from, m_pAccel[axis] + to, count);
+		}
+		P::Scalar::Pack(pool.Column(PARTICLE_LIFE) + from, m_pLife + to, count);
+		P::Scalar::Pack(pool.Column(PARTICLE_FADE_RATE) + from, m_pFadeRate + to, count);
+		P::Colour::Pack(pool.Column(PARTICLE_COL_R) + from, pool.Column(PARTICLE_COL_G) + from,
+			pool.Column(PARTICLE_COL_B) + from, m_pColour + to, count);
+		memcpy(m_puiSprite + to, pool.UIntColumn(PARTICLE_SPRITE) + from, sizeof(unsigned int) * count);
+	}
+
+	//-----------------------------------------------------------
+	// Copy particles [first, first + count) of the store back
+	// into the same slots of a pool as floats
+	//-----------------------------------------------------------
+	void Unpack(CParticlePool& pool, int first, int count) const {
+		unsigned int *emitter = pool.UIntColumn(PARTICLE_EMITTER) + first;
+		int axis, i;
+
+		count = MIN(count, m_iLiveCount - first);
+		if (count <= 0)
+			return;
+
+		UnpackDraw(pool, first, count, first);
+		for (axis = 0; axis < 3; axis++)
+		{
+			P::Vector::Unpack(m_pVel[axis] + first, pool.Column(PARTICLE_VEL_X + axis) + first, count);
+			P::Vector::Unpack(m_pAccel[axis] + first, pool.Column(PARTICLE_ACCEL_X + axis) + first, count);
+		}
+		P::Scalar::Unpack(m_pFadeRate + first, pool.Column(PARTICLE_FADE_RATE) + first, count);
+		for (i = 0; i < count; i++)
+			emitter[i] = m_pusEmitter[first + i];
+	}
+
+	//-----------------------------------------------------------
+	// Unpack only what drawing reads, both positions, colour,
+	// life and sprite, of particles [first, first + count) into
+	// a pool from slot to on.  A renderer can draw the store a
+	// block at a time through a small pool.  The previous
+	// position steps back along the velocity, undoing a bounce
+	// off the floor, as the velocity is not needed to draw.
+	//-----------------------------------------------------------
+	void UnpackDraw(CParticlePool& pool, int first, int count, int to) const {
+		float *posY = pool.Column(PARTICLE_POS_Y) + to;
+		float *prevY = pool.Column(PARTICLE_PREV_Y) + to;
+		int axis, i;
+
+		count = MIN(count, m_iLiveCount - first);
+		if (count <= 0)
+			return;
+
+		UnpackPositions(pool, first, count, to);
+		for (axis = 0; axis < 3; axis++)
+			P::Vector::Unpack(m_pVel[axis] + first, pool.Column(PARTICLE_PREV_X + axis) + to, count);
+
+		for (i = 0; i < count; i++)
+		{
+			if (posY[i] < 0.0f)
+				prevY[i] /= -0.75f;
+		}
+		for (axis = 0; axis < 3; axis++)
+		{
+			const float *pos = pool.Column(PARTICLE_POS_X + axis) + to;
+			float *prev = pool.Column(PARTICLE_PREV_X + axis) + to;
+
+			for (i = 0; i < count; i++)
+				prev[i] = pos[i] - m_fStepDt * prev[i];
+		}
+
+		P::Scalar::Unpack(m_pLife + first, pool.Column(PARTICLE_LIFE) + to, count);
+		P::Colour::Unpack(m_pColour + first, pool.Column(PARTICLE_COL_R) + to, pool.Column(PARTICLE_COL_G) + to,
+			pool.Column(PARTICLE_COL_B) + to, count);
+		memcpy(pool.UIntColumn(PARTICLE_SPRITE) + to, m_puiSprite + first, sizeof(unsigned int) * count);
+	}
+
+	//-----------------------------------------------------------
+	// Step every live particle over dt seconds, the same
+	// integration as CParticlePool::Update in place, a chunk per
+	// job
+	//-----------------------------------------------------------
+	void Update(float dt) {
+		m_fStepDt = dt;
+
+		RunJobs(m_pJobs, m_iLiveCount, PARTICLE_STORE_GRAIN, [&](int first, int num, int worker) {
+			TStoreStreams<P> s;
+			int axis;
+
+			for (axis = 0; axis < 3; axis++)
+			{
+				s.pos[axis] = m_pPos[axis] + first;
+				s.remainder[axis] = m_pRemainder[axis] + first * REMAINDER_BYTES;
+				s.vel[axis] = m_pVel[axis] + first;
+				s.accel[axis] = m_pAccel[axis] + first;
+				s.range[axis] = m_range[axis];
+			}
+			s.life = m_pLife + first;
+			s.fadeRate = m_pFadeRate + first;
+			s.emitter = m_pusEmitter + first;
+			s.originY = m_pfOrigin[1];
+
+			UpdateStored(s, num, dt);
+		});
+	}
+};
+
+#endif
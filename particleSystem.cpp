@@ -0,0 +1,572 @@
+/*-----------------------------------------------------------------------------------
+File:			particleSystem.cpp
+Author:			Steve Costa
+Description:	Spawning and updating the particles of a particle system.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <new>
+
+#include "particleSystem.h"					// Class header file
+#include "profiler.h"						// Frame zones
+
+/*-----------------------------------------------------------------------------------
+Initialize particle gravity
+-----------------------------------------------------------------------------------*/
+
+float CParticle::m_sfGravity = 9.8f;
+
+/*-----------------------------------------------------------------------------------
+Set any initial values for class state variables.
+-----------------------------------------------------------------------------------*/
+
+CParticleSystem::CParticleSystem()
+{
+	m_pJobs = NULL;
+	m_pWorkerRandom = NULL;
+	m_pWorkerBlock = NULL;
+	m_iNumWorkers = 0;
+	m_iRandomMode = RANDOM_MODE_COUNTER;
+	m_uiSeed = DEFAULT_RANDOM_SEED;
+	m_pEmitters = NULL;
+	m_iNumEmitters = 0;
+	m_iMaxEmitters = 0;
+	m_piDead = NULL;
+	m_pSpawnRanges = NULL;
+	m_iNumSpawnRanges = 0;
+	m_iSpawnFirst = 0;
+	m_iSpawnCount = 0;
+	m_fStepDt = 0.0f;
+	m_fCollideRadius = 0.0f;
+	m_fRestitution = 1.0f;
+	memset(m_pfCollide, 0, sizeof(m_pfCollide));
+	m_pbFluid = NULL;
+	m_pbNBody = NULL;
+	m_piAffected = NULL;
+	m_iNumAffected = 0;
+	m_pbAccelerated = NULL;
+	m_pTrails = NULL;
+	m_piRemoved = NULL;
+}
+
+/*-----------------------------------------------------------------------------------
+Allocate the particles and room for the emitters, the update runs on the given
+job system if there is one.  There are no emitters to begin with.
+-----------------------------------------------------------------------------------*/
+
+int CParticleSystem::Init(int numParticles, CJobSystem *jobs, int maxEmitters)
+{
+	int i;
+
+	m_pJobs = jobs;
+	m_iNumWorkers = jobs ? jobs->GetNumThreads() : 1;
+
+	// Before any update, the workers only read the choice
+	if (GetUpdateKernel() == UPDATE_KERNEL_AUTO)
+		SelectUpdateKernel(UPDATE_KERNEL_AUTO);
+
+	// Streams start on a cache line, as the pool's columns do
+	m_pWorkerBlock = malloc(sizeof(TWorkerRandom) * m_iNumWorkers + JOB_CACHE_LINE);
+	if (!m_pWorkerBlock)
+		return RETURN_FAILURE;
+	m_pWorkerRandom = (TWorkerRandom *)(((size_t)m_pWorkerBlock + JOB_CACHE_LINE - 1) & ~(size_t)(JOB_CACHE_LINE - 1));
+	for (i = 0; i < m_iNumWorkers; i++)
+		new (&m_pWorkerRandom[i]) TWorkerRandom();
+	SetRandomSeed(m_uiSeed);
+
+	m_iMaxEmitters = maxEmitters;
+	m_iNumEmitters = 0;
+	m_pEmitters = new CEmitter[maxEmitters];
+	m_piDead = new int[maxEmitters];
+	m_pSpawnRanges = new TSpawnRange[maxEmitters];
+	m_pbFluid = new bool[maxEmitters];
+	m_pbNBody = new bool[maxEmitters];
+	m_piAffected = new int[maxEmitters];
+	m_pbAccelerated = new bool[maxEmitters];
+	memset(m_pbAccelerated, 0, sizeof(bool) * maxEmitters);
+	m_piRemoved = new int[numParticles];
+
+	if (m_pool.Init(numParticles) != RETURN_SUCCESS)
+		return RETURN_FAILURE;
+
+	// Collisions turned on before there were particles
+	if (m_fCollideRadius > 0.0f)
+		AllocateCollide();
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Free the particles
+-----------------------------------------------------------------------------------*/
+
+int CParticleSystem::Shutdown()
+{
+	m_pool.Shutdown();
+	m_pJobs = NULL;
+
+	free(m_pWorkerBlock);
+	m_pWorkerBlock = NULL;
+	m_pWorkerRandom = NULL;
+	m_iNumWorkers = 0;
+
+	delete[] m_pEmitters;
+	delete[] m_piDead;
+	delete[] m_pSpawnRanges;
+	delete[] m_pbFluid;
+	delete[] m_pbNBody;
+	delete[] m_piAffected;
+	delete[] m_pbAccelerated;
+	delete[] m_piRemoved;
+	m_pEmitters = NULL;
+	m_piDead = NULL;
+	m_pSpawnRanges = NULL;
+	m_pbFluid = NULL;
+	m_pbNBody = NULL;
+	m_piAffected = NULL;
+	m_pbAccelerated = NULL;
+	m_piRemoved = NULL;
+	m_iNumAffected = 0;
+	m_iNumEmitters = 0;
+	m_iMaxEmitters = 0;
+	m_iNumSpawnRanges = 0;
+
+	delete[] m_pfCollide[0];
+	memset(m_pfCollide, 0, sizeof(m_pfCollide));
+	m_grid.Shutdown();
+	m_fluid.Shutdown();
+	m_nbody.Shutdown();
+	m_turbulence.Shutdown();
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Seed both generators.  Each worker stream is the one before it jumped on 2^64
+steps so the streams never overlap.
+-----------------------------------------------------------------------------------*/
+
+void CParticleSystem::SetRandomSeed(TRandU64 seed)
+{
+	int i;
+
+	m_uiSeed = seed;
+	m_counterRandom.Seed(seed);
+
+	for (i = 0; i < m_iNumWorkers; i++)
+	{
+		if (i == 0)
+			m_pWorkerRandom[i].rng.Seed(seed);
+		else
+		{
+			m_pWorkerRandom[i].rng = m_pWorkerRandom[i - 1].rng;
+			m_pWorkerRandom[i].rng.Jump();
+		}
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Add an emitter, it starts spawning on the next update
+-----------------------------------------------------------------------------------*/
+
+int CParticleSystem::AddEmitter(const TEmitterDesc& desc)
+{
+	if (m_iNumEmitters >= m_iMaxEmitters)
+		return RETURN_FAILURE;
+
+	m_pEmitters[m_iNumEmitters].SetDesc(desc);
+
+	return m_iNumEmitters++;
+}
+
+/*-----------------------------------------------------------------------------------
+Turn particle collisions on or off.  The grid cells are one particle across so
+every contact is found in the neighbouring cells.  The collision columns are
+allocated now if there are particles, or else by Init.
+-----------------------------------------------------------------------------------*/
+
+void CParticleSystem::SetCollisions(float radius, float restitution)
+{
+	m_fCollideRadius = MAX(radius, 0.0f);
+	m_fRestitution = restitution;
+
+	if (m_fCollideRadius <= 0.0f)
+		return;
+
+	m_grid.SetCellSize(2.0f * m_fCollideRadius);
+	AllocateCollide();
+}
+
+void CParticleSystem::AllocateCollide()
+{
+	int i;
+
+	if (m_pfCollide[0] || !m_pool.GetCapacity())
+		return;
+
+	m_pfCollide[0] = new float[COLLIDE_NUM_COLUMNS * m_pool.GetCapacity()];
+	for (i = 1; i < COLLIDE_NUM_COLUMNS; i++)
+		m_pfCollide[i] = m_pfCollide[0] + i * m_pool.GetCapacity();
+}
+
+/*-----------------------------------------------------------------------------------
+Random words for count particles of an emitter, starting with the given spawn
+number.  In counter mode the words for a particle depend only on the seed, the
+emitter and its spawn number, so it does not matter which worker spawns it or
+in what order.
+-----------------------------------------------------------------------------------*/
+
+void CParticleSystem::FillSpawnRandom(int emitter, TRandU64 serial, int count, int worker,
+	TRandU32 random[EMITTER_RANDOM_WORDS][SPAWN_BATCH])
+{
+	int block;
+
+	if (m_iRandomMode == RANDOM_MODE_COUNTER)
+	{
+		for (block = 0; block < EMITTER_RANDOM_BLOCKS; block++)
+		{
+			m_counterRandom.FillRange(TRandU32(serial), count, TRandU32(serial >> 32), TRandU32(block),
+				TRandU32(emitter), random[block * 4], random[block * 4 + 1], random[block * 4 + 2],
+				random[block * 4 + 3]);
+		}
+		return;
+	}
+
+	CRandomXoshiro128& rng = m_pWorkerRandom[worker].rng;
+	for (block = 0; block < EMITTER_RANDOM_WORDS; block++)
+		rng.Fill(random[block], count);
+}
+
+/*-----------------------------------------------------------------------------------
+Ask every emitter how many particles it wants this step and give each one a
+run of slots at the end of the live range.  Runs in emitter order on the
+calling thread so the slots are the same every time.
+-----------------------------------------------------------------------------------*/
+
+void CParticleSystem::ScheduleSpawns(float dt)
+{
+	int i, wanted, given, first;
+
+	m_iNumSpawnRanges = 0;
+	m_iSpawnFirst = m_pool.GetLiveCount();
+	m_iSpawnCount = 0;
+
+	for (i = 0; i < m_iNumEmitters; i++)
+	{
+		wanted = m_pEmitters[i].Schedule(dt, m_pool.GetCapacity() - m_pool.GetLiveCount());
+		given = m_pool.Allocate(wanted, &first);
+
+		if (!given)
+			continue;
+
+		TSpawnRange& range = m_pSpawnRanges[m_iNumSpawnRanges++];
+		range.first = first;
+		range.count = given;
+		range.emitter = i;
+		range.serial = m_pEmitters[i].GetSerial();
+
+		m_pEmitters[i].Spawned(given);
+		m_iSpawnCount += given;
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Fill in the new particles in slots [first, first + count), which must lie in
+the range handed out this step.  Each emitter fills in its part as batches of
+SPAWN_BATCH particles, the random numbers for a whole batch are made in one
+go.
+-----------------------------------------------------------------------------------*/
+
+void CParticleSystem::SpawnParticles(int first, int count, int worker)
+{
+	TRandU32 random[EMITTER_RANDOM_WORDS][SPAWN_BATCH];
+	int last = first + count;
+	int lo = 0, hi = m_iNumSpawnRanges;
+	int r, p, n;
+
+	// Find the first range which ends after first
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (m_pSpawnRanges[mid].first + m_pSpawnRanges[mid].count <= first)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (r = lo; r < m_iNumSpawnRanges && m_pSpawnRanges[r].first < last; r++)
+	{
+		const TSpawnRange& range = m_pSpawnRanges[r];
+		int rangeLast = MIN(last, range.first + range.count);
+
+		for (p = MAX(first, range.first); p < rangeLast; p += n)
+		{
+			n = MIN(SPAWN_BATCH, rangeLast - p);
+
+			FillSpawnRandom(range.emitter, range.serial + TRandU64(p - range.first), n, worker, random);
+			m_pEmitters[range.emitter].SpawnBatch(m_pool, p, n, (unsigned int)range.emitter, m_fStepDt, random);
+		}
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Zero the accelerations of the particles of one emitter
+-----------------------------------------------------------------------------------*/
+
+static void ClearAccelerations(CParticlePool& pool, int first, int count, unsigned int emitter)
+{
+	float *accelX = pool.Column(PARTICLE_ACCEL_X);
+	float *accelY = pool.Column(PARTICLE_ACCEL_Y);
+	float *accelZ = pool.Column(PARTICLE_ACCEL_Z);
+	const unsigned int *emitters = pool.UIntColumn(PARTICLE_EMITTER);
+	int i;
+
+	for (i = first; i < first + count; i++)
+	{
+		if (emitters[i] == emitter)
+			accelX[i] = accelY[i] = accelZ[i] = 0.0f;
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Integrate the particles in [first, first + count).  With affectors or
+turbulence about the range goes a block at a time, each emitter's affectors
+fill in the accelerations of its particles in the block, the update follows
+while the block is still in the cache and the turbulence field then carries
+the particles along.  Fluid and n-body particles had their accelerations
+worked out this step and the affectors add to them, the rest start from zero,
+and ballistic particles with no affectors are set back to zero.  The trails record the positions the update reads just before it, while they
+are in the cache.
+-----------------------------------------------------------------------------------*/
+
+void CParticleSystem::MoveParticles(int first, int count, float dt)
+{
+	int block, n, i;
+
+	if (!m_iNumAffected)
+	{
+		if (m_pTrails)
+			m_pTrails->Record(m_pool, first, count, m_iSpawnFirst, m_iSpawnCount);
+		UpdateParticles(m_pool, first, count, dt);
+		return;
+	}
+
+	for (block = first; block < first + count; block += AFFECTOR_BLOCK)
+	{
+		n = MIN(AFFECTOR_BLOCK, first + count - block);
+
+		for (i = 0; i < m_iNumAffected; i++)
+		{
+			int emitter = m_piAffected[i];
+			const TEmitterDesc& desc = m_pEmitters[emitter].GetDesc();
+
+			bool accumulate = (desc.behaviour != PARTICLE_BEHAVIOUR_BALLISTIC);
+
+			if (desc.affectors)
+				desc.affectors->Apply(m_pool, block, n, (unsigned int)emitter, accumulate, dt);
+			else if (!accumulate)
+				ClearAccelerations(m_pool, block, n, (unsigned int)emitter);
+		}
+
+		if (m_pTrails)
+			m_pTrails->Record(m_pool, block, n, m_iSpawnFirst, m_iSpawnCount);
+		UpdateParticles(m_pool, block, n, dt);
+
+		for (i = 0; i < m_iNumAffected; i++)
+		{
+			int emitter = m_piAffected[i];
+			float turbulence = m_pEmitters[emitter].GetDesc().turbulence;
+
+			if (turbulence != 0.0f)
+				m_turbulence.Advect(m_pool, block, n, (unsigned int)emitter, turbulence, dt);
+		}
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Work out how the particles in grid slots [first, first + count) are pushed by
+the particles they touch.  Every particle only works out its own response,
+half of the overlap and half of the impulse of each contact as the masses are
+equal, so no two jobs write to the same particle and the results are applied
+afterwards.  Working in grid order keeps the neighbours of one particle close
+to those of the next in memory.
+-----------------------------------------------------------------------------------*/
+
+void CParticleSystem::CollideParticles(int first, int count)
+{
+	const float *velX = m_pfCollide[COLLIDE_VEL_X];
+	const float *velY = m_pfCollide[COLLIDE_VEL_Y];
+	const float *velZ = m_pfCollide[COLLIDE_VEL_Z];
+	float diameter = 2.0f * m_fCollideRadius;
+	float bounce = 0.5f * (1.0f + m_fRestitution);
+	int i;
+
+	for (i = first; i < first + count; i++)
+	{
+		float dpx = 0.0f, dpy = 0.0f, dpz = 0.0f;
+		float dvx = 0.0f, dvy = 0.0f, dvz = 0.0f;
+		int contacts = 0;
+
+		m_grid.ForEachNeighbour(m_grid.GetX(i), m_grid.GetY(i), m_grid.GetZ(i), diameter,
+			[&](int j, float dx, float dy, float dz, float distSq) {
+			// Skip ourselves and particles in exactly the same
+			// place, which have no direction to push in
+			if (j == i || distSq < 1.0e-12f)
+				return true;
+
+			float dist = sqrtf(distSq);
+			float nx = -dx / dist, ny = -dy / dist, nz = -dz / dist;
+			float push = 0.5f * (diameter - dist);
+			float closing = (velX[i] - velX[j]) * nx + (velY[i] - velY[j]) * ny + (velZ[i] - velZ[j]) * nz;
+
+			dpx += push * nx;	dpy += push * ny;	dpz += push * nz;
+
+			if (closing < 0.0f)
+			{
+				dvx -= bounce * closing * nx;
+				dvy -= bounce * closing * ny;
+				dvz -= bounce * closing * nz;
+			}
+
+			return ++contacts < COLLIDE_MAX_NEIGHBOURS;
+		});
+
+		m_pfCollide[COLLIDE_DPOS_X][i] = dpx;
+		m_pfCollide[COLLIDE_DPOS_Y][i] = dpy;
+		m_pfCollide[COLLIDE_DPOS_Z][i] = dpz;
+		m_pfCollide[COLLIDE_DVEL_X][i] = dvx;
+		m_pfCollide[COLLIDE_DVEL_Y][i] = dvy;
+		m_pfCollide[COLLIDE_DVEL_Z][i] = dvz;
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Remove the particles which died last step, let the emitters spawn new ones at
+the end of the live range and update the live particles, shared out across
+the worker threads.  A job which covers some of the new slots fills them in
+before updating them.  The positions before the step are kept in the previous
+position columns.  When there are fluid or n-body emitters the spawns go
+first, then the fluid and the n-body gravity work out the accelerations of
+their particles and the update follows.  The affectors of each emitter add their
+accelerations just before the update of each block of particles and the
+turbulence field carries the particles along just after, the field is only
+moved on while some emitter uses it.
+With collisions on the new positions are then sorted into the grid and every
+particle is pushed out of the ones it touches.  The trails follow the
+particles moved by the removals before they move on a step.
+-----------------------------------------------------------------------------------*/
+
+void CParticleSystem::Update(float dt)
+{
+	PROFILE_ZONE("step");
+
+	int i, live, removed;
+	bool fluid = false, nbody = false, turbulence = false;
+
+	m_pool.BeginStep();
+
+	live = m_pool.GetLiveCount();
+	memset(m_piDead, 0, sizeof(int) * m_iNumEmitters);
+	removed = m_pool.RemoveDead(m_piDead, m_iNumEmitters, m_pTrails ? m_piRemoved : NULL);
+	if (m_pTrails)
+	{
+		m_pTrails->Moved(m_piRemoved, removed, live);
+		m_pTrails->BeginStep();
+	}
+	m_iNumAffected = 0;
+	for (i = 0; i < m_iNumEmitters; i++)
+	{
+		m_pEmitters[i].Died(m_piDead[i]);
+		m_pbFluid[i] = (m_pEmitters[i].GetDesc().behaviour == PARTICLE_BEHAVIOUR_FLUID);
+		m_pbNBody[i] = (m_pEmitters[i].GetDesc().behaviour == PARTICLE_BEHAVIOUR_NBODY);
+		fluid = fluid || m_pbFluid[i];
+		nbody = nbody || m_pbNBody[i];
+		turbulence = turbulence || (m_pEmitters[i].GetDesc().turbulence != 0.0f);
+
+		// A ballistic emitter whose affectors were taken away, or which was
+		// a fluid or n-body, still has the accelerations it was last given
+		if (m_pEmitters[i].GetDesc().affectors || m_pEmitters[i].GetDesc().turbulence != 0.0f ||
+			(m_pbAccelerated[i] && !m_pbFluid[i] && !m_pbNBody[i]))
+		{
+			m_piAffected[m_iNumAffected++] = i;
+		}
+		m_pbAccelerated[i] = m_pEmitters[i].GetDesc().affectors || m_pbFluid[i] || m_pbNBody[i];
+	}
+
+	m_fStepDt = dt;
+	ScheduleSpawns(dt);
+	if (turbulence)
+		m_turbulence.Advance(dt, m_pJobs);
+	live = m_pool.GetLiveCount();
+
+	if (fluid || nbody)
+	{
+		RunJobs(m_pJobs, m_iSpawnCount, UPDATE_GRAIN, [this](int first, int count, int worker) {
+			SpawnParticles(m_iSpawnFirst + first, count, worker);
+		});
+
+		if (fluid)
+			m_fluid.Step(m_pool, m_pbFluid, m_iNumEmitters, m_pJobs);
+		if (nbody)
+			m_nbody.Step(m_pool, m_pbNBody, m_iNumEmitters, m_pJobs);
+
+		RunJobs(m_pJobs, live, UPDATE_GRAIN, [this, dt](int first, int count, int worker) {
+			MoveParticles(first, count, dt);
+		});
+	}
+	else if (!m_pJobs)
+	{
+		SpawnParticles(m_iSpawnFirst, m_iSpawnCount, 0);
+		MoveParticles(0, live, dt);
+	}
+	else
+	{
+		m_pJobs->ParallelFor(live, UPDATE_GRAIN, [this, dt](int first, int count, int worker) {
+			int spawnFirst = MAX(first, m_iSpawnFirst);
+			int spawnLast = MIN(first + count, m_iSpawnFirst + m_iSpawnCount);
+
+			if (spawnFirst < spawnLast)
+				SpawnParticles(spawnFirst, spawnLast - spawnFirst, worker);
+			MoveParticles(first, count, dt);
+		});
+	}
+
+	if (m_fCollideRadius > 0.0f && m_pfCollide[0])
+	{
+		PROFILE_ZONE("collide");
+
+		m_grid.Build(m_pool.Column(PARTICLE_POS_X), m_pool.Column(PARTICLE_POS_Y),
+			m_pool.Column(PARTICLE_POS_Z), live, m_pJobs);
+
+		RunJobs(m_pJobs, live, UPDATE_GRAIN, [this](int first, int count, int worker) {
+			for (int axis = 0; axis < 3; axis++)
+			{
+				const float *vel = m_pool.Column(PARTICLE_VEL_X + axis);
+				for (int slot = first; slot < first + count; slot++)
+					m_pfCollide[COLLIDE_VEL_X + axis][slot] = vel[m_grid.GetParticle(slot)];
+			}
+		});
+
+		RunJobs(m_pJobs, live, UPDATE_GRAIN, [this](int first, int count, int worker) {
+			CollideParticles(first, count);
+		});
+
+		RunJobs(m_pJobs, live, UPDATE_GRAIN, [this](int first, int count, int worker) {
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float *pos = m_pool.Column(PARTICLE_POS_X + axis);
+				float *vel = m_pool.Column(PARTICLE_VEL_X + axis);
+
+				for (int slot = first; slot < first + count; slot++)
+				{
+					int i = m_grid.GetParticle(slot);
+					pos[i] += m_pfCollide[COLLIDE_DPOS_X + axis][slot];
+					vel[i] += m_pfCollide[COLLIDE_DVEL_X + axis][slot];
+				}
+			}
+		});
+	}
+}
@@ -0,0 +1,200 @@
+/*-----------------------------------------------------------------------------------
+File:			particleSystem.h
+Author:			Steve Costa
+Description:	The particle simulation on its own: a pool of particles shared
+by a set of emitters which spawn into it, and the update which
+is shared out across the worker threads.  Nothing in here
+depends on the window or on OpenGL so it can be run headless.
+-----------------------------------------------------------------------------------*/
+
+#ifndef PARTICLE_SYSTEM_H_
+#define PARTICLE_SYSTEM_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "simUtil.h"						// Common Macros
+#include "particlePool.h"					// Particle attribute columns
+#include "jobSystem.h"						// Worker threads
+#include "random.h"							// Random number generators
+#include "emitter.h"						// Particle emitters
+#include "spatialGrid.h"					// Neighbour queries
+#include "sphFluid.h"						// SPH fluid behaviour
+#include "barnesHut.h"						// N-body gravity behaviour
+#include "turbulence.h"						// Shared turbulence field
+#include "trails.h"							// Recent positions
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define UPDATE_GRAIN			4096			// Particles per job, whole cache lines
+#define AFFECTOR_BLOCK			1024			// Particles affected and then updated while in the cache
+#define MAX_EMITTERS			256
+#define COLLIDE_MAX_NEIGHBOURS	32				// Contacts resolved per particle per step
+
+/*-----------------------------------------------------------------------------------
+Scratch columns for the collision pass, indexed by grid slot
+-----------------------------------------------------------------------------------*/
+
+enum ECollideColumn
+{
+	COLLIDE_VEL_X, COLLIDE_VEL_Y, COLLIDE_VEL_Z,				// Velocity in grid order
+	COLLIDE_DPOS_X, COLLIDE_DPOS_Y, COLLIDE_DPOS_Z,				// Push out of contacts
+	COLLIDE_DVEL_X, COLLIDE_DVEL_Y, COLLIDE_DVEL_Z,				// Bounce off contacts
+
+	COLLIDE_NUM_COLUMNS
+};
+#define DEFAULT_RANDOM_SEED		0x5EED5EEDull
+
+/*-----------------------------------------------------------------------------------
+Where respawned particles get their random numbers from
+-----------------------------------------------------------------------------------*/
+
+enum ERandomMode
+{
+	RANDOM_MODE_COUNTER,		// Philox keyed by emitter and spawn number, same result on any number of threads
+	RANDOM_MODE_STREAM			// xoshiro stream per worker, faster but depends on the job split
+};
+
+/*-----------------------------------------------------------------------------------
+One random stream per worker, padded so workers never share a cache line once
+the array starts on one
+-----------------------------------------------------------------------------------*/
+
+struct TWorkerRandom
+{
+	CRandomXoshiro128	rng;
+	char				pad[JOB_CACHE_LINE - sizeof(CRandomXoshiro128)];
+};
+
+/*-----------------------------------------------------------------------------------
+Slots given to one emitter this step
+-----------------------------------------------------------------------------------*/
+
+struct TSpawnRange
+{
+	int			first, count;
+	int			emitter;
+	TRandU64	serial;							// Spawn number of the first one
+};
+
+/*-----------------------------------------------------------------------------------
+Particle system class definition
+-----------------------------------------------------------------------------------*/
+
+class CParticleSystem
+{
+	// Attributes
+private:
+
+	CParticlePool	m_pool;						// Particle attribute columns
+	CJobSystem		*m_pJobs;					// Workers, may be NULL
+	CRandomPhilox	m_counterRandom;			// Keyed generator for RANDOM_MODE_COUNTER
+	TWorkerRandom	*m_pWorkerRandom;			// Per worker streams for RANDOM_MODE_STREAM
+	void			*m_pWorkerBlock;			// Allocation m_pWorkerRandom is aligned in
+	int				m_iNumWorkers;
+	int				m_iRandomMode;
+	TRandU64		m_uiSeed;
+
+	CEmitter		*m_pEmitters;
+	int				m_iNumEmitters;
+	int				m_iMaxEmitters;
+	int				*m_piDead;					// Deaths per emitter this step
+	TSpawnRange		*m_pSpawnRanges;			// One per emitter spawning this step
+	int				m_iNumSpawnRanges;
+	int				m_iSpawnFirst;				// Slots spawned this step
+	int				m_iSpawnCount;
+	float			m_fStepDt;
+
+	CSpatialGrid	m_grid;						// Built from the new positions each step
+	float			m_fCollideRadius;			// 0 when particles do not collide
+	float			m_fRestitution;
+	float			*m_pfCollide[COLLIDE_NUM_COLUMNS];
+
+	CSphFluid		m_fluid;					// Moves the particles of fluid emitters
+	bool			*m_pbFluid;					// Whether each emitter is a fluid this step
+
+	CBarnesHut		m_nbody;					// Gravity between the particles of n-body emitters
+	bool			*m_pbNBody;					// Whether each emitter is n-body this step
+
+	int				*m_piAffected;				// Emitters with affectors, turbulence or accelerations to clear this step
+	int				m_iNumAffected;
+	bool			*m_pbAccelerated;			// Whether each emitter's accelerations were worked out last step
+
+	CTurbulenceField	m_turbulence;			// Shared by every emitter, advanced when in use
+
+	CTrails			*m_pTrails;					// Not owned, NULL when there are no trails
+	int				*m_piRemoved;				// Slots particles died in this step, for the trails
+
+	// Methods
+private:
+
+	void ScheduleSpawns(float dt);								// Hand out slots to emitters
+	void SpawnParticles(int first, int count, int worker);		// Fill in new particles
+	void MoveParticles(int first, int count, float dt);		// Affectors and update
+	void CollideParticles(int first, int count);				// Contact responses of grid slots
+	void AllocateCollide();										// Collision columns for the pool
+	void FillSpawnRandom(int emitter, TRandU64 serial, int count, int worker,
+		TRandU32 random[EMITTER_RANDOM_WORDS][SPAWN_BATCH]);
+
+public:
+
+	CParticleSystem();
+
+	int Init(int numParticles, CJobSystem *jobs, int maxEmitters = MAX_EMITTERS);
+	int Shutdown();
+
+	// Remove dead particles, spawn new ones and advance everything by dt seconds
+	void Update(float dt);
+
+	// Add an emitter, returns its id or RETURN_FAILURE when there
+	// is no room for it
+	int AddEmitter(const TEmitterDesc& desc);
+	CEmitter& GetEmitter(int id) { return m_pEmitters[id]; }
+	int GetNumEmitters() const { return m_iNumEmitters; }
+
+	// Particles bounce off each other as spheres of the given radius,
+	// 0 turns collisions off.  restitution is 1 for a perfect bounce.
+	// Can be called before Init, and lasts over Shutdown and Init.
+	void SetCollisions(float radius, float restitution);
+
+	// Grid over the particle positions, built during Update when
+	// collisions are on
+	const CSpatialGrid& GetGrid() const { return m_grid; }
+
+	// The fluid which particles of PARTICLE_BEHAVIOUR_FLUID emitters
+	// belong to
+	void SetFluidParams(const TSphParams& params) { m_fluid.SetParams(params); }
+	CSphFluid& GetFluid() { return m_fluid; }
+	const CSphFluid& GetFluid() const { return m_fluid; }
+
+	// The gravity which particles of PARTICLE_BEHAVIOUR_NBODY
+	// emitters pull on each other with, heavy bodies are added here
+	void SetNBodyParams(const TBarnesHutParams& params) { m_nbody.SetParams(params); }
+	CBarnesHut& GetNBody() { return m_nbody; }
+	const CBarnesHut& GetNBody() const { return m_nbody; }
+
+	// The turbulence field emitters with a turbulence scale sample
+	void SetTurbulenceParams(const TTurbulenceParams& params) { m_turbulence.SetParams(params); }
+	CTurbulenceField& GetTurbulence() { return m_turbulence; }
+	const CTurbulenceField& GetTurbulence() const { return m_turbulence; }
+
+	// Record the positions of the particles into trails, which
+	// must hold the capacity of the pool, or stop with NULL
+	void SetTrails(CTrails *trails) { m_pTrails = trails; }
+	const CTrails *GetTrails() const { return m_pTrails; }
+
+	// Reseed and pick the generator used for spawns
+	void SetRandomSeed(TRandU64 seed);
+	void SetRandomMode(int mode) { m_iRandomMode = mode; }
+	int GetRandomMode() const { return m_iRandomMode; }
+
+	CParticlePool& GetPool() { return m_pool; }
+	const CParticlePool& GetPool() const { return m_pool; }
+	int GetNumParticles() const { return m_pool.GetLiveCount(); }
+	int GetCapacity() const { return m_pool.GetCapacity(); }
+};
+
+#endif
@@ -2,7 +2,14 @@
 File:			pointSprite.h
 Author:			Steve Costa
 Description:	This class is similar to point sprites as found in Direct3D.  It is
-simply a textured quad which faces the viewer at all times.
+simply a textured quad which faces the viewer at all times.  A whole
+particle pool can also be drawn at once, the quads are built on the
+CPU into a streamed vertex buffer and submitted with one draw call,
+in pool order or in the order of an index list such as the back to
+front order from CDepthSort, or drawn on the CPU by CSoftRasterizer.
+Given a CSpriteAtlas the batch takes each particle's image from it.
+The impostors CParticleLod merges distant particles into are drawn
+the same way, each at its own size.
 -----------------------------------------------------------------------------------*/
 
 #ifndef POINT_SPRITE_H_
@@ -12,10 +19,37 @@ simply a textured quad which faces the viewer at all times.
 Include files
 -----------------------------------------------------------------------------------*/
 
+#include <stddef.h>
+
 #include "vector.h"
 using namespace vec;
 #include "matrix.h"
 using namespace matrix;
+#include "particlePool.h"					// Particle attribute columns
+#include "jobSystem.h"						// Worker threads
+#include "profiler.h"						// Frame zones
+#include "streamBuffer.h"					// Streamed vertex buffer
+#include "softRaster.h"						// CPU sprite rasterizer
+#include "spriteAtlas.h"					// Packed sprite images
+#include "particleLod.h"					// Impostors for distant particles
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define SPRITE_BATCH_INITIAL	4096			// Sprites the vertex buffer starts with
+#define SPRITE_BUILD_GRAIN		2048			// Sprites built per job
+
+/*-----------------------------------------------------------------------------------
+Vertex layout of a batched sprite corner
+-----------------------------------------------------------------------------------*/
+
+struct TSpriteVertex
+{
+	float	x, y, z;							// World space position
+	float	u, v;								// Texture coordinates
+	GLubyte	r, g, b, a;							// Colour
+};
 
 /*-----------------------------------------------------------------------------------
 This defines the point sprite attributes and methods.  It will draw a textured
@@ -29,7 +63,13 @@ private:
 
 	GLuint	m_uiTexture;				// OpenGL texture reference
 	GLuint	m_uiSpriteDL;				// Particle dispaly list
+	GLuint	m_uiAtlasTexture;			// Mipmapped atlas levels
+	const CSpriteAtlas *m_pAtlas;		// Not owned, NULL to use m_uiTexture
+	float	m_fXExtent, m_fYExtent;		// Half the width and height of the quad
+	CStreamBuffer m_vertices;			// Batched sprite vertices
+	CStreamBuffer m_impostorVertices;	// Batched impostor vertices
 	static TMatrix orientation;			// Store orientation of modelview matrix
+	static TMatrix projection;			// Projection matrix at the same time
 
 	// Methods
 private:
@@ -52,7 +92,10 @@ private:
 	}
 
 	//-----------------------------------------------------------
-	// Load texture data into memory
+	// Load texture data into memory.  The bitmap is a grey
+	// shape on black, it is kept as alpha only so the vertex
+	// colour tints it and the same texture works for additive
+	// and alpha blending.
 	//-----------------------------------------------------------
 	int LoadTextures(char* textureFile) {
 		int status = false;
@@ -63,15 +106,32 @@ private:
 		// load bitmap
 		if (TextureImage[0] = LoadBMP(textureFile))
 		{
+			SDL_Surface *image = TextureImage[0];
+			GLubyte *alpha = new GLubyte[image->w * image->h];
+			int x, y;
+
 			status = true;
 			glGenTextures(1, &m_uiTexture);
 
+			// brightest channel of each texel
+			for (y = 0; y < image->h; y++)
+			{
+				const GLubyte *row = (const GLubyte *)image->pixels + y * image->pitch;
+
+				for (x = 0; x < image->w; x++, row += 3)
+					alpha[y * image->w + x] = MAX(row[0], MAX(row[1], row[2]));
+			}
+
 			// generate texture 1
 			glBindTexture(GL_TEXTURE_2D, m_uiTexture);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexImage2D(GL_TEXTURE_2D, 0, 3, TextureImage[0]->w,
-				TextureImage[0]->h, 0, GL_RGB, GL_UNSIGNED_BYTE, TextureImage[0]->pixels);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, image->w,
+				image->h, 0, GL_ALPHA, GL_UNSIGNED_BYTE, alpha);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+			delete[] alpha;
 		}
 
 		// clean up
@@ -87,8 +147,8 @@ private:
 	// Pre render the quad to save on processing
 	//-----------------------------------------------------------
 	void PreRender(float width, float height) {
-		float xExtent = width * 0.5f;
-		float yExtent = height * 0.5f;
+		float xExtent = m_fXExtent = width * 0.5f;
+		float yExtent = m_fYExtent = height * 0.5f;
 
 		glNewList(m_uiSpriteDL, GL_COMPILE);
 		glBindTexture(GL_TEXTURE_2D, m_uiTexture);
@@ -110,7 +170,13 @@ public:
 	//-----------------------------------------------------------
 	// Standard constructor
 	//-----------------------------------------------------------
-	CPointSprite() {}
+	CPointSprite() {
+		m_uiTexture = 0;
+		m_uiSpriteDL = 0;
+		m_uiAtlasTexture = 0;
+		m_pAtlas = NULL;
+		m_fXExtent = m_fYExtent = 0.5f;
+	}
 
 	//-----------------------------------------------------------
 	// Standard destructor
@@ -118,12 +184,14 @@ public:
 	~CPointSprite() {
 		glDeleteLists(m_uiSpriteDL, 1);
 		glDeleteTextures(1, &m_uiTexture);
+		glDeleteTextures(1, &m_uiAtlasTexture);
 	}
 
 	//-----------------------------------------------------------
-	// Initialize any member variables
+	// Initialize any member variables, fails when the vertex
+	// buffers cannot be made
 	//-----------------------------------------------------------
-	void Init(char* textureFile, float width, float height) {
+	int Init(char* textureFile, float width, float height) {
 		// Allocate memory for the display list
 		m_uiSpriteDL = glGenLists(1);
 
@@ -132,19 +200,79 @@ public:
 
 		// Prerender the textured quad
 		PreRender(width, height);
+
+		// Vertex buffer for batched rendering
+		if (m_vertices.Init(GL_ARRAY_BUFFER, sizeof(TSpriteVertex) * 4 * SPRITE_BATCH_INITIAL) != RETURN_SUCCESS ||
+			m_impostorVertices.Init(GL_ARRAY_BUFFER, sizeof(TSpriteVertex) * 4 * SPRITE_BATCH_INITIAL) != RETURN_SUCCESS)
+		{
+			return RETURN_FAILURE;
+		}
+
+		return RETURN_SUCCESS;
+	}
+
+	//-----------------------------------------------------------
+	// Draw the batches from a sprite atlas, which must outlive
+	// this sprite, or from the texture given to Init again when
+	// atlas is NULL.  The atlas levels are uploaded as the mip
+	// chain, the levels past the last one in the atlas are
+	// never sampled.
+	//-----------------------------------------------------------
+	void SetAtlas(const CSpriteAtlas *atlas) {
+		int level;
+
+		m_pAtlas = NULL;
+		if (!atlas || !atlas->GetNumLevels())
+			return;
+
+		if (!m_uiAtlasTexture)
+			glGenTextures(1, &m_uiAtlasTexture);
+
+		glBindTexture(GL_TEXTURE_2D, m_uiAtlasTexture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, atlas->GetNumLevels() - 1);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (level = 0; level < atlas->GetNumLevels(); level++)
+		{
+			glTexImage2D(GL_TEXTURE_2D, level, GL_ALPHA, atlas->GetLevelWidth(level),
+				atlas->GetLevelHeight(level), 0, GL_ALPHA, GL_UNSIGNED_BYTE, atlas->GetLevel(level));
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		m_pAtlas = atlas;
 	}
 
 	//-----------------------------------------------------------
 	// Call this method once before rendering all the point
 	// sprites so that they are all facing the viewer.  This
 	// will copy the model view matrix into the matrix object
-	// which is used in the renderinf method.
+	// which is used in the renderinf method.  The projection
+	// is kept too for culling.
 	//-----------------------------------------------------------
 	static void GetModelView() {
 		// Get the current matrix
 		glGetFloatv(GL_MODELVIEW_MATRIX, orientation.m);
+		glGetFloatv(GL_PROJECTION_MATRIX, projection.m);
 	}
 
+	// The matrices saved by GetModelView, for sorting by depth
+	// and culling
+	static const TMatrix& GetOrientation() { return orientation; }
+	static const TMatrix& GetProjection() { return projection; }
+
+	// The texture the batches are drawn with, and the atlas it
+	// holds or NULL
+	GLuint GetTexture() const { return m_pAtlas ? m_uiAtlasTexture : m_uiTexture; }
+	const CSpriteAtlas *GetAtlas() const { return m_pAtlas; }
+
+	// Width of a square quad of the same area, for working out
+	// how much of the screen a sprite covers
+	float GetSize() const { return 2.0f * sqrtf(m_fXExtent * m_fYExtent); }
+
+	// Radius of a sphere round the quad whatever way it faces
+	float GetRadius() const { return sqrtf(m_fXExtent * m_fXExtent + m_fYExtent * m_fYExtent); }
+
 	//-----------------------------------------------------------
 	// Draw the quad to the screen, the user can treat the quad
 	// as if it is a point by passing in the x, y, z coordinates
@@ -166,6 +294,230 @@ public:
 		glCallList(m_uiSpriteDL);
 		glPopMatrix();
 	}
+
+	//-----------------------------------------------------------
+	// Build the camera facing quads for sprites
+	// [first, first + count) into out.  Sprite k is particle k,
+	// or particle order[k] when there is an order.  The corners
+	// are offset along the camera right and up axes in world
+	// space so the modelview matrix can be left as it is when
+	// drawing.  Each position is blended between the last two
+	// simulation steps, a blend of 1 draws the latest step.
+	// With an atlas the texture coordinates are those of the
+	// frame of the particle's sprite for its age.
+	//-----------------------------------------------------------
+	static void BuildQuads(const CParticlePool& pool, int first, int count, float blend,
+		const TVector& right, const TVector& up, const int *order, const CSpriteAtlas *atlas,
+		TSpriteVertex *out) {
+		int k, last = first + count;
+
+		const float *prevX = pool.Column(PARTICLE_PREV_X);
+		const float *prevY = pool.Column(PARTICLE_PREV_Y);
+		const float *prevZ = pool.Column(PARTICLE_PREV_Z);
+		const float *posX = pool.Column(PARTICLE_POS_X);
+		const float *posY = pool.Column(PARTICLE_POS_Y);
+		const float *posZ = pool.Column(PARTICLE_POS_Z);
+		const float *colR = pool.Column(PARTICLE_COL_R);
+		const float *colG = pool.Column(PARTICLE_COL_G);
+		const float *colB = pool.Column(PARTICLE_COL_B);
+		const float *life = pool.Column(PARTICLE_LIFE);
+		const unsigned int *sprite = pool.UIntColumn(PARTICLE_SPRITE);
+
+		// Corner offsets: bottom left, bottom right, top right, top left
+		TVector corner[4] = { -right - up, right - up, right + up, up - right };
+		float u[4] = { 0.0f, 1.0f, 1.0f, 0.0f };
+		float v[4] = { 0.0f, 0.0f, 1.0f, 1.0f };
+
+		out += first * 4;
+		for (k = first; k < last; k++)
+		{
+			int c, i = order ? order[k] : k;
+			float x = prevX[i] + blend * (posX[i] - prevX[i]);
+			float y = prevY[i] + blend * (posY[i] - prevY[i]);
+			float z = prevZ[i] + blend * (posZ[i] - prevZ[i]);
+			GLubyte r = (GLubyte)(MAX(0.0f, MIN(1.0f, colR[i])) * 255.0f);
+			GLubyte g = (GLubyte)(MAX(0.0f, MIN(1.0f, colG[i])) * 255.0f);
+			GLubyte b = (GLubyte)(MAX(0.0f, MIN(1.0f, colB[i])) * 255.0f);
+			GLubyte a = (GLubyte)(MAX(0.0f, MIN(1.0f, life[i])) * 255.0f);
+
+			if (atlas)
+			{
+				const TAtlasFrame& frame = atlas->GetFrame(sprite[i], 1.0f - life[i]);
+
+				u[0] = u[3] = frame.u0;
+				u[1] = u[2] = frame.u1;
+				v[0] = v[1] = frame.v0;
+				v[2] = v[3] = frame.v1;
+			}
+
+			for (c = 0; c < 4; c++, out++)
+			{
+				out->x = x + corner[c].x;
+				out->y = y + corner[c].y;
+				out->z = z + corner[c].z;
+				out->u = u[c];
+				out->v = v[c];
+				out->r = r;	out->g = g;	out->b = b;	out->a = a;
+			}
+		}
+	}
+
+	//-----------------------------------------------------------
+	// Build the quads of impostors [first, first + count) into
+	// out as BuildQuads does, each its own size across.  right
+	// and up are the unit camera axes.
+	//-----------------------------------------------------------
+	static void BuildImpostorQuads(const TParticleImpostor *impostors, int first, int count,
+		const TVector& right, const TVector& up, const CSpriteAtlas *atlas, TSpriteVertex *out) {
+		int k, last = first + count;
+
+		// Corner offsets: bottom left, bottom right, top right, top left
+		TVector corner[4] = { -right - up, right - up, right + up, up - right };
+		float u[4] = { 0.0f, 1.0f, 1.0f, 0.0f };
+		float v[4] = { 0.0f, 0.0f, 1.0f, 1.0f };
+
+		out += first * 4;
+		for (k = first; k < last; k++)
+		{
+			const TParticleImpostor& imp = impostors[k];
+			float half = 0.5f * imp.size;
+			GLubyte r = (GLubyte)(MAX(0.0f, MIN(1.0f, imp.r)) * 255.0f);
+			GLubyte g = (GLubyte)(MAX(0.0f, MIN(1.0f, imp.g)) * 255.0f);
+			GLubyte b = (GLubyte)(MAX(0.0f, MIN(1.0f, imp.b)) * 255.0f);
+			GLubyte a = (GLubyte)(MAX(0.0f, MIN(1.0f, imp.a)) * 255.0f);
+			int c;
+
+			if (atlas)
+			{
+				const TAtlasFrame& frame = atlas->GetFrame(imp.sprite, imp.age);
+
+				u[0] = u[3] = frame.u0;
+				u[1] = u[2] = frame.u1;
+				v[0] = v[1] = frame.v0;
+				v[2] = v[3] = frame.v1;
+			}
+
+			for (c = 0; c < 4; c++, out++)
+			{
+				out->x = imp.x + corner[c].x * half;
+				out->y = imp.y + corner[c].y * half;
+				out->z = imp.z + corner[c].z * half;
+				out->u = u[c];
+				out->v = v[c];
+				out->r = r;	out->g = g;	out->b = b;	out->a = a;
+			}
+		}
+	}
+
+	//-----------------------------------------------------------
+	// Draw count impostors in one call, in the order given.
+	// GetModelView must have been called first.
+	//-----------------------------------------------------------
+	void RenderImpostors(const TParticleImpostor *impostors, int count, CJobSystem *jobs = NULL) {
+		PROFILE_ZONE("impostors");
+
+		TSpriteVertex *vertices;
+		const char *base;
+
+		if (count <= 0)
+			return;
+
+		TVector right(orientation.m[0], orientation.m[4], orientation.m[8]);
+		TVector up(orientation.m[1], orientation.m[5], orientation.m[9]);
+
+		vertices = (TSpriteVertex *)m_impostorVertices.Map(sizeof(TSpriteVertex) * 4 * count);
+		if (!vertices)
+			return;
+
+		RunJobs(jobs, count, SPRITE_BUILD_GRAIN, [&](int first, int num, int worker) {
+			BuildImpostorQuads(impostors, first, num, right, up, m_pAtlas, vertices);
+		});
+
+		base = m_impostorVertices.Unmap();
+
+		glBindTexture(GL_TEXTURE_2D, GetTexture());
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+		glVertexPointer(3, GL_FLOAT, sizeof(TSpriteVertex), base + offsetof(TSpriteVertex, x));
+		glTexCoordPointer(2, GL_FLOAT, sizeof(TSpriteVertex), base + offsetof(TSpriteVertex, u));
+		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(TSpriteVertex), base + offsetof(TSpriteVertex, r));
+
+		glDrawArrays(GL_QUADS, 0, count * 4);
+
+		m_impostorVertices.Fence();
+		glDisableClientState(GL_COLOR_ARRAY);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+	}
+
+	//-----------------------------------------------------------
+	// Draw the first count particles of a pool in one call.
+	// GetModelView must have been called first.  The quads are
+	// built on the worker threads when a job system is given.
+	// blend interpolates between the last two simulation steps.
+	// order, when given, holds count pool indices to draw in
+	// that order.
+	//-----------------------------------------------------------
+	void RenderBatch(const CParticlePool& pool, int count, CJobSystem *jobs = NULL, float blend = 1.0f,
+		const int *order = NULL) {
+		PROFILE_ZONE("sprites");
+
+		TSpriteVertex *vertices;
+		const char *base;
+
+		if (count <= 0)
+			return;
+
+		// The rows of the modelview rotation are the camera axes
+		TVector right(orientation.m[0], orientation.m[4], orientation.m[8]);
+		TVector up(orientation.m[1], orientation.m[5], orientation.m[9]);
+		right *= m_fXExtent;
+		up *= m_fYExtent;
+
+		vertices = (TSpriteVertex *)m_vertices.Map(sizeof(TSpriteVertex) * 4 * count);
+		if (!vertices)
+			return;
+
+		if (jobs) {
+			jobs->ParallelFor(count, SPRITE_BUILD_GRAIN, [&](int first, int num, int worker) {
+				BuildQuads(pool, first, num, blend, right, up, order, m_pAtlas, vertices);
+			});
+		}
+		else {
+			BuildQuads(pool, 0, count, blend, right, up, order, m_pAtlas, vertices);
+		}
+
+		base = m_vertices.Unmap();
+
+		glBindTexture(GL_TEXTURE_2D, m_pAtlas ? m_uiAtlasTexture : m_uiTexture);
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+		glVertexPointer(3, GL_FLOAT, sizeof(TSpriteVertex), base + offsetof(TSpriteVertex, x));
+		glTexCoordPointer(2, GL_FLOAT, sizeof(TSpriteVertex), base + offsetof(TSpriteVertex, u));
+		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(TSpriteVertex), base + offsetof(TSpriteVertex, r));
+
+		glDrawArrays(GL_QUADS, 0, count * 4);
+
+		m_vertices.Fence();
+		glDisableClientState(GL_COLOR_ARRAY);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+	}
+
+	//-----------------------------------------------------------
+	// Draw the same batch with the software rasterizer instead,
+	// through the matrices saved by GetModelView and with this
+	// sprite's size.  The rasterizer keeps its own texture and
+	// blend mode.
+	//-----------------------------------------------------------
+	void RenderSoftware(CSoftRasterizer& raster, const CParticlePool& pool, int count,
+		CJobSystem *jobs = NULL, float blend = 1.0f, const int *order = NULL) {
+		raster.SetCamera(projection, orientation);
+		raster.SetSpriteSize(2.0f * m_fXExtent, 2.0f * m_fYExtent);
+		raster.Render(pool, count, blend, order, jobs);
+	}
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,409 @@
+/*-----------------------------------------------------------------------------------
+File:			profiler.cpp
+Author:			Steve Costa
+Description:	Rings of zones for each thread, the frame statistics and the
+Chrome trace writer.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <atomic>
+#include <algorithm>
+
+#include "profiler.h"						// Class header file
+#include "simUtil.h"						// Common Macros
+#include "timer.h"							// High resolution clock
+
+/*-----------------------------------------------------------------------------------
+A zone as it is kept.  The fields are atomic so WriteTrace can read a ring
+while its thread writes it, and drops any it may have read half written.
+-----------------------------------------------------------------------------------*/
+
+struct TProfileEvent
+{
+	std::atomic<const char *>			name;
+	std::atomic<unsigned long long>		start;
+	std::atomic<unsigned long long>		end;
+	std::atomic<bool>					job;
+};
+
+// Only its own thread writes a ring
+struct TProfileRing
+{
+	std::atomic<unsigned long long>	head;		// Zones ever recorded, the next goes at head
+	std::atomic<const char *>		name;		// In the trace, a copy never freed
+	const char						*current;	// Innermost open zone
+	unsigned long long				frameRead;	// Zones EndFrame has summed
+	int								id;			// Thread id in the trace
+	TProfileEvent					events[PROFILE_RING_SIZE];
+};
+
+// What EndFrame keeps of each phase, only the thread calling it touches these
+struct TProfilePhase
+{
+	const char		*name;
+	float			history[PROFILE_HISTORY];	// Seconds in each frame, a ring
+	int				count;						// Frames recorded
+};
+
+/*-----------------------------------------------------------------------------------
+Profiler state
+-----------------------------------------------------------------------------------*/
+
+static std::atomic<TProfileRing *>	s_pRings[PROFILE_MAX_THREADS];
+static std::atomic<int>				s_iNumRings(0);
+static std::atomic<bool>			s_bEnabled(true);
+
+// Where ticks are counted from, and the seconds then
+static const unsigned long long		s_iBaseTicks = CProfiler::Now();
+static const double					s_fBaseSeconds = CTimer::GetSeconds();
+
+static TProfilePhase				s_phases[PROFILE_MAX_PHASES];
+static int							s_iNumPhases = 0;
+static unsigned long long			s_iLastFrame = 0;
+
+#if defined(_MSC_VER)
+static __declspec(thread) TProfileRing *s_pRing = NULL;
+#else
+static __thread TProfileRing *s_pRing = NULL;
+#endif
+
+/*-----------------------------------------------------------------------------------
+The calling thread's ring, made the first time it records.  Rings outlive
+their threads so what they recorded stays in the trace.  A thread past
+PROFILE_MAX_THREADS still gets one, but it is left out of the trace.
+-----------------------------------------------------------------------------------*/
+
+static TProfileRing *GetRing()
+{
+	if (!s_pRing)
+	{
+		TProfileRing *ring = new TProfileRing();
+		int index = s_iNumRings.fetch_add(1);
+
+		ring->head = 0;
+		ring->name = NULL;
+		ring->current = NULL;
+		ring->frameRead = 0;
+		ring->id = index;
+		if (index < PROFILE_MAX_THREADS)
+			s_pRings[index].store(ring, std::memory_order_release);
+		s_pRing = ring;
+	}
+
+	return s_pRing;
+}
+
+/*-----------------------------------------------------------------------------------
+Seconds per tick over everything since the profiler started
+-----------------------------------------------------------------------------------*/
+
+static double SecondsPerTick()
+{
+#ifdef CPU_X86
+	double seconds = CTimer::GetSeconds() - s_fBaseSeconds;
+	unsigned long long ticks = CProfiler::Now() - s_iBaseTicks;
+
+	// Too soon to tell, near enough any processor of late
+	if (seconds <= 0.0 || ticks < 1000)
+		return 1.0 / 3.0e9;
+
+	return seconds / double(ticks);
+#else
+	return 1.0e-9;
+#endif
+}
+
+double CProfiler::TicksToSeconds(unsigned long long ticks)
+{
+	return double(ticks) * SecondsPerTick();
+}
+
+/*-----------------------------------------------------------------------------------
+Switching the recording, the zones are still tracked so jobs are named
+-----------------------------------------------------------------------------------*/
+
+void CProfiler::SetEnabled(bool enabled)
+{
+	s_bEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool CProfiler::IsEnabled()
+{
+	return s_bEnabled.load(std::memory_order_relaxed);
+}
+
+void CProfiler::SetThreadName(const char *name)
+{
+	size_t length = strlen(name);
+	char *copy = new char[length + 1];
+
+	memcpy(copy, name, length + 1);
+	GetRing()->name.store(copy, std::memory_order_release);
+}
+
+/*-----------------------------------------------------------------------------------
+Zones
+-----------------------------------------------------------------------------------*/
+
+const char *CProfiler::Enter(const char *name)
+{
+	TProfileRing *ring = GetRing();
+	const char *outer = ring->current;
+
+	ring->current = name;
+
+	return outer;
+}
+
+void CProfiler::Leave(const char *name, const char *outer, unsigned long long start, bool job)
+{
+	unsigned long long end = Now();
+	TProfileRing *ring = GetRing();
+	unsigned long long head;
+
+	ring->current = outer;
+	if (!s_bEnabled.load(std::memory_order_relaxed))
+		return;
+
+	// A reader which sees any of this zone then sees the head it
+	// goes at, so knows the slot is being written
+	head = ring->head.load(std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	TProfileEvent& event = ring->events[head & (PROFILE_RING_SIZE - 1)];
+	event.name.store(name, std::memory_order_relaxed);
+	event.start.store(start, std::memory_order_relaxed);
+	event.end.store(end, std::memory_order_relaxed);
+	event.job.store(job, std::memory_order_relaxed);
+
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+const char *CProfiler::GetZoneName()
+{
+	return GetRing()->current;
+}
+
+/*-----------------------------------------------------------------------------------
+Sum the zones the calling thread closed since the last call by name, a phase
+which ran more than once counts once with the total.  The time since the last
+call is the frame.
+-----------------------------------------------------------------------------------*/
+
+static int FindPhase(const char *name)
+{
+	int phase;
+
+	for (phase = 0; phase < s_iNumPhases; phase++)
+	{
+		if (s_phases[phase].name == name || !strcmp(s_phases[phase].name, name))
+			return phase;
+	}
+
+	if (s_iNumPhases == PROFILE_MAX_PHASES)
+		return -1;
+
+	s_phases[s_iNumPhases].name = name;
+	s_phases[s_iNumPhases].count = 0;
+
+	return s_iNumPhases++;
+}
+
+void CProfiler::EndFrame()
+{
+	TProfileRing *ring = GetRing();
+	unsigned long long now = Now();
+	unsigned long long head = ring->head.load(std::memory_order_relaxed);
+	unsigned long long first = MAX(ring->frameRead, head - MIN(head, (unsigned long long)PROFILE_RING_SIZE));
+	unsigned long long sums[PROFILE_MAX_PHASES];
+	bool seen[PROFILE_MAX_PHASES];
+	double secondsPerTick = SecondsPerTick();
+	int phase;
+
+	memset(sums, 0, sizeof(sums));
+	memset(seen, 0, sizeof(seen));
+
+	phase = FindPhase(PROFILE_FRAME_NAME);
+	if (s_iLastFrame != 0 && phase >= 0)
+	{
+		sums[phase] = now - s_iLastFrame;
+		seen[phase] = true;
+	}
+	s_iLastFrame = now;
+
+	for (; first < head; first++)
+	{
+		const TProfileEvent& event = ring->events[first & (PROFILE_RING_SIZE - 1)];
+
+		if (event.job.load(std::memory_order_relaxed))
+			continue;
+
+		phase = FindPhase(event.name.load(std::memory_order_relaxed));
+		if (phase < 0)
+			continue;
+
+		sums[phase] += event.end.load(std::memory_order_relaxed) - event.start.load(std::memory_order_relaxed);
+		seen[phase] = true;
+	}
+	ring->frameRead = head;
+
+	for (phase = 0; phase < s_iNumPhases; phase++)
+	{
+		TProfilePhase& p = s_phases[phase];
+
+		if (!seen[phase])
+			continue;
+
+		p.history[p.count % PROFILE_HISTORY] = float(double(sums[phase]) * secondsPerTick);
+		p.count++;
+	}
+}
+
+int CProfiler::GetNumPhases()
+{
+	return s_iNumPhases;
+}
+
+/*-----------------------------------------------------------------------------------
+Percentiles by nearest rank over the frames kept
+-----------------------------------------------------------------------------------*/
+
+void CProfiler::GetPhaseStats(int phase, TProfileStats *stats)
+{
+	const TProfilePhase& p = s_phases[phase];
+	float sorted[PROFILE_HISTORY];
+	int n = MIN(p.count, PROFILE_HISTORY);
+
+	stats->name = p.name;
+	stats->frames = n;
+	stats->p50 = stats->p99 = stats->max = 0.0;
+	if (n == 0)
+		return;
+
+	memcpy(sorted, p.history, sizeof(float) * n);
+	std::sort(sorted, sorted + n);
+
+	stats->p50 = sorted[(n * 50 + 99) / 100 - 1];
+	stats->p99 = sorted[(n * 99 + 99) / 100 - 1];
+	stats->max = sorted[n - 1];
+}
+
+void CProfiler::PrintStats(FILE *file)
+{
+	TProfileStats stats;
+	int phase;
+
+	fprintf(file, "%-16s  %9s  %9s  %9s  %6s\n", "phase", "p50 ms", "p99 ms", "max ms", "frames");
+
+	for (phase = 0; phase < s_iNumPhases; phase++)
+	{
+		GetPhaseStats(phase, &stats);
+		if (stats.frames == 0)
+			continue;
+
+		fprintf(file, "%-16s  %9.3f  %9.3f  %9.3f  %6d\n", stats.name,
+			stats.p50 * 1000.0, stats.p99 * 1000.0, stats.max * 1000.0, stats.frames);
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Chrome trace.  Each ring is copied then its head read again, the zones which
+may have been written over while it was copied are dropped.
+-----------------------------------------------------------------------------------*/
+
+static void WriteJsonString(FILE *file, const char *text)
+{
+	fputc('"', file);
+	for (; *text; text++)
+	{
+		unsigned char c = (unsigned char)*text;
+
+		if (c == '"' || c == '\\')
+			fprintf(file, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(file, "\\u%04x", c);
+		else
+			fputc(c, file);
+	}
+	fputc('"', file);
+}
+
+int CProfiler::WriteTrace(const char *fileName)
+{
+	struct TZone { const char *name; unsigned long long start, end; bool job; };
+
+	FILE *file = fopen(fileName, "w");
+	TZone *zones;
+	double microsPerTick = SecondsPerTick() * 1.0e6;
+	int numRings = MIN(s_iNumRings.load(std::memory_order_acquire), PROFILE_MAX_THREADS);
+	int r, status = RETURN_SUCCESS;
+	bool first = true;
+
+	if (!file)
+		return RETURN_FAILURE;
+
+	zones = new TZone[PROFILE_RING_SIZE];
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+	for (r = 0; r < numRings; r++)
+	{
+		TProfileRing *ring = s_pRings[r].load(std::memory_order_acquire);
+		unsigned long long head, start, valid, i;
+		const char *name;
+
+		if (!ring)
+			continue;
+
+		head = ring->head.load(std::memory_order_acquire);
+		start = head - MIN(head, (unsigned long long)PROFILE_RING_SIZE);
+		for (i = start; i < head; i++)
+		{
+			const TProfileEvent& event = ring->events[i & (PROFILE_RING_SIZE - 1)];
+			TZone& zone = zones[i - start];
+
+			zone.name = event.name.load(std::memory_order_relaxed);
+			zone.start = event.start.load(std::memory_order_relaxed);
+			zone.end = event.end.load(std::memory_order_relaxed);
+			zone.job = event.job.load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		// The slot of the zone being written now is the oldest's
+		valid = ring->head.load(std::memory_order_relaxed);
+		valid = (valid >= PROFILE_RING_SIZE) ? valid - PROFILE_RING_SIZE + 1 : 0;
+
+		name = ring->name.load(std::memory_order_acquire);
+		fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+			first ? "" : ",", ring->id);
+		if (name)
+			WriteJsonString(file, name);
+		else
+			fprintf(file, "\"thread %d\"", ring->id);
+		fprintf(file, "}}");
+		first = false;
+
+		for (i = MAX(start, valid); i < head; i++)
+		{
+			const TZone& zone = zones[i - start];
+
+			fprintf(file, ",\n{\"name\":");
+			WriteJsonString(file, zone.name);
+			fprintf(file, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+				zone.job ? "job" : "zone", double((long long)(zone.start - s_iBaseTicks)) * microsPerTick,
+				double(zone.end - zone.start) * microsPerTick, ring->id);
+		}
+	}
+
+	fprintf(file, "\n]}\n");
+	if (ferror(file))
+		status = RETURN_FAILURE;
+	if (fclose(file) != 0)
+		status = RETURN_FAILURE;
+	delete[] zones;
+
+	return status;
+}
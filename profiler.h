@@ -0,0 +1,161 @@
+/*-----------------------------------------------------------------------------------
+File:			profiler.h
+Author:			Steve Costa
+Description:	Where the time of a frame goes.  A zone is a scope timed from
+where it is opened to where it closes, PROFILE_ZONE("update") at
+the top of a block.  Each thread records its zones into a ring of
+its own, so recording takes no lock and shares no cache line with
+the other threads, and the oldest zones are written over once the
+ring is full.  Jobs run by CJobSystem are recorded as zones named
+after the zone which started them, on the thread which ran them.
+
+Zones are timed with the processor's time stamp counter on x86,
+which on any processor of the last decade ticks at a fixed rate
+and is kept in step between cores, and with the steady clock
+elsewhere.  Ticks are turned into seconds against CTimer, over
+the whole time since the profiler started.
+
+Once a frame EndFrame sums the zones the calling thread closed
+since the last call by name, and keeps the last PROFILE_HISTORY
+frames of each so the 50th and 99th percentile of every phase can
+be read back.  WriteTrace writes every zone still in the rings as
+a Chrome trace, which chrome://tracing and Perfetto open.
+
+Opening and closing a zone costs two counter reads, two calls and
+a few stores, so the zones are left in release builds.
+SetEnabled(false) stops the recording.
+-----------------------------------------------------------------------------------*/
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <chrono>
+
+#include "cpuFeatures.h"					// Instruction set detection
+
+#if defined(CPU_X86) && !defined(_MSC_VER)
+#include <x86intrin.h>
+#endif
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define PROFILE_MAX_THREADS		64				// Threads which can record zones
+#define PROFILE_RING_SIZE		16384			// Zones kept by each thread, a power of two
+#define PROFILE_MAX_PHASES		32				// Zone names EndFrame keeps statistics of
+#define PROFILE_HISTORY			256				// Frames the statistics are taken over
+#define PROFILE_FRAME_NAME		"frame"			// Phase timing EndFrame to EndFrame
+
+/*-----------------------------------------------------------------------------------
+Statistics of a phase over the frames it ran in, in seconds a frame
+-----------------------------------------------------------------------------------*/
+
+struct TProfileStats
+{
+	const char		*name;
+	int				frames;					// Frames the percentiles are taken over
+	double			p50, p99, max;
+};
+
+/*-----------------------------------------------------------------------------------
+Profiler, every method is static as there is one set of rings for the process
+-----------------------------------------------------------------------------------*/
+
+class CProfiler
+{
+	// Methods
+public:
+
+	//-----------------------------------------------------------
+	// A count which goes up at a fixed rate, see TicksToSeconds
+	//-----------------------------------------------------------
+	static unsigned long long Now() {
+#ifdef CPU_X86
+		return __rdtsc();
+#else
+		return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	// Seconds a number of ticks takes
+	static double TicksToSeconds(unsigned long long ticks);
+
+	// Recording is on from the start
+	static void SetEnabled(bool enabled);
+	static bool IsEnabled();
+
+	// Name of the calling thread in the trace, copied
+	static void SetThreadName(const char *name);
+
+	//-----------------------------------------------------------
+	// Used by CProfileZone.  Enter makes name the calling
+	// thread's innermost zone and returns the one it was in.
+	// Leave puts that back and records the zone.  A job is a
+	// zone run for CJobSystem, it is left out of the phases.
+	//-----------------------------------------------------------
+	static const char *Enter(const char *name);
+	static void Leave(const char *name, const char *outer, unsigned long long start, bool job);
+
+	// The innermost zone open on the calling thread, NULL when none is
+	static const char *GetZoneName();
+
+	//-----------------------------------------------------------
+	// Call once a frame from the thread whose zones are the
+	// phases of the frame, and read the statistics from the same
+	// thread.  Phases are numbered in the order they were first
+	// seen, the frame itself first.
+	//-----------------------------------------------------------
+	static void EndFrame();
+	static int GetNumPhases();
+	static void GetPhaseStats(int phase, TProfileStats *stats);
+	static void PrintStats(FILE *file);
+
+	//-----------------------------------------------------------
+	// Write the zones in every ring to a Chrome trace JSON file.
+	// Can be called from any thread while the others record.
+	//-----------------------------------------------------------
+	static int WriteTrace(const char *fileName);
+};
+
+/*-----------------------------------------------------------------------------------
+Times the scope it is declared in.  name must outlive the profiler, a string
+literal.
+-----------------------------------------------------------------------------------*/
+
+class CProfileZone
+{
+	// Attributes
+private:
+
+	const char			*m_pszName;
+	const char			*m_pszOuter;			// Zone this one is inside
+	unsigned long long	m_iStart;
+	bool				m_bJob;
+
+	// Methods
+public:
+
+	CProfileZone(const char *name, bool job = false) {
+		m_pszName = name;
+		m_bJob = job;
+		m_pszOuter = CProfiler::Enter(name);
+		m_iStart = CProfiler::Now();
+	}
+
+	~CProfileZone() {
+		CProfiler::Leave(m_pszName, m_pszOuter, m_iStart, m_bJob);
+	}
+};
+
+#define PROFILE_JOIN2(a, b)		a##b
+#define PROFILE_JOIN(a, b)		PROFILE_JOIN2(a, b)
+#define PROFILE_ZONE(name)		CProfileZone PROFILE_JOIN(profileZone, __LINE__)(name)
+
+#endif
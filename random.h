@@ -0,0 +1,257 @@
+/*-----------------------------------------------------------------------------------
+File:			random.h
+Author:			Steve Costa
+Description:	Random number generators to replace rand(), which is slow, has
+weak low bits and shares one hidden state between threads.
+
+	CRandomPcg32		small, fast, good quality sequential generator
+	CRandomXoshiro128	fastest sequential generator, can jump ahead
+						2^64 steps to hand out independent per-thread
+						streams
+	CRandomPhilox		counter based: the output is a pure function of
+						a key and a counter, so any number can be
+						regenerated in any order on any thread
+
+All of them hand out 32 bit integers.  The helpers at the bottom turn those
+into floats and ranges without using the weak low bits.
+-----------------------------------------------------------------------------------*/
+
+#ifndef RANDOM_H_
+#define RANDOM_H_
+
+/*-----------------------------------------------------------------------------------
+Types
+-----------------------------------------------------------------------------------*/
+
+typedef unsigned int		TRandU32;
+typedef unsigned long long	TRandU64;
+
+/*-----------------------------------------------------------------------------------
+SplitMix64, used to turn one seed into well mixed generator states
+-----------------------------------------------------------------------------------*/
+
+inline TRandU64 SplitMix64(TRandU64& state)
+{
+	TRandU64 z = (state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+/*-----------------------------------------------------------------------------------
+PCG32 (XSH RR variant) by Melissa O'Neill
+-----------------------------------------------------------------------------------*/
+
+class CRandomPcg32
+{
+	// Attributes
+private:
+
+	TRandU64	m_state;
+	TRandU64	m_inc;						// Stream selector, always odd
+
+	// Methods
+public:
+
+	CRandomPcg32() { Seed(0, 0); }
+
+	void Seed(TRandU64 seed, TRandU64 stream) {
+		m_state = 0;
+		m_inc = (stream << 1) | 1;
+		NextUInt();
+		m_state += seed;
+		NextUInt();
+	}
+
+	TRandU32 NextUInt() {
+		TRandU64 old = m_state;
+		TRandU32 xorShifted = TRandU32(((old >> 18) ^ old) >> 27);
+		TRandU32 rot = TRandU32(old >> 59);
+
+		m_state = old * 6364136223846793005ull + m_inc;
+
+		return (xorShifted >> rot) | (xorShifted << ((32 - rot) & 31));
+	}
+
+	void Fill(TRandU32 *out, int count) {
+		int i;
+		for (i = 0; i < count; i++)
+			out[i] = NextUInt();
+	}
+};
+
+/*-----------------------------------------------------------------------------------
+xoshiro128+ by David Blackman and Sebastiano Vigna.  The low bits are weak,
+which the float and range helpers never use.
+-----------------------------------------------------------------------------------*/
+
+class CRandomXoshiro128
+{
+	// Attributes
+private:
+
+	TRandU32	m_s[4];
+
+	static TRandU32 Rotl(TRandU32 x, int k) {
+		return (x << k) | (x >> (32 - k));
+	}
+
+	// Methods
+public:
+
+	CRandomXoshiro128() { Seed(0); }
+
+	void Seed(TRandU64 seed) {
+		TRandU64 a = SplitMix64(seed);
+		TRandU64 b = SplitMix64(seed);
+		m_s[0] = TRandU32(a);	m_s[1] = TRandU32(a >> 32);
+		m_s[2] = TRandU32(b);	m_s[3] = TRandU32(b >> 32);
+	}
+
+	TRandU32 NextUInt() {
+		TRandU32 result = m_s[0] + m_s[3];
+		TRandU32 t = m_s[1] << 9;
+
+		m_s[2] ^= m_s[0];
+		m_s[3] ^= m_s[1];
+		m_s[1] ^= m_s[2];
+		m_s[0] ^= m_s[3];
+		m_s[2] ^= t;
+		m_s[3] = Rotl(m_s[3], 11);
+
+		return result;
+	}
+
+	// Advance 2^64 steps, used to give each thread its own stream
+	void Jump() {
+		static const TRandU32 jump[4] = { 0x8764000b, 0xf542d2d3, 0x6fa035c3, 0x77f2db5b };
+		TRandU32 s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+		int i, b;
+
+		for (i = 0; i < 4; i++)
+		{
+			for (b = 0; b < 32; b++)
+			{
+				if (jump[i] & (1u << b))
+				{
+					s0 ^= m_s[0];	s1 ^= m_s[1];	s2 ^= m_s[2];	s3 ^= m_s[3];
+				}
+				NextUInt();
+			}
+		}
+
+		m_s[0] = s0;	m_s[1] = s1;	m_s[2] = s2;	m_s[3] = s3;
+	}
+
+	void Fill(TRandU32 *out, int count) {
+		int i;
+		for (i = 0; i < count; i++)
+			out[i] = NextUInt();
+	}
+};
+
+/*-----------------------------------------------------------------------------------
+Philox4x32-10 by Salmon et al.  Ten rounds of multiply and xor turn a 128 bit
+counter and a 64 bit key into four random words.
+-----------------------------------------------------------------------------------*/
+
+class CRandomPhilox
+{
+	// Attributes
+private:
+
+	TRandU32	m_key[2];
+
+	// Methods
+public:
+
+	CRandomPhilox() { Seed(0); }
+
+	void Seed(TRandU64 seed) {
+		m_key[0] = TRandU32(seed);
+		m_key[1] = TRandU32(seed >> 32);
+	}
+
+	//-----------------------------------------------------------
+	// Random words for a single counter value
+	//-----------------------------------------------------------
+	void Block(TRandU32 c0, TRandU32 c1, TRandU32 c2, TRandU32 c3, TRandU32 out[4]) const {
+		TRandU32 k0 = m_key[0], k1 = m_key[1];
+		int round;
+
+		for (round = 0; round < 10; round++)
+		{
+			TRandU64 p0 = TRandU64(0xD2511F53u) * c0;
+			TRandU64 p1 = TRandU64(0xCD9E8D57u) * c2;
+			TRandU32 n0 = TRandU32(p1 >> 32) ^ c1 ^ k0;
+			TRandU32 n2 = TRandU32(p0 >> 32) ^ c3 ^ k1;
+
+			c0 = n0;
+			c1 = TRandU32(p1);
+			c2 = n2;
+			c3 = TRandU32(p0);
+
+			k0 += 0x9E3779B9u;
+			k1 += 0xBB67AE85u;
+		}
+
+		out[0] = c0;	out[1] = c1;	out[2] = c2;	out[3] = c3;
+	}
+
+	//-----------------------------------------------------------
+	// Bulk version: one block per id, with counter (ids[i], c1,
+	// c2, 0).  Results are written as four separate streams.
+	// Every lane is independent so compilers vectorize the loop.
+	//-----------------------------------------------------------
+	void Fill(const TRandU32 *ids, int count, TRandU32 c1, TRandU32 c2,
+		TRandU32 *out0, TRandU32 *out1, TRandU32 *out2, TRandU32 *out3) const {
+		int i;
+
+		for (i = 0; i < count; i++)
+		{
+			TRandU32 block[4];
+			Block(ids[i], c1, c2, 0, block);
+			out0[i] = block[0];
+			out1[i] = block[1];
+			out2[i] = block[2];
+			out3[i] = block[3];
+		}
+	}
+
+	//-----------------------------------------------------------
+	// As above for the consecutive counters (first + i, c1, c2,
+	// c3)
+	//-----------------------------------------------------------
+	void FillRange(TRandU32 first, int count, TRandU32 c1, TRandU32 c2, TRandU32 c3,
+		TRandU32 *out0, TRandU32 *out1, TRandU32 *out2, TRandU32 *out3) const {
+		int i;
+
+		for (i = 0; i < count; i++)
+		{
+			TRandU32 block[4];
+			Block(first + TRandU32(i), c1, c2, c3, block);
+			out0[i] = block[0];
+			out1[i] = block[1];
+			out2[i] = block[2];
+			out3[i] = block[3];
+		}
+	}
+};
+
+/*-----------------------------------------------------------------------------------
+Conversions.  Both use the high bits only.
+-----------------------------------------------------------------------------------*/
+
+// Uniform float in [0, 1) from the top 24 bits
+inline float RandomToFloat(TRandU32 x)
+{
+	return float(x >> 8) * (1.0f / 16777216.0f);
+}
+
+// Uniform integer in [0, n) by multiply and shift, no modulo bias on the low bits
+inline TRandU32 RandomToRange(TRandU32 x, TRandU32 n)
+{
+	return TRandU32((TRandU64(x) * n) >> 32);
+}
+
+#endif
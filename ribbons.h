@@ -0,0 +1,236 @@
+/*-----------------------------------------------------------------------------------
+File:			ribbons.h
+Author:			Steve Costa
+Description:	Draws a ribbon behind every particle along the positions kept by
+CTrails.  Each ribbon runs from where the particle is drawn back
+through its history, turned about its length to face the camera
+and narrowing and fading towards the tail.  The strips of all the
+particles are built on the CPU in one pass into a streamed vertex
+buffer, joined by repeated vertices into one triangle strip, and
+submitted with one draw call using the point sprite's texture.
+
+Every particle has the same number of vertices however much of its
+trail there is, so each job knows where its particles go.  The
+points past the end of a short trail sit on its last point and
+make no triangles.
+-----------------------------------------------------------------------------------*/
+
+#ifndef RIBBONS_H_
+#define RIBBONS_H_
+
+/*-----------------------------------------------------------------------------------
+Include files
+-----------------------------------------------------------------------------------*/
+
+#include <stddef.h>
+
+#include "vector.h"
+using namespace vec;
+#include "matrix.h"
+using namespace matrix;
+#include "particlePool.h"					// Particle attribute columns
+#include "trails.h"							// Recent positions
+#include "jobSystem.h"						// Worker threads
+#include "profiler.h"						// Frame zones
+#include "streamBuffer.h"					// Streamed vertex buffer
+#include "spriteAtlas.h"					// Packed sprite images
+#include "pointSprite.h"					// Sprite vertex layout and texture
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define RIBBON_BATCH_INITIAL	1024			// Ribbons the vertex buffer starts with
+#define RIBBON_BUILD_GRAIN		256				// Ribbons built per job
+
+/*-----------------------------------------------------------------------------------
+Ribbon batch class definition
+-----------------------------------------------------------------------------------*/
+
+class CRibbons
+{
+	// Attributes
+private:
+
+	CStreamBuffer	m_vertices;				// Strips of the last batch
+	float			m_fHalfWidth;			// At the head of a ribbon
+
+	// Methods
+public:
+
+	//-----------------------------------------------------------
+	// Standard constructor
+	//-----------------------------------------------------------
+	CRibbons() {
+		m_fHalfWidth = 0.25f;
+	}
+
+	//-----------------------------------------------------------
+	// Set up the vertex buffer, width is across the head of a
+	// ribbon in world units.  Fails when the buffer cannot be
+	// made.
+	//-----------------------------------------------------------
+	int Init(float width, int length) {
+		m_fHalfWidth = width * 0.5f;
+		return m_vertices.Init(GL_ARRAY_BUFFER, sizeof(TSpriteVertex) * GetVertices(length) * RIBBON_BATCH_INITIAL);
+	}
+
+	// Vertices each ribbon is built from: a pair for the head and
+	// each step of a trail length long, and one repeated at each
+	// end to join it to the strips either side
+	static int GetVertices(int length) { return 2 * (length + 1) + 2; }
+
+	//-----------------------------------------------------------
+	// Build the strips of ribbons [first, first + count) into
+	// out.  Ribbon k is behind particle k, or particle order[k]
+	// when there is an order.  The head is blended between the
+	// last two steps as the sprite is.  eye is the camera
+	// position in world space, the ribbon is turned about each
+	// segment to face it.  The texture is a row through the
+	// middle of the particle's sprite, across the ribbon.
+	//-----------------------------------------------------------
+	static void BuildStrips(const CParticlePool& pool, const CTrails& trails, int first, int count,
+		float blend, const TVector& eye, float halfWidth, const int *order, const CSpriteAtlas *atlas,
+		TSpriteVertex *out) {
+		int k, j, last = first + count;
+		int length = trails.GetLength();
+		int points = length + 1;
+		float invPoints = 1.0f / float(points);
+		TVector point[TRAIL_MAX_LENGTH + 1];
+
+		const float *prevX = pool.Column(PARTICLE_PREV_X);
+		const float *prevY = pool.Column(PARTICLE_PREV_Y);
+		const float *prevZ = pool.Column(PARTICLE_PREV_Z);
+		const float *posX = pool.Column(PARTICLE_POS_X);
+		const float *posY = pool.Column(PARTICLE_POS_Y);
+		const float *posZ = pool.Column(PARTICLE_POS_Z);
+		const float *colR = pool.Column(PARTICLE_COL_R);
+		const float *colG = pool.Column(PARTICLE_COL_G);
+		const float *colB = pool.Column(PARTICLE_COL_B);
+		const float *life = pool.Column(PARTICLE_LIFE);
+		const unsigned int *sprite = pool.UIntColumn(PARTICLE_SPRITE);
+
+		out += first * GetVertices(length);
+		for (k = first; k < last; k++)
+		{
+			int i = order ? order[k] : k;
+			int valid = 1 + trails.GetCount(i);
+			float u0 = 0.0f, u1 = 1.0f, v = 0.5f;
+			GLubyte r = (GLubyte)(MAX(0.0f, MIN(1.0f, colR[i])) * 255.0f);
+			GLubyte g = (GLubyte)(MAX(0.0f, MIN(1.0f, colG[i])) * 255.0f);
+			GLubyte b = (GLubyte)(MAX(0.0f, MIN(1.0f, colB[i])) * 255.0f);
+			float alpha = MAX(0.0f, MIN(1.0f, life[i])) * 255.0f;
+			TSpriteVertex *strip = out;
+
+			if (atlas)
+			{
+				const TAtlasFrame& frame = atlas->GetFrame(sprite[i], 1.0f - life[i]);
+
+				u0 = frame.u0;
+				u1 = frame.u1;
+				v = 0.5f * (frame.v0 + frame.v1);
+			}
+
+			// The head, then the trail back from the start of this
+			// step, the rest on the last point of it
+			point[0] = TVector(prevX[i] + blend * (posX[i] - prevX[i]),
+				prevY[i] + blend * (posY[i] - prevY[i]),
+				prevZ[i] + blend * (posZ[i] - prevZ[i]));
+			for (j = 1; j < points; j++)
+			{
+				int age = MIN(j, valid - 1) - 1;
+
+				point[j] = (age < 0) ? point[0] :
+					TVector(trails.GetX(age)[i], trails.GetY(age)[i], trails.GetZ(age)[i]);
+			}
+
+			out++;
+			for (j = 0; j < points; j++, out += 2)
+			{
+				TVector along = point[MAX(j - 1, 0)] - point[MIN(j + 1, points - 1)];
+				TVector side = CrossProduct(along, eye - point[j]);
+				float size = Magnitude(side);
+				float taper = 1.0f - float(j) * invPoints;
+				GLubyte a = (GLubyte)(alpha * taper);
+
+				// Nothing to turn about where the trail stops
+				if (size > 1.0e-12f)
+					side *= halfWidth * taper / size;
+				else
+					side = TVector(0.0f, 0.0f, 0.0f);
+
+				out[0].x = point[j].x - side.x;
+				out[0].y = point[j].y - side.y;
+				out[0].z = point[j].z - side.z;
+				out[0].u = u0;
+				out[1].x = point[j].x + side.x;
+				out[1].y = point[j].y + side.y;
+				out[1].z = point[j].z + side.z;
+				out[1].u = u1;
+				out[0].v = out[1].v = v;
+				out[0].r = out[1].r = r;
+				out[0].g = out[1].g = g;
+				out[0].b = out[1].b = b;
+				out[0].a = out[1].a = a;
+			}
+
+			// Repeat the ends so the triangles between strips have
+			// no area
+			strip[0] = strip[1];
+			out[0] = out[-1];
+			out++;
+		}
+	}
+
+	//-----------------------------------------------------------
+	// Draw the ribbons behind the first count particles of a
+	// pool with the texture of a point sprite.  GetModelView must
+	// have been called first.  blend and order are as for
+	// CPointSprite::RenderBatch.
+	//-----------------------------------------------------------
+	void Render(const CParticlePool& pool, const CTrails& trails, int count, const CPointSprite& sprite,
+		CJobSystem *jobs = NULL, float blend = 1.0f, const int *order = NULL) {
+		PROFILE_ZONE("ribbons");
+
+		TSpriteVertex *vertices;
+		const char *base;
+		int stride = GetVertices(trails.GetLength());
+		float halfWidth = m_fHalfWidth;
+		const CSpriteAtlas *atlas = sprite.GetAtlas();
+
+		count = MIN(count, trails.GetCapacity());
+		if (count <= 0 || !trails.IsEnabled())
+			return;
+
+		// The camera sits where the inverse of the view puts the
+		// origin
+		TVector eye = InverseRigid(CPointSprite::GetOrientation()).GetTranslation();
+
+		vertices = (TSpriteVertex *)m_vertices.Map(sizeof(TSpriteVertex) * stride * count);
+		if (!vertices)
+			return;
+
+		RunJobs(jobs, count, RIBBON_BUILD_GRAIN, [&](int first, int num, int worker) {
+			BuildStrips(pool, trails, first, num, blend, eye, halfWidth, order, atlas, vertices);
+		});
+
+		base = m_vertices.Unmap();
+
+		glBindTexture(GL_TEXTURE_2D, sprite.GetTexture());
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+		glVertexPointer(3, GL_FLOAT, sizeof(TSpriteVertex), base + offsetof(TSpriteVertex, x));
+		glTexCoordPointer(2, GL_FLOAT, sizeof(TSpriteVertex), base + offsetof(TSpriteVertex, u));
+		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(TSpriteVertex), base + offsetof(TSpriteVertex, r));
+
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, count * stride);
+
+		m_vertices.Fence();
+		glDisableClientState(GL_COLOR_ARRAY);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+	}
+};
+
+#endif
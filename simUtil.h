@@ -0,0 +1,95 @@
+/*-----------------------------------------------------------------------------------
+File:			simUtil.h
+Author:			Steve Costa
+Description:	Constants and macros shared by the simulation code.  Nothing in
+here depends on the platform, the window or the graphics library.
+-----------------------------------------------------------------------------------*/
+
+#ifndef SIM_UTIL_H
+#define SIM_UTIL_H
+
+/*-----------------------------------------------------------------------------------
+External Libraries
+-----------------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+/*-----------------------------------------------------------------------------------
+Return values
+-----------------------------------------------------------------------------------*/
+
+#define	RETURN_SUCCESS			1
+#define	RETURN_FAILURE			-1
+
+/*-----------------------------------------------------------------------------------
+Macros
+-----------------------------------------------------------------------------------*/
+
+// PI
+#define PI		3.14159265f
+#define PI2		6.28318531f
+
+// Get 3 dimensional index array
+#ifndef GET3DINDEX
+#define GET3DINDEX(i, j, k, sizeI, sizeJ) (((((i) * (sizeI)) + (j)) * (sizeJ)) + (k))
+#endif
+
+// Square macro
+#ifndef SQR
+#define SQR(a)	((a) * (a))
+#endif
+
+// Cube macro
+#ifndef CUBE
+#define CUBE(a)	((a) * (a) * (a))
+#endif
+
+// Min macro
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif 
+
+// Max macro
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif 
+
+// Swap macro
+#ifndef SWAP
+#define SWAP(a, b, t) { t = a; a = b; b = t; }
+#endif
+
+// Absolute macro
+#ifndef ABS
+#define ABS(a) ((a) < 0 ? -(a) : (a))
+#endif
+
+/*-----------------------------------------------------------------------------------
+Visual Studio before 2015 has no snprintf, only _snprintf and _vsnprintf, which
+leave the string unterminated when it does not fit and return -1 rather than
+the length it needed
+-----------------------------------------------------------------------------------*/
+
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#pragma warning(push)
+#pragma warning(disable : 4996)				// SDL checks reject _vsnprintf, terminated below
+inline int snprintf(char *buffer, size_t size, const char *format, ...)
+{
+	va_list args;
+	int length;
+
+	va_start(args, format);
+	length = _vsnprintf(buffer, size, format, args);
+	va_end(args);
+
+	if (size > 0 && (length < 0 || (size_t)length >= size))
+		buffer[size - 1] = '\0';
+
+	return length;
+}
+#pragma warning(pop)
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,636 @@
+/*-----------------------------------------------------------------------------------
+File:			snapshot.cpp
+Author:			Steve Costa
+Description:	Recording the particle pool a frame at a time, and playing the
+recording back.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#define _CRT_SECURE_NO_WARNINGS				// fopen as it is everywhere else
+
+#include <string.h>
+
+#include "snapshot.h"						// Class header file
+#include "profiler.h"						// Frame zones
+
+/*-----------------------------------------------------------------------------------
+Bytes a key frame column takes, and the most a delta column can take.  A run
+of literals only ends early before SNAPSHOT_MIN_ZEROS zeros, which are left
+out, so only the runs cut at SNAPSHOT_MAX_LITERALS cost more than they hold.
+-----------------------------------------------------------------------------------*/
+
+static inline size_t AlignSize(size_t bytes)
+{
+	return (bytes + SNAPSHOT_ALIGN - 1) & ~(size_t)(SNAPSHOT_ALIGN - 1);
+}
+
+static inline size_t DeltaBound(int count)
+{
+	size_t bytes = 4 * size_t(count);
+
+	return AlignSize(bytes + bytes / 64 + 16);
+}
+
+/*-----------------------------------------------------------------------------------
+A delta column is a run of tokens, each a count of zeros as a little endian
+base 128 number, a byte counting the literals and the literals.  They cover the
+XOR of each value with the last frame's, the lowest byte of every value, then
+the next byte of every value and so on.
+-----------------------------------------------------------------------------------*/
+
+static unsigned char *PutToken(unsigned char *out, size_t zeros, const unsigned char *literals, int count)
+{
+	while (zeros >= 0x80)
+	{
+		*out++ = (unsigned char)(zeros | 0x80);
+		zeros >>= 7;
+	}
+	*out++ = (unsigned char)zeros;
+	*out++ = (unsigned char)count;
+	memcpy(out, literals, count);
+
+	return out + count;
+}
+
+static size_t EncodeColumn(const unsigned int *current, const unsigned int *previous, int count,
+	unsigned char *out)
+{
+	unsigned char literals[SNAPSHOT_MAX_LITERALS];
+	unsigned char *start = out;
+	size_t zeros = 0;
+	int numLiterals = 0, trailing = 0;
+	int shift, i;
+
+	for (shift = 0; shift < 32; shift += 8)
+	{
+		for (i = 0; i < count; i++)
+		{
+			unsigned char b = (unsigned char)((current[i] ^ previous[i]) >> shift);
+
+			if (!b && !numLiterals)
+			{
+				zeros++;
+				continue;
+			}
+
+			literals[numLiterals++] = b;
+			trailing = b ? 0 : trailing + 1;
+
+			// Enough zeros to be worth a new token
+			if (trailing == SNAPSHOT_MIN_ZEROS)
+			{
+				out = PutToken(out, zeros, literals, numLiterals - SNAPSHOT_MIN_ZEROS);
+				zeros = SNAPSHOT_MIN_ZEROS;
+				numLiterals = trailing = 0;
+			}
+			else if (numLiterals == SNAPSHOT_MAX_LITERALS)
+			{
+				out = PutToken(out, zeros, literals, numLiterals);
+				zeros = 0;
+				numLiterals = trailing = 0;
+			}
+		}
+	}
+
+	if (zeros || numLiterals)
+		out = PutToken(out, zeros, literals, numLiterals);
+
+	return size_t(out - start);
+}
+
+// XOR a delta column into the last frame's, returns false when
+// it does not cover the column exactly
+static bool DecodeColumn(const unsigned char *in, size_t size, int count, unsigned int *column)
+{
+	const unsigned char *end = in + size;
+	size_t total = 4 * size_t(count), k = 0;
+
+	while (k < total)
+	{
+		size_t zeros = 0;
+		int bits = 0, numLiterals, shift, i;
+
+		do
+		{
+			if (in == end || bits > 28)
+				return false;
+			zeros |= size_t(*in & 0x7F) << bits;
+			bits += 7;
+		} while (*in++ & 0x80);
+
+		if (zeros > total - k || in == end)
+			return false;
+		k += zeros;
+
+		numLiterals = *in++;
+		if (size_t(numLiterals) > size_t(end - in) || size_t(numLiterals) > total - k)
+			return false;
+
+		shift = int(k / count) * 8;
+		i = int(k % count);
+		for (k += numLiterals; numLiterals > 0; numLiterals--)
+		{
+			column[i] ^= (unsigned int)*in++ << shift;
+			if (++i == count)
+			{
+				i = 0;
+				shift += 8;
+			}
+		}
+	}
+
+	return in == end;
+}
+
+/*-----------------------------------------------------------------------------------
+Set any initial values for class state variables.
+-----------------------------------------------------------------------------------*/
+
+CSnapshotWriter::CSnapshotWriter()
+{
+	m_pFile = NULL;
+	m_iCapacity = 0;
+	m_iNumColumns = 0;
+	m_iKeyInterval = SNAPSHOT_KEY_INTERVAL;
+	m_bFailed = false;
+	m_puiPrevious = NULL;
+	m_iPrevLive = 0;
+	m_pucEncoded = NULL;
+	m_uiRegion = 0;
+	m_pOffsets = NULL;
+	m_iNumFrames = m_iFrameCapacity = 0;
+	m_ullOffset = 0;
+}
+
+CSnapshotWriter::~CSnapshotWriter()
+{
+	Close();
+}
+
+/*-----------------------------------------------------------------------------------
+Write to the file, remembering any failure
+-----------------------------------------------------------------------------------*/
+
+bool CSnapshotWriter::Write(const void *data, size_t bytes)
+{
+	if (m_bFailed || fwrite(data, 1, bytes, m_pFile) != bytes)
+	{
+		m_bFailed = true;
+		return false;
+	}
+
+	m_ullOffset += bytes;
+
+	return true;
+}
+
+/*-----------------------------------------------------------------------------------
+Create the file and the buffers, and write the header
+-----------------------------------------------------------------------------------*/
+
+int CSnapshotWriter::Open(const char *filename, int capacity, unsigned int columnMask, int keyInterval)
+{
+	TSnapshotHeader header;
+	int column;
+
+	Close();
+
+	columnMask &= SNAPSHOT_ALL_COLUMNS;
+	if (!filename || capacity <= 0 || !columnMask || keyInterval <= 0)
+		return RETURN_FAILURE;
+
+	if (!(m_pFile = fopen(filename, "wb")))
+		return RETURN_FAILURE;
+
+	m_iNumColumns = 0;
+	for (column = 0; column < PARTICLE_NUM_COLUMNS; column++)
+	{
+		if (columnMask & (1u << column))
+			m_iColumns[m_iNumColumns++] = column;
+	}
+
+	m_iCapacity = capacity;
+	m_iKeyInterval = keyInterval;
+	m_bFailed = false;
+	m_iPrevLive = 0;
+	m_iNumFrames = 0;
+	m_ullOffset = 0;
+
+	m_puiPrevious = new unsigned int[size_t(m_iNumColumns) * capacity];
+	memset(m_puiPrevious, 0, sizeof(unsigned int) * m_iNumColumns * capacity);
+	m_uiRegion = DeltaBound(capacity);
+	m_pucEncoded = new unsigned char[m_uiRegion * m_iNumColumns];
+	m_iFrameCapacity = SNAPSHOT_INITIAL_FRAMES;
+	m_pOffsets = new unsigned long long[m_iFrameCapacity];
+
+	memset(&header, 0, sizeof(header));
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.capacity = capacity;
+	header.columnMask = columnMask;
+	header.keyInterval = keyInterval;
+
+	if (!Write(&header, sizeof(header)))
+	{
+		Close();
+		return RETURN_FAILURE;
+	}
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Finish the file with the index, unless it could not all be written, in which
+case the frames that made it are still found by walking them
+-----------------------------------------------------------------------------------*/
+
+int CSnapshotWriter::Close()
+{
+	int status = RETURN_SUCCESS;
+
+	if (m_pFile)
+	{
+		TSnapshotFooter footer;
+
+		memset(&footer, 0, sizeof(footer));
+		footer.indexOffset = m_ullOffset;
+		footer.numFrames = m_iNumFrames;
+		footer.magic = SNAPSHOT_FOOTER_MAGIC;
+
+		Write(m_pOffsets, sizeof(unsigned long long) * m_iNumFrames);
+		Write(&footer, sizeof(footer));
+
+		if (fclose(m_pFile) != 0 || m_bFailed)
+			status = RETURN_FAILURE;
+		m_pFile = NULL;
+	}
+
+	delete[] m_puiPrevious;
+	delete[] m_pucEncoded;
+	delete[] m_pOffsets;
+	m_puiPrevious = NULL;
+	m_pucEncoded = NULL;
+	m_pOffsets = NULL;
+	m_iFrameCapacity = 0;
+
+	return status;
+}
+
+/*-----------------------------------------------------------------------------------
+Encode the columns of a frame side by side, then write them in order
+-----------------------------------------------------------------------------------*/
+
+int CSnapshotWriter::Append(const CParticlePool& pool, float time, CJobSystem *jobs)
+{
+	PROFILE_ZONE("record");
+
+	static const unsigned char zeros[SNAPSHOT_ALIGN] = { 0 };
+	TSnapshotFrame frame;
+	int live = pool.GetLiveCount(), prevLive = m_iPrevLive;
+	bool key = (m_iNumFrames % m_iKeyInterval == 0);
+	size_t column = AlignSize(sizeof(unsigned int) * live);
+	size_t payload;
+	int c;
+
+	if (!m_pFile || m_bFailed || live > m_iCapacity)
+		return RETURN_FAILURE;
+
+	// Each column against the last frame, which becomes this one
+	RunJobs(jobs, m_iNumColumns, 1, [&](int first, int num, int worker) {
+		for (int c = first; c < first + num; c++)
+		{
+			const unsigned int *current = pool.UIntColumn(m_iColumns[c]);
+			unsigned int *previous = m_puiPrevious + size_t(c) * m_iCapacity;
+
+			if (!key)
+				m_uiEncoded[c] = (unsigned int)EncodeColumn(current, previous, live, m_pucEncoded + c * m_uiRegion);
+
+			memcpy(previous, current, sizeof(unsigned int) * live);
+			if (prevLive > live)
+				memset(previous + live, 0, sizeof(unsigned int) * (prevLive - live));
+		}
+	});
+	m_iPrevLive = live;
+
+	if (key)
+	{
+		payload = column * m_iNumColumns;
+	}
+	else
+	{
+		payload = sizeof(unsigned int) * m_iNumColumns;
+		for (c = 0; c < m_iNumColumns; c++)
+			payload += m_uiEncoded[c];
+		payload = AlignSize(payload);
+	}
+
+	memset(&frame, 0, sizeof(frame));
+	frame.magic = SNAPSHOT_FRAME_MAGIC;
+	frame.type = key ? SNAPSHOT_KEY : SNAPSHOT_DELTA;
+	frame.liveCount = live;
+	frame.time = time;
+	frame.size = (unsigned int)payload;
+	frame.keyFrame = m_iNumFrames - m_iNumFrames % m_iKeyInterval;
+
+	if (m_iNumFrames == m_iFrameCapacity)
+	{
+		unsigned long long *offsets = new unsigned long long[2 * m_iFrameCapacity];
+
+		memcpy(offsets, m_pOffsets, sizeof(unsigned long long) * m_iNumFrames);
+		delete[] m_pOffsets;
+		m_pOffsets = offsets;
+		m_iFrameCapacity *= 2;
+	}
+	m_pOffsets[m_iNumFrames] = m_ullOffset;
+
+	Write(&frame, sizeof(frame));
+
+	if (key)
+	{
+		for (c = 0; c < m_iNumColumns; c++)
+		{
+			Write(pool.UIntColumn(m_iColumns[c]), sizeof(unsigned int) * live);
+			Write(zeros, column - sizeof(unsigned int) * live);
+		}
+	}
+	else
+	{
+		size_t used = sizeof(unsigned int) * m_iNumColumns;
+
+		Write(m_uiEncoded, sizeof(unsigned int) * m_iNumColumns);
+		for (c = 0; c < m_iNumColumns; c++)
+		{
+			Write(m_pucEncoded + c * m_uiRegion, m_uiEncoded[c]);
+			used += m_uiEncoded[c];
+		}
+		Write(zeros, payload - used);
+	}
+
+	if (m_bFailed)
+		return RETURN_FAILURE;
+
+	m_iNumFrames++;
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Set any initial values for class state variables.
+-----------------------------------------------------------------------------------*/
+
+CSnapshotReader::CSnapshotReader()
+{
+	m_pHeader = NULL;
+	m_pOffsets = NULL;
+	m_pScanned = NULL;
+	m_iNumFrames = 0;
+	m_iNumColumns = 0;
+	m_iCurrent = -1;
+}
+
+CSnapshotReader::~CSnapshotReader()
+{
+	Close();
+}
+
+/*-----------------------------------------------------------------------------------
+Check a frame header and that its columns are inside [0, end).  Every frame
+before it must have been checked.
+-----------------------------------------------------------------------------------*/
+
+bool CSnapshotReader::CheckFrame(unsigned long long offset, unsigned long long end, int frame) const
+{
+	const TSnapshotFrame *header;
+
+	if (offset % SNAPSHOT_ALIGN || offset < sizeof(TSnapshotHeader) || end < sizeof(TSnapshotFrame) ||
+		offset > end - sizeof(TSnapshotFrame))
+	{
+		return false;
+	}
+
+	header = (const TSnapshotFrame *)(m_file.GetData() + offset);
+	if (header->magic != SNAPSHOT_FRAME_MAGIC || header->liveCount > m_pHeader->capacity ||
+		header->size > end - offset - sizeof(TSnapshotFrame))
+	{
+		return false;
+	}
+
+	if (header->type == SNAPSHOT_KEY)
+	{
+		return header->keyFrame == (unsigned int)frame &&
+			header->size >= AlignSize(sizeof(unsigned int) * header->liveCount) * m_iNumColumns;
+	}
+
+	return header->type == SNAPSHOT_DELTA && header->keyFrame < (unsigned int)frame &&
+		GetFrameHeader(header->keyFrame)->type == SNAPSHOT_KEY &&
+		header->size >= sizeof(unsigned int) * m_iNumColumns;
+}
+
+/*-----------------------------------------------------------------------------------
+Map the file, and find the frames from the index or by walking them
+-----------------------------------------------------------------------------------*/
+
+int CSnapshotReader::Open(const char *filename)
+{
+	const TSnapshotHeader *header;
+	const TSnapshotFooter *footer;
+	size_t size;
+	int column, frame;
+
+	Close();
+
+	if (m_file.Open(filename) != RETURN_SUCCESS)
+		return RETURN_FAILURE;
+
+	size = m_file.GetSize();
+	header = (const TSnapshotHeader *)m_file.GetData();
+	if (size < sizeof(TSnapshotHeader) || header->magic != SNAPSHOT_MAGIC ||
+		header->version != SNAPSHOT_VERSION || header->capacity == 0 || header->capacity > (1u << 28) ||
+		!header->columnMask || (header->columnMask & ~SNAPSHOT_ALL_COLUMNS) || header->keyInterval == 0)
+	{
+		Close();
+		return RETURN_FAILURE;
+	}
+	m_pHeader = header;
+
+	m_iNumColumns = 0;
+	for (column = 0; column < PARTICLE_NUM_COLUMNS; column++)
+	{
+		if (header->columnMask & (1u << column))
+			m_iColumns[m_iNumColumns++] = column;
+	}
+
+	// A closed recording ends with the index
+	footer = (const TSnapshotFooter *)(m_file.GetData() + size - sizeof(TSnapshotFooter));
+	if (size >= sizeof(TSnapshotHeader) + sizeof(TSnapshotFooter) && footer->magic == SNAPSHOT_FOOTER_MAGIC &&
+		footer->indexOffset % sizeof(unsigned long long) == 0 && footer->indexOffset >= sizeof(TSnapshotHeader) &&
+		footer->indexOffset <= size - sizeof(TSnapshotFooter) &&
+		(size - sizeof(TSnapshotFooter) - footer->indexOffset) == footer->numFrames * sizeof(unsigned long long))
+	{
+		m_pOffsets = (const unsigned long long *)(m_file.GetData() + footer->indexOffset);
+		m_iNumFrames = footer->numFrames;
+
+		for (frame = 0; frame < m_iNumFrames; frame++)
+		{
+			if (!CheckFrame(m_pOffsets[frame], footer->indexOffset, frame))
+				break;
+		}
+		if (frame < m_iNumFrames)
+			m_iNumFrames = 0;
+	}
+
+	// Otherwise walk the frames as far as they go
+	if (!m_iNumFrames)
+	{
+		unsigned long long offset = sizeof(TSnapshotHeader);
+		int capacity = SNAPSHOT_INITIAL_FRAMES;
+
+		m_pScanned = new unsigned long long[capacity];
+		m_pOffsets = m_pScanned;
+
+		while (CheckFrame(offset, size, m_iNumFrames))
+		{
+			if (m_iNumFrames == capacity)
+			{
+				unsigned long long *offsets = new unsigned long long[2 * capacity];
+
+				memcpy(offsets, m_pScanned, sizeof(unsigned long long) * m_iNumFrames);
+				delete[] m_pScanned;
+				m_pScanned = offsets;
+				m_pOffsets = m_pScanned;
+				capacity *= 2;
+			}
+
+			m_pScanned[m_iNumFrames++] = offset;
+			offset += sizeof(TSnapshotFrame) + GetFrameHeader(m_iNumFrames - 1)->size;
+		}
+	}
+
+	if (!m_iNumFrames || m_pool.Init(header->capacity) != RETURN_SUCCESS)
+	{
+		Close();
+		return RETURN_FAILURE;
+	}
+
+	return RETURN_SUCCESS;
+}
+
+void CSnapshotReader::Close()
+{
+	m_file.Close();
+	m_pool.Shutdown();
+	delete[] m_pScanned;
+
+	m_pHeader = NULL;
+	m_pOffsets = NULL;
+	m_pScanned = NULL;
+	m_iNumFrames = 0;
+	m_iNumColumns = 0;
+	m_iCurrent = -1;
+}
+
+/*-----------------------------------------------------------------------------------
+Copy a key frame into the pool
+-----------------------------------------------------------------------------------*/
+
+int CSnapshotReader::DecodeKey(int frame)
+{
+	const TSnapshotFrame *header = GetFrameHeader(frame);
+	const unsigned char *data = (const unsigned char *)(header + 1);
+	size_t bytes = sizeof(unsigned int) * header->liveCount;
+	int c;
+
+	for (c = 0; c < m_iNumColumns; c++)
+		memcpy(m_pool.UIntColumn(m_iColumns[c]), data + c * AlignSize(bytes), bytes);
+
+	m_pool.SetLiveCount(header->liveCount);
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+XOR a delta frame into the frame before it in the pool.  Slots which come to
+life were zero when it was written.
+-----------------------------------------------------------------------------------*/
+
+int CSnapshotReader::DecodeDelta(int frame, CJobSystem *jobs)
+{
+	const TSnapshotFrame *header = GetFrameHeader(frame);
+	const unsigned int *sizes = (const unsigned int *)(header + 1);
+	const unsigned char *data = (const unsigned char *)(sizes + m_iNumColumns);
+	size_t available = header->size - sizeof(unsigned int) * m_iNumColumns;
+	size_t start[PARTICLE_NUM_COLUMNS], total = 0;
+	bool decoded[PARTICLE_NUM_COLUMNS];
+	int live = header->liveCount, prevLive = m_pool.GetLiveCount();
+	int c;
+
+	for (c = 0; c < m_iNumColumns; c++)
+	{
+		if (sizes[c] > available - total)
+			return RETURN_FAILURE;
+		start[c] = total;
+		total += sizes[c];
+	}
+
+	RunJobs(jobs, m_iNumColumns, 1, [&](int first, int num, int worker) {
+		for (int c = first; c < first + num; c++)
+		{
+			unsigned int *column = m_pool.UIntColumn(m_iColumns[c]);
+
+			if (live > prevLive)
+				memset(column + prevLive, 0, sizeof(unsigned int) * (live - prevLive));
+			decoded[c] = DecodeColumn(data + start[c], sizes[c], live, column);
+		}
+	});
+
+	m_pool.SetLiveCount(live);
+
+	for (c = 0; c < m_iNumColumns; c++)
+	{
+		if (!decoded[c])
+			return RETURN_FAILURE;
+	}
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Decode a frame, from the frame in the pool when it is on the way
+-----------------------------------------------------------------------------------*/
+
+int CSnapshotReader::Seek(int frame, CJobSystem *jobs)
+{
+	PROFILE_ZONE("seek");
+
+	int key;
+
+	if (!m_pHeader || frame < 0 || frame >= m_iNumFrames)
+		return RETURN_FAILURE;
+
+	if (frame == m_iCurrent)
+		return RETURN_SUCCESS;
+
+	// Only the deltas after the key frame are needed
+	key = GetFrameHeader(frame)->keyFrame;
+	if (m_iCurrent < key || m_iCurrent > frame)
+	{
+		DecodeKey(key);
+		m_iCurrent = key;
+	}
+
+	while (m_iCurrent < frame)
+	{
+		if (DecodeDelta(m_iCurrent + 1, jobs) != RETURN_SUCCESS)
+		{
+			m_pool.SetLiveCount(0);
+			m_iCurrent = -1;
+			return RETURN_FAILURE;
+		}
+		m_iCurrent++;
+	}
+
+	return RETURN_SUCCESS;
+}
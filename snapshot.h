@@ -0,0 +1,220 @@
+/*-----------------------------------------------------------------------------------
+File:			snapshot.h
+Author:			Steve Costa
+Description:	Recording of the particle pool to a file, a frame per simulation
+step, and playing it back without running the simulation.  A run
+can be saved when something goes wrong and stepped through later,
+or an expensive effect simulated once and replayed.
+
+The file keeps the pool as it is kept in memory, a column at a time:
+
+	TSnapshotHeader
+	TSnapshotFrame, columns		frame 0, always a key frame
+	TSnapshotFrame, columns		frame 1
+	...
+	frame offsets				once the recording is closed
+	TSnapshotFooter
+
+A key frame holds each recorded column as it is in the pool, every
+column starting on SNAPSHOT_ALIGN bytes.  The frames between keys
+hold each column XORed with the frame before it.  Most attributes
+do not change from one step to the next and the sign, exponent
+and top of the mantissa of those which do rarely change, so the
+bytes of the XOR are written out a byte plane at a time with the
+runs of zeros left out.  Frames are appended as they are made, and
+a recording which was never closed is read by walking its frames.
+
+Reading maps the file.  Seeking decodes at most the key frame
+before the frame wanted and the deltas after it, and stepping
+forward decodes one delta.  Each column is a job.  The file is in
+the byte order of the machine that wrote it.
+-----------------------------------------------------------------------------------*/
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <stdio.h>
+
+#include "simUtil.h"						// Common Macros
+#include "particlePool.h"					// Particle attribute columns
+#include "jobSystem.h"						// Worker threads
+#include "mappedFile.h"						// Read only file mapping
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define SNAPSHOT_MAGIC			0x50414E53		// "SNAP"
+#define SNAPSHOT_FRAME_MAGIC	0x4D415246		// "FRAM"
+#define SNAPSHOT_FOOTER_MAGIC	0x444E4553		// "SEND"
+#define SNAPSHOT_VERSION		1
+#define SNAPSHOT_ALIGN			16				// Frames and key frame columns start on this
+#define SNAPSHOT_KEY_INTERVAL	32				// Frames from one key frame to the next
+#define SNAPSHOT_MIN_ZEROS		4				// Shortest run of zeros left out of a delta
+#define SNAPSHOT_MAX_LITERALS	255				// Bytes copied after each run of zeros
+#define SNAPSHOT_INITIAL_FRAMES	256
+#define SNAPSHOT_ALL_COLUMNS	((1u << PARTICLE_NUM_COLUMNS) - 1)
+
+enum ESnapshotFrame
+{
+	SNAPSHOT_KEY,								// Columns as they are
+	SNAPSHOT_DELTA								// Columns XORed with the frame before
+};
+
+/*-----------------------------------------------------------------------------------
+File layout, see above.  Each frame is followed by size bytes of columns.  A
+delta frame's columns start with the number of bytes each one is encoded to.
+-----------------------------------------------------------------------------------*/
+
+struct TSnapshotHeader
+{
+	unsigned int	magic;
+	unsigned int	version;
+	unsigned int	capacity;				// Most live particles in a frame
+	unsigned int	columnMask;				// Bit per EParticleColumn recorded
+	unsigned int	keyInterval;
+	unsigned int	reserved[3];
+};
+
+struct TSnapshotFrame
+{
+	unsigned int	magic;
+	unsigned int	type;					// ESnapshotFrame
+	unsigned int	liveCount;
+	float			time;					// Simulated seconds
+	unsigned int	size;					// Bytes of columns that follow
+	unsigned int	keyFrame;				// Key frame this one is decoded from
+	unsigned int	reserved[2];
+};
+
+struct TSnapshotFooter
+{
+	unsigned long long	indexOffset;		// Offset of each frame, numFrames of them
+	unsigned int		numFrames;
+	unsigned int		magic;
+};
+
+/*-----------------------------------------------------------------------------------
+Snapshot writer class definition
+-----------------------------------------------------------------------------------*/
+
+class CSnapshotWriter
+{
+	// Attributes
+private:
+
+	FILE			*m_pFile;
+	int				m_iCapacity;
+	int				m_iColumns[PARTICLE_NUM_COLUMNS];	// Recorded columns in order
+	int				m_iNumColumns;
+	int				m_iKeyInterval;
+	bool			m_bFailed;
+
+	unsigned int	*m_puiPrevious;			// Last frame's columns, zero past its live count
+	int				m_iPrevLive;
+	unsigned char	*m_pucEncoded;			// A region per column for its delta
+	unsigned int	m_uiEncoded[PARTICLE_NUM_COLUMNS];	// Bytes used in each region
+	size_t			m_uiRegion;
+
+	unsigned long long	*m_pOffsets;		// Where each frame starts
+	int				m_iNumFrames, m_iFrameCapacity;
+	unsigned long long	m_ullOffset;		// Bytes written so far
+
+	// Methods
+private:
+
+	bool Write(const void *data, size_t bytes);
+
+public:
+
+	CSnapshotWriter();
+	~CSnapshotWriter();
+
+	//-----------------------------------------------------------
+	// Start a recording of pools of up to capacity particles,
+	// of the columns in columnMask, a bit per EParticleColumn.
+	// Every keyInterval'th frame is a key frame.
+	//-----------------------------------------------------------
+	int Open(const char *filename, int capacity, unsigned int columnMask = SNAPSHOT_ALL_COLUMNS,
+		int keyInterval = SNAPSHOT_KEY_INTERVAL);
+
+	// Write the index so the frames can be found without walking
+	// them, and close the file
+	int Close();
+
+	//-----------------------------------------------------------
+	// Append the live particles of a pool as the next frame.  The
+	// columns are encoded as jobs when a job system is given.
+	// Fails once anything could not be written.
+	//-----------------------------------------------------------
+	int Append(const CParticlePool& pool, float time, CJobSystem *jobs = NULL);
+
+	bool IsOpen() const { return m_pFile != NULL; }
+	int GetNumFrames() const { return m_iNumFrames; }
+	unsigned long long GetBytesWritten() const { return m_ullOffset; }
+};
+
+/*-----------------------------------------------------------------------------------
+Snapshot reader class definition
+-----------------------------------------------------------------------------------*/
+
+class CSnapshotReader
+{
+	// Attributes
+private:
+
+	CMappedFile		m_file;
+	const TSnapshotHeader		*m_pHeader;
+	const unsigned long long	*m_pOffsets;	// In the file, or m_pScanned
+	unsigned long long	*m_pScanned;		// Offsets found walking an unclosed recording
+	int				m_iNumFrames;
+	int				m_iColumns[PARTICLE_NUM_COLUMNS];
+	int				m_iNumColumns;
+
+	CParticlePool	m_pool;					// The frame decoded last
+	int				m_iCurrent;				// Which frame that is, -1 for none
+
+	// Methods
+private:
+
+	const TSnapshotFrame *GetFrameHeader(int frame) const {
+		return (const TSnapshotFrame *)(m_file.GetData() + m_pOffsets[frame]);
+	}
+
+	bool CheckFrame(unsigned long long offset, unsigned long long end, int frame) const;
+	int DecodeKey(int frame);
+	int DecodeDelta(int frame, CJobSystem *jobs);
+
+public:
+
+	CSnapshotReader();
+	~CSnapshotReader();
+
+	// Map a recording and check every frame header in it
+	int Open(const char *filename);
+	void Close();
+
+	//-----------------------------------------------------------
+	// Decode a frame into the pool.  Going forward from the frame
+	// in the pool only decodes the frames between, anything else
+	// starts from the key frame before.  The pool is left empty
+	// when the frame is damaged.
+	//-----------------------------------------------------------
+	int Seek(int frame, CJobSystem *jobs = NULL);
+	int Next(CJobSystem *jobs = NULL) { return Seek(m_iCurrent + 1, jobs); }
+
+	bool IsOpen() const { return m_pHeader != NULL; }
+	int GetNumFrames() const { return m_iNumFrames; }
+	int GetCurrentFrame() const { return m_iCurrent; }
+	float GetTime() const { return (m_iCurrent >= 0) ? GetFrameHeader(m_iCurrent)->time : 0.0f; }
+
+	// The particles of the frame decoded last, columns not
+	// recorded are zero
+	const CParticlePool& GetPool() const { return m_pool; }
+};
+
+#endif
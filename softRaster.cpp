@@ -0,0 +1,685 @@
+/*-----------------------------------------------------------------------------------
+File:			softRaster.cpp
+Author:			Steve Costa
+Description:	Sprite setup, tile binning and the scalar and SSE2 span blends of
+the software rasterizer.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <math.h>
+#include <string.h>
+
+#include "softRaster.h"						// Class header file
+#include "profiler.h"						// Frame zones
+#include "bitmap.h"							// Bitmap reading and writing
+#include "cpuFeatures.h"					// Instruction set detection
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/*-----------------------------------------------------------------------------------
+Span blends
+-----------------------------------------------------------------------------------*/
+
+static void BlendSpanScalar(float *red, float *green, float *blue, const float *lower,
+	const float *upper, float down, int count, const float *colour, bool alpha)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		float weight = colour[3] * (lower[i] + down * (upper[i] - lower[i]));
+
+		if (alpha)
+		{
+			red[i] += (colour[0] - red[i]) * weight;
+			green[i] += (colour[1] - green[i]) * weight;
+			blue[i] += (colour[2] - blue[i]) * weight;
+		}
+		else
+		{
+			red[i] += colour[0] * weight;
+			green[i] += colour[1] * weight;
+			blue[i] += colour[2] * weight;
+		}
+	}
+}
+
+#ifdef CPU_X86
+
+TARGET_SSE2 static void BlendSpanSSE2(float *red, float *green, float *blue, const float *lower,
+	const float *upper, float down, int count, const float *colour, bool alpha)
+{
+	__m128 r = _mm_set1_ps(colour[0]);
+	__m128 g = _mm_set1_ps(colour[1]);
+	__m128 b = _mm_set1_ps(colour[2]);
+	__m128 a = _mm_set1_ps(colour[3]);
+	__m128 d = _mm_set1_ps(down);
+	int last = count & ~3;
+	int i;
+
+	for (i = 0; i < last; i += 4)
+	{
+		__m128 l = _mm_loadu_ps(lower + i);
+		__m128 w = _mm_mul_ps(a, _mm_add_ps(l, _mm_mul_ps(d, _mm_sub_ps(_mm_loadu_ps(upper + i), l))));
+		__m128 dr = _mm_loadu_ps(red + i);
+		__m128 dg = _mm_loadu_ps(green + i);
+		__m128 db = _mm_loadu_ps(blue + i);
+
+		if (alpha)
+		{
+			dr = _mm_add_ps(dr, _mm_mul_ps(_mm_sub_ps(r, dr), w));
+			dg = _mm_add_ps(dg, _mm_mul_ps(_mm_sub_ps(g, dg), w));
+			db = _mm_add_ps(db, _mm_mul_ps(_mm_sub_ps(b, db), w));
+		}
+		else
+		{
+			dr = _mm_add_ps(dr, _mm_mul_ps(r, w));
+			dg = _mm_add_ps(dg, _mm_mul_ps(g, w));
+			db = _mm_add_ps(db, _mm_mul_ps(b, w));
+		}
+
+		_mm_storeu_ps(red + i, dr);
+		_mm_storeu_ps(green + i, dg);
+		_mm_storeu_ps(blue + i, db);
+	}
+
+	BlendSpanScalar(red + last, green + last, blue + last, lower + last, upper + last, down,
+		count - last, colour, alpha);
+}
+
+#endif
+
+/*-----------------------------------------------------------------------------------
+Colours are clamped and cut to 8 bits as the sprite batch does
+-----------------------------------------------------------------------------------*/
+
+static inline float ColourByte(float c)
+{
+	return float((unsigned char)(MAX(0.0f, MIN(1.0f, c)) * 255.0f)) * (1.0f / 255.0f);
+}
+
+/*-----------------------------------------------------------------------------------
+Set any initial values for class state variables.
+-----------------------------------------------------------------------------------*/
+
+CSoftRasterizer::CSoftRasterizer()
+{
+	unsigned char spot[SOFT_DEFAULT_TEXTURE * SOFT_DEFAULT_TEXTURE];
+	int x, y;
+
+	m_iWidth = m_iHeight = 0;
+	m_iTilesX = m_iTilesY = 0;
+	m_iBlendMode = BLEND_ADDITIVE;
+	m_fClear[0] = m_fClear[1] = m_fClear[2] = 0.0f;
+	m_projection.LoadIdentity();
+	m_modelView.LoadIdentity();
+	m_fXExtent = m_fYExtent = 0.5f;
+	m_pfTexture = NULL;
+	m_iNumLevels = 0;
+	m_pAtlas = NULL;
+	m_pfColour[0] = m_pfColour[1] = m_pfColour[2] = NULL;
+	m_pucPixels = NULL;
+	m_pSprites = NULL;
+	m_iSpriteCapacity = 0;
+	m_piBinCounts = NULL;
+	m_iCountCapacity = 0;
+	m_piTileStart = NULL;
+	m_piBins = NULL;
+	m_iBinCapacity = 0;
+
+	SetSimd(true);
+
+	// Soft round spot, brightest in the middle
+	for (y = 0; y < SOFT_DEFAULT_TEXTURE; y++)
+	{
+		for (x = 0; x < SOFT_DEFAULT_TEXTURE; x++)
+		{
+			float dx = (x + 0.5f) / (0.5f * SOFT_DEFAULT_TEXTURE) - 1.0f;
+			float dy = (y + 0.5f) / (0.5f * SOFT_DEFAULT_TEXTURE) - 1.0f;
+			float c = MAX(0.0f, 1.0f - sqrtf(dx * dx + dy * dy));
+
+			spot[y * SOFT_DEFAULT_TEXTURE + x] = (unsigned char)(c * c * 255.0f);
+		}
+	}
+	SetTexture(spot, SOFT_DEFAULT_TEXTURE, SOFT_DEFAULT_TEXTURE);
+}
+
+CSoftRasterizer::~CSoftRasterizer()
+{
+	Shutdown();
+	delete[] m_pfTexture;
+}
+
+/*-----------------------------------------------------------------------------------
+Allocate the framebuffer
+-----------------------------------------------------------------------------------*/
+
+int CSoftRasterizer::Init(int width, int height)
+{
+	int numPixels = width * height;
+
+	Shutdown();
+
+	if (width <= 0 || height <= 0)
+		return RETURN_FAILURE;
+
+	m_iWidth = width;
+	m_iHeight = height;
+	m_iTilesX = (width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+	m_iTilesY = (height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+
+	m_pfColour[0] = new float[3 * numPixels];
+	m_pfColour[1] = m_pfColour[0] + numPixels;
+	m_pfColour[2] = m_pfColour[1] + numPixels;
+	m_pucPixels = new unsigned char[4 * numPixels];
+	m_piTileStart = new int[m_iTilesX * m_iTilesY + 1];
+
+	memset(m_pucPixels, 0, 4 * numPixels);
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Free the framebuffer and the sprite arrays
+-----------------------------------------------------------------------------------*/
+
+void CSoftRasterizer::Shutdown()
+{
+	delete[] m_pfColour[0];
+	delete[] m_pucPixels;
+	delete[] m_pSprites;
+	delete[] m_piBinCounts;
+	delete[] m_piTileStart;
+	delete[] m_piBins;
+
+	m_pfColour[0] = m_pfColour[1] = m_pfColour[2] = NULL;
+	m_pucPixels = NULL;
+	m_pSprites = NULL;
+	m_piBinCounts = NULL;
+	m_piTileStart = NULL;
+	m_piBins = NULL;
+
+	m_iWidth = m_iHeight = 0;
+	m_iTilesX = m_iTilesY = 0;
+	m_iSpriteCapacity = 0;
+	m_iCountCapacity = 0;
+	m_iBinCapacity = 0;
+}
+
+/*-----------------------------------------------------------------------------------
+Choose the span blend
+-----------------------------------------------------------------------------------*/
+
+bool CSoftRasterizer::SetSimd(bool simd)
+{
+	m_pfnBlend = BlendSpanScalar;
+	m_bSimd = false;
+
+#ifdef CPU_X86
+	if (simd && (DetectCpuFeatures() & CPU_FEATURE_SSE2))
+		m_pfnBlend = BlendSpanSSE2;
+
+	m_bSimd = (m_pfnBlend != BlendSpanScalar);
+#endif
+
+	return m_bSimd;
+}
+
+/*-----------------------------------------------------------------------------------
+Textures
+-----------------------------------------------------------------------------------*/
+
+int CSoftRasterizer::SetTexture(const unsigned char *coverage, int width, int height)
+{
+	int i;
+
+	if (width <= 0 || height <= 0 || width > SOFT_MAX_TEXTURE || height > SOFT_MAX_TEXTURE)
+		return RETURN_FAILURE;
+
+	delete[] m_pfTexture;
+	m_pfTexture = new float[width * height];
+	m_pfLevels[0] = m_pfTexture;
+	m_iLevelWidth[0] = width;
+	m_iLevelHeight[0] = height;
+	m_iNumLevels = 1;
+	m_pAtlas = NULL;
+
+	for (i = 0; i < width * height; i++)
+		m_pfTexture[i] = coverage[i] * (1.0f / 255.0f);
+
+	return RETURN_SUCCESS;
+}
+
+int CSoftRasterizer::SetAtlas(const CSpriteAtlas *atlas)
+{
+	int level, i, total = 0;
+	float *texels;
+
+	if (!atlas || !atlas->GetNumLevels())
+		return RETURN_FAILURE;
+
+	for (level = 0; level < atlas->GetNumLevels(); level++)
+		total += atlas->GetLevelWidth(level) * atlas->GetLevelHeight(level);
+
+	delete[] m_pfTexture;
+	m_pfTexture = texels = new float[total];
+	m_iNumLevels = atlas->GetNumLevels();
+	m_pAtlas = atlas;
+
+	for (level = 0; level < m_iNumLevels; level++)
+	{
+		const unsigned char *coverage = atlas->GetLevel(level);
+		int size = atlas->GetLevelWidth(level) * atlas->GetLevelHeight(level);
+
+		m_pfLevels[level] = texels;
+		m_iLevelWidth[level] = atlas->GetLevelWidth(level);
+		m_iLevelHeight[level] = atlas->GetLevelHeight(level);
+
+		for (i = 0; i < size; i++)
+			texels[i] = coverage[i] * (1.0f / 255.0f);
+		texels += size;
+	}
+
+	return RETURN_SUCCESS;
+}
+
+// The bitmap rows go in from the top of the picture down, as
+// CPointSprite loads them, so the sprites look the same both ways
+int CSoftRasterizer::LoadTexture(const char *filename)
+{
+	unsigned char *coverage;
+	int width, height, status;
+
+	if (!(coverage = ReadBMPCoverage(filename, &width, &height)))
+		return RETURN_FAILURE;
+
+	status = SetTexture(coverage, width, height);
+	delete[] coverage;
+
+	return status;
+}
+
+/*-----------------------------------------------------------------------------------
+Colour the frame is cleared to
+-----------------------------------------------------------------------------------*/
+
+void CSoftRasterizer::SetClearColour(float r, float g, float b)
+{
+	m_fClear[0] = r;
+	m_fClear[1] = g;
+	m_fClear[2] = b;
+}
+
+/*-----------------------------------------------------------------------------------
+Project sprites [first, first + count) to their rectangles.  The corners are
+offset along the camera axes, so in view space the quad keeps the depth of its
+centre.  Sprites behind the camera or past the near or far planes are left
+empty.
+-----------------------------------------------------------------------------------*/
+
+void CSoftRasterizer::SetupSprites(const CParticlePool& pool, int first, int count, float blend,
+	const int *order)
+{
+	const float *colR = pool.Column(PARTICLE_COL_R);
+	const float *colG = pool.Column(PARTICLE_COL_G);
+	const float *colB = pool.Column(PARTICLE_COL_B);
+	const float *life = pool.Column(PARTICLE_LIFE);
+	const unsigned int *image = pool.UIntColumn(PARTICLE_SPRITE);
+	const float *p = m_projection.m;
+	float halfWidth = 0.5f * m_iWidth, halfHeight = 0.5f * m_iHeight;
+	float viewX[SOFT_VIEW_BATCH], viewY[SOFT_VIEW_BATCH], viewZ[SOFT_VIEW_BATCH];
+	int k;
+
+	for (k = first; k < first + count; k++)
+	{
+		TSoftSprite& sprite = m_pSprites[k];
+		int i = order ? order[k] : k;
+		int j = (k - first) % SOFT_VIEW_BATCH;
+
+		// The next batch of positions to view space together
+		if (j == 0)
+		{
+			int num = MIN(SOFT_VIEW_BATCH, first + count - k);
+
+			pool.BlendPositions(k, num, order, blend, viewX, viewY, viewZ);
+			TransformPoints(m_modelView, viewX, viewY, viewZ, viewX, viewY, viewZ, num);
+		}
+
+		TVector view(viewX[j], viewY[j], viewZ[j]);
+		float left = view.x - m_fXExtent, right = view.x + m_fXExtent;
+		float bottom = view.y - m_fYExtent, top = view.y + m_fYExtent;
+		float clipZ = p[2] * view.x + p[6] * view.y + p[10] * view.z + p[14];
+		float clipW = p[3] * view.x + p[7] * view.y + p[11] * view.z + p[15];
+		float x0, y0, x1, y1, w0, w1;
+
+		sprite.xs = sprite.xe = sprite.ys = sprite.ye = 0;
+
+		if (!(clipW > 0.0f) || !(clipZ >= -clipW && clipZ <= clipW))
+			continue;
+
+		// Bottom left and top right corners to the window
+		w0 = p[3] * left + p[7] * bottom + p[11] * view.z + p[15];
+		w1 = p[3] * right + p[7] * top + p[11] * view.z + p[15];
+		if (!(w0 > 0.0f) || !(w1 > 0.0f))
+			continue;
+
+		x0 = ((p[0] * left + p[4] * bottom + p[8] * view.z + p[12]) / w0 + 1.0f) * halfWidth;
+		y0 = ((p[1] * left + p[5] * bottom + p[9] * view.z + p[13]) / w0 + 1.0f) * halfHeight;
+		x1 = ((p[0] * right + p[4] * top + p[8] * view.z + p[12]) / w1 + 1.0f) * halfWidth;
+		y1 = ((p[1] * right + p[5] * top + p[9] * view.z + p[13]) / w1 + 1.0f) * halfHeight;
+
+		if (!(x1 > x0) || !(y1 > y0))
+			continue;
+
+		// Pixels whose centres are inside, clamped before the cast
+		// so sprites right in front of the camera do not overflow
+		sprite.xs = int(ceilf(MAX(x0 - 0.5f, 0.0f)));
+		sprite.xe = int(ceilf(MIN(x1 - 0.5f, float(m_iWidth))));
+		sprite.ys = int(ceilf(MAX(y0 - 0.5f, 0.0f)));
+		sprite.ye = int(ceilf(MIN(y1 - 0.5f, float(m_iHeight))));
+
+		if (sprite.xe <= sprite.xs || sprite.ye <= sprite.ys)
+		{
+			sprite.xs = sprite.xe = sprite.ys = sprite.ye = 0;
+			continue;
+		}
+
+		sprite.x0 = x0;
+		sprite.y0 = y0;
+		sprite.u0 = sprite.v0 = 0.0f;
+		sprite.du = float(m_iLevelWidth[0]);
+		sprite.dv = float(m_iLevelHeight[0]);
+		sprite.level = 0;
+
+		if (m_pAtlas)
+		{
+			const TAtlasFrame& frame = m_pAtlas->GetFrame(image[i], 1.0f - life[i]);
+
+			sprite.u0 = frame.u0 * m_iLevelWidth[0];
+			sprite.v0 = frame.v0 * m_iLevelHeight[0];
+			sprite.du *= frame.u1 - frame.u0;
+			sprite.dv *= frame.v1 - frame.v0;
+		}
+		sprite.du /= x1 - x0;
+		sprite.dv /= y1 - y0;
+
+		// Halve down the mip chain while a pixel covers two texels
+		while (sprite.level + 1 < m_iNumLevels && MAX(ABS(sprite.du), ABS(sprite.dv)) >= 2.0f)
+		{
+			sprite.u0 *= 0.5f;
+			sprite.v0 *= 0.5f;
+			sprite.du *= 0.5f;
+			sprite.dv *= 0.5f;
+			sprite.level++;
+		}
+		sprite.r = ColourByte(colR[i]);
+		sprite.g = ColourByte(colG[i]);
+		sprite.b = ColourByte(colB[i]);
+		sprite.a = ColourByte(life[i]);
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Count the sprites of a chunk in each tile, then once every chunk has been
+counted and the counts made into offsets, write them into the bins
+-----------------------------------------------------------------------------------*/
+
+void CSoftRasterizer::CountBins(int chunk, int count)
+{
+	int numTiles = m_iTilesX * m_iTilesY;
+	int *counts = m_piBinCounts + chunk * numTiles;
+	int last = MIN((chunk + 1) * SOFT_SPRITE_CHUNK, count);
+	int k, tx0, ty0, tx1, ty1, tx, ty;
+
+	memset(counts, 0, sizeof(int) * numTiles);
+
+	for (k = chunk * SOFT_SPRITE_CHUNK; k < last; k++)
+	{
+		if (m_pSprites[k].xe <= m_pSprites[k].xs)
+			continue;
+
+		GetTileRange(m_pSprites[k], &tx0, &ty0, &tx1, &ty1);
+		for (ty = ty0; ty < ty1; ty++)
+		{
+			for (tx = tx0; tx < tx1; tx++)
+				counts[ty * m_iTilesX + tx]++;
+		}
+	}
+}
+
+void CSoftRasterizer::FillBins(int chunk, int count)
+{
+	int *offsets = m_piBinCounts + chunk * m_iTilesX * m_iTilesY;
+	int last = MIN((chunk + 1) * SOFT_SPRITE_CHUNK, count);
+	int k, tx0, ty0, tx1, ty1, tx, ty;
+
+	for (k = chunk * SOFT_SPRITE_CHUNK; k < last; k++)
+	{
+		if (m_pSprites[k].xe <= m_pSprites[k].xs)
+			continue;
+
+		GetTileRange(m_pSprites[k], &tx0, &ty0, &tx1, &ty1);
+		for (ty = ty0; ty < ty1; ty++)
+		{
+			for (tx = tx0; tx < tx1; tx++)
+				m_piBins[offsets[ty * m_iTilesX + tx]++] = k;
+		}
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Filter a row of the texture across to the columns of a span
+-----------------------------------------------------------------------------------*/
+
+void CSoftRasterizer::FilterRow(int level, int row, int count, const int *left, const int *right,
+	const float *across, float *out) const
+{
+	const float *texels = m_pfLevels[level] + MAX(0, MIN(m_iLevelHeight[level] - 1, row)) * m_iLevelWidth[level];
+	int i;
+
+	for (i = 0; i < count; i++)
+		out[i] = texels[left[i]] + across[i] * (texels[right[i]] - texels[left[i]]);
+}
+
+/*-----------------------------------------------------------------------------------
+Draw the part of a sprite inside the pixels [tx0, tx1) by [ty0, ty1).  The
+texture is filtered bilinearly and clamped at its edges.  Where each column
+samples is worked out once for the sprite, and each texture row is filtered
+across once and kept while the pixel rows between it and the next are blended,
+so only the step down the texture is left to the span blend.
+-----------------------------------------------------------------------------------*/
+
+void CSoftRasterizer::DrawSprite(const TSoftSprite& sprite, int tx0, int ty0, int tx1, int ty1)
+{
+	int x0 = MAX(sprite.xs, tx0), x1 = MIN(sprite.xe, tx1);
+	int y0 = MAX(sprite.ys, ty0), y1 = MIN(sprite.ye, ty1);
+	int left[SOFT_TILE_SIZE], right[SOFT_TILE_SIZE];
+	float across[SOFT_TILE_SIZE];
+	float filtered[2][SOFT_TILE_SIZE];
+	int filteredRow[2] = { -1, -1 };		// Texture row held in each, -1 for none
+	float colour[4] = { sprite.r, sprite.g, sprite.b, sprite.a };
+	bool alpha = (m_iBlendMode == BLEND_ALPHA);
+	int level = sprite.level;
+	int texWidth = m_iLevelWidth[level], texHeight = m_iLevelHeight[level];
+	int n = x1 - x0;
+	int y, i;
+
+	if (n <= 0 || y1 <= y0)
+		return;
+
+	for (i = 0; i < n; i++)
+	{
+		float u = sprite.u0 + (x0 + i + 0.5f - sprite.x0) * sprite.du - 0.5f;
+		float base = floorf(u);
+		int texel = int(base);
+
+		across[i] = u - base;
+		left[i] = MAX(0, MIN(texWidth - 1, texel));
+		right[i] = MAX(0, MIN(texWidth - 1, texel + 1));
+	}
+
+	for (y = y0; y < y1; y++)
+	{
+		float v = sprite.v0 + (y + 0.5f - sprite.y0) * sprite.dv - 0.5f;
+		float base = floorf(v);
+		int lower = MAX(0, MIN(texHeight - 1, int(base)));
+		int upper = MAX(0, MIN(texHeight - 1, int(base) + 1));
+		int offset = y * m_iWidth + x0;
+		int l, u;
+
+		// Reuse the rows already filtered
+		l = (filteredRow[0] == lower) ? 0 : (filteredRow[1] == lower) ? 1 : -1;
+		if (l < 0)
+		{
+			l = (filteredRow[0] == upper) ? 1 : 0;
+			FilterRow(level, lower, n, left, right, across, filtered[l]);
+			filteredRow[l] = lower;
+		}
+		u = (filteredRow[l] == upper) ? l : 1 - l;
+		if (filteredRow[u] != upper)
+		{
+			FilterRow(level, upper, n, left, right, across, filtered[u]);
+			filteredRow[u] = upper;
+		}
+
+		m_pfnBlend(m_pfColour[0] + offset, m_pfColour[1] + offset, m_pfColour[2] + offset,
+			filtered[l], filtered[u], v - base, n, colour, alpha);
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Clear a tile, draw its bin in order and turn it into pixels
+-----------------------------------------------------------------------------------*/
+
+void CSoftRasterizer::DrawTile(int tile)
+{
+	int tx0 = (tile % m_iTilesX) * SOFT_TILE_SIZE;
+	int ty0 = (tile / m_iTilesX) * SOFT_TILE_SIZE;
+	int tx1 = MIN(tx0 + SOFT_TILE_SIZE, m_iWidth);
+	int ty1 = MIN(ty0 + SOFT_TILE_SIZE, m_iHeight);
+	int c, x, y, b;
+
+	for (c = 0; c < 3; c++)
+	{
+		for (y = ty0; y < ty1; y++)
+		{
+			float *row = m_pfColour[c] + y * m_iWidth;
+
+			for (x = tx0; x < tx1; x++)
+				row[x] = m_fClear[c];
+		}
+	}
+
+	for (b = m_piTileStart[tile]; b < m_piTileStart[tile + 1]; b++)
+		DrawSprite(m_pSprites[m_piBins[b]], tx0, ty0, tx1, ty1);
+
+	ResolveTile(tile);
+}
+
+void CSoftRasterizer::ResolveTile(int tile)
+{
+	int tx0 = (tile % m_iTilesX) * SOFT_TILE_SIZE;
+	int ty0 = (tile / m_iTilesX) * SOFT_TILE_SIZE;
+	int tx1 = MIN(tx0 + SOFT_TILE_SIZE, m_iWidth);
+	int ty1 = MIN(ty0 + SOFT_TILE_SIZE, m_iHeight);
+	int x, y, c;
+
+	for (y = ty0; y < ty1; y++)
+	{
+		unsigned char *out = m_pucPixels + 4 * (y * m_iWidth + tx0);
+
+		for (x = tx0; x < tx1; x++, out += 4)
+		{
+			for (c = 0; c < 3; c++)
+				out[c] = (unsigned char)(MAX(0.0f, MIN(1.0f, m_pfColour[c][y * m_iWidth + x])) * 255.0f + 0.5f);
+			out[3] = 255;
+		}
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Draw a frame
+-----------------------------------------------------------------------------------*/
+
+void CSoftRasterizer::Render(const CParticlePool& pool, int count, float blend, const int *order,
+	CJobSystem *jobs)
+{
+	PROFILE_ZONE("raster");
+
+	int numTiles = m_iTilesX * m_iTilesY;
+	int numChunks, chunk, tile, total;
+
+	if (!m_pucPixels)
+		return;
+
+	count = MAX(count, 0);
+	numChunks = (count + SOFT_SPRITE_CHUNK - 1) / SOFT_SPRITE_CHUNK;
+
+	if (count > m_iSpriteCapacity)
+	{
+		delete[] m_pSprites;
+		m_pSprites = new TSoftSprite[count];
+		m_iSpriteCapacity = count;
+	}
+	if (numChunks * numTiles > m_iCountCapacity)
+	{
+		delete[] m_piBinCounts;
+		m_piBinCounts = new int[numChunks * numTiles];
+		m_iCountCapacity = numChunks * numTiles;
+	}
+
+	RunJobs(jobs, numChunks, 1, [this, &pool, count, blend, order](int first, int num, int worker) {
+		for (int c = first; c < first + num; c++)
+		{
+			int start = c * SOFT_SPRITE_CHUNK;
+
+			SetupSprites(pool, start, MIN(SOFT_SPRITE_CHUNK, count - start), blend, order);
+			CountBins(c, count);
+		}
+	});
+
+	// Each chunk's part of each bin, tile by tile so a bin is one run
+	for (tile = 0, total = 0; tile < numTiles; tile++)
+	{
+		m_piTileStart[tile] = total;
+		for (chunk = 0; chunk < numChunks; chunk++)
+		{
+			int *counter = m_piBinCounts + chunk * numTiles + tile;
+			int n = *counter;
+			*counter = total;
+			total += n;
+		}
+	}
+	m_piTileStart[numTiles] = total;
+
+	if (total > m_iBinCapacity)
+	{
+		delete[] m_piBins;
+		m_piBins = new int[total];
+		m_iBinCapacity = total;
+	}
+
+	RunJobs(jobs, numChunks, 1, [this, count](int first, int num, int worker) {
+		for (int c = first; c < first + num; c++)
+			FillBins(c, count);
+	});
+
+	RunJobs(jobs, numTiles, 1, [this](int first, int num, int worker) {
+		for (int t = first; t < first + num; t++)
+			DrawTile(t);
+	});
+}
+
+/*-----------------------------------------------------------------------------------
+Write the frame as a bottom up 24 bit bitmap, the order the rows are kept in
+-----------------------------------------------------------------------------------*/
+
+int CSoftRasterizer::SaveBMP(const char *filename) const
+{
+	return WriteBMP(filename, m_pucPixels, m_iWidth, m_iHeight);
+}
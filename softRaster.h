@@ -0,0 +1,207 @@
+/*-----------------------------------------------------------------------------------
+File:			softRaster.h
+Author:			Steve Costa
+Description:	Draws particle sprites on the CPU into a framebuffer in memory, so
+frames can be made on machines with no GPU or window.  The sprites
+are the same camera facing textured quads as CPointSprite draws,
+with the same texture, colours and blending.
+
+A quad which faces the camera keeps its depth, so on the screen it
+is a rectangle with the texture mapped straight across it.  A frame
+is made in three passes on the job system:
+
+	1. every sprite is projected to its rectangle, a chunk of
+	   sprites per job
+	2. the sprites are binned into the screen tiles they touch,
+	   each chunk counting then writing its own part of each bin so
+	   a bin holds its sprites in the order they were given
+	3. the tiles are drawn in parallel, each sprite a row at a time
+	   with the texture filtered and the colour blended in four
+	   pixels at a time with SSE2
+
+The colour is kept as floats, one plane per channel, and turned
+into 8 bit pixels at the end of each tile.
+
+With a CSpriteAtlas each sprite is drawn with the frame of its
+particle's image, from the mip level nearest to one texel a pixel
+without going under it.
+-----------------------------------------------------------------------------------*/
+
+#ifndef SOFT_RASTER_H_
+#define SOFT_RASTER_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "simUtil.h"						// Common Macros
+#include "matrix.h"
+using namespace matrix;
+#include "particlePool.h"					// Particle attribute columns
+#include "jobSystem.h"						// Worker threads
+#include "spriteAtlas.h"					// Packed sprite images
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define SOFT_TILE_SIZE			64				// Pixels along each side of a tile
+#define SOFT_SPRITE_CHUNK		4096			// Sprites per setup and binning job
+#define SOFT_VIEW_BATCH			256				// Sprites taken to view space together
+#define SOFT_MAX_TEXTURE		256				// Widest texture, in texels
+#define SOFT_DEFAULT_TEXTURE	32				// Size of the built in texture
+
+// How the sprites are blended into the frame
+enum EBlendMode
+{
+	BLEND_ADDITIVE,								// Glows, drawn in any order
+	BLEND_ALPHA									// Smoke, drawn back to front
+};
+
+/*-----------------------------------------------------------------------------------
+Blends a span of count pixels into the colour planes.  lower and upper are the
+two texture rows either side of the span, already filtered across, and down is
+how far it is between them.  The weight of each pixel is the coverage this
+gives times the alpha in colour[3].  The colour times the weight is added on,
+or for alpha blending covers what is there by the weight.
+-----------------------------------------------------------------------------------*/
+
+typedef void (*PFNBLENDSPAN)(float *red, float *green, float *blue, const float *lower,
+	const float *upper, float down, int count, const float *colour, bool alpha);
+
+/*-----------------------------------------------------------------------------------
+A sprite projected to the screen.  The pixels from xs to xe and ys to ye, not
+including the ends, have their centres inside it.  y goes up the screen.
+-----------------------------------------------------------------------------------*/
+
+struct TSoftSprite
+{
+	int			xs, xe, ys, ye;
+	float		x0, y0;					// Bottom left corner
+	float		u0, v0;					// Texel at the bottom left corner
+	float		du, dv;					// Texels per pixel, negative when the rows go down
+	int			level;					// Mip level the texels are in
+	float		r, g, b, a;
+};
+
+/*-----------------------------------------------------------------------------------
+Software rasterizer class definition
+-----------------------------------------------------------------------------------*/
+
+class CSoftRasterizer
+{
+	// Attributes
+private:
+
+	int				m_iWidth, m_iHeight;
+	int				m_iTilesX, m_iTilesY;
+	bool			m_bSimd;
+	PFNBLENDSPAN	m_pfnBlend;
+	int				m_iBlendMode;			// One of EBlendMode
+	float			m_fClear[3];
+
+	TMatrix			m_projection;
+	TMatrix			m_modelView;
+	float			m_fXExtent, m_fYExtent;	// Half the width and height of a sprite
+
+	float			*m_pfTexture;			// Coverage of each texel, rows from v = 0
+	const float		*m_pfLevels[ATLAS_LEVELS];	// Each mip level in m_pfTexture
+	int				m_iLevelWidth[ATLAS_LEVELS], m_iLevelHeight[ATLAS_LEVELS];
+	int				m_iNumLevels;
+	const CSpriteAtlas *m_pAtlas;			// Not owned, NULL for a single image
+
+	float			*m_pfColour[3];			// Red, green and blue planes, rows from the bottom
+	unsigned char	*m_pucPixels;			// RGBA, rows from the bottom
+
+	TSoftSprite		*m_pSprites;
+	int				m_iSpriteCapacity;
+	int				*m_piBinCounts;			// Sprites of each chunk in each tile
+	int				m_iCountCapacity;
+	int				*m_piTileStart;			// First entry of each tile's bin
+	int				*m_piBins;				// Sprite indices, a run per tile
+	int				m_iBinCapacity;
+
+	// Methods
+private:
+
+	void SetupSprites(const CParticlePool& pool, int first, int count, float blend,
+		const int *order);
+	void CountBins(int chunk, int count);
+	void FillBins(int chunk, int count);
+	void DrawTile(int tile);
+	void DrawSprite(const TSoftSprite& sprite, int tx0, int ty0, int tx1, int ty1);
+	void FilterRow(int level, int row, int count, const int *left, const int *right, const float *across,
+		float *out) const;
+	void ResolveTile(int tile);
+
+	void GetTileRange(const TSoftSprite& sprite, int *tx0, int *ty0, int *tx1, int *ty1) const {
+		*tx0 = sprite.xs / SOFT_TILE_SIZE;
+		*ty0 = sprite.ys / SOFT_TILE_SIZE;
+		*tx1 = (sprite.xe - 1) / SOFT_TILE_SIZE + 1;
+		*ty1 = (sprite.ye - 1) / SOFT_TILE_SIZE + 1;
+	}
+
+public:
+
+	CSoftRasterizer();
+	~CSoftRasterizer();
+
+	// Allocate a framebuffer of width by height pixels
+	int Init(int width, int height);
+	void Shutdown();
+
+	// Blend the colour spans with SSE2 when the processor has it,
+	// returns whether it is in use
+	bool SetSimd(bool simd);
+	bool GetSimd() const { return m_bSimd; }
+
+	//-----------------------------------------------------------
+	// The texture is a coverage mask, the sprite colour is
+	// scaled by it.  A grey bitmap such as Particle.bmp is read
+	// by its brightest channel, as CPointSprite does.  Until one
+	// is loaded a soft round spot is used.
+	//-----------------------------------------------------------
+	int LoadTexture(const char *filename);
+	int SetTexture(const unsigned char *coverage, int width, int height);
+
+	// Draw each particle's sprite from an atlas, which must
+	// outlive the rasterizer or the next texture set.  Its
+	// levels are copied.
+	int SetAtlas(const CSpriteAtlas *atlas);
+
+	// Matrices as OpenGL keeps them, and the sprite size in world
+	// units
+	void SetCamera(const TMatrix& projection, const TMatrix& modelView) {
+		m_projection = projection;
+		m_modelView = modelView;
+	}
+	void SetSpriteSize(float width, float height) {
+		m_fXExtent = width * 0.5f;
+		m_fYExtent = height * 0.5f;
+	}
+
+	void SetBlendMode(int mode) { m_iBlendMode = mode; }
+	int GetBlendMode() const { return m_iBlendMode; }
+
+	void SetClearColour(float r, float g, float b);
+
+	//-----------------------------------------------------------
+	// Clear the frame and draw count sprites of a pool.  Sprite k
+	// is particle k, or particle order[k] when there is an order,
+	// and they are blended in that order.  Positions are blended
+	// between the last two simulation steps as the sprite batch
+	// does.  jobs may be NULL.
+	//-----------------------------------------------------------
+	void Render(const CParticlePool& pool, int count, float blend, const int *order,
+		CJobSystem *jobs);
+
+	// The last frame, RGBA with the bottom row first
+	const unsigned char *GetPixels() const { return m_pucPixels; }
+	int GetWidth() const { return m_iWidth; }
+	int GetHeight() const { return m_iHeight; }
+
+	// Write the last frame to a 24 bit bitmap
+	int SaveBMP(const char *filename) const;
+};
+
+#endif
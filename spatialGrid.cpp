@@ -0,0 +1,592 @@
+/*-----------------------------------------------------------------------------------
+File:			spatialGrid.cpp
+Author:			Steve Costa
+Description:	Building and searching the uniform particle grid.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <float.h>
+#include <algorithm>
+
+#include "spatialGrid.h"					// Class header file
+#include "profiler.h"						// Frame zones
+#include "cpuFeatures.h"					// Instruction set detection
+#include "random.h"							// Random number generators
+
+#ifdef CPU_X86
+#include <emmintrin.h>
+#endif
+
+/*-----------------------------------------------------------------------------------
+One row of cells searched by GatherNeighbours
+-----------------------------------------------------------------------------------*/
+
+struct TGatherRow
+{
+	float	x, y, z;					// Centre of the search
+	float	radiusSq;
+	float	invCellSize;
+	int		cy, cz;						// Cell of the row in y and z
+};
+
+/*-----------------------------------------------------------------------------------
+Gather the particles of the row from sorted slots [start, end) onto the end of
+out, n of which are filled already.  Every slot is written and the count only
+moves on for the ones that pass, so there are no branches to mispredict.  A
+particle within the radius is always in one of the cells of the row along x,
+so only its y and z cells need checking.
+-----------------------------------------------------------------------------------*/
+
+static int GatherRowScalar(const float *px, const float *py, const float *pz, int start, int end,
+	const TGatherRow& row, int *out, float *distSq, int n, int maxOut)
+{
+	int slot;
+
+	for (slot = start; slot < end && n < maxOut; slot++)
+	{
+		float dx = px[slot] - row.x;
+		float dy = py[slot] - row.y;
+		float dz = pz[slot] - row.z;
+		float d = dx * dx + dy * dy + dz * dz;
+		float sy = py[slot] * row.invCellSize;
+		float sz = pz[slot] * row.invCellSize;
+		int cy = int(sy) - (sy < float(int(sy)));
+		int cz = int(sz) - (sz < float(int(sz)));
+
+		out[n] = slot;
+		distSq[n] = d;
+		n += (d <= row.radiusSq) & (cy == row.cy) & (cz == row.cz);
+	}
+
+	return n;
+}
+
+#ifdef CPU_X86
+
+/*-----------------------------------------------------------------------------------
+As above for four slots at a time.  Reads up to three slots past end, which is
+why the position arrays are padded.  May write up to three entries past maxOut.
+-----------------------------------------------------------------------------------*/
+
+TARGET_SSE2 static __m128i CellSSE2(__m128 v, __m128 invCellSize)
+{
+	__m128 scaled = _mm_mul_ps(v, invCellSize);
+	__m128i truncated = _mm_cvttps_epi32(scaled);
+
+	// Take one off where truncating rounded up
+	return _mm_add_epi32(truncated, _mm_castps_si128(_mm_cmplt_ps(scaled, _mm_cvtepi32_ps(truncated))));
+}
+
+TARGET_SSE2 static int GatherRowSSE2(const float *px, const float *py, const float *pz, int start, int end,
+	const TGatherRow& row, int *out, float *distSq, int n, int maxOut)
+{
+	__m128 vx = _mm_set1_ps(row.x), vy = _mm_set1_ps(row.y), vz = _mm_set1_ps(row.z);
+	__m128 vradiusSq = _mm_set1_ps(row.radiusSq);
+	__m128 vinvCellSize = _mm_set1_ps(row.invCellSize);
+	__m128i vcy = _mm_set1_epi32(row.cy), vcz = _mm_set1_epi32(row.cz);
+	__m128i lane = _mm_set_epi32(3, 2, 1, 0);
+	float d[4];
+	int slot, k;
+
+	for (slot = start; slot < end && n < maxOut; slot += 4)
+	{
+		__m128 x = _mm_loadu_ps(px + slot);
+		__m128 y = _mm_loadu_ps(py + slot);
+		__m128 z = _mm_loadu_ps(pz + slot);
+		__m128 dx = _mm_sub_ps(x, vx);
+		__m128 dy = _mm_sub_ps(y, vy);
+		__m128 dz = _mm_sub_ps(z, vz);
+		__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		__m128i inRow = _mm_cmpeq_epi32(CellSSE2(y, vinvCellSize), vcy);
+		int mask;
+
+		inRow = _mm_and_si128(inRow, _mm_cmpeq_epi32(CellSSE2(z, vinvCellSize), vcz));
+		inRow = _mm_and_si128(inRow, _mm_cmplt_epi32(lane, _mm_set1_epi32(end - slot)));
+		mask = _mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(dist, vradiusSq), _mm_castsi128_ps(inRow)));
+
+		_mm_storeu_ps(d, dist);
+		for (k = 0; k < 4; k++)
+		{
+			out[n] = slot + k;
+			distSq[n] = d[k];
+			n += (mask >> k) & 1;
+		}
+	}
+
+	return MIN(n, maxOut);
+}
+
+#endif
+
+/*-----------------------------------------------------------------------------------
+Set any initial values for class state variables.
+-----------------------------------------------------------------------------------*/
+
+CSpatialGrid::CSpatialGrid()
+{
+	m_fCellSize = 1.0f;
+	m_fInvCellSize = 1.0f;
+#ifdef CPU_X86
+	m_bSimd = (DetectCpuFeatures() & CPU_FEATURE_SSE2) != 0;
+#else
+	m_bSimd = false;
+#endif
+	m_iCount = 0;
+	m_iCapacity = 0;
+	m_iNumBuckets = 0;
+	m_iBucketCapacity = 0;
+	m_puiBucket = NULL;
+	m_piStart = NULL;
+	m_piEnd = NULL;
+	m_piBlockSum = NULL;
+	m_piSorted = NULL;
+	m_pfX = m_pfY = m_pfZ = NULL;
+}
+
+CSpatialGrid::~CSpatialGrid()
+{
+	Shutdown();
+}
+
+/*-----------------------------------------------------------------------------------
+Free the arrays
+-----------------------------------------------------------------------------------*/
+
+void CSpatialGrid::Shutdown()
+{
+	delete[] m_puiBucket;
+	delete[] m_piStart;
+	delete[] m_piEnd;
+	delete[] m_piBlockSum;
+	delete[] m_piSorted;
+	delete[] m_pfX;
+	delete[] m_pfY;
+	delete[] m_pfZ;
+
+	m_puiBucket = NULL;
+	m_piStart = NULL;
+	m_piEnd = NULL;
+	m_piBlockSum = NULL;
+	m_piSorted = NULL;
+	m_pfX = m_pfY = m_pfZ = NULL;
+
+	m_iCount = 0;
+	m_iCapacity = 0;
+	m_iNumBuckets = 0;
+	m_iBucketCapacity = 0;
+}
+
+/*-----------------------------------------------------------------------------------
+Make room for count particles.  The arrays only ever grow, so once the grid has
+seen the largest particle count a build allocates nothing.
+-----------------------------------------------------------------------------------*/
+
+void CSpatialGrid::Grow(int count)
+{
+	int buckets = GRID_MIN_BUCKETS;
+
+	while (buckets < 2 * count)
+		buckets *= 2;
+
+	if (count > m_iCapacity)
+	{
+		delete[] m_puiBucket;
+		delete[] m_piSorted;
+		delete[] m_pfX;
+		delete[] m_pfY;
+		delete[] m_pfZ;
+
+		m_iCapacity = count;
+		m_puiBucket = new unsigned int[count];
+		m_piSorted = new int[count];
+		m_pfX = new float[count + GRID_GATHER_PAD];
+		m_pfY = new float[count + GRID_GATHER_PAD];
+		m_pfZ = new float[count + GRID_GATHER_PAD];
+
+		// The padding is read but never used
+		for (int i = count; i < count + GRID_GATHER_PAD; i++)
+			m_pfX[i] = m_pfY[i] = m_pfZ[i] = 0.0f;
+	}
+
+	if (buckets > m_iBucketCapacity)
+	{
+		delete[] m_piStart;
+		delete[] m_piEnd;
+		delete[] m_piBlockSum;
+
+		m_iBucketCapacity = buckets;
+		m_piStart = new int[buckets];
+		m_piEnd = new std::atomic<int>[buckets];
+		m_piBlockSum = new int[buckets / GRID_BUILD_GRAIN + 1];
+	}
+
+	// The table follows the particle count down as well as up
+	m_iNumBuckets = buckets;
+}
+
+/*-----------------------------------------------------------------------------------
+Counting sort of the particles by bucket:
+
+	1. clear the counts
+	2. find the bucket of each particle and count it
+	3. prefix sum the counts, each block of buckets on its own and then the
+	   block totals, to get the first slot of every bucket
+	4. scatter each particle to the next free slot of its bucket
+	5. put each bucket back in particle order, as the scatter fills them
+	   in whatever order the threads run, and copy the positions into
+	   sorted order
+-----------------------------------------------------------------------------------*/
+
+int CSpatialGrid::Build(const float *x, const float *y, const float *z, int count, CJobSystem *jobs)
+{
+	PROFILE_ZONE("grid");
+
+	int numBlocks, block, total;
+
+	Grow(count);
+	m_iCount = count;
+
+	RunJobs(jobs, m_iNumBuckets, GRID_BUILD_GRAIN, [this](int first, int n, int worker) {
+		for (int i = first; i < first + n; i++)
+			m_piEnd[i].store(0, std::memory_order_relaxed);
+	});
+
+	RunJobs(jobs, count, GRID_BUILD_GRAIN, [this, x, y, z](int first, int n, int worker) {
+		for (int i = first; i < first + n; i++)
+		{
+			unsigned int bucket = Bucket(Cell(x[i]), Cell(y[i]), Cell(z[i]));
+			m_puiBucket[i] = bucket;
+			m_piEnd[bucket].fetch_add(1, std::memory_order_relaxed);
+		}
+	});
+
+	// Each block sums its own buckets, then the block totals are
+	// summed and added back
+	numBlocks = (m_iNumBuckets + GRID_BUILD_GRAIN - 1) / GRID_BUILD_GRAIN;
+
+	RunJobs(jobs, m_iNumBuckets, GRID_BUILD_GRAIN, [this](int first, int n, int worker) {
+		for (int b = first; b < first + n; b += GRID_BUILD_GRAIN)
+		{
+			int last = MIN(b + GRID_BUILD_GRAIN, first + n);
+			int sum = 0;
+			for (int i = b; i < last; i++)
+			{
+				m_piStart[i] = sum;
+				sum += m_piEnd[i].load(std::memory_order_relaxed);
+			}
+			m_piBlockSum[b / GRID_BUILD_GRAIN] = sum;
+		}
+	});
+
+	for (block = 0, total = 0; block < numBlocks; block++)
+	{
+		int sum = m_piBlockSum[block];
+		m_piBlockSum[block] = total;
+		total += sum;
+	}
+
+	RunJobs(jobs, m_iNumBuckets, GRID_BUILD_GRAIN, [this](int first, int n, int worker) {
+		for (int i = first; i < first + n; i++)
+		{
+			m_piStart[i] += m_piBlockSum[i / GRID_BUILD_GRAIN];
+			m_piEnd[i].store(m_piStart[i], std::memory_order_relaxed);
+		}
+	});
+
+	RunJobs(jobs, count, GRID_BUILD_GRAIN, [this](int first, int n, int worker) {
+		for (int i = first; i < first + n; i++)
+			m_piSorted[m_piEnd[m_puiBucket[i]].fetch_add(1, std::memory_order_relaxed)] = i;
+	});
+
+	RunJobs(jobs, m_iNumBuckets, GRID_BUILD_GRAIN, [this, x, y, z](int first, int n, int worker) {
+		for (int i = first; i < first + n; i++)
+		{
+			int start = m_piStart[i];
+			int end = m_piEnd[i].load(std::memory_order_relaxed);
+			int slot, j;
+
+			// Insertion sort, buckets hold a handful of particles
+			// unless they are packed together
+			if (end - start <= GRID_SORT_BUCKET_MAX)
+			{
+				for (slot = start + 1; slot < end; slot++)
+				{
+					int particle = m_piSorted[slot];
+					for (j = slot; j > start && m_piSorted[j - 1] > particle; j--)
+						m_piSorted[j] = m_piSorted[j - 1];
+					m_piSorted[j] = particle;
+				}
+			}
+			else
+				std::sort(m_piSorted + start, m_piSorted + end);
+
+			for (slot = start; slot < end; slot++)
+			{
+				m_pfX[slot] = x[m_piSorted[slot]];
+				m_pfY[slot] = y[m_piSorted[slot]];
+				m_pfZ[slot] = z[m_piSorted[slot]];
+			}
+		}
+	});
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Particles within radius of a point
+-----------------------------------------------------------------------------------*/
+
+int CSpatialGrid::QueryRadius(float x, float y, float z, float radius, int *out, int maxOut) const
+{
+	int n = 0;
+
+	if (maxOut <= 0)
+		return 0;
+
+	ForEachNeighbour(x, y, z, radius, [this, &n, out, maxOut](int slot, float dx, float dy, float dz, float distSq) {
+		out[n++] = m_piSorted[slot];
+		return n < maxOut;
+	});
+
+	return n;
+}
+
+/*-----------------------------------------------------------------------------------
+Gather the particles within radius of a point one row of cells at a time
+-----------------------------------------------------------------------------------*/
+
+int CSpatialGrid::GatherNeighbours(float x, float y, float z, float radius, int *out, float *distSq, int maxOut) const
+{
+	TGatherRow row;
+	int n = 0;
+
+	if (!m_iCount || maxOut <= 0)
+		return 0;
+
+	row.x = x;	row.y = y;	row.z = z;
+	row.radiusSq = radius * radius;
+	row.invCellSize = m_fInvCellSize;
+	int cx0 = Cell(x - radius), cx1 = Cell(x + radius);
+	int cy0 = Cell(y - radius), cy1 = Cell(y + radius);
+	int cz0 = Cell(z - radius), cz1 = Cell(z + radius);
+
+	for (row.cz = cz0; row.cz <= cz1; row.cz++)
+	{
+		for (row.cy = cy0; row.cy <= cy1; row.cy++)
+		{
+			unsigned int first = Bucket(cx0, row.cy, row.cz);
+			unsigned int last = Bucket(cx1, row.cy, row.cz);
+			int cx;
+
+			// The whole row at once unless it wraps round the end
+			// of the table
+			for (cx = cx0; cx <= cx1 && n < maxOut; cx++)
+			{
+				unsigned int bucket = Bucket(cx, row.cy, row.cz);
+				int start = m_piStart[bucket];
+				int end = m_piEnd[bucket].load(std::memory_order_relaxed);
+
+				if (first <= last)
+				{
+					end = m_piEnd[last].load(std::memory_order_relaxed);
+					cx = cx1;
+				}
+
+#ifdef CPU_X86
+				if (m_bSimd)
+					n = GatherRowSSE2(m_pfX, m_pfY, m_pfZ, start, end, row, out, distSq, n, maxOut);
+				else
+#endif
+					n = GatherRowScalar(m_pfX, m_pfY, m_pfZ, start, end, row, out, distSq, n, maxOut);
+			}
+		}
+	}
+
+	return n;
+}
+
+/*-----------------------------------------------------------------------------------
+The k nearest particles.  Searches shells of cells outwards from the cell of
+the point, shell d being the cells d steps away.  Nothing in shell d or beyond
+can be closer than d - 1 cells, so the search stops once the k-th nearest so
+far is inside that.
+-----------------------------------------------------------------------------------*/
+
+int CSpatialGrid::QueryNearest(float x, float y, float z, int k, float maxRadius, int *out, float *distSq) const
+{
+	int px = Cell(x), py = Cell(y), pz = Cell(z);
+	int maxShell = int(ceilf(maxRadius * m_fInvCellSize));
+	float maxRadiusSq = maxRadius * maxRadius;
+	float kthSq = FLT_MAX;
+	int found = 0;
+	int shell, cx, cy, cz, slot, i;
+
+	if (!m_iCount || k <= 0)
+		return 0;
+
+	for (shell = 0; shell <= maxShell; shell++)
+	{
+		// The point can be anywhere in its cell, so shell d is at
+		// least d - 1 cells away
+		float reach = float(shell - 1) * m_fCellSize;
+
+		if (shell > 0 && found == k && kthSq <= reach * reach)
+			break;
+
+		for (cz = pz - shell; cz <= pz + shell; cz++)
+		{
+			for (cy = py - shell; cy <= py + shell; cy++)
+			{
+				for (cx = px - shell; cx <= px + shell; cx++)
+				{
+					// Only the surface of the shell, the inside was
+					// searched already
+					if (ABS(cx - px) != shell && ABS(cy - py) != shell && ABS(cz - pz) != shell)
+						continue;
+
+					unsigned int bucket = Bucket(cx, cy, cz);
+					int end = m_piEnd[bucket].load(std::memory_order_relaxed);
+
+					for (slot = m_piStart[bucket]; slot < end; slot++)
+					{
+						float dx = m_pfX[slot] - x;
+						float dy = m_pfY[slot] - y;
+						float dz = m_pfZ[slot] - z;
+						float d = dx * dx + dy * dy + dz * dz;
+
+						if (d > maxRadiusSq || (found == k && d >= kthSq))
+							continue;
+
+						if (Cell(m_pfX[slot]) != cx || Cell(m_pfY[slot]) != cy || Cell(m_pfZ[slot]) != cz)
+							continue;
+
+						// Insert in distance order, dropping the furthest
+						// when the list is full
+						i = (found < k) ? found++ : k - 1;
+						for (; i > 0 && d < distSq[i - 1]; i--)
+						{
+							out[i] = out[i - 1];
+							distSq[i] = distSq[i - 1];
+						}
+						out[i] = m_piSorted[slot];
+						distSq[i] = d;
+
+						if (found == k)
+							kthSq = distSq[k - 1];
+					}
+				}
+			}
+		}
+	}
+
+	return found;
+}
+
+/*-----------------------------------------------------------------------------------
+Check the grid on scattered particles with a dense clump in the middle, so some
+buckets are longer than GRID_SORT_BUCKET_MAX.  Every query is compared with
+testing every particle, and builds with and without the job system must sort
+the particles the same way.
+-----------------------------------------------------------------------------------*/
+
+int CheckSpatialGrid(CJobSystem *jobs)
+{
+	const int numParticles = 20011;
+	const int numClumped = 2000;
+	const int numQueries = 64;
+	const int k = 16;
+	const float radius = 1.5f;
+	const float nearestRadius = 6.0f;
+
+	CSpatialGrid grid, serial;
+	CRandomPcg32 rng;
+	float *x = new float[numParticles];
+	float *y = new float[numParticles];
+	float *z = new float[numParticles];
+	int *out = new int[numParticles + GRID_GATHER_PAD];
+	int *expected = new int[numParticles];
+	float *distSq = new float[numParticles + GRID_GATHER_PAD];
+	float nearestSq[k], expectedSq[k];
+	int status = RETURN_SUCCESS;
+	int i, q, n, count;
+
+	rng.Seed(3, 0);
+	for (i = 0; i < numParticles; i++)
+	{
+		float extent = (i < numClumped) ? 0.5f : 40.0f;
+
+		x[i] = (RandomToFloat(rng.NextUInt()) - 0.5f) * extent;
+		y[i] = (RandomToFloat(rng.NextUInt()) - 0.5f) * extent;
+		z[i] = (RandomToFloat(rng.NextUInt()) - 0.5f) * extent;
+	}
+
+	grid.SetCellSize(1.0f);
+	serial.SetCellSize(1.0f);
+	grid.Build(x, y, z, numParticles, jobs);
+	serial.Build(x, y, z, numParticles, NULL);
+
+	for (i = 0; i < numParticles; i++)
+	{
+		if (grid.GetParticle(i) != serial.GetParticle(i))
+			status = RETURN_FAILURE;
+	}
+
+	for (q = 0; q < numQueries && status == RETURN_SUCCESS; q++)
+	{
+		// Half the queries in the clump
+		int centre = (q & 1) ? int(RandomToRange(rng.NextUInt(), numClumped)) :
+			int(RandomToRange(rng.NextUInt(), numParticles));
+		float px = x[centre] + 0.1f, py = y[centre] - 0.2f, pz = z[centre] + 0.3f;
+
+		// Brute force, in particle order and then by distance
+		for (i = 0, count = 0; i < numParticles; i++)
+		{
+			float d = SQR(x[i] - px) + SQR(y[i] - py) + SQR(z[i] - pz);
+			if (d <= radius * radius)
+				expected[count++] = i;
+		}
+
+		n = grid.QueryRadius(px, py, pz, radius, out, numParticles);
+		std::sort(out, out + n);
+		if (n != count || !std::equal(out, out + n, expected))
+			status = RETURN_FAILURE;
+
+		n = grid.GatherNeighbours(px, py, pz, radius, out, distSq, numParticles);
+		for (i = 0; i < n; i++)
+			out[i] = grid.GetParticle(out[i]);
+		std::sort(out, out + n);
+		if (n != count || !std::equal(out, out + n, expected))
+			status = RETURN_FAILURE;
+
+		for (i = 0; i < numParticles; i++)
+			distSq[i] = SQR(x[i] - px) + SQR(y[i] - py) + SQR(z[i] - pz);
+		std::partial_sort(distSq, distSq + k, distSq + numParticles);
+		for (i = 0, count = 0; i < k; i++)
+		{
+			if (distSq[i] <= nearestRadius * nearestRadius)
+				expectedSq[count++] = distSq[i];
+		}
+
+		// Ties can come back in either order, so compare distances
+		n = grid.QueryNearest(px, py, pz, k, nearestRadius, out, nearestSq);
+		if (n != count || !std::equal(nearestSq, nearestSq + n, expectedSq))
+			status = RETURN_FAILURE;
+		for (i = 0; i < n; i++)
+		{
+			if (SQR(x[out[i]] - px) + SQR(y[out[i]] - py) + SQR(z[out[i]] - pz) != nearestSq[i])
+				status = RETURN_FAILURE;
+		}
+	}
+
+	delete[] x;
+	delete[] y;
+	delete[] z;
+	delete[] out;
+	delete[] expected;
+	delete[] distSq;
+
+	return status;
+}
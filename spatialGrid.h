@@ -0,0 +1,208 @@
+/*-----------------------------------------------------------------------------------
+File:			spatialGrid.h
+Author:			Steve Costa
+Description:	Uniform grid over particle positions for neighbour queries.
+Space is cut into cubic cells which are hashed into a table
+twice the size of the particle count, so the grid needs no
+bounds.  Each build counting sorts the particles by cell: count
+the particles in every bucket, prefix sum the counts into bucket
+starts and scatter the particles into place.  All three passes
+run on the job system and nothing is allocated once the grid
+has grown to the particle count.  Each bucket is then put back
+in particle order, so a build gives the same order whatever the
+number of threads.
+
+Queries visit the cells a search touches and check the actual
+distance.  Different cells can share a bucket, so a particle is
+only reported from the cell it really lies in.
+-----------------------------------------------------------------------------------*/
+
+#ifndef SPATIAL_GRID_H_
+#define SPATIAL_GRID_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <math.h>
+#include <atomic>
+
+#include "simUtil.h"						// Common Macros
+#include "jobSystem.h"						// Worker threads
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define GRID_MIN_BUCKETS		1024
+#define GRID_BUILD_GRAIN		4096			// Particles or buckets per job
+#define GRID_SORT_BUCKET_MAX	64				// Longer buckets are sorted with std::sort
+#define GRID_GATHER_PAD			4				// Extra room GatherNeighbours may write past maxOut
+
+/*-----------------------------------------------------------------------------------
+Spatial grid class definition
+-----------------------------------------------------------------------------------*/
+
+class CSpatialGrid
+{
+	// Attributes
+private:
+
+	float				m_fCellSize;
+	float				m_fInvCellSize;
+	bool				m_bSimd;				// Gather with SSE2
+
+	int					m_iCount;				// Particles in the last build
+	int					m_iCapacity;			// Particles the arrays hold
+	int					m_iNumBuckets;			// Power of two
+	int					m_iBucketCapacity;
+
+	unsigned int		*m_puiBucket;			// Bucket of each particle
+	int					*m_piStart;				// First sorted slot of each bucket
+	std::atomic<int>	*m_piEnd;				// Counts, then scatter cursors, then ends
+	int					*m_piBlockSum;			// Prefix sum of each block of buckets
+	int					*m_piSorted;			// Particle index of each sorted slot
+	float				*m_pfX, *m_pfY, *m_pfZ;	// Positions in sorted order, padded to whole SSE registers
+
+	// Methods
+private:
+
+	void Grow(int count);
+
+public:
+
+	CSpatialGrid();
+	~CSpatialGrid();
+
+	void Shutdown();
+
+	// Cells should be at least as big as the usual query radius
+	void SetCellSize(float size) { m_fCellSize = size; m_fInvCellSize = 1.0f / size; }
+	float GetCellSize() const { return m_fCellSize; }
+
+	// Sort count particles into the grid.  jobs may be NULL.
+	int Build(const float *x, const float *y, const float *z, int count, CJobSystem *jobs);
+
+	int GetCount() const { return m_iCount; }
+
+	//-----------------------------------------------------------
+	// Cell coordinate along one axis and the bucket of a cell.
+	// Cells next to each other along x go in buckets next to
+	// each other, so a row of cells is one run of sorted slots.
+	//-----------------------------------------------------------
+	int Cell(float v) const {
+		float scaled = v * m_fInvCellSize;
+		int truncated = (int)scaled;
+
+		// Round down, floorf is a library call without SSE4.1
+		return truncated - (scaled < float(truncated));
+	}
+
+	unsigned int Bucket(int cx, int cy, int cz) const {
+		return (((unsigned int)cy * 19349663u ^ (unsigned int)cz * 83492791u) + (unsigned int)cx)
+			& (unsigned int)(m_iNumBuckets - 1);
+	}
+
+	//-----------------------------------------------------------
+	// Particles in sorted order, particles close in space are
+	// close in this order
+	//-----------------------------------------------------------
+	int GetParticle(int slot) const { return m_piSorted[slot]; }
+	float GetX(int slot) const { return m_pfX[slot]; }
+	float GetY(int slot) const { return m_pfY[slot]; }
+	float GetZ(int slot) const { return m_pfZ[slot]; }
+
+	//-----------------------------------------------------------
+	// Call func(slot, dx, dy, dz, distSq) for every particle
+	// within radius of (x, y, z), where slot is its sorted slot
+	// and d is the particle minus the point.  Returns the number
+	// of particles visited, it stops early once func returns
+	// false.  Searching for the particles in slot order is much
+	// kinder to the cache than in particle order.
+	//-----------------------------------------------------------
+	template <class F>
+	int ForEachNeighbour(float x, float y, float z, float radius, const F& func) const {
+		int cx0 = Cell(x - radius), cx1 = Cell(x + radius);
+		int cy0 = Cell(y - radius), cy1 = Cell(y + radius);
+		int cz0 = Cell(z - radius), cz1 = Cell(z + radius);
+		float radiusSq = radius * radius;
+		int cx, cy, cz, slot, found = 0;
+
+		if (!m_iCount)
+			return 0;
+
+		for (cz = cz0; cz <= cz1; cz++)
+		{
+			for (cy = cy0; cy <= cy1; cy++)
+			{
+				unsigned int first = Bucket(cx0, cy, cz);
+				unsigned int last = Bucket(cx1, cy, cz);
+
+				for (cx = cx0; cx <= cx1; cx++)
+				{
+					unsigned int bucket = Bucket(cx, cy, cz);
+					int start = m_piStart[bucket];
+					int end = m_piEnd[bucket].load(std::memory_order_relaxed);
+
+					// Take the whole row at once unless it wraps
+					// round the end of the table
+					if (first <= last)
+					{
+						end = m_piEnd[last].load(std::memory_order_relaxed);
+						cx = cx1;
+					}
+
+					for (slot = start; slot < end; slot++)
+					{
+						float dx = m_pfX[slot] - x;
+						float dy = m_pfY[slot] - y;
+						float dz = m_pfZ[slot] - z;
+						float distSq = dx * dx + dy * dy + dz * dz;
+
+						if (distSq > radiusSq)
+							continue;
+
+						// Another cell which shares the bucket
+						int px = Cell(m_pfX[slot]);
+						if (px < cx0 || px > cx1 || Cell(m_pfY[slot]) != cy || Cell(m_pfZ[slot]) != cz)
+							continue;
+
+						found++;
+						if (!func(slot, dx, dy, dz, distSq))
+							return found;
+					}
+				}
+			}
+		}
+
+		return found;
+	}
+
+	//-----------------------------------------------------------
+	// As ForEachNeighbour, but writes the sorted slots and
+	// squared distances of at most maxOut particles to out and
+	// distSq and returns the number found.  Four particles are
+	// tested at a time without branches, which is much faster
+	// when most of the particles looked at are too far away.
+	// Both arrays need GRID_GATHER_PAD more entries than maxOut.
+	//-----------------------------------------------------------
+	int GatherNeighbours(float x, float y, float z, float radius, int *out, float *distSq, int maxOut) const;
+
+	// Particles within radius of a point, at most maxOut of them.
+	// Returns the number written to out.
+	int QueryRadius(float x, float y, float z, float radius, int *out, int maxOut) const;
+
+	// The k particles nearest a point no further than maxRadius,
+	// nearest first, with their squared distances.  Returns the
+	// number found.
+	int QueryNearest(float x, float y, float z, int k, float maxRadius, int *out, float *distSq) const;
+};
+
+/*-----------------------------------------------------------------------------------
+Check the queries against testing every particle, and that a build on the job
+system gives the same order as one without.  jobs may be NULL.
+-----------------------------------------------------------------------------------*/
+
+int CheckSpatialGrid(CJobSystem *jobs);
+
+#endif
@@ -0,0 +1,486 @@
+/*-----------------------------------------------------------------------------------
+File:			sphFluid.cpp
+Author:			Steve Costa
+Description:	Density and force passes of the SPH fluid, with scalar and SSE2
+kernel sums.  The kernels are those of Mueller, Charypar and
+Gross, "Particle-Based Fluid Simulation for Interactive
+Applications" (2003), and the cohesion term is that of Becker and
+Teschner, "Weakly compressible SPH for free surface flows" (2007).
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "sphFluid.h"						// Class header file
+#include "profiler.h"						// Frame zones
+#include "cpuFeatures.h"					// Instruction set detection
+
+#ifdef CPU_X86
+#include <emmintrin.h>
+#endif
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define SPH_MIN_DIST_SQ			1.0e-12f		// Closer than this has no direction
+#define SPH_BATCH_FLOATS		(SPH_MAX_NEIGHBOURS + GRID_GATHER_PAD)	// Room to pad to a whole SSE register
+
+/*-----------------------------------------------------------------------------------
+The neighbours of one particle gathered for the force pass.  The list is
+padded to a multiple of four with neighbours on the edge of the radius, where
+every kernel is zero.
+-----------------------------------------------------------------------------------*/
+
+struct TSphNeighbours
+{
+	float	dx[SPH_BATCH_FLOATS], dy[SPH_BATCH_FLOATS], dz[SPH_BATCH_FLOATS];	// Neighbour minus particle
+	float	distSq[SPH_BATCH_FLOATS];
+	float	density[SPH_BATCH_FLOATS];
+	float	pressure[SPH_BATCH_FLOATS];
+	float	velX[SPH_BATCH_FLOATS], velY[SPH_BATCH_FLOATS], velZ[SPH_BATCH_FLOATS];
+};
+
+/*-----------------------------------------------------------------------------------
+Unscaled sums of the force pass, the caller applies the constants
+-----------------------------------------------------------------------------------*/
+
+struct TSphForceSums
+{
+	float	pressure[3];			// Sum of (pi + pj) / 2 rhoj (h - r)^2 d / r
+	float	viscosity[3];			// Sum of (vj - vi) / rhoj (h - r)
+	float	cohesion[3];			// Sum of d (h^2 - r^2)^3
+};
+
+/*-----------------------------------------------------------------------------------
+Scalar kernel sums
+-----------------------------------------------------------------------------------*/
+
+// Sum of (h^2 - r^2)^3
+static float SumDensityScalar(const float *distSq, int count, float radiusSq)
+{
+	float sum = 0.0f;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		float w = MAX(radiusSq - distSq[i], 0.0f);
+		sum += w * w * w;
+	}
+
+	return sum;
+}
+
+static void SumForcesScalar(const TSphNeighbours& nb, int count, float radius, float pressure,
+	float velX, float velY, float velZ, TSphForceSums& out)
+{
+	float radiusSq = radius * radius;
+	int i;
+
+	memset(&out, 0, sizeof(out));
+
+	for (i = 0; i < count; i++)
+	{
+		float r = sqrtf(MAX(nb.distSq[i], SPH_MIN_DIST_SQ));
+		float q = MAX(radius - r, 0.0f);
+		float w = MAX(radiusSq - nb.distSq[i], 0.0f);
+		float invDensity = 1.0f / nb.density[i];
+		float p = (pressure + nb.pressure[i]) * 0.5f * invDensity * q * q / r;
+		float v = q * invDensity;
+		float c = w * w * w;
+
+		out.pressure[0] += p * nb.dx[i];
+		out.pressure[1] += p * nb.dy[i];
+		out.pressure[2] += p * nb.dz[i];
+		out.viscosity[0] += v * (nb.velX[i] - velX);
+		out.viscosity[1] += v * (nb.velY[i] - velY);
+		out.viscosity[2] += v * (nb.velZ[i] - velZ);
+		out.cohesion[0] += c * nb.dx[i];
+		out.cohesion[1] += c * nb.dy[i];
+		out.cohesion[2] += c * nb.dz[i];
+	}
+}
+
+#ifdef CPU_X86
+
+/*-----------------------------------------------------------------------------------
+SSE2 kernel sums, four neighbours at a time.  count must be a multiple of four.
+-----------------------------------------------------------------------------------*/
+
+TARGET_SSE2 static float HorizontalSum(__m128 v)
+{
+	__m128 shuffled = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(v, shuffled);
+
+	shuffled = _mm_movehl_ps(shuffled, sums);
+	return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+}
+
+TARGET_SSE2 static float SumDensitySSE2(const float *distSq, int count, float radiusSq)
+{
+	__m128 vradiusSq = _mm_set1_ps(radiusSq);
+	__m128 vzero = _mm_setzero_ps();
+	__m128 sum = _mm_setzero_ps();
+	int i;
+
+	for (i = 0; i < count; i += 4)
+	{
+		__m128 w = _mm_max_ps(_mm_sub_ps(vradiusSq, _mm_loadu_ps(distSq + i)), vzero);
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_mul_ps(w, w), w));
+	}
+
+	return HorizontalSum(sum);
+}
+
+TARGET_SSE2 static void SumForcesSSE2(const TSphNeighbours& nb, int count, float radius, float pressure,
+	float velX, float velY, float velZ, TSphForceSums& out)
+{
+	__m128 vradius = _mm_set1_ps(radius);
+	__m128 vradiusSq = _mm_set1_ps(radius * radius);
+	__m128 vminDistSq = _mm_set1_ps(SPH_MIN_DIST_SQ);
+	__m128 vpressure = _mm_set1_ps(pressure);
+	__m128 vhalf = _mm_set1_ps(0.5f);
+	__m128 vone = _mm_set1_ps(1.0f);
+	__m128 vzero = _mm_setzero_ps();
+	__m128 vvelX = _mm_set1_ps(velX), vvelY = _mm_set1_ps(velY), vvelZ = _mm_set1_ps(velZ);
+	__m128 px = vzero, py = vzero, pz = vzero;
+	__m128 vx = vzero, vy = vzero, vz = vzero;
+	__m128 cx = vzero, cy = vzero, cz = vzero;
+	int i;
+
+	for (i = 0; i < count; i += 4)
+	{
+		__m128 distSq = _mm_loadu_ps(nb.distSq + i);
+		__m128 r = _mm_sqrt_ps(_mm_max_ps(distSq, vminDistSq));
+		__m128 q = _mm_max_ps(_mm_sub_ps(vradius, r), vzero);
+		__m128 w = _mm_max_ps(_mm_sub_ps(vradiusSq, distSq), vzero);
+		__m128 invDensity = _mm_div_ps(vone, _mm_loadu_ps(nb.density + i));
+		__m128 p = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(vpressure, _mm_loadu_ps(nb.pressure + i)), vhalf), invDensity);
+		__m128 v = _mm_mul_ps(q, invDensity);
+		__m128 c = _mm_mul_ps(_mm_mul_ps(w, w), w);
+		__m128 dx = _mm_loadu_ps(nb.dx + i);
+		__m128 dy = _mm_loadu_ps(nb.dy + i);
+		__m128 dz = _mm_loadu_ps(nb.dz + i);
+
+		p = _mm_div_ps(_mm_mul_ps(p, _mm_mul_ps(q, q)), r);
+
+		px = _mm_add_ps(px, _mm_mul_ps(p, dx));
+		py = _mm_add_ps(py, _mm_mul_ps(p, dy));
+		pz = _mm_add_ps(pz, _mm_mul_ps(p, dz));
+		vx = _mm_add_ps(vx, _mm_mul_ps(v, _mm_sub_ps(_mm_loadu_ps(nb.velX + i), vvelX)));
+		vy = _mm_add_ps(vy, _mm_mul_ps(v, _mm_sub_ps(_mm_loadu_ps(nb.velY + i), vvelY)));
+		vz = _mm_add_ps(vz, _mm_mul_ps(v, _mm_sub_ps(_mm_loadu_ps(nb.velZ + i), vvelZ)));
+		cx = _mm_add_ps(cx, _mm_mul_ps(c, dx));
+		cy = _mm_add_ps(cy, _mm_mul_ps(c, dy));
+		cz = _mm_add_ps(cz, _mm_mul_ps(c, dz));
+	}
+
+	out.pressure[0] = HorizontalSum(px);
+	out.pressure[1] = HorizontalSum(py);
+	out.pressure[2] = HorizontalSum(pz);
+	out.viscosity[0] = HorizontalSum(vx);
+	out.viscosity[1] = HorizontalSum(vy);
+	out.viscosity[2] = HorizontalSum(vz);
+	out.cohesion[0] = HorizontalSum(cx);
+	out.cohesion[1] = HorizontalSum(cy);
+	out.cohesion[2] = HorizontalSum(cz);
+}
+
+#endif
+
+/*-----------------------------------------------------------------------------------
+Set any initial values for class state variables.
+-----------------------------------------------------------------------------------*/
+
+CSphFluid::CSphFluid()
+{
+	m_iCount = 0;
+	m_iCapacity = 0;
+	m_piParticles = NULL;
+	m_pfX = m_pfY = m_pfZ = NULL;
+	memset(m_pfColumns, 0, sizeof(m_pfColumns));
+	m_piNeighbours = NULL;
+	m_piNumNeighbours = NULL;
+
+	SetParams(TSphParams());
+	SetSimd(true);
+}
+
+CSphFluid::~CSphFluid()
+{
+	Shutdown();
+}
+
+/*-----------------------------------------------------------------------------------
+Free the scratch arrays
+-----------------------------------------------------------------------------------*/
+
+void CSphFluid::Shutdown()
+{
+	delete[] m_piParticles;
+	delete[] m_pfX;
+	delete[] m_pfY;
+	delete[] m_pfZ;
+	delete[] m_pfColumns[0];
+	delete[] m_piNeighbours;
+	delete[] m_piNumNeighbours;
+
+	m_piParticles = NULL;
+	m_pfX = m_pfY = m_pfZ = NULL;
+	memset(m_pfColumns, 0, sizeof(m_pfColumns));
+	m_piNeighbours = NULL;
+	m_piNumNeighbours = NULL;
+
+	m_iCount = 0;
+	m_iCapacity = 0;
+	m_grid.Shutdown();
+}
+
+/*-----------------------------------------------------------------------------------
+Make room for count fluid particles.  As with the grid the arrays only grow.
+-----------------------------------------------------------------------------------*/
+
+void CSphFluid::Grow(int count)
+{
+	int i;
+
+	if (count <= m_iCapacity)
+		return;
+
+	Shutdown();
+
+	m_iCapacity = count;
+	m_piParticles = new int[count];
+	m_pfX = new float[count];
+	m_pfY = new float[count];
+	m_pfZ = new float[count];
+	m_pfColumns[0] = new float[SPH_NUM_COLUMNS * count];
+	for (i = 1; i < SPH_NUM_COLUMNS; i++)
+		m_pfColumns[i] = m_pfColumns[0] + i * count;
+	m_piNeighbours = new int[SPH_MAX_NEIGHBOURS * count];
+	m_piNumNeighbours = new int[count];
+}
+
+/*-----------------------------------------------------------------------------------
+Change the fluid and work out the kernel constants for it.  The grid cells are
+one smoothing radius across so every neighbour is in the next cell.
+-----------------------------------------------------------------------------------*/
+
+void CSphFluid::SetParams(const TSphParams& params)
+{
+	float h = params.radius;
+	float h3 = h * h * h;
+	float poly6 = 315.0f / (64.0f * PI * h3 * h3 * h3);
+	float spiky = 45.0f / (PI * h3 * h3);
+
+	m_params = params;
+	m_fRadiusSq = h * h;
+	m_fPoly6 = params.particleMass * poly6;
+	m_fSpiky = params.particleMass * spiky;
+	m_fViscosity = params.viscosity * params.particleMass * spiky;
+	m_fCohesion = params.surfaceTension * poly6;
+
+	m_grid.SetCellSize(h);
+}
+
+/*-----------------------------------------------------------------------------------
+Choose between the SSE2 and scalar kernel sums
+-----------------------------------------------------------------------------------*/
+
+bool CSphFluid::SetSimd(bool simd)
+{
+#ifdef CPU_X86
+	m_bSimd = simd && (DetectCpuFeatures() & CPU_FEATURE_SSE2);
+#else
+	m_bSimd = false;
+#endif
+
+	return m_bSimd;
+}
+
+/*-----------------------------------------------------------------------------------
+Density and pressure of the particles in grid slots [first, first + count).
+The neighbours found are kept for the force pass, which saves searching the
+grid twice.  A particle is its own neighbour, it adds to its own density and
+drops out of the forces as it is no distance away.
+-----------------------------------------------------------------------------------*/
+
+void CSphFluid::Density(int first, int count)
+{
+	int neighbours[SPH_BATCH_FLOATS];
+	float distSq[SPH_BATCH_FLOATS];
+	int i, k;
+
+	for (i = first; i < first + count; i++)
+	{
+		int n = m_grid.GatherNeighbours(m_grid.GetX(i), m_grid.GetY(i), m_grid.GetZ(i), m_params.radius,
+			neighbours, distSq, SPH_MAX_NEIGHBOURS);
+		float sum;
+
+		memcpy(m_piNeighbours + i * SPH_MAX_NEIGHBOURS, neighbours, sizeof(int) * n);
+		m_piNumNeighbours[i] = n;
+
+#ifdef CPU_X86
+		if (m_bSimd)
+		{
+			for (k = n; k & 3; k++)
+				distSq[k] = m_fRadiusSq;
+			sum = SumDensitySSE2(distSq, k, m_fRadiusSq);
+		}
+		else
+#endif
+			sum = SumDensityScalar(distSq, n, m_fRadiusSq);
+
+		float density = m_fPoly6 * sum;
+
+		// No pressure below the rest density, pulling particles
+		// together is left to the surface tension
+		m_pfColumns[SPH_DENSITY][i] = density;
+		m_pfColumns[SPH_PRESSURE][i] = MAX(m_params.stiffness * (density - m_params.restDensity), 0.0f);
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Acceleration of the particles in grid slots [first, first + count), written
+to the acceleration columns of the pool.  Every particle only writes its own
+acceleration so jobs never share a particle.
+-----------------------------------------------------------------------------------*/
+
+void CSphFluid::Forces(CParticlePool& pool, int first, int count)
+{
+	TSphNeighbours nb;
+	TSphForceSums sums;
+	float *accelX = pool.Column(PARTICLE_ACCEL_X);
+	float *accelY = pool.Column(PARTICLE_ACCEL_Y);
+	float *accelZ = pool.Column(PARTICLE_ACCEL_Z);
+	const float *velX = m_pfColumns[SPH_VEL_X];
+	const float *velY = m_pfColumns[SPH_VEL_Y];
+	const float *velZ = m_pfColumns[SPH_VEL_Z];
+	const float *density = m_pfColumns[SPH_DENSITY];
+	const float *pressure = m_pfColumns[SPH_PRESSURE];
+	TVector inset(0.5f * m_params.radius, 0.5f * m_params.radius, 0.5f * m_params.radius);
+	TVector lo = m_params.boundsMin + inset;
+	TVector hi = m_params.boundsMax - inset;
+	int i, k;
+
+	for (i = first; i < first + count; i++)
+	{
+		const int *neighbours = m_piNeighbours + i * SPH_MAX_NEIGHBOURS;
+		int n = m_piNumNeighbours[i];
+		float x = m_grid.GetX(i), y = m_grid.GetY(i), z = m_grid.GetZ(i);
+
+		for (k = 0; k < n; k++)
+		{
+			int j = neighbours[k];
+			float dx = m_grid.GetX(j) - x;
+			float dy = m_grid.GetY(j) - y;
+			float dz = m_grid.GetZ(j) - z;
+
+			nb.dx[k] = dx;	nb.dy[k] = dy;	nb.dz[k] = dz;
+			nb.distSq[k] = dx * dx + dy * dy + dz * dz;
+			nb.density[k] = density[j];
+			nb.pressure[k] = pressure[j];
+			nb.velX[k] = velX[j];	nb.velY[k] = velY[j];	nb.velZ[k] = velZ[j];
+		}
+
+#ifdef CPU_X86
+		if (m_bSimd)
+		{
+			for (; k & 3; k++)
+			{
+				nb.dx[k] = nb.dy[k] = nb.dz[k] = 0.0f;
+				nb.distSq[k] = m_fRadiusSq;
+				nb.density[k] = 1.0f;
+				nb.pressure[k] = 0.0f;
+				nb.velX[k] = velX[i];	nb.velY[k] = velY[i];	nb.velZ[k] = velZ[i];
+			}
+			SumForcesSSE2(nb, k, m_params.radius, pressure[i], velX[i], velY[i], velZ[i], sums);
+		}
+		else
+#endif
+			SumForcesScalar(nb, n, m_params.radius, pressure[i], velX[i], velY[i], velZ[i], sums);
+
+		// Pressure pushes away from the neighbours, viscosity drags
+		// towards their velocity and cohesion pulls towards them
+		float invDensity = 1.0f / density[i];
+		float ax = (m_fViscosity * sums.viscosity[0] - m_fSpiky * sums.pressure[0]) * invDensity + m_fCohesion * sums.cohesion[0];
+		float ay = (m_fViscosity * sums.viscosity[1] - m_fSpiky * sums.pressure[1]) * invDensity + m_fCohesion * sums.cohesion[1];
+		float az = (m_fViscosity * sums.viscosity[2] - m_fSpiky * sums.pressure[2]) * invDensity + m_fCohesion * sums.cohesion[2];
+
+		// Walls start pushing half a radius inside the box, where
+		// a particle would start to feel fluid beyond the wall
+		if (m_params.wallStiffness > 0.0f)
+		{
+			ax += m_params.wallStiffness * (MAX(lo.x - x, 0.0f) - MAX(x - hi.x, 0.0f));
+			ay += m_params.wallStiffness * (MAX(lo.y - y, 0.0f) - MAX(y - hi.y, 0.0f));
+			az += m_params.wallStiffness * (MAX(lo.z - z, 0.0f) - MAX(z - hi.z, 0.0f));
+		}
+
+		int particle = m_piParticles[m_grid.GetParticle(i)];
+		accelX[particle] = ax;
+		accelY[particle] = ay;
+		accelZ[particle] = az;
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+One step of the fluid:
+
+	1. collect the live particles of fluid emitters, in pool order
+	2. sort them into the grid
+	3. gather their velocities into grid order
+	4. density pass
+	5. force pass
+
+Everything but the collection runs on the job system.
+-----------------------------------------------------------------------------------*/
+
+void CSphFluid::Step(CParticlePool& pool, const bool *fluidEmitters, int numEmitters, CJobSystem *jobs)
+{
+	PROFILE_ZONE("fluid");
+
+	const float *prevX = pool.Column(PARTICLE_PREV_X);
+	const float *prevY = pool.Column(PARTICLE_PREV_Y);
+	const float *prevZ = pool.Column(PARTICLE_PREV_Z);
+	const unsigned int *emitter = pool.UIntColumn(PARTICLE_EMITTER);
+	int live = pool.GetLiveCount();
+	int i;
+
+	Grow(live);
+	m_iCount = 0;
+
+	for (i = 0; i < live; i++)
+	{
+		if (emitter[i] < (unsigned int)numEmitters && fluidEmitters[emitter[i]])
+		{
+			m_piParticles[m_iCount] = i;
+			m_pfX[m_iCount] = prevX[i];
+			m_pfY[m_iCount] = prevY[i];
+			m_pfZ[m_iCount] = prevZ[i];
+			m_iCount++;
+		}
+	}
+
+	if (!m_iCount)
+		return;
+
+	m_grid.Build(m_pfX, m_pfY, m_pfZ, m_iCount, jobs);
+
+	RunJobs(jobs, m_iCount, SPH_GRAIN, [this, &pool](int first, int count, int worker) {
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float *vel = pool.Column(PARTICLE_VEL_X + axis);
+			for (int slot = first; slot < first + count; slot++)
+				m_pfColumns[SPH_VEL_X + axis][slot] = vel[m_piParticles[m_grid.GetParticle(slot)]];
+		}
+	});
+
+	RunJobs(jobs, m_iCount, SPH_GRAIN, [this](int first, int count, int worker) {
+		Density(first, count);
+	});
+
+	RunJobs(jobs, m_iCount, SPH_GRAIN, [this, &pool](int first, int count, int worker) {
+		Forces(pool, first, count);
+	});
+}
@@ -0,0 +1,153 @@
+/*-----------------------------------------------------------------------------------
+File:			sphFluid.h
+Author:			Steve Costa
+Description:	Smoothed particle hydrodynamics for the particles of fluid
+emitters.  Every step the fluid particles are sorted into a
+uniform grid one smoothing radius across and two passes run over
+them in grid order on the job system:
+
+	density		sum the poly6 kernel over the neighbours within the
+				smoothing radius and turn the density into a pressure
+				with a linear equation of state.  The neighbours are
+				kept for the next pass.
+	forces		pressure from the spiky kernel gradient, viscosity
+				from the viscosity kernel Laplacian and surface tension
+				as a cohesion force, plus walls which push particles
+				back into a container box
+
+The result is written to the acceleration columns of the pool,
+so the normal update integrates fluid particles like any others.
+Kernel sums are evaluated over four neighbours at a time with SSE2
+where the processor has it.
+-----------------------------------------------------------------------------------*/
+
+#ifndef SPH_FLUID_H_
+#define SPH_FLUID_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "simUtil.h"						// Common Macros
+#include "vector.h"
+using namespace vec;
+#include "particlePool.h"					// Particle attribute columns
+#include "jobSystem.h"						// Worker threads
+#include "spatialGrid.h"					// Neighbour queries
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define SPH_MAX_NEIGHBOURS		64				// Neighbours summed over per particle
+#define SPH_GRAIN				1024			// Fluid particles per job
+
+/*-----------------------------------------------------------------------------------
+Scratch columns, indexed by grid slot
+-----------------------------------------------------------------------------------*/
+
+enum ESphColumn
+{
+	SPH_VEL_X, SPH_VEL_Y, SPH_VEL_Z,							// Velocity in grid order
+	SPH_DENSITY,
+	SPH_PRESSURE,
+
+	SPH_NUM_COLUMNS
+};
+
+/*-----------------------------------------------------------------------------------
+Fluid properties.  The defaults are a runny liquid which stays stable at the
+50 Hz step of the game loop, stiffer fluids need a smaller step.
+-----------------------------------------------------------------------------------*/
+
+struct TSphParams
+{
+	float		radius;					// Smoothing radius, about twice the particle spacing
+	float		restDensity;			// Density the pressure pushes towards
+	float		particleMass;
+	float		stiffness;				// Pressure per unit of density over the rest density
+	float		viscosity;
+	float		surfaceTension;			// Strength of the cohesion between neighbours
+
+	TVector		boundsMin, boundsMax;	// Container box
+	float		wallStiffness;			// Acceleration per unit outside the box, 0 for no walls
+
+	TSphParams() {
+		radius = 0.5f;
+		restDensity = 1000.0f;
+		particleMass = 1000.0f * 0.25f * 0.25f * 0.25f;
+		stiffness = 200.0f;
+		viscosity = 20.0f;
+		surfaceTension = 0.2f;
+		boundsMin = TVector(-5.0f, 0.0f, -5.0f);
+		boundsMax = TVector(5.0f, 1000.0f, 5.0f);
+		wallStiffness = 1000.0f;
+	}
+};
+
+/*-----------------------------------------------------------------------------------
+SPH fluid class definition
+-----------------------------------------------------------------------------------*/
+
+class CSphFluid
+{
+	// Attributes
+private:
+
+	TSphParams		m_params;
+	bool			m_bSimd;					// Evaluate the kernels with SSE2
+
+	// Kernel constants for the current radius and mass
+	float			m_fRadiusSq;
+	float			m_fPoly6;					// Mass times the poly6 normalisation
+	float			m_fSpiky;					// Mass times the spiky gradient normalisation
+	float			m_fViscosity;				// Viscosity times mass times the Laplacian normalisation
+	float			m_fCohesion;				// Surface tension times the poly6 normalisation
+
+	CSpatialGrid	m_grid;
+	int				m_iCount;					// Fluid particles this step
+	int				m_iCapacity;
+	int				*m_piParticles;				// Pool index of each fluid particle
+	float			*m_pfX, *m_pfY, *m_pfZ;		// Their positions, for the grid build
+	float			*m_pfColumns[SPH_NUM_COLUMNS];
+	int				*m_piNeighbours;			// SPH_MAX_NEIGHBOURS slots per slot
+	int				*m_piNumNeighbours;
+
+	// Methods
+private:
+
+	void Grow(int count);
+	void Density(int first, int count);						// Density pass over grid slots
+	void Forces(CParticlePool& pool, int first, int count);	// Force pass over grid slots
+
+public:
+
+	CSphFluid();
+	~CSphFluid();
+
+	void Shutdown();
+
+	void SetParams(const TSphParams& params);
+	const TSphParams& GetParams() const { return m_params; }
+
+	// Use SSE2 for the kernel sums when the processor has it,
+	// returns whether it is in use
+	bool SetSimd(bool simd);
+	bool GetSimd() const { return m_bSimd; }
+
+	//-----------------------------------------------------------
+	// Work out the acceleration of every live particle whose
+	// emitter is flagged in fluidEmitters, from the positions in
+	// the previous position columns.  Call after BeginStep and the
+	// spawns and before UpdateParticles.  jobs may be NULL.
+	//-----------------------------------------------------------
+	void Step(CParticlePool& pool, const bool *fluidEmitters, int numEmitters, CJobSystem *jobs);
+
+	int GetCount() const { return m_iCount; }
+	const CSpatialGrid& GetGrid() const { return m_grid; }
+
+	// Density of the particle in a grid slot after a step
+	float GetDensity(int slot) const { return m_pfColumns[SPH_DENSITY][slot]; }
+};
+
+#endif
@@ -0,0 +1,568 @@
+/*-----------------------------------------------------------------------------------
+File:			spriteAtlas.cpp
+Author:			Steve Costa
+Description:	Atlas packing, mip making and the cooked atlas file.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#define _CRT_SECURE_NO_WARNINGS				// fopen as it is everywhere else
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "spriteAtlas.h"					// Class header file
+#include "bitmap.h"							// Bitmap reading
+
+/*-----------------------------------------------------------------------------------
+Cells are whole multiples of the padding with at least the padding all round,
+and the parts of the cooked file start on 16 bytes
+-----------------------------------------------------------------------------------*/
+
+static inline int CellSize(int size)
+{
+	return (size + ATLAS_PADDING - 1) / ATLAS_PADDING * ATLAS_PADDING + 2 * ATLAS_PADDING;
+}
+
+static inline unsigned int AlignOffset(unsigned int offset)
+{
+	return (offset + 15) & ~15u;
+}
+
+/*-----------------------------------------------------------------------------------
+Size and modification time of the bitmap an atlas is cooked from
+-----------------------------------------------------------------------------------*/
+
+static bool GetSource(const char *filename, int framesX, int framesY, TAtlasSource *source)
+{
+#ifdef _WIN32
+	struct _stat64 info;
+
+	if (_stat64(filename, &info) != 0)
+		return false;
+#else
+	struct stat info;
+
+	if (stat(filename, &info) != 0)
+		return false;
+#endif
+
+	memset(source, 0, sizeof(*source));
+	source->size = (unsigned long long)info.st_size;
+	source->time = (unsigned long long)info.st_mtime;
+	source->framesX = framesX;
+	source->framesY = framesY;
+
+	return true;
+}
+
+/*-----------------------------------------------------------------------------------
+Set any initial values for class state variables.
+-----------------------------------------------------------------------------------*/
+
+CSpriteAtlas::CSpriteAtlas()
+{
+	int i;
+
+	m_iWidth = m_iHeight = 0;
+	m_iNumLevels = 0;
+	for (i = 0; i < ATLAS_LEVELS; i++)
+		m_pucLevels[i] = NULL;
+	m_pSprites = NULL;
+	m_pFrames = NULL;
+	m_iNumSprites = 0;
+	m_iNumFrames = 0;
+
+	m_pucTexels = NULL;
+	m_pBuiltSprites = NULL;
+	m_pBuiltFrames = NULL;
+	memset(&m_source, 0, sizeof(m_source));
+
+	m_pAdded = NULL;
+	m_iNumAdded = m_iAddedCapacity = 0;
+	m_ppucImages = NULL;
+	m_piImageWidth = m_piImageHeight = NULL;
+	m_iNumImages = m_iImageCapacity = 0;
+}
+
+CSpriteAtlas::~CSpriteAtlas()
+{
+	Shutdown();
+}
+
+/*-----------------------------------------------------------------------------------
+Stop using the current atlas, whether built or mapped
+-----------------------------------------------------------------------------------*/
+
+void CSpriteAtlas::Release()
+{
+	int i;
+
+	m_file.Close();
+	delete[] m_pucTexels;
+	delete[] m_pBuiltSprites;
+	delete[] m_pBuiltFrames;
+	m_pucTexels = NULL;
+	m_pBuiltSprites = NULL;
+	m_pBuiltFrames = NULL;
+	memset(&m_source, 0, sizeof(m_source));
+
+	m_iWidth = m_iHeight = 0;
+	m_iNumLevels = 0;
+	for (i = 0; i < ATLAS_LEVELS; i++)
+		m_pucLevels[i] = NULL;
+	m_pSprites = NULL;
+	m_pFrames = NULL;
+	m_iNumSprites = 0;
+	m_iNumFrames = 0;
+}
+
+/*-----------------------------------------------------------------------------------
+Free the atlas and every image added
+-----------------------------------------------------------------------------------*/
+
+void CSpriteAtlas::Shutdown()
+{
+	int i;
+
+	Release();
+
+	for (i = 0; i < m_iNumImages; i++)
+		delete[] m_ppucImages[i];
+	delete[] m_ppucImages;
+	delete[] m_piImageWidth;
+	delete[] m_piImageHeight;
+	delete[] m_pAdded;
+
+	m_ppucImages = NULL;
+	m_piImageWidth = m_piImageHeight = NULL;
+	m_pAdded = NULL;
+	m_iNumImages = m_iImageCapacity = 0;
+	m_iNumAdded = m_iAddedCapacity = 0;
+}
+
+/*-----------------------------------------------------------------------------------
+Cut an image into its frames and keep them until the next build
+-----------------------------------------------------------------------------------*/
+
+int CSpriteAtlas::AddSprite(const unsigned char *coverage, int width, int height, int framesX, int framesY)
+{
+	int frameWidth, frameHeight, numFrames, fx, fy, y;
+
+	if (!coverage || framesX <= 0 || framesY <= 0 || width < framesX || height < framesY)
+		return -1;
+
+	frameWidth = width / framesX;
+	frameHeight = height / framesY;
+	numFrames = framesX * framesY;
+
+	if (CellSize(frameWidth) > ATLAS_MAX_SIZE || CellSize(frameHeight) > ATLAS_MAX_SIZE)
+		return -1;
+
+	if (m_iNumAdded == m_iAddedCapacity)
+	{
+		TAtlasSprite *sprites = new TAtlasSprite[MAX(2 * m_iAddedCapacity, ATLAS_INITIAL_FRAMES)];
+
+		if (m_iNumAdded)
+			memcpy(sprites, m_pAdded, sizeof(TAtlasSprite) * m_iNumAdded);
+		delete[] m_pAdded;
+		m_pAdded = sprites;
+		m_iAddedCapacity = MAX(2 * m_iAddedCapacity, ATLAS_INITIAL_FRAMES);
+	}
+
+	if (m_iNumImages + numFrames > m_iImageCapacity)
+	{
+		int capacity = MAX(MAX(2 * m_iImageCapacity, m_iNumImages + numFrames), ATLAS_INITIAL_FRAMES);
+		unsigned char **images = new unsigned char *[capacity];
+		int *widths = new int[capacity];
+		int *heights = new int[capacity];
+
+		if (m_iNumImages)
+		{
+			memcpy(images, m_ppucImages, sizeof(unsigned char *) * m_iNumImages);
+			memcpy(widths, m_piImageWidth, sizeof(int) * m_iNumImages);
+			memcpy(heights, m_piImageHeight, sizeof(int) * m_iNumImages);
+		}
+		delete[] m_ppucImages;
+		delete[] m_piImageWidth;
+		delete[] m_piImageHeight;
+		m_ppucImages = images;
+		m_piImageWidth = widths;
+		m_piImageHeight = heights;
+		m_iImageCapacity = capacity;
+	}
+
+	m_pAdded[m_iNumAdded].firstFrame = m_iNumImages;
+	m_pAdded[m_iNumAdded].numFrames = numFrames;
+
+	for (fy = 0; fy < framesY; fy++)
+	{
+		for (fx = 0; fx < framesX; fx++)
+		{
+			unsigned char *image = new unsigned char[frameWidth * frameHeight];
+
+			for (y = 0; y < frameHeight; y++)
+			{
+				memcpy(image + y * frameWidth,
+					coverage + (fy * frameHeight + y) * width + fx * frameWidth, frameWidth);
+			}
+
+			m_ppucImages[m_iNumImages] = image;
+			m_piImageWidth[m_iNumImages] = frameWidth;
+			m_piImageHeight[m_iNumImages] = frameHeight;
+			m_iNumImages++;
+		}
+	}
+
+	return m_iNumAdded++;
+}
+
+int CSpriteAtlas::AddBMP(const char *filename, int framesX, int framesY)
+{
+	unsigned char *coverage;
+	int width, height, sprite;
+
+	if (!(coverage = ReadBMPCoverage(filename, &width, &height)))
+		return -1;
+
+	sprite = AddSprite(coverage, width, height, framesX, framesY);
+	delete[] coverage;
+
+	return sprite;
+}
+
+/*-----------------------------------------------------------------------------------
+Place the cells on shelves, tallest first, returns false when they do not fit
+-----------------------------------------------------------------------------------*/
+
+bool CSpriteAtlas::Pack(int width, int height, const int *order, int *x, int *y) const
+{
+	int shelfX = 0, shelfY = 0, shelfHeight = 0;
+	int k;
+
+	for (k = 0; k < m_iNumImages; k++)
+	{
+		int i = order[k];
+		int cellWidth = CellSize(m_piImageWidth[i]);
+		int cellHeight = CellSize(m_piImageHeight[i]);
+
+		if (shelfX + cellWidth > width)
+		{
+			shelfY += shelfHeight;
+			shelfX = 0;
+			shelfHeight = 0;
+		}
+		if (cellWidth > width || shelfY + cellHeight > height)
+			return false;
+
+		x[i] = shelfX;
+		y[i] = shelfY;
+		shelfX += cellWidth;
+		shelfHeight = MAX(shelfHeight, cellHeight);
+	}
+
+	return true;
+}
+
+/*-----------------------------------------------------------------------------------
+Pack the frames into the smallest power of two atlas they fit, copy them in
+with their gutters and box filter the mip chain
+-----------------------------------------------------------------------------------*/
+
+int CSpriteAtlas::Build()
+{
+	int *order, *x, *y;
+	int width = 1, height = 1, area = 0;
+	int i, k, level, tx, ty;
+	size_t offset;
+	bool packed;
+
+	if (!m_iNumImages)
+		return RETURN_FAILURE;
+
+	order = new int[m_iNumImages];
+	x = new int[m_iNumImages];
+	y = new int[m_iNumImages];
+
+	// Tallest cells first so the shelves waste little
+	for (k = 0; k < m_iNumImages; k++)
+	{
+		int cellWidth = CellSize(m_piImageWidth[k]);
+		int cellHeight = CellSize(m_piImageHeight[k]);
+
+		for (i = k; i > 0 && CellSize(m_piImageHeight[order[i - 1]]) < cellHeight; i--)
+			order[i] = order[i - 1];
+		order[i] = k;
+
+		area += cellWidth * cellHeight;
+		while (width < cellWidth)
+			width <<= 1;
+		while (height < cellHeight)
+			height <<= 1;
+	}
+
+	// Grow the narrower side until everything fits
+	while (width * height < area && MAX(width, height) <= ATLAS_MAX_SIZE)
+	{
+		if (width <= height)
+			width <<= 1;
+		else
+			height <<= 1;
+	}
+	while (!(packed = Pack(width, height, order, x, y)) && MAX(width, height) <= ATLAS_MAX_SIZE)
+	{
+		if (width <= height)
+			width <<= 1;
+		else
+			height <<= 1;
+	}
+
+	if (!packed || width > ATLAS_MAX_SIZE || height > ATLAS_MAX_SIZE)
+	{
+		delete[] order;
+		delete[] x;
+		delete[] y;
+		return RETURN_FAILURE;
+	}
+
+	Release();
+
+	m_iWidth = width;
+	m_iHeight = height;
+	for (m_iNumLevels = 1; m_iNumLevels < ATLAS_LEVELS && (MIN(width, height) >> m_iNumLevels); m_iNumLevels++)
+		;
+
+	// All the levels in one block
+	for (level = 0, offset = 0; level < m_iNumLevels; level++)
+		offset += GetLevelWidth(level) * GetLevelHeight(level);
+	m_pucTexels = new unsigned char[offset];
+	for (level = 0, offset = 0; level < m_iNumLevels; level++)
+	{
+		m_pucLevels[level] = m_pucTexels + offset;
+		offset += GetLevelWidth(level) * GetLevelHeight(level);
+	}
+	memset(m_pucTexels, 0, GetLevelWidth(0) * GetLevelHeight(0));
+
+	// Each frame fills its whole cell, the edges carried out to the
+	// sides of the cell
+	m_pBuiltFrames = new TAtlasFrame[m_iNumImages];
+	for (i = 0; i < m_iNumImages; i++)
+	{
+		int frameWidth = m_piImageWidth[i], frameHeight = m_piImageHeight[i];
+		int cellWidth = CellSize(frameWidth), cellHeight = CellSize(frameHeight);
+		const unsigned char *image = m_ppucImages[i];
+
+		for (ty = 0; ty < cellHeight; ty++)
+		{
+			const unsigned char *row = image + MAX(0, MIN(frameHeight - 1, ty - ATLAS_PADDING)) * frameWidth;
+			unsigned char *out = m_pucTexels + (y[i] + ty) * width + x[i];
+
+			for (tx = 0; tx < cellWidth; tx++)
+				out[tx] = row[MAX(0, MIN(frameWidth - 1, tx - ATLAS_PADDING))];
+		}
+
+		m_pBuiltFrames[i].u0 = float(x[i] + ATLAS_PADDING) / float(width);
+		m_pBuiltFrames[i].u1 = float(x[i] + ATLAS_PADDING + frameWidth) / float(width);
+		m_pBuiltFrames[i].v0 = float(y[i] + ATLAS_PADDING + frameHeight) / float(height);
+		m_pBuiltFrames[i].v1 = float(y[i] + ATLAS_PADDING) / float(height);
+	}
+
+	// Each level the average of 2 by 2 texels of the one above
+	for (level = 1; level < m_iNumLevels; level++)
+	{
+		const unsigned char *above = m_pucLevels[level - 1];
+		unsigned char *out = (unsigned char *)m_pucLevels[level];
+		int aboveWidth = GetLevelWidth(level - 1), aboveHeight = GetLevelHeight(level - 1);
+		int levelWidth = GetLevelWidth(level), levelHeight = GetLevelHeight(level);
+
+		for (ty = 0; ty < levelHeight; ty++)
+		{
+			const unsigned char *row0 = above + MIN(2 * ty, aboveHeight - 1) * aboveWidth;
+			const unsigned char *row1 = above + MIN(2 * ty + 1, aboveHeight - 1) * aboveWidth;
+
+			for (tx = 0; tx < levelWidth; tx++)
+			{
+				int x0 = MIN(2 * tx, aboveWidth - 1), x1 = MIN(2 * tx + 1, aboveWidth - 1);
+
+				out[ty * levelWidth + tx] = (unsigned char)((row0[x0] + row0[x1] + row1[x0] + row1[x1] + 2) >> 2);
+			}
+		}
+	}
+
+	// A copy of the sprites, as adding more reallocates m_pAdded
+	m_pBuiltSprites = new TAtlasSprite[m_iNumAdded];
+	memcpy(m_pBuiltSprites, m_pAdded, sizeof(TAtlasSprite) * m_iNumAdded);
+
+	m_pSprites = m_pBuiltSprites;
+	m_pFrames = m_pBuiltFrames;
+	m_iNumSprites = m_iNumAdded;
+	m_iNumFrames = m_iNumImages;
+
+	delete[] order;
+	delete[] x;
+	delete[] y;
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Write the cooked file, see spriteAtlas.h for the layout
+-----------------------------------------------------------------------------------*/
+
+int CSpriteAtlas::Save(const char *filename) const
+{
+	static const unsigned char zeros[16] = { 0 };
+	TAtlasHeader header;
+	FILE *file;
+	unsigned int offset;
+	int level, status = RETURN_SUCCESS;
+
+	if (!m_iNumLevels || !filename || !(file = fopen(filename, "wb")))
+		return RETURN_FAILURE;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = ATLAS_MAGIC;
+	header.version = ATLAS_VERSION;
+	header.width = m_iWidth;
+	header.height = m_iHeight;
+	header.numLevels = m_iNumLevels;
+	header.numSprites = m_iNumSprites;
+	header.numFrames = m_iNumFrames;
+	header.source = m_source;
+
+	offset = sizeof(header) + sizeof(TAtlasSprite) * m_iNumSprites + sizeof(TAtlasFrame) * m_iNumFrames;
+	for (level = 0; level < m_iNumLevels; level++)
+	{
+		offset = AlignOffset(offset);
+		header.levelOffset[level] = offset;
+		offset += GetLevelWidth(level) * GetLevelHeight(level);
+	}
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+		fwrite(m_pSprites, sizeof(TAtlasSprite), m_iNumSprites, file) != size_t(m_iNumSprites) ||
+		fwrite(m_pFrames, sizeof(TAtlasFrame), m_iNumFrames, file) != size_t(m_iNumFrames))
+	{
+		status = RETURN_FAILURE;
+	}
+
+	offset = sizeof(header) + sizeof(TAtlasSprite) * m_iNumSprites + sizeof(TAtlasFrame) * m_iNumFrames;
+	for (level = 0; level < m_iNumLevels && status == RETURN_SUCCESS; level++)
+	{
+		size_t bytes = GetLevelWidth(level) * GetLevelHeight(level);
+
+		if (fwrite(zeros, 1, header.levelOffset[level] - offset, file) != header.levelOffset[level] - offset ||
+			fwrite(m_pucLevels[level], 1, bytes, file) != bytes)
+		{
+			status = RETURN_FAILURE;
+		}
+		offset = header.levelOffset[level] + (unsigned int)bytes;
+	}
+
+	if (fclose(file) != 0)
+		status = RETURN_FAILURE;
+
+	return status;
+}
+
+/*-----------------------------------------------------------------------------------
+Map a cooked file and use it in place, after checking everything it points
+at is inside it
+-----------------------------------------------------------------------------------*/
+
+int CSpriteAtlas::Load(const char *filename)
+{
+	CMappedFile file;
+	const TAtlasHeader *header;
+	const TAtlasSprite *sprites;
+	size_t size, tables;
+	unsigned int level, i;
+
+	if (file.Open(filename) != RETURN_SUCCESS || file.GetSize() < sizeof(TAtlasHeader))
+		return RETURN_FAILURE;
+
+	header = (const TAtlasHeader *)file.GetData();
+	size = file.GetSize();
+
+	if (header->magic != ATLAS_MAGIC || header->version != ATLAS_VERSION ||
+		header->width == 0 || header->width > ATLAS_MAX_SIZE ||
+		header->height == 0 || header->height > ATLAS_MAX_SIZE ||
+		header->numLevels == 0 || header->numLevels > ATLAS_LEVELS ||
+		header->numSprites == 0 || header->numFrames == 0 ||
+		header->numSprites > size || header->numFrames > size)
+	{
+		return RETURN_FAILURE;
+	}
+
+	tables = sizeof(TAtlasHeader) + sizeof(TAtlasSprite) * header->numSprites + sizeof(TAtlasFrame) * header->numFrames;
+	if (tables > size)
+		return RETURN_FAILURE;
+
+	sprites = (const TAtlasSprite *)(file.GetData() + sizeof(TAtlasHeader));
+	for (i = 0; i < header->numSprites; i++)
+	{
+		if (sprites[i].firstFrame < 0 || sprites[i].numFrames <= 0 ||
+			(unsigned int)sprites[i].firstFrame + (unsigned int)sprites[i].numFrames > header->numFrames)
+		{
+			return RETURN_FAILURE;
+		}
+	}
+
+	for (level = 0; level < header->numLevels; level++)
+	{
+		size_t bytes = size_t(MAX(1u, header->width >> level)) * MAX(1u, header->height >> level);
+
+		if (header->levelOffset[level] < tables || header->levelOffset[level] > size ||
+			bytes > size - header->levelOffset[level])
+		{
+			return RETURN_FAILURE;
+		}
+	}
+
+	// Good, use it in place of the current atlas
+	Release();
+	m_file.Swap(file);
+
+	m_iWidth = header->width;
+	m_iHeight = header->height;
+	m_iNumLevels = header->numLevels;
+	m_iNumSprites = header->numSprites;
+	m_iNumFrames = header->numFrames;
+	m_source = header->source;
+	m_pSprites = (const TAtlasSprite *)(m_file.GetData() + sizeof(TAtlasHeader));
+	m_pFrames = (const TAtlasFrame *)(m_pSprites + m_iNumSprites);
+	for (level = 0; level < header->numLevels; level++)
+		m_pucLevels[level] = m_file.GetData() + ((const TAtlasHeader *)m_file.GetData())->levelOffset[level];
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Use the cooked atlas, cooking it first if it is not there yet or the bitmap has
+changed since.  A cooked atlas without its bitmap is used as it is.
+-----------------------------------------------------------------------------------*/
+
+int CSpriteAtlas::LoadCached(const char *cooked, const char *source, int framesX, int framesY)
+{
+	TAtlasSource stamp;
+	bool found = GetSource(source, framesX, framesY, &stamp);
+	bool loaded = (Load(cooked) == RETURN_SUCCESS);
+
+	if (loaded && (!found || (m_source.size == stamp.size && m_source.time == stamp.time &&
+		m_source.framesX == stamp.framesX && m_source.framesY == stamp.framesY)))
+	{
+		return RETURN_SUCCESS;
+	}
+
+	// An out of date atlas is still better than none
+	if (!found || AddBMP(source, framesX, framesY) < 0 || Build() != RETURN_SUCCESS)
+		return loaded ? RETURN_SUCCESS : RETURN_FAILURE;
+
+	// Not being able to save it only costs the next start up time
+	m_source = stamp;
+	Save(cooked);
+
+	return RETURN_SUCCESS;
+}
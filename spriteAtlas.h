@@ -0,0 +1,183 @@
+/*-----------------------------------------------------------------------------------
+File:			spriteAtlas.h
+Author:			Steve Costa
+Description:	Packs every sprite image, and every frame of flipbook animations,
+into one texture so all the effects are drawn with one bind.  Each
+particle carries the index of its sprite in PARTICLE_SPRITE, and a
+flipbook is played over the life of the particle.
+
+The atlas holds coverage masks, one byte a texel, as CPointSprite
+keeps its texture, and a chain of mip levels made with a box filter
+so small sprites do not shimmer.  Frames are placed on a grid of
+ATLAS_PADDING texels with a gutter of their edge texels at least
+that wide round them, so no level of the chain blends one frame
+into the next.
+
+A built atlas can be cooked to a file laid out as it is used:
+
+	TAtlasHeader
+	TAtlasSprite	numSprites
+	TAtlasFrame		numFrames
+	level 0 texels, level 1 texels, ...
+
+Loading maps the file and points at it, so there is nothing to read
+or decode before the levels are handed to glTexImage2D.  The file
+is in the byte order of the machine that cooked it.  The header
+keeps the size and modification time of the bitmap the atlas was
+cooked from, so LoadCached cooks it again when the bitmap changes.
+-----------------------------------------------------------------------------------*/
+
+#ifndef SPRITE_ATLAS_H_
+#define SPRITE_ATLAS_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "simUtil.h"						// Common Macros
+#include "mappedFile.h"						// Read only file mapping
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define ATLAS_MAGIC				0x4C544150		// "PATL"
+#define ATLAS_VERSION			2
+#define ATLAS_LEVELS			4				// Mip levels kept, level 0 included
+#define ATLAS_PADDING			8				// 1 << (ATLAS_LEVELS - 1), a texel at the last level
+#define ATLAS_MAX_SIZE			4096			// Widest or tallest atlas
+#define ATLAS_INITIAL_FRAMES	16
+
+/*-----------------------------------------------------------------------------------
+Where a frame is in the atlas.  (u0, v0) are the texture coordinates of the
+bottom left of the image and (u1, v1) of the top right.  Texture rows go down
+the images, as bitmaps are loaded, so v1 is less than v0.
+-----------------------------------------------------------------------------------*/
+
+struct TAtlasFrame
+{
+	float			u0, v0, u1, v1;
+};
+
+// A sprite is a run of frames, one for a still image
+struct TAtlasSprite
+{
+	int				firstFrame;
+	int				numFrames;
+};
+
+// The bitmap a cooked atlas came from, all zero when it was built from sprites
+struct TAtlasSource
+{
+	unsigned long long	size;				// Bytes
+	unsigned long long	time;				// Modification time
+	int				framesX, framesY;
+};
+
+struct TAtlasHeader
+{
+	unsigned int	magic;
+	unsigned int	version;
+	unsigned int	width, height;			// Level 0 texels
+	unsigned int	numLevels;
+	unsigned int	numSprites;
+	unsigned int	numFrames;
+	unsigned int	levelOffset[ATLAS_LEVELS];	// Bytes from the start of the file
+	TAtlasSource	source;
+};
+
+/*-----------------------------------------------------------------------------------
+Sprite atlas class definition
+-----------------------------------------------------------------------------------*/
+
+class CSpriteAtlas
+{
+	// Attributes
+private:
+
+	int				m_iWidth, m_iHeight;
+	int				m_iNumLevels;
+	const unsigned char	*m_pucLevels[ATLAS_LEVELS];
+	const TAtlasSprite	*m_pSprites;
+	const TAtlasFrame	*m_pFrames;
+	int				m_iNumSprites;
+	int				m_iNumFrames;
+
+	CMappedFile		m_file;					// Cooked atlas in use
+	unsigned char	*m_pucTexels;			// Built levels, one after the other
+	TAtlasSprite	*m_pBuiltSprites;
+	TAtlasFrame		*m_pBuiltFrames;
+	TAtlasSource	m_source;				// Saved with the atlas
+
+	// Everything added, one image a frame with rows from the top
+	TAtlasSprite	*m_pAdded;
+	int				m_iNumAdded, m_iAddedCapacity;
+	unsigned char	**m_ppucImages;
+	int				*m_piImageWidth, *m_piImageHeight;
+	int				m_iNumImages, m_iImageCapacity;
+
+	// Methods
+private:
+
+	void Release();
+	bool Pack(int width, int height, const int *order, int *x, int *y) const;
+
+public:
+
+	CSpriteAtlas();
+	~CSpriteAtlas();
+
+	void Shutdown();
+
+	//-----------------------------------------------------------
+	// Add an image of framesX by framesY flipbook frames, read
+	// left to right then down, and return its sprite index, or
+	// -1.  coverage has a byte a texel with the top row first.
+	// The image is packed by the next Build.
+	//-----------------------------------------------------------
+	int AddSprite(const unsigned char *coverage, int width, int height, int framesX = 1, int framesY = 1);
+	int AddBMP(const char *filename, int framesX = 1, int framesY = 1);
+
+	// Pack every image added so far and make the mip chain, in
+	// place of the atlas in use.  Sprites keep the indices AddSprite
+	// gave them.
+	int Build();
+
+	// Write the atlas in use to a cooked file, or map one in its
+	// place
+	int Save(const char *filename) const;
+	int Load(const char *filename);
+
+	//-----------------------------------------------------------
+	// Map a cooked atlas, or when there is none, or it was
+	// cooked from another version of the bitmap or another grid
+	// of frames, cook one from a bitmap of framesX by framesY
+	// frames and save it for the next run.
+	//-----------------------------------------------------------
+	int LoadCached(const char *cooked, const char *source, int framesX = 1, int framesY = 1);
+
+	int GetWidth() const { return m_iWidth; }
+	int GetHeight() const { return m_iHeight; }
+	int GetNumLevels() const { return m_iNumLevels; }
+	int GetLevelWidth(int level) const { return MAX(1, m_iWidth >> level); }
+	int GetLevelHeight(int level) const { return MAX(1, m_iHeight >> level); }
+	const unsigned char *GetLevel(int level) const { return m_pucLevels[level]; }
+
+	int GetNumSprites() const { return m_iNumSprites; }
+	int GetNumFrames() const { return m_iNumFrames; }
+	const TAtlasSprite& GetSprite(int sprite) const { return m_pSprites[sprite]; }
+
+	//-----------------------------------------------------------
+	// The frame of a sprite shown a fraction age through the
+	// life of a particle, 0 when it is spawned and 1 when it
+	// dies.  Unknown sprites show sprite 0.
+	//-----------------------------------------------------------
+	const TAtlasFrame& GetFrame(unsigned int sprite, float age) const {
+		const TAtlasSprite& s = m_pSprites[(sprite < (unsigned int)m_iNumSprites) ? sprite : 0];
+		int frame = int(MAX(0.0f, age) * float(s.numFrames));
+
+		return m_pFrames[s.firstFrame + MIN(frame, s.numFrames - 1)];
+	}
+};
+
+#endif
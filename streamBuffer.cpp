@@ -0,0 +1,241 @@
+/*-----------------------------------------------------------------------------------
+File:			streamBuffer.cpp
+Author:			Steve Costa
+Description:	Streaming buffer object used to hand per-frame vertex data to
+the driver.
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include "streamBuffer.h"					// Class header file
+
+/*-----------------------------------------------------------------------------------
+Set any initial values for class state variables.
+-----------------------------------------------------------------------------------*/
+
+CStreamBuffer::CStreamBuffer()
+{
+	int i;
+
+	m_eTarget = GL_ARRAY_BUFFER;
+	m_iMode = STREAM_MODE_CLIENT;
+	m_uiBuffer = 0;
+	m_uiSize = 0;
+	m_iSection = 0;
+	m_pMapped = NULL;
+
+	for (i = 0; i < STREAM_BUFFER_SECTIONS; i++)
+		m_fences[i] = NULL;
+}
+
+CStreamBuffer::~CStreamBuffer()
+{
+	Shutdown();
+}
+
+/*-----------------------------------------------------------------------------------
+Choose a streaming mode and create the first storage
+-----------------------------------------------------------------------------------*/
+
+int CStreamBuffer::Init(GLenum target, size_t initialSize, int maxMode)
+{
+	int caps = glext::GetCaps();
+
+	Shutdown();
+
+	m_eTarget = target;
+
+	if ((caps & GLEXT_BUFFER_STORAGE) && maxMode >= STREAM_MODE_PERSISTENT)
+		m_iMode = STREAM_MODE_PERSISTENT;
+	else if ((caps & GLEXT_BUFFER_OBJECTS) && maxMode >= STREAM_MODE_ORPHAN)
+		m_iMode = STREAM_MODE_ORPHAN;
+	else
+		m_iMode = STREAM_MODE_CLIENT;
+
+	return Allocate(initialSize);
+}
+
+/*-----------------------------------------------------------------------------------
+Free everything
+-----------------------------------------------------------------------------------*/
+
+void CStreamBuffer::Shutdown()
+{
+	Release();
+	m_uiSize = 0;
+}
+
+/*-----------------------------------------------------------------------------------
+Create storage for size bytes per section.  A persistent mapping that fails
+drops the buffer to orphaning, any other failure leaves no storage at all so
+Map returns NULL.
+-----------------------------------------------------------------------------------*/
+
+int CStreamBuffer::Allocate(size_t size)
+{
+	Release();
+
+	m_uiSize = size;
+	m_iSection = 0;
+
+	switch (m_iMode)
+	{
+	case STREAM_MODE_PERSISTENT:
+		{
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+			glext::GenBuffers(1, &m_uiBuffer);
+			glext::BindBuffer(m_eTarget, m_uiBuffer);
+			glext::BufferStorage(m_eTarget, size * STREAM_BUFFER_SECTIONS, NULL, flags);
+			m_pMapped = (char *)glext::MapBufferRange(m_eTarget, 0, size * STREAM_BUFFER_SECTIONS, flags);
+			glext::BindBuffer(m_eTarget, 0);
+
+			if (!m_pMapped)
+			{
+				Release();
+				m_iMode = STREAM_MODE_ORPHAN;
+				return Allocate(size);
+			}
+		}
+		break;
+
+	case STREAM_MODE_ORPHAN:
+		glext::GenBuffers(1, &m_uiBuffer);
+		glext::BindBuffer(m_eTarget, m_uiBuffer);
+		glext::BufferData(m_eTarget, size, NULL, GL_STREAM_DRAW);
+		glext::BindBuffer(m_eTarget, 0);
+		break;
+
+	default:
+		m_pMapped = (char *)malloc(size);
+		if (!m_pMapped)
+		{
+			m_uiSize = 0;
+			return RETURN_FAILURE;
+		}
+		break;
+	}
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Release the storage, waiting for the GPU to finish with it first
+-----------------------------------------------------------------------------------*/
+
+void CStreamBuffer::Release()
+{
+	int i;
+
+	for (i = 0; i < STREAM_BUFFER_SECTIONS; i++)
+	{
+		if (m_fences[i])
+		{
+			glext::ClientWaitSync(m_fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, ~(GLuint64)0);
+			glext::DeleteSync(m_fences[i]);
+			m_fences[i] = NULL;
+		}
+	}
+
+	if (m_uiBuffer)
+	{
+		if (m_iMode == STREAM_MODE_PERSISTENT && m_pMapped)
+		{
+			glext::BindBuffer(m_eTarget, m_uiBuffer);
+			glext::UnmapBuffer(m_eTarget);
+			glext::BindBuffer(m_eTarget, 0);
+		}
+		glext::DeleteBuffers(1, &m_uiBuffer);
+		m_uiBuffer = 0;
+	}
+	else if (m_iMode == STREAM_MODE_CLIENT)
+	{
+		free(m_pMapped);
+	}
+
+	m_pMapped = NULL;
+}
+
+/*-----------------------------------------------------------------------------------
+Return somewhere to write this frame's data
+-----------------------------------------------------------------------------------*/
+
+void *CStreamBuffer::Map(size_t bytes)
+{
+	// Grow so that a whole frame always fits in one piece
+	if (bytes > m_uiSize)
+	{
+		if (Allocate(MAX(bytes, m_uiSize * 2)) != RETURN_SUCCESS)
+			return NULL;
+	}
+
+	// Nothing to write into after a failed Init or grow
+	if (m_iMode != STREAM_MODE_ORPHAN && !m_pMapped)
+		return NULL;
+
+	switch (m_iMode)
+	{
+	case STREAM_MODE_PERSISTENT:
+		// Move on to the next section and wait until the GPU is done with it
+		m_iSection = (m_iSection + 1) % STREAM_BUFFER_SECTIONS;
+		if (m_fences[m_iSection])
+		{
+			GLenum result;
+			do {
+				result = glext::ClientWaitSync(m_fences[m_iSection], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			} while (result == GL_TIMEOUT_EXPIRED);
+
+			glext::DeleteSync(m_fences[m_iSection]);
+			m_fences[m_iSection] = NULL;
+		}
+		return m_pMapped + m_iSection * m_uiSize;
+
+	case STREAM_MODE_ORPHAN:
+		// Orphan the old storage then map the fresh one
+		glext::BindBuffer(m_eTarget, m_uiBuffer);
+		glext::BufferData(m_eTarget, m_uiSize, NULL, GL_STREAM_DRAW);
+		if (glext::GetCaps() & GLEXT_MAP_RANGE)
+			return glext::MapBufferRange(m_eTarget, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		return glext::MapBuffer(m_eTarget, GL_WRITE_ONLY);
+
+	default:
+		return m_pMapped;
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Finish writing and bind the buffer for drawing
+-----------------------------------------------------------------------------------*/
+
+const char *CStreamBuffer::Unmap()
+{
+	switch (m_iMode)
+	{
+	case STREAM_MODE_PERSISTENT:
+		glext::BindBuffer(m_eTarget, m_uiBuffer);
+		return (const char *)NULL + m_iSection * m_uiSize;
+
+	case STREAM_MODE_ORPHAN:
+		glext::UnmapBuffer(m_eTarget);
+		return (const char *)NULL;
+
+	default:
+		return m_pMapped;
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Mark the end of the commands reading the current section
+-----------------------------------------------------------------------------------*/
+
+void CStreamBuffer::Fence()
+{
+	if (m_iMode == STREAM_MODE_PERSISTENT)
+		m_fences[m_iSection] = glext::FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	if (m_iMode != STREAM_MODE_CLIENT)
+		glext::BindBuffer(m_eTarget, 0);
+}
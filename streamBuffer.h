@@ -0,0 +1,88 @@
+/*-----------------------------------------------------------------------------------
+File:			streamBuffer.h
+Author:			Steve Costa
+Description:	A buffer object that the CPU refills every frame without
+waiting on the driver.  The best method the context supports is
+used:
+
+	persistent	one persistently mapped buffer split into a ring of
+				sections, a fence per section stops the CPU writing
+				over data the GPU has not consumed yet
+	orphan		the buffer storage is thrown away with glBufferData
+				before each map so the driver can hand back fresh
+				memory instead of stalling
+	client		no buffer objects at all, plain system memory used
+				through client side arrays
+-----------------------------------------------------------------------------------*/
+
+#ifndef STREAM_BUFFER_H_
+#define STREAM_BUFFER_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "glExtensions.h"					// Buffer object entry points
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define STREAM_BUFFER_SECTIONS		3			// Frames in flight for the ring
+
+enum EStreamMode
+{
+	STREAM_MODE_CLIENT,
+	STREAM_MODE_ORPHAN,
+	STREAM_MODE_PERSISTENT
+};
+
+/*-----------------------------------------------------------------------------------
+Stream buffer class definition
+-----------------------------------------------------------------------------------*/
+
+class CStreamBuffer
+{
+	// Attributes
+private:
+
+	GLenum		m_eTarget;								// Binding point
+	int			m_iMode;								// One of EStreamMode
+	GLuint		m_uiBuffer;								// Buffer object
+	size_t		m_uiSize;								// Bytes per section
+	int			m_iSection;								// Section being written
+	char		*m_pMapped;								// Persistent mapping / client memory
+	GLsync		m_fences[STREAM_BUFFER_SECTIONS];		// Guards each section
+
+	// Methods
+private:
+
+	int Allocate(size_t size);							// (Re)create the storage
+	void Release();										// Free the storage
+
+public:
+
+	CStreamBuffer();
+	~CStreamBuffer();
+
+	// Pick the best mode the current context supports, a mode can be
+	// forced lower, but not higher, than what is available.  Falls
+	// back to orphaning when a persistent mapping cannot be made.
+	int Init(GLenum target, size_t initialSize, int maxMode = STREAM_MODE_PERSISTENT);
+	void Shutdown();
+
+	// Get somewhere to write bytes of data for this frame.  The
+	// buffer grows if needed so the whole frame fits in one go.
+	void *Map(size_t bytes);
+
+	// Finish writing and bind the buffer.  Returns the value to pass
+	// as the pointer to gl*Pointer calls (an offset or an address).
+	const char *Unmap();
+
+	// Call after the draw that reads the data has been issued
+	void Fence();
+
+	int GetMode() const { return m_iMode; }
+};
+
+#endif
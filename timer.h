@@ -0,0 +1,94 @@
+/*-----------------------------------------------------------------------------------
+File:			timer.h
+Author:			Steve Costa
+Description:	Monotonic high resolution clock and a sleep which does not
+overshoot.  GetTickCount only moves in 10-16 ms steps, which is
+most of a frame, so it is no good for measuring frame times.
+-----------------------------------------------------------------------------------*/
+
+#ifndef TIMER_H_
+#define TIMER_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <sched.h>
+#endif
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+// Time left at which SleepUntil stops asking the OS to sleep and spins
+// instead, the scheduler can wake us this late
+#define TIMER_SPIN_THRESHOLD	0.002
+
+/*-----------------------------------------------------------------------------------
+Timer class definition
+-----------------------------------------------------------------------------------*/
+
+class CTimer
+{
+	// Methods
+public:
+
+	//-----------------------------------------------------------
+	// Seconds since an arbitrary fixed point, never goes back
+	//-----------------------------------------------------------
+	static double GetSeconds() {
+#ifdef _WIN32
+		static LARGE_INTEGER frequency = { 0 };
+		LARGE_INTEGER counter;
+
+		if (!frequency.QuadPart)
+			QueryPerformanceFrequency(&frequency);
+		QueryPerformanceCounter(&counter);
+
+		return double(counter.QuadPart) / double(frequency.QuadPart);
+#else
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		return double(now.tv_sec) + double(now.tv_nsec) * 1.0e-9;
+#endif
+	}
+
+	//-----------------------------------------------------------
+	// Wait until GetSeconds reaches the given time.  Sleeps in
+	// whole scheduler slices while there is plenty of time left
+	// and yields for the last stretch, so it does not oversleep.
+	//-----------------------------------------------------------
+	static void SleepUntil(double target) {
+		double remaining;
+
+		while ((remaining = target - GetSeconds()) > TIMER_SPIN_THRESHOLD)
+		{
+#ifdef _WIN32
+			Sleep(DWORD((remaining - TIMER_SPIN_THRESHOLD) * 1000.0));
+#else
+			struct timespec wait;
+			remaining -= TIMER_SPIN_THRESHOLD;
+			wait.tv_sec = (time_t)remaining;
+			wait.tv_nsec = long((remaining - double(wait.tv_sec)) * 1.0e9);
+			nanosleep(&wait, NULL);
+#endif
+		}
+
+		while (GetSeconds() < target)
+		{
+#ifdef _WIN32
+			Sleep(0);
+#else
+			sched_yield();
+#endif
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,156 @@
+/*-----------------------------------------------------------------------------------
+File:			trails.cpp
+Author:			Steve Costa
+Description:	Ring of recent particle positions, see trails.h
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "trails.h"
+
+/*-----------------------------------------------------------------------------------
+Start with no trails
+-----------------------------------------------------------------------------------*/
+
+CTrails::CTrails()
+{
+	m_iCapacity = 0;
+	m_iStride = 0;
+	m_iLength = 0;
+	m_iHead = 0;
+	m_iStep = 0;
+	m_pBlock = NULL;
+	m_pfHistory = NULL;
+	m_piBirth = NULL;
+}
+
+CTrails::~CTrails()
+{
+	Shutdown();
+}
+
+/*-----------------------------------------------------------------------------------
+Allocate the ring.  The columns are padded and aligned as the pool's are, the
+birth steps follow the last of them.  Every particle is born on the step after
+this one, so nothing is drawn from the history until it has been recorded.
+-----------------------------------------------------------------------------------*/
+
+int CTrails::Init(int capacity, int length)
+{
+	int i;
+	char *base;
+
+	Shutdown();
+
+	if (capacity <= 0 || length <= 0 || length > TRAIL_MAX_LENGTH)
+		return RETURN_FAILURE;
+
+	m_iStride = (capacity + PARTICLE_POOL_ALIGN_FLOATS - 1) & ~(PARTICLE_POOL_ALIGN_FLOATS - 1);
+	m_iLength = length;
+
+	m_pBlock = malloc((sizeof(float) * 3 * length + sizeof(int)) * m_iStride + PARTICLE_POOL_ALIGN);
+	if (!m_pBlock)
+	{
+		Shutdown();
+		return RETURN_FAILURE;
+	}
+
+	base = (char *)(((size_t)m_pBlock + PARTICLE_POOL_ALIGN - 1) & ~(size_t)(PARTICLE_POOL_ALIGN - 1));
+	m_pfHistory = (float *)base;
+	m_piBirth = (int *)(m_pfHistory + 3 * length * m_iStride);
+
+	memset(m_pfHistory, 0, sizeof(float) * 3 * length * m_iStride);
+	for (i = 0; i < m_iStride; i++)
+		m_piBirth[i] = 1;
+
+	m_iCapacity = capacity;
+	m_iHead = 0;
+	m_iStep = 0;
+
+	return RETURN_SUCCESS;
+}
+
+/*-----------------------------------------------------------------------------------
+Free the ring
+-----------------------------------------------------------------------------------*/
+
+void CTrails::Shutdown()
+{
+	free(m_pBlock);
+	m_pBlock = NULL;
+	m_pfHistory = NULL;
+	m_piBirth = NULL;
+	m_iCapacity = 0;
+	m_iStride = 0;
+	m_iLength = 0;
+	m_iHead = 0;
+	m_iStep = 0;
+}
+
+/*-----------------------------------------------------------------------------------
+The oldest slot of the ring is written over by this step
+-----------------------------------------------------------------------------------*/
+
+void CTrails::BeginStep()
+{
+	if (!m_pBlock)
+		return;
+
+	m_iHead = (m_iHead + 1) % m_iLength;
+	m_iStep++;
+}
+
+/*-----------------------------------------------------------------------------------
+The previous positions are where the last step left the particles, after any
+collisions, or where the new particles were spawned.  They are copied a whole
+column at a time, which streams as fast as the update that reads them.
+-----------------------------------------------------------------------------------*/
+
+void CTrails::Record(const CParticlePool& pool, int first, int count, int spawnFirst, int spawnCount)
+{
+	int axis, i, last;
+
+	count = MIN(count, m_iCapacity - first);
+	if (!m_pBlock || count <= 0)
+		return;
+
+	for (axis = 0; axis < 3; axis++)
+	{
+		memcpy(Column(m_iHead, axis) + first, pool.Column(PARTICLE_PREV_X + axis) + first,
+			sizeof(float) * count);
+	}
+
+	last = MIN(first + count, spawnFirst + spawnCount);
+	for (i = MAX(first, spawnFirst); i < last; i++)
+		m_piBirth[i] = m_iStep;
+}
+
+/*-----------------------------------------------------------------------------------
+Each removal moved the last live particle down into the slot, the history of
+every step moves with it.  There are only as many as died this step.
+-----------------------------------------------------------------------------------*/
+
+void CTrails::Moved(const int *removed, int numRemoved, int liveBefore)
+{
+	int n, column, i, last;
+
+	if (!m_pBlock)
+		return;
+
+	for (n = 0; n < numRemoved; n++)
+	{
+		i = removed[n];
+		last = liveBefore - 1 - n;
+		if (i == last || last >= m_iCapacity)
+			continue;
+
+		for (column = 0; column < 3 * m_iLength; column++)
+			m_pfHistory[column * m_iStride + i] = m_pfHistory[column * m_iStride + last];
+		m_piBirth[i] = m_piBirth[last];
+	}
+}
@@ -0,0 +1,108 @@
+/*-----------------------------------------------------------------------------------
+File:			trails.h
+Author:			Steve Costa
+Description:	Where every particle has been over its last few steps, for drawing
+ribbons behind them.  Rather than a small buffer per particle there
+is one ring of the last length steps shared by the whole pool, each
+step a set of position columns laid out as the pool is, so keeping
+the history up to date is a copy of the previous position columns
+next to the update.  The memory is fixed when the trails are set up,
+12 bytes a particle a step of trail.
+
+Particles move about the pool as others die, so the history is
+moved with them, and each particle keeps the step it was born on
+so a trail never reaches back into the particle which had the slot
+before it.
+-----------------------------------------------------------------------------------*/
+
+#ifndef TRAILS_H_
+#define TRAILS_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "simUtil.h"						// Common Macros
+#include "particlePool.h"					// Particle attribute columns
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define TRAIL_MAX_LENGTH		64				// Most steps a trail can cover
+
+/*-----------------------------------------------------------------------------------
+Trails class definition
+-----------------------------------------------------------------------------------*/
+
+class CTrails
+{
+	// Attributes
+private:
+
+	int				m_iCapacity;
+	int				m_iStride;				// Column length padded to alignment
+	int				m_iLength;				// Steps of history
+	int				m_iHead;				// Ring slot written this step
+	int				m_iStep;				// Steps recorded
+	void			*m_pBlock;				// Single allocation for all the columns
+	float			*m_pfHistory;			// Slot h holds x, y and z columns from 3 * h
+	int				*m_piBirth;				// Step each particle was first recorded on
+
+	// Methods
+private:
+
+	float *Column(int slot, int axis) const {
+		return m_pfHistory + (slot * 3 + axis) * m_iStride;
+	}
+
+public:
+
+	CTrails();
+	~CTrails();
+
+	//-----------------------------------------------------------
+	// Keep the last length positions of up to capacity
+	// particles.  Particles already alive start their trails
+	// from the next step.
+	//-----------------------------------------------------------
+	int Init(int capacity, int length);
+	void Shutdown();
+
+	// Move the ring on, called once before the particles of a
+	// step are recorded
+	void BeginStep();
+
+	//-----------------------------------------------------------
+	// Record the positions before this step of the particles
+	// [first, first + count), the new particles among them are
+	// those in [spawnFirst, spawnFirst + spawnCount).  Ranges
+	// which do not overlap can be recorded at the same time.
+	//-----------------------------------------------------------
+	void Record(const CParticlePool& pool, int first, int count, int spawnFirst, int spawnCount);
+
+	//-----------------------------------------------------------
+	// Follow CParticlePool::RemoveDead, which moved the last of
+	// liveBefore particles into each of the numRemoved slots in
+	// removed, in that order.
+	//-----------------------------------------------------------
+	void Moved(const int *removed, int numRemoved, int liveBefore);
+
+	//-----------------------------------------------------------
+	// Positions age steps back, 0 for the newest, an x, y and z
+	// column indexed as the pool is.  Only the first GetCount(i)
+	// ages of particle i are its own.
+	//-----------------------------------------------------------
+	const float *GetX(int age) const { return Column((m_iHead - age + m_iLength) % m_iLength, 0); }
+	const float *GetY(int age) const { return Column((m_iHead - age + m_iLength) % m_iLength, 1); }
+	const float *GetZ(int age) const { return Column((m_iHead - age + m_iLength) % m_iLength, 2); }
+
+	int GetCount(int i) const { return MIN(m_iStep - m_piBirth[i] + 1, m_iLength); }
+
+	bool IsEnabled() const { return m_pBlock != NULL; }
+	int GetLength() const { return m_iLength; }
+	int GetCapacity() const { return m_iCapacity; }
+	size_t GetMemory() const { return (sizeof(float) * 3 * m_iLength + sizeof(int)) * (size_t)m_iStride; }
+};
+
+#endif
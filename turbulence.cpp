@@ -0,0 +1,490 @@
+/*-----------------------------------------------------------------------------------
+File:			turbulence.cpp
+Author:			Steve Costa
+Description:	Baking the curl noise keys of the turbulence field and sampling
+it, with a scalar and an SSE2 trilinear sample.  The noise is
+Perlin's gradient noise, "Improving Noise" (2002), made periodic
+over the tile, and the curl is that of Bridson, Hourihan and
+Nordenstam, "Curl-Noise for Procedural Fluid Flow" (2007).
+-----------------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include <math.h>
+#include <string.h>
+
+#include "turbulence.h"						// Class header file
+#include "profiler.h"						// Frame zones
+#include "cpuFeatures.h"					// Instruction set detection
+
+#ifdef CPU_X86
+#include <emmintrin.h>
+#endif
+
+/*-----------------------------------------------------------------------------------
+Round down, floorf is a library call without SSE4.1
+-----------------------------------------------------------------------------------*/
+
+static int Floor(float v)
+{
+	int truncated = (int)v;
+
+	return truncated - (v < float(truncated));
+}
+
+/*-----------------------------------------------------------------------------------
+Periodic gradient noise.  Each lattice corner hashes to one of the twelve
+gradients along the edges of a cube, four of them repeated to make sixteen.
+-----------------------------------------------------------------------------------*/
+
+static float Fade(float t)
+{
+	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+static float Gradient(int x, int y, int z, TRandU64 seed, float fx, float fy, float fz)
+{
+	TRandU64 state = seed ^ ((TRandU64)x * 0x9E3779B97F4A7C15ull + (TRandU64)y * 0xC2B2AE3D27D4EB4Full
+		+ (TRandU64)z * 0x165667B19E3779F9ull);
+	int h = int(SplitMix64(state) & 15);
+	float u = (h < 8) ? fx : fy;
+	float v = (h < 4) ? fy : ((h == 12 || h == 14) ? fx : fz);
+
+	return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+}
+
+static float GradientNoise(float x, float y, float z, int period, TRandU64 seed)
+{
+	int ix = Floor(x), iy = Floor(y), iz = Floor(z);
+	float fx = x - float(ix), fy = y - float(iy), fz = z - float(iz);
+	float u = Fade(fx), v = Fade(fy), w = Fade(fz);
+	int x0 = ix % period, y0 = iy % period, z0 = iz % period;
+	int x1 = (x0 + 1) % period, y1 = (y0 + 1) % period, z1 = (z0 + 1) % period;
+
+	float n000 = Gradient(x0, y0, z0, seed, fx, fy, fz);
+	float n100 = Gradient(x1, y0, z0, seed, fx - 1.0f, fy, fz);
+	float n010 = Gradient(x0, y1, z0, seed, fx, fy - 1.0f, fz);
+	float n110 = Gradient(x1, y1, z0, seed, fx - 1.0f, fy - 1.0f, fz);
+	float n001 = Gradient(x0, y0, z1, seed, fx, fy, fz - 1.0f);
+	float n101 = Gradient(x1, y0, z1, seed, fx - 1.0f, fy, fz - 1.0f);
+	float n011 = Gradient(x0, y1, z1, seed, fx, fy - 1.0f, fz - 1.0f);
+	float n111 = Gradient(x1, y1, z1, seed, fx - 1.0f, fy - 1.0f, fz - 1.0f);
+
+	float n00 = n000 + u * (n100 - n000);
+	float n10 = n010 + u * (n110 - n010);
+	float n01 = n001 + u * (n101 - n001);
+	float n11 = n011 + u * (n111 - n011);
+	float n0 = n00 + v * (n10 - n00);
+	float n1 = n01 + v * (n11 - n01);
+
+	return n0 + w * (n1 - n0);
+}
+
+/*-----------------------------------------------------------------------------------
+Set any initial values for class state variables.
+-----------------------------------------------------------------------------------*/
+
+CTurbulenceField::CTurbulenceField()
+{
+	m_iMask = 0;
+	m_fInvCellSize = 1.0f;
+	m_pfPotential = NULL;
+	memset(m_pfKeys, 0, sizeof(m_pfKeys));
+	m_pfField = NULL;
+	m_dTime = 0.0;
+	m_bBaked = false;
+	m_iKey = 0;
+	m_iBakeUnits = 0;
+
+	SetParams(m_params);
+	SetSimd(true);
+}
+
+CTurbulenceField::~CTurbulenceField()
+{
+	Shutdown();
+}
+
+/*-----------------------------------------------------------------------------------
+Free the lattices
+-----------------------------------------------------------------------------------*/
+
+void CTurbulenceField::Shutdown()
+{
+	int i;
+
+	delete[] m_pfPotential;
+	for (i = 0; i < TURBULENCE_KEYS; i++)
+		delete[] m_pfKeys[i];
+	delete[] m_pfField;
+
+	m_pfPotential = NULL;
+	memset(m_pfKeys, 0, sizeof(m_pfKeys));
+	m_pfField = NULL;
+	m_bBaked = false;
+}
+
+/*-----------------------------------------------------------------------------------
+Settings, the lattices are allocated when the field is first advanced
+-----------------------------------------------------------------------------------*/
+
+void CTurbulenceField::SetParams(const TTurbulenceParams& params)
+{
+	int resolution = params.resolution;
+
+	Shutdown();
+
+	m_params = params;
+	m_params.octaves = MAX(1, MIN(m_params.octaves, TURBULENCE_MAX_OCTAVES));
+	m_params.noiseScale = MAX(m_params.noiseScale, 1);
+
+	// The lattice wraps with a mask
+	for (m_params.resolution = 2; m_params.resolution < resolution; m_params.resolution *= 2)
+		;
+	m_iMask = m_params.resolution - 1;
+	m_fInvCellSize = 1.0f / m_params.cellSize;
+}
+
+void CTurbulenceField::Allocate()
+{
+	int numPoints = GetNumPoints();
+	int i;
+
+	m_pfPotential = new float[3 * size_t(numPoints)];
+	for (i = 0; i < TURBULENCE_KEYS; i++)
+		m_pfKeys[i] = new float[4 * size_t(numPoints)];
+	m_pfField = new float[4 * size_t(numPoints)];
+}
+
+bool CTurbulenceField::SetSimd(bool simd)
+{
+#ifdef CPU_X86
+	m_bSimd = simd && (DetectCpuFeatures() & CPU_FEATURE_SSE2);
+#else
+	m_bSimd = false;
+#endif
+
+	return m_bSimd;
+}
+
+/*-----------------------------------------------------------------------------------
+One component of the vector potential, octaves of noise which all repeat
+across the tile.  x, y and z are in lattice points.
+-----------------------------------------------------------------------------------*/
+
+float CTurbulenceField::Potential(float x, float y, float z, TRandU64 seed) const
+{
+	float frequency = float(m_params.noiseScale) / float(m_params.resolution);
+	int period = m_params.noiseScale;
+	float amplitude = 1.0f, sum = 0.0f;
+	int octave;
+
+	for (octave = 0; octave < m_params.octaves; octave++)
+	{
+		sum += amplitude * GradientNoise(x * frequency, y * frequency, z * frequency, period, seed + octave);
+		frequency *= 2.0f;
+		period *= 2;
+		amplitude *= 0.5f;
+	}
+
+	return sum;
+}
+
+/*-----------------------------------------------------------------------------------
+The potential of one z slice of a key, each component from its own noise
+-----------------------------------------------------------------------------------*/
+
+void CTurbulenceField::BakePotentialSlice(long long key, int z)
+{
+	TRandU64 state = m_params.seed ^ ((TRandU64)key * 0xD1B54A32D192ED03ull);
+	TRandU64 seeds[3];
+	int res = m_params.resolution;
+	int x, y, c;
+
+	for (c = 0; c < 3; c++)
+		seeds[c] = SplitMix64(state);
+
+	for (y = 0; y < res; y++)
+	{
+		float *out = m_pfPotential + 3 * (z * res + y) * res;
+
+		for (x = 0; x < res; x++)
+		{
+			for (c = 0; c < 3; c++)
+				out[3 * x + c] = Potential(float(x), float(y), float(z), seeds[c]);
+		}
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+The velocity of one z slice of a key, the curl of the potential by central
+differences which wrap round the tile.  The slices either side must have
+their potential.  The differences are scaled so the field averages about
+strength.
+-----------------------------------------------------------------------------------*/
+
+void CTurbulenceField::BakeCurlSlice(long long key, int z)
+{
+	const float *p = m_pfPotential;
+	float *out = GetKey(key);
+	int res = m_params.resolution;
+	float scale = 0.25f * m_params.strength * float(res) / float(m_params.noiseScale);
+	int x, y;
+
+	auto at = [p, res, this](int x, int y, int z) {
+		return p + 3 * (((z & m_iMask) * res + (y & m_iMask)) * res + (x & m_iMask));
+	};
+
+	for (y = 0; y < res; y++)
+	{
+		for (x = 0; x < res; x++)
+		{
+			const float *px0 = at(x - 1, y, z), *px1 = at(x + 1, y, z);
+			const float *py0 = at(x, y - 1, z), *py1 = at(x, y + 1, z);
+			const float *pz0 = at(x, y, z - 1), *pz1 = at(x, y, z + 1);
+			float *v = out + 4 * ((z * res + y) * res + x);
+
+			v[0] = scale * ((py1[2] - py0[2]) - (pz1[1] - pz0[1]));
+			v[1] = scale * ((pz1[0] - pz0[0]) - (px1[2] - px0[2]));
+			v[2] = scale * ((px1[1] - px0[1]) - (py1[0] - py0[0]));
+			v[3] = 0.0f;
+		}
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Bake units [first, last) of a key.  The first resolution units are the
+potential slices and the next resolution the curl slices, so a key takes
+twice the resolution in units.  The curl needs the whole potential, so the
+two kinds run as separate rounds of jobs.
+-----------------------------------------------------------------------------------*/
+
+void CTurbulenceField::BakeUnits(long long key, int first, int last, CJobSystem *jobs)
+{
+	int res = m_params.resolution;
+	int potentialLast = MIN(last, res);
+	int curlFirst = MAX(first, res);
+
+	if (first < potentialLast)
+	{
+		RunJobs(jobs, potentialLast - first, 1, [this, key, first](int start, int count, int worker) {
+			for (int z = first + start; z < first + start + count; z++)
+				BakePotentialSlice(key, z);
+		});
+	}
+
+	if (curlFirst < last)
+	{
+		RunJobs(jobs, last - curlFirst, 1, [this, key, curlFirst, res](int start, int count, int worker) {
+			for (int z = curlFirst + start; z < curlFirst + start + count; z++)
+				BakeCurlSlice(key, z - res);
+		});
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+Move time on.  The key after next is baked in step with the blend, a share of
+its units for each share of the interval gone by, so it is ready by the time
+the interval ends.  A step which crosses an interval finishes the bake first,
+and a step which skips whole intervals starts again from fresh keys.
+-----------------------------------------------------------------------------------*/
+
+void CTurbulenceField::Advance(float dt, CJobSystem *jobs)
+{
+	PROFILE_ZONE("turbulence");
+
+	int numUnits = 2 * m_params.resolution;
+	int numPoints = GetNumPoints();
+	long long target;
+	float blend;
+
+	if (!m_pfField)
+		Allocate();
+
+	m_dTime += dt;
+	target = (long long)floor(m_dTime / m_params.keyInterval);
+
+	if (!m_bBaked || target > m_iKey + 2 || target < m_iKey)
+	{
+		m_iKey = target;
+		BakeUnits(m_iKey, 0, numUnits, jobs);
+		BakeUnits(m_iKey + 1, 0, numUnits, jobs);
+		m_iBakeUnits = 0;
+		m_bBaked = true;
+	}
+
+	while (m_iKey < target)
+	{
+		BakeUnits(m_iKey + 2, m_iBakeUnits, numUnits, jobs);
+		m_iKey++;
+		m_iBakeUnits = 0;
+	}
+
+	blend = float(m_dTime / m_params.keyInterval - double(m_iKey));
+
+	// One unit ahead so the last lands before the interval ends
+	int due = MIN(int(blend * float(numUnits)) + 1, numUnits);
+	if (due > m_iBakeUnits)
+	{
+		BakeUnits(m_iKey + 2, m_iBakeUnits, due, jobs);
+		m_iBakeUnits = due;
+	}
+
+	const float *from = GetKey(m_iKey);
+	const float *to = GetKey(m_iKey + 1);
+
+	RunJobs(jobs, 4 * numPoints, TURBULENCE_BLEND_GRAIN, [this, from, to, blend](int first, int count, int worker) {
+		for (int i = first; i < first + count; i++)
+			m_pfField[i] = from[i] + blend * (to[i] - from[i]);
+	});
+}
+
+/*-----------------------------------------------------------------------------------
+Trilinear sample of the blended field
+-----------------------------------------------------------------------------------*/
+
+TVector CTurbulenceField::Sample(float x, float y, float z) const
+{
+	float u = x * m_fInvCellSize, v = y * m_fInvCellSize, w = z * m_fInvCellSize;
+	int ix = Floor(u), iy = Floor(v), iz = Floor(w);
+	float fx = u - float(ix), fy = v - float(iy), fz = w - float(iz);
+	int res = m_params.resolution;
+	int x0 = ix & m_iMask, y0 = iy & m_iMask, z0 = iz & m_iMask;
+	int x1 = (ix + 1) & m_iMask, y1 = (iy + 1) & m_iMask, z1 = (iz + 1) & m_iMask;
+	float result[3];
+	int c;
+
+	if (!m_pfField)
+		return TVector(0.0f, 0.0f, 0.0f);
+
+	const float *p000 = m_pfField + 4 * ((z0 * res + y0) * res + x0);
+	const float *p100 = m_pfField + 4 * ((z0 * res + y0) * res + x1);
+	const float *p010 = m_pfField + 4 * ((z0 * res + y1) * res + x0);
+	const float *p110 = m_pfField + 4 * ((z0 * res + y1) * res + x1);
+	const float *p001 = m_pfField + 4 * ((z1 * res + y0) * res + x0);
+	const float *p101 = m_pfField + 4 * ((z1 * res + y0) * res + x1);
+	const float *p011 = m_pfField + 4 * ((z1 * res + y1) * res + x0);
+	const float *p111 = m_pfField + 4 * ((z1 * res + y1) * res + x1);
+
+	for (c = 0; c < 3; c++)
+	{
+		float c00 = p000[c] + fx * (p100[c] - p000[c]);
+		float c10 = p010[c] + fx * (p110[c] - p010[c]);
+		float c01 = p001[c] + fx * (p101[c] - p001[c]);
+		float c11 = p011[c] + fx * (p111[c] - p011[c]);
+		float c0 = c00 + fy * (c10 - c00);
+		float c1 = c01 + fy * (c11 - c01);
+
+		result[c] = c0 + fz * (c1 - c0);
+	}
+
+	return TVector(result[0], result[1], result[2]);
+}
+
+#ifdef CPU_X86
+
+/*-----------------------------------------------------------------------------------
+SSE2 trilinear sample, the three components of a lattice point are one load
+and every lerp works on all of them at once
+-----------------------------------------------------------------------------------*/
+
+TARGET_SSE2 static __m128 SampleSSE2(const float *field, int res, int mask, float invCellSize,
+	float x, float y, float z)
+{
+	float u = x * invCellSize, v = y * invCellSize, w = z * invCellSize;
+	int ix = Floor(u), iy = Floor(v), iz = Floor(w);
+	__m128 fx = _mm_set1_ps(u - float(ix));
+	__m128 fy = _mm_set1_ps(v - float(iy));
+	__m128 fz = _mm_set1_ps(w - float(iz));
+	int x0 = ix & mask, y0 = iy & mask, z0 = iz & mask;
+	int x1 = (ix + 1) & mask, y1 = (iy + 1) & mask, z1 = (iz + 1) & mask;
+	int row00 = (z0 * res + y0) * res, row10 = (z0 * res + y1) * res;
+	int row01 = (z1 * res + y0) * res, row11 = (z1 * res + y1) * res;
+
+	__m128 p000 = _mm_loadu_ps(field + 4 * (row00 + x0)), p100 = _mm_loadu_ps(field + 4 * (row00 + x1));
+	__m128 p010 = _mm_loadu_ps(field + 4 * (row10 + x0)), p110 = _mm_loadu_ps(field + 4 * (row10 + x1));
+	__m128 p001 = _mm_loadu_ps(field + 4 * (row01 + x0)), p101 = _mm_loadu_ps(field + 4 * (row01 + x1));
+	__m128 p011 = _mm_loadu_ps(field + 4 * (row11 + x0)), p111 = _mm_loadu_ps(field + 4 * (row11 + x1));
+
+	__m128 c00 = _mm_add_ps(p000, _mm_mul_ps(fx, _mm_sub_ps(p100, p000)));
+	__m128 c10 = _mm_add_ps(p010, _mm_mul_ps(fx, _mm_sub_ps(p110, p010)));
+	__m128 c01 = _mm_add_ps(p001, _mm_mul_ps(fx, _mm_sub_ps(p101, p001)));
+	__m128 c11 = _mm_add_ps(p011, _mm_mul_ps(fx, _mm_sub_ps(p111, p011)));
+	__m128 c0 = _mm_add_ps(c00, _mm_mul_ps(fy, _mm_sub_ps(c10, c00)));
+	__m128 c1 = _mm_add_ps(c01, _mm_mul_ps(fy, _mm_sub_ps(c11, c01)));
+
+	return _mm_add_ps(c0, _mm_mul_ps(fz, _mm_sub_ps(c1, c0)));
+}
+
+TARGET_SSE2 static void AdvectSSE2(const float *field, int res, int mask, float invCellSize,
+	CParticlePool& pool, int first, int count, unsigned int emitter, float scale, float dt)
+{
+	const float *prevX = pool.Column(PARTICLE_PREV_X);
+	const float *prevY = pool.Column(PARTICLE_PREV_Y);
+	const float *prevZ = pool.Column(PARTICLE_PREV_Z);
+	float *posX = pool.Column(PARTICLE_POS_X);
+	float *posY = pool.Column(PARTICLE_POS_Y);
+	float *posZ = pool.Column(PARTICLE_POS_Z);
+	const unsigned int *emitters = pool.UIntColumn(PARTICLE_EMITTER);
+	__m128 vscale = _mm_set1_ps(scale * dt);
+	float sample[4];
+	int i;
+
+	for (i = first; i < first + count; i++)
+	{
+		if (emitters[i] != emitter)
+			continue;
+
+		_mm_storeu_ps(sample, _mm_mul_ps(vscale,
+			SampleSSE2(field, res, mask, invCellSize, prevX[i], prevY[i], prevZ[i])));
+
+		posX[i] += sample[0];
+		posY[i] += sample[1];
+		posZ[i] += sample[2];
+	}
+}
+
+#endif
+
+/*-----------------------------------------------------------------------------------
+Carry the particles of one emitter along with the field
+-----------------------------------------------------------------------------------*/
+
+void CTurbulenceField::Advect(CParticlePool& pool, int first, int count, unsigned int emitter,
+	float scale, float dt) const
+{
+	const float *prevX = pool.Column(PARTICLE_PREV_X);
+	const float *prevY = pool.Column(PARTICLE_PREV_Y);
+	const float *prevZ = pool.Column(PARTICLE_PREV_Z);
+	float *posX = pool.Column(PARTICLE_POS_X);
+	float *posY = pool.Column(PARTICLE_POS_Y);
+	float *posZ = pool.Column(PARTICLE_POS_Z);
+	const unsigned int *emitters = pool.UIntColumn(PARTICLE_EMITTER);
+	int i;
+
+	if (!m_pfField)
+		return;
+
+#ifdef CPU_X86
+	if (m_bSimd)
+	{
+		AdvectSSE2(m_pfField, m_params.resolution, m_iMask, m_fInvCellSize, pool, first, count,
+			emitter, scale, dt);
+		return;
+	}
+#endif
+
+	for (i = first; i < first + count; i++)
+	{
+		if (emitters[i] != emitter)
+			continue;
+
+		TVector sample = Sample(prevX[i], prevY[i], prevZ[i]);
+
+		posX[i] += scale * dt * sample.x;
+		posY[i] += scale * dt * sample.y;
+		posZ[i] += scale * dt * sample.z;
+	}
+}
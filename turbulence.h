@@ -0,0 +1,144 @@
+/*-----------------------------------------------------------------------------------
+File:			turbulence.h
+Author:			Steve Costa
+Description:	A turbulence field shared by the emitters.  Rather than evaluate
+noise for every particle, curl noise is baked into a lattice
+which tiles space and the particles sample it with trilinear
+interpolation.  The field is a velocity which carries the
+particles along on top of their own motion, rather than a force,
+so it moves them the same distance whatever the step.  The curl
+of a vector potential has no divergence, so the particles swirl
+without bunching up or spreading out.
+
+Time is cut into key frames, each a lattice baked from its own
+noise.  The field between two keys is a blend of them, and while
+the particles move through one interval the key after next is
+baked a few slices at a time, so the cost is spread evenly over
+the steps and runs on the job system.  The lattice resolution
+sets the memory, 19 floats a lattice point, and how fine the
+detail can be.
+-----------------------------------------------------------------------------------*/
+
+#ifndef TURBULENCE_H_
+#define TURBULENCE_H_
+
+/*-----------------------------------------------------------------------------------
+Header files
+-----------------------------------------------------------------------------------*/
+
+#include "simUtil.h"						// Common Macros
+#include "vector.h"
+using namespace vec;
+#include "random.h"							// Random number generators
+#include "particlePool.h"					// Particle attribute columns
+#include "jobSystem.h"						// Worker threads
+
+/*-----------------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------------*/
+
+#define TURBULENCE_KEYS			3				// Two blended and one being baked
+#define TURBULENCE_MAX_OCTAVES	4
+#define TURBULENCE_BLEND_GRAIN	4096			// Lattice points per blend job
+
+/*-----------------------------------------------------------------------------------
+Settings
+-----------------------------------------------------------------------------------*/
+
+struct TTurbulenceParams
+{
+	int			resolution;				// Lattice points along each axis, a power of two
+	float		cellSize;				// World units between lattice points
+	int			noiseScale;				// Noise cells across the tile, the size of the swirls
+	int			octaves;				// Each adds detail half the size
+	float		strength;				// Average size of the field
+	float		keyInterval;			// Seconds between key frames
+	TRandU64	seed;
+
+	TTurbulenceParams() {
+		resolution = 32;
+		cellSize = 0.5f;
+		noiseScale = 4;
+		octaves = 2;
+		strength = 4.0f;
+		keyInterval = 2.0f;
+		seed = 1;
+	}
+};
+
+/*-----------------------------------------------------------------------------------
+Turbulence field class definition
+-----------------------------------------------------------------------------------*/
+
+class CTurbulenceField
+{
+	// Attributes
+private:
+
+	TTurbulenceParams	m_params;
+	bool				m_bSimd;				// Sample with SSE2
+	int					m_iMask;				// Resolution - 1
+	float				m_fInvCellSize;
+
+	float				*m_pfPotential;			// Vector potential of the key being baked, 3 floats a point
+	float				*m_pfKeys[TURBULENCE_KEYS];	// Baked keys, 4 floats a point
+	float				*m_pfField;				// Blend of the current two keys
+
+	double				m_dTime;
+	bool				m_bBaked;				// Keys ready for the interval of m_iKey
+	long long			m_iKey;					// Key at the start of the current interval
+	int					m_iBakeUnits;			// Slices of the next key done, see BakeUnits
+
+	// Methods
+private:
+
+	void Allocate();
+	int GetNumPoints() const { return m_params.resolution * m_params.resolution * m_params.resolution; }
+	float *GetKey(long long key) { return m_pfKeys[key % TURBULENCE_KEYS]; }
+
+	float Potential(float x, float y, float z, TRandU64 seed) const;
+	void BakePotentialSlice(long long key, int z);
+	void BakeCurlSlice(long long key, int z);
+	void BakeUnits(long long key, int first, int last, CJobSystem *jobs);
+
+public:
+
+	CTurbulenceField();
+	~CTurbulenceField();
+
+	void Shutdown();
+
+	// Changing the settings rebakes the keys the next time the field
+	// is advanced
+	void SetParams(const TTurbulenceParams& params);
+	const TTurbulenceParams& GetParams() const { return m_params; }
+
+	// Use SSE2 for sampling when the processor has it, returns
+	// whether it is in use
+	bool SetSimd(bool simd);
+	bool GetSimd() const { return m_bSimd; }
+
+	// Bytes held by the lattices
+	size_t GetMemorySize() const { return size_t(GetNumPoints()) * (3 + 4 * (TURBULENCE_KEYS + 1)) * sizeof(float); }
+
+	//-----------------------------------------------------------
+	// Move the field on by dt seconds, bake the share of the next
+	// key due by now and blend the current keys.  The first call
+	// bakes the current keys in full.  jobs may be NULL.
+	//-----------------------------------------------------------
+	void Advance(float dt, CJobSystem *jobs);
+
+	// The field at a point, once it has been advanced
+	TVector Sample(float x, float y, float z) const;
+
+	//-----------------------------------------------------------
+	// Move the particles of emitter in [first, first + count) on
+	// by dt times scale times the field where they started the
+	// step.  Call it after the update has written the new
+	// positions.
+	//-----------------------------------------------------------
+	void Advect(CParticlePool& pool, int first, int count, unsigned int emitter, float scale,
+		float dt) const;
+};
+
+#endif
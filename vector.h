@@ -14,6 +14,13 @@ as a reference for this class
 #include <math.h>
 #include <assert.h>
 
+// Sixteen byte alignment, Visual Studio before 2015 has no alignas
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define VECTOR_ALIGN16		__declspec(align(16))
+#else
+#define VECTOR_ALIGN16		alignas(16)
+#endif
+
 /*-----------------------------------------------------------------------------------
 Encapsulate within the vec namespace in order to prevent non-member functions
 from having global scope.
@@ -158,6 +165,37 @@ namespace vec
 
 	};
 
+	/*-----------------------------------------------------------------------------------
+	Four element vector, aligned so that one loads into an SSE register whole.
+	Points have w = 1 and directions w = 0.
+	-----------------------------------------------------------------------------------*/
+
+	class VECTOR_ALIGN16 TVector4
+	{
+		// ATTRIBUTES
+	public:
+
+		float x, y, z, w;			// Coordinate values
+
+		// METHODS
+	public:
+
+		// Default constructor
+		TVector4() { }
+
+		// Initializing constructor
+		TVector4(float x1, float y1, float z1, float w1) : x(x1), y(y1), z(z1), w(w1) { }
+
+		// Extend a three element vector
+		TVector4(const TVector& vec, float w1) : x(vec.x), y(vec.y), z(vec.z), w(w1) { }
+
+		// Drop the last element
+		TVector XYZ() const
+		{
+			return TVector(x, y, z);
+		}
+	};
+
 	/*-----------------------------------------------------------------------------------
 	Vector math functions
 	-----------------------------------------------------------------------------------*/
@@ -214,6 +252,24 @@ namespace vec
 		return diff_x * diff_x + diff_y * diff_y + diff_z * diff_z;
 	}
 
+	/*-----------------------------------------------------------------------------------
+	Batches of vectors held as an array for each element.  These run four or
+	eight at a time with SSE2 or AVX2 when the processor has them, and give the
+	same bits as the functions above.  They are defined in batchMath.cpp.
+	-----------------------------------------------------------------------------------*/
+
+	// out[i] = a[i] * b[i]
+	void DotProducts(const float *ax, const float *ay, const float *az,
+		const float *bx, const float *by, const float *bz, float *out, int count);
+
+	// out[i] = CrossProduct(a[i], b[i]), out may be a or b
+	void CrossProducts(const float *ax, const float *ay, const float *az,
+		const float *bx, const float *by, const float *bz,
+		float *outX, float *outY, float *outZ, int count);
+
+	// Normalize each vector in place, zero vectors are left alone
+	void NormalizeVectors(float *x, float *y, float *z, int count);
+
 }
 
 #endif
\ No newline at end of file